@@ -1,6 +1,10 @@
 
 let predictionData = null; // FIXME hack
 let predictionImage = null; // FIXME hack
+let cameraResolution = { "width": 640, "height": 480 };
+let classificationData = null;
+let segmentationMeta = null;
+let segmentationCanvas = null;
 
 function camera_device_play_toggle_button(ws, buttonElement)
 {
@@ -28,6 +32,14 @@ function camera_device_play_toggle_button(ws, buttonElement)
 	// Send message to server
 	ws.send(JSON.stringify(msg_json));
 
+	// Boxes come back in camera frame coordinates; the reply has the
+	// size actually captured, the server picks 640x480 if none is given
+	if (play) {
+		cameraResolution = (width && height) ?
+			{ "width": width, "height": height } :
+			{ "width": 640, "height": 480 };
+	}
+
 	if (play) {
 		// FIXME: bind this to server response
 		buttonElement.value = "Stop";
@@ -41,6 +53,12 @@ function camera_device_play_toggle_button(ws, buttonElement)
 	}
 }
 
+function camera_device_play_response(ws, msg)
+{
+	if (msg && msg.width && msg.height)
+		cameraResolution = { "width": msg.width, "height": msg.height };
+}
+
 function camera_device_play_toggle(ws, ev)
 {
 	camera_device_play_toggle_button(ws, ev.currentTarget);
@@ -144,6 +162,67 @@ function drpai_handle_object_detection_result(ws, msg)
 	predictionData = msg; // FIXME hack
 }
 
+function drpai_handle_classification_result(ws, msg)
+{
+	classificationData = (msg && msg.label) ? msg : null;
+}
+
+function drpai_handle_segmentation_result(ws, msg)
+{
+	segmentationMeta = msg;
+}
+
+// A fixed color per class; class 0 (the background, usually) is left out
+function drpai_segmentation_color(c)
+{
+	return [ (c * 97) & 0xff, (c * 57 + 128) & 0xff, (c * 151 + 64) & 0xff ];
+}
+
+// The mask that goes with the last segmentation result; see model_segment.c
+function drpai_handle_segmentation_mask(data)
+{
+	let meta = segmentationMeta;
+	let mask = new Uint8Array(data, 16);
+	if (!meta)
+		return;
+
+	let n = meta.width * meta.height;
+	let classes = new Uint8Array(n);
+	if (meta.encoding == "rle") {
+		let i = 0, p = 0;
+		while (i < mask.length && p < n) {
+			let c = mask[i++], run = 0, shift = 0, b;
+			do {
+				b = mask[i++];
+				run += (b & 0x7f) * Math.pow(2, shift);
+				shift += 7;
+			} while (b & 0x80);
+			classes.fill(c, p, p + run);
+			p += run;
+		}
+	} else {
+		classes.set(mask.subarray(0, n));
+	}
+
+	if (!segmentationCanvas)
+		segmentationCanvas = document.createElement("canvas");
+	segmentationCanvas.width = meta.width;
+	segmentationCanvas.height = meta.height;
+
+	let context = segmentationCanvas.getContext("2d");
+	let imgData = context.createImageData(meta.width, meta.height);
+	for (let i = 0; i < n; i++) {
+		if (!classes[i])
+			continue;
+		let rgb = drpai_segmentation_color(classes[i]);
+		imgData.data[4 * i    ] = rgb[0];
+		imgData.data[4 * i + 1] = rgb[1];
+		imgData.data[4 * i + 2] = rgb[2];
+		imgData.data[4 * i + 3] = 128;
+	}
+	context.putImageData(imgData, 0, 0);
+}
+
 function connect_camera_socket()
 {
 	let startTime = null;
@@ -152,8 +231,11 @@ function connect_camera_socket()
 
 	const callbacks = {
 		"camera-devices-get": camera_devices_get_response,
+		"camera-device-play": camera_device_play_response,
 		// FIXME: hack to do this quickly
 		"drpai-object-detection-result": drpai_handle_object_detection_result,
+		"drpai-classification-result": drpai_handle_classification_result,
+		"drpai-segmentation-result": drpai_handle_segmentation_result,
 	};
 
 	function update_elapsed_time() {
@@ -209,8 +291,25 @@ function connect_camera_socket()
 			let contextDrpAi = canvas.getContext("2d");
 			contextDrpAi.drawImage(imgElemDrpAi, 0, 0, 640, 480);
 
+			if (segmentationCanvas && segmentationMeta) {
+				let box = segmentationMeta.box;
+				let sx = 640 / cameraResolution.width;
+				let sy = 480 / cameraResolution.height;
+				contextDrpAi.drawImage(segmentationCanvas, box.x * sx, box.y * sy,
+						       box.w * sx, box.h * sy);
+			}
+
+			if (classificationData) {
+				contextDrpAi.fillStyle = 'blue';
+				contextDrpAi.font = "24pt";
+				contextDrpAi.fillText(classificationData.label + " " +
+						      classificationData.probability.toFixed(1) + "%", 8, 24);
+			}
+
 			if (predictionData) {
 				let data = predictionData;
+				let sx = 640 / cameraResolution.width;
+				let sy = 480 / cameraResolution.height;
 				contextDrpAi.lineWidth = 16;
 				contextDrpAi.strokeStyle = 'blue';
 				contextDrpAi.fillStyle = 'blue';
@@ -218,8 +317,12 @@ function connect_camera_socket()
 				for (i = 0; i < data.length; i++) {
 					let label = data[i].label;
 					let box = data[i].box;
-					contextDrpAi.strokeRect(box.x, box.y, box.w, box.h);
-					contextDrpAi.fillText(label, box.x, (box.y + 16));
+					if (data[i].class && data[i].class.label)
+						label += ": " + data[i].class.label;
+					if (data[i].track)
+						label = "#" + data[i].track + " " + label;
+					contextDrpAi.strokeRect(box.x * sx, box.y * sy, box.w * sx, box.h * sy);
+					contextDrpAi.fillText(label, box.x * sx, (box.y * sy + 16));
 				}
 			}
 		}
@@ -246,7 +349,11 @@ function connect_camera_socket()
 
 		ws.onmessage = function got_packet(msg) {
 			if (msg.data instanceof ArrayBuffer) {
-				handle_binary_response2(msg);
+				let id = String.fromCharCode.apply(null, new Uint8Array(msg.data, 0, 10));
+				if (id == "drpai-mask")
+					drpai_handle_segmentation_mask(msg.data);
+				else
+					handle_binary_response2(msg);
 			} else {
 				handle_json_response(msg);
 			}
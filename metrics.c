@@ -0,0 +1,211 @@
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+#include "metrics.h"
+#include "plugins/camera/latency.h"
+#include "plugins/camera/stats.h"
+#include "plugins/drpai/drpai.h"
+#include "plugins/drpai/sched.h"
+#include "plugins/drpai/workers.h"
+
+#define METRICS_CHUNK		4096
+#define METRICS_CONTENT_TYPE	"text/plain; version=0.0.4; charset=utf-8"
+
+struct metrics {
+	char *buf;
+	size_t len;		/* with LWS_PRE */
+	size_t size;
+	bool failed;
+};
+
+static bool metrics_reserve(struct metrics *m, size_t len)
+{
+	size_t size = m->size ? m->size : 65536;
+	char *buf;
+
+	if (m->failed)
+		return false;
+	if (m->len + len < m->size)
+		return true;
+
+	while (m->len + len >= size)
+		size *= 2;
+
+	buf = realloc(m->buf, size);
+	if (!buf) {
+		m->failed = true;
+		return false;
+	}
+	m->buf = buf;
+	m->size = size;
+
+	return true;
+}
+
+void metrics_printf(struct metrics *m, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (!metrics_reserve(m, 256))
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(m->buf + m->len, m->size - m->len, fmt, ap);
+	va_end(ap);
+	if (n < 0) {
+		m->failed = true;
+		return;
+	}
+
+	if ((size_t)n >= m->size - m->len) {
+		if (!metrics_reserve(m, n + 1))
+			return;
+		va_start(ap, fmt);
+		vsnprintf(m->buf + m->len, m->size - m->len, fmt, ap);
+		va_end(ap);
+	}
+	m->len += n;
+}
+
+void metrics_family(struct metrics *m, const char *name, const char *type,
+		    const char *help)
+{
+	metrics_printf(m, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_label(struct metrics *m, const char *value)
+{
+	const char *s;
+
+	if (!metrics_reserve(m, 2 * strlen(value) + 1))
+		return;
+
+	for (s = value; *s; s++) {
+		if (*s == '\\' || *s == '"')
+			m->buf[m->len++] = '\\';
+		if (*s == '\n') {
+			m->buf[m->len++] = '\\';
+			m->buf[m->len++] = 'n';
+			continue;
+		}
+		m->buf[m->len++] = *s;
+	}
+	m->buf[m->len] = '\0';
+}
+
+static void metrics_sessions(struct metrics *m, struct lws_vhost *vh)
+{
+	static const char *names[] = { "camera", "drpai" };
+	const struct lws_protocols *p;
+	size_t i;
+
+	metrics_family(m, "etb_session_queue_depth", "gauge",
+		       "Messages waiting to be sent, per websocket session");
+
+	for (i = 0; i < LWS_ARRAY_SIZE(names); i++) {
+		p = lws_vhost_name_to_protocol(vh, names[i]);
+		if (p)
+			lws_callback_all_protocol_vhost_args(vh, p, METRICS_CALLBACK_SESSION,
+							     m, 0);
+	}
+}
+
+static int metrics_render(struct lws *wsi, struct per_session_data__metrics *pss)
+{
+	struct metrics m = {};
+
+	/* lws_write() may use what is before the data */
+	if (!metrics_reserve(&m, LWS_PRE))
+		return -ENOMEM;
+	m.len = LWS_PRE;
+
+	camera_stats_metrics(&m);
+	latency_metrics(&m);
+	drpai_sched_metrics(&m);
+	drpai_metrics(&m);
+	workers_metrics(&m);
+	metrics_sessions(&m, lws_get_vhost(wsi));
+
+	if (m.failed) {
+		free(m.buf);
+		return -ENOMEM;
+	}
+
+	pss->buf = m.buf;
+	pss->len = m.len;
+	pss->sent = LWS_PRE;
+
+	return 0;
+}
+
+int callback_metrics(struct lws *wsi, enum lws_callback_reasons reason,
+		     void *user, void *in, size_t len)
+{
+	struct per_session_data__metrics *pss = user;
+	uint8_t buf[LWS_PRE + 256], *start = &buf[LWS_PRE], *p = start,
+		*end = &buf[sizeof(buf) - 1];
+	enum lws_write_protocol wp;
+	size_t n;
+
+	switch (reason) {
+	case LWS_CALLBACK_HTTP:
+		free(pss->buf);
+		pss->buf = NULL;
+		if (metrics_render(wsi, pss)) {
+			lwsl_err("metrics: out of memory\n");
+			return 1;
+		}
+
+		if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK, METRICS_CONTENT_TYPE,
+						pss->len - LWS_PRE, &p, end) ||
+		    lws_finalize_write_http_header(wsi, start, &p, end))
+			return 1;
+
+		lws_callback_on_writable(wsi);
+		return 0;
+
+	case LWS_CALLBACK_HTTP_WRITEABLE:
+		if (!pss->buf)
+			return 0;
+
+		/* what was sent already is the LWS_PRE of the next chunk */
+		n = pss->len - pss->sent;
+		wp = LWS_WRITE_HTTP_FINAL;
+		if (n > METRICS_CHUNK) {
+			n = METRICS_CHUNK;
+			wp = LWS_WRITE_HTTP;
+		}
+
+		if (lws_write(wsi, (uint8_t *)pss->buf + pss->sent, n, wp) != (int)n)
+			return 1;
+		pss->sent += n;
+
+		if (wp == LWS_WRITE_HTTP) {
+			lws_callback_on_writable(wsi);
+			return 0;
+		}
+
+		free(pss->buf);
+		pss->buf = NULL;
+		if (lws_http_transaction_completed(wsi))
+			return -1;
+		return 0;
+
+	case LWS_CALLBACK_CLOSED_HTTP:
+		free(pss->buf);
+		pss->buf = NULL;
+		break;
+
+	default:
+		break;
+	}
+
+	return lws_callback_http_dummy(wsi, reason, user, in, len);
+}
@@ -0,0 +1,52 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stddef.h>
+#include <libwebsockets.h>
+
+/**
+ * GET /metrics, in the Prometheus text format. Each module renders its
+ * own metrics, from counters it keeps anyway; this all runs on the event
+ * loop, and what other threads count is read with relaxed atomics, so a
+ * scrape takes no lock that the stream could wait on.
+ */
+
+/* The text being rendered; opaque */
+struct metrics;
+
+void metrics_printf(struct metrics *m, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+/* The # HELP and # TYPE lines, before the samples of a metric */
+void metrics_family(struct metrics *m, const char *name, const char *type,
+		    const char *help);
+
+/* A label value, escaped */
+void metrics_label(struct metrics *m, const char *value);
+
+/**
+ * Sent to all sessions of the websocket protocols, with 'in' the struct
+ * metrics, after the etb_session_queue_depth family header: each session
+ * adds its sample, with "protocol" and "session" labels.
+ */
+#define METRICS_CALLBACK_SESSION	LWS_CALLBACK_USER
+
+int callback_metrics(struct lws *wsi, enum lws_callback_reasons reason,
+		     void *user, void *in, size_t len);
+
+struct per_session_data__metrics {
+	char *buf;		/* LWS_PRE, then the text */
+	size_t len;
+	size_t sent;
+};
+
+#define LWS_PLUGIN_PROTOCOL_METRICS \
+	{ \
+		"metrics", \
+		callback_metrics, \
+		sizeof(struct per_session_data__metrics), \
+		0, \
+		0, NULL, 0 \
+	}
+
+#endif /* __METRICS_H__ */
@@ -0,0 +1,19 @@
+#ifndef __MONOTONIC_H__
+#define __MONOTONIC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * CLOCK_MONOTONIC, in microseconds: the clock of the V4L2 timestamps, and
+ * the one all durations and deadlines are taken with.
+ */
+static inline uint64_t monotonic_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif /* __MONOTONIC_H__ */
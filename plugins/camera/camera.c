@@ -1,5 +1,8 @@
 
 #include "camera.h"
+#include "latency.h"
+#include "stats.h"
+#include "../../monotonic.h"
 
 #include <errno.h>
 #include <string.h>
@@ -14,7 +17,6 @@
 
 #include <libwebsockets.h>
 
-#define NUM_MAX_CAMERAS		32
 #define NUM_MAX_CAPTURE_BUFS	8
 #define DEV_NAME_MAX_SIZE	sizeof("/dev/video999")
 
@@ -36,15 +38,16 @@ static int xioctl(int fd, int request, void* arg)
 	return r;
 }
 
-static int camera_set_capture_parameters(int fd, int width, int height)
+/* The driver may adjust the size; 'width' and 'height' get what it set */
+static int camera_set_capture_parameters(int fd, int *width, int *height)
 {
 	struct v4l2_streamparm setfps = {};
 	struct v4l2_format fmt = {};
 
 	/* FIXME: hard-coded for now */
 	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	fmt.fmt.pix.width = width;
-	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.width = *width;
+	fmt.fmt.pix.height = *height;
 	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
 	fmt.fmt.pix.field = V4L2_FIELD_NONE;
 
@@ -52,6 +55,8 @@ static int camera_set_capture_parameters(int fd, int width, int height)
 		lwsl_err("ioctl(VIDIOC_S_FMT): %s\n", strerror(errno));
 		return -1;
 	}
+	*width = fmt.fmt.pix.width;
+	*height = fmt.fmt.pix.height;
 
 	setfps.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	setfps.parm.capture.timeperframe.numerator = 1;
@@ -94,17 +99,29 @@ static int camera_enqueue_buffer(int fd, int index) {
 	return bufd.bytesused;
 }
 
-static int camera_dequeue_buffer(int fd) {
+static int camera_dequeue_buffer(int cam_id, int fd, uint64_t *timestamp_us) {
 	struct v4l2_buffer buf = {};
+	uint64_t start, now;
 
 	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	buf.memory = V4L2_MEMORY_MMAP;
 	buf.index = 0;
 
+	start = monotonic_now_us();
 	if (xioctl(fd, VIDIOC_DQBUF, &buf) < 0) {
 		lwsl_err("ioctl(VIDIOC_QBUF): %s\n", strerror(errno));
 		return -1;
 	}
+	now = monotonic_now_us();
+	latency_record(cam_id, LATENCY_DEQUEUE, now - start);
+	camera_stats_add(cam_id, CAMERA_FRAMES_CAPTURED, 1);
+
+	/* other clocks cannot be compared; the frame is as old as it is now */
+	*timestamp_us = now;
+	if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+		*timestamp_us = (uint64_t)buf.timestamp.tv_sec * 1000000 + buf.timestamp.tv_usec;
+		latency_span(cam_id, LATENCY_CAPTURE, *timestamp_us, now);
+	}
 
 	return buf.index;
 }
@@ -333,7 +350,7 @@ int camera_dev_play_start(json_object *req)
 		height = 480;
 	}
 
-	if (camera_set_capture_parameters(cam->fd, width, height) < 0) {
+	if (camera_set_capture_parameters(cam->fd, &width, &height) < 0) {
 		err = "error configuring camera parameters";
 		goto err_close_fd;
 	}
@@ -368,7 +385,14 @@ int camera_dev_play_start(json_object *req)
 	}
 
 	strncpy(cam->dev_name, dev, sizeof(cam->dev_name) - 1);
-	json_object_object_add(req, "value", json_object_new_int(cam_id));
+
+	/* the client scales the results by the size actually captured */
+	jval = json_object_new_object();
+	json_object_object_add(jval, "camera", json_object_new_int(cam_id));
+	json_object_object_add(jval, "width", json_object_new_int(width));
+	json_object_object_add(jval, "height", json_object_new_int(height));
+	json_object_object_add(req, "value", jval);
+	latency_reset(cam_id);
 
 	return cam_id;
 
@@ -437,6 +461,7 @@ void camera_dev_play_stop_req(json_object *req)
 int camera_dev_acquire_capture_buffer(int cam_id, struct camera_buffer *buf)
 {
 	struct camera_entry *cam;
+	uint64_t timestamp_us;
 	int buf_id;
 
 	if (cam_id < 0 || cam_id >= NUM_MAX_CAMERAS) {
@@ -450,11 +475,12 @@ int camera_dev_acquire_capture_buffer(int cam_id, struct camera_buffer *buf)
 		return -1;
 	}
 
-	buf_id = camera_dequeue_buffer(cam->fd);
+	buf_id = camera_dequeue_buffer(cam_id, cam->fd, &timestamp_us);
 	if (buf_id < 0)
 		return -1;
 
 	memcpy(buf, &cam->buffers[buf_id], sizeof(*buf));
+	buf->timestamp_us = timestamp_us;
 
 	return 0;
 }
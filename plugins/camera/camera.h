@@ -3,15 +3,19 @@
 
 #include <json-c/json.h>
 
+#define NUM_MAX_CAMERAS		32
+
 struct camera_buffer {
 	uint8_t *ptr;
 	size_t length;
 	int width;
 	int height;
 	uint32_t id;
+	uint64_t timestamp_us;	/* of the capture, CLOCK_MONOTONIC */
 };
 
 int camera_devices_get(json_object *req);
+/* The reply "value" is { "camera", "width", "height" }, as captured */
 int camera_dev_play_start(json_object *req);
 void camera_dev_play_stop_req(json_object *req);
 void camera_dev_play_stop_by_id(int cam_id);
@@ -1,5 +1,7 @@
 
 #include "jpeg.h"
+#include "latency.h"
+#include "../../monotonic.h"
 
 static uint8_t *yuyv_align422(uint8_t *input, int width, int height, int bytes_per_pix)
 {
@@ -44,15 +46,19 @@ static uint8_t *yuyv_align422(uint8_t *input, int width, int height, int bytes_p
 }
 
 uint8_t *turbo_jpeg_compress(tjhandle tjh, uint8_t *input, int width, int height,
-			     int bytes_per_pix, int padding, int quality, unsigned long *out_size)
+			     int bytes_per_pix, int padding, int quality, unsigned long *out_size,
+			     uint64_t *convert_us)
 {
 	uint8_t *yuv422_buf, *jpeg_buf = NULL;
+	uint64_t t = convert_us ? monotonic_now_us() : 0;
 
 	yuv422_buf = yuyv_align422(input, width, height, bytes_per_pix);
 	if (!yuv422_buf) {
 		lwsl_err("%s: failed to align to YUV 422\n", __func__);
 		return NULL;
 	}
+	if (convert_us)
+		*convert_us = monotonic_now_us() - t;
 
 	if (tjCompressFromYUV(tjh, yuv422_buf, width, padding, height,
 	    TJSAMP_422, &jpeg_buf, out_size, quality, 0)) {
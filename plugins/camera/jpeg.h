@@ -5,8 +5,9 @@
 #include <turbojpeg.h>
 #include <libwebsockets.h>
 
+/* 'convert_us' (optional) gets the time taken by the YUYV to 4:2:2 step */
 uint8_t *turbo_jpeg_compress(tjhandle tjh, uint8_t *input, int width, int height,
                              int bytes_per_pix, int padding, int quality,
-			     unsigned long *out_size);
+			     unsigned long *out_size, uint64_t *convert_us);
 
 #endif /* __JPEG_H__ */
@@ -0,0 +1,264 @@
+
+#include "latency.h"
+#include "camera.h"
+#include "../../metrics.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Values below 2 * LATENCY_SUB_BUCKETS each have their bucket; above, each
+ * power of two is split in LATENCY_SUB_BUCKETS buckets. Anything from
+ * 2^LATENCY_MAX_BITS us up goes in the last bucket.
+ */
+#define LATENCY_SUB_BITS	4
+#define LATENCY_SUB_BUCKETS	(1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS	27
+#define LATENCY_MAX_US		((1ULL << LATENCY_MAX_BITS) - 1)
+#define LATENCY_NUM_BUCKETS	((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+struct latency_histogram {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint32_t buckets[LATENCY_NUM_BUCKETS];
+};
+
+/* ~22 KiB per camera; only the pages of cameras that stream get touched */
+static struct latency_histogram latency[NUM_MAX_CAMERAS][LATENCY_NUM];
+
+static const char *latency_stage_names[] = {
+	[LATENCY_CAPTURE] = "capture",
+	[LATENCY_DEQUEUE] = "dequeue",
+	[LATENCY_CONVERT] = "convert",
+	[LATENCY_ENCODE] = "encode",
+	[LATENCY_DRPAI_LOAD] = "drpai_load",
+	[LATENCY_DRPAI_START] = "drpai_start",
+	[LATENCY_DRPAI_RUN] = "drpai_run",
+	[LATENCY_DRPAI_READ] = "drpai_read",
+	[LATENCY_POSTPROC] = "postproc",
+	[LATENCY_SERIALIZE] = "serialize",
+	[LATENCY_QUEUE] = "queue",
+	[LATENCY_WRITE] = "write",
+	[LATENCY_VIDEO] = "video",
+	[LATENCY_RESULT] = "result",
+};
+
+const char *latency_stage_name(enum latency_stage stage)
+{
+	return stage < LATENCY_NUM ? latency_stage_names[stage] : NULL;
+}
+
+static int latency_bucket(uint64_t us)
+{
+	int shift;
+
+	if (us > LATENCY_MAX_US)
+		us = LATENCY_MAX_US;
+	if (us < 2 * LATENCY_SUB_BUCKETS)
+		return us;
+
+	/* the top LATENCY_SUB_BITS + 1 bits, of which the first is set */
+	shift = 63 - __builtin_clzll(us) - LATENCY_SUB_BITS;
+
+	return (shift + 1) * LATENCY_SUB_BUCKETS + (us >> shift) - LATENCY_SUB_BUCKETS;
+}
+
+/* The largest value that goes in bucket 'i' */
+static uint64_t latency_bucket_max(int i)
+{
+	uint64_t sub;
+	int shift;
+
+	if (i < 2 * LATENCY_SUB_BUCKETS)
+		return i;
+
+	shift = i / LATENCY_SUB_BUCKETS - 1;
+	sub = i % LATENCY_SUB_BUCKETS + LATENCY_SUB_BUCKETS;
+
+	return ((sub + 1) << shift) - 1;
+}
+
+static struct latency_histogram *latency_histogram(int cam_id, enum latency_stage stage)
+{
+	if (cam_id < 0 || cam_id >= NUM_MAX_CAMERAS || stage >= LATENCY_NUM)
+		return NULL;
+
+	return &latency[cam_id][stage];
+}
+
+void latency_record(int cam_id, enum latency_stage stage, uint64_t us)
+{
+	struct latency_histogram *h = latency_histogram(cam_id, stage);
+	uint64_t max;
+
+	if (!h)
+		return;
+
+	__atomic_fetch_add(&h->buckets[latency_bucket(us)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum_us, us, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+	while (us > max &&
+	       !__atomic_compare_exchange_n(&h->max_us, &max, us, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+void latency_reset(int cam_id)
+{
+	if (cam_id < 0 || cam_id >= NUM_MAX_CAMERAS)
+		return;
+
+	memset(latency[cam_id], 0, sizeof(latency[cam_id]));
+}
+
+int latency_summary_get(int cam_id, enum latency_stage stage, struct latency_summary *s)
+{
+	const struct latency_histogram *h = latency_histogram(cam_id, stage);
+	uint64_t *pct[] = { &s->p50_us, &s->p90_us, &s->p99_us };
+	static const int permille[] = { 500, 900, 990 };
+	uint64_t seen = 0, total = 0;
+	uint32_t n;
+	int i, p = 0;
+
+	memset(s, 0, sizeof(*s));
+	if (!h || !__atomic_load_n(&h->count, __ATOMIC_RELAXED))
+		return 0;
+
+	s->sum_us = __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED);
+	s->max_us = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+
+	/* the count that goes with the buckets as they are read */
+	for (i = 0; i < LATENCY_NUM_BUCKETS; i++)
+		total += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+	s->count = total;
+
+	for (i = 0; i < LATENCY_NUM_BUCKETS && p < 3; i++) {
+		n = __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+		seen += n;
+		while (p < 3 && seen * 1000 >= total * permille[p]) {
+			*pct[p] = latency_bucket_max(i);
+			if (*pct[p] > s->max_us)
+				*pct[p] = s->max_us;
+			p++;
+		}
+	}
+
+	return total > 0;
+}
+
+static json_object *latency_summary_to_json(const struct latency_summary *s)
+{
+	json_object *e = json_object_new_object();
+
+	if (!e)
+		return NULL;
+
+	json_object_object_add(e, "count", json_object_new_int64(s->count));
+	json_object_object_add(e, "mean_us", json_object_new_int64(s->sum_us / s->count));
+	json_object_object_add(e, "p50_us", json_object_new_int64(s->p50_us));
+	json_object_object_add(e, "p90_us", json_object_new_int64(s->p90_us));
+	json_object_object_add(e, "p99_us", json_object_new_int64(s->p99_us));
+	json_object_object_add(e, "max_us", json_object_new_int64(s->max_us));
+
+	return e;
+}
+
+int latency_get(json_object *req)
+{
+	json_object *jval = json_object_object_get(req, "value");
+	bool reset = json_object_get_boolean(json_object_object_get(jval, "reset"));
+	struct latency_summary s;
+	json_object *arr, *cam, *stages;
+	int i, st;
+
+	arr = json_object_new_array();
+	if (!arr) {
+		json_object_object_add(req, "error",
+				       json_object_new_string("error allocating JSON array"));
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < NUM_MAX_CAMERAS; i++) {
+		stages = NULL;
+		for (st = 0; st < LATENCY_NUM; st++) {
+			if (!latency_summary_get(i, st, &s))
+				continue;
+			if (!stages && !(stages = json_object_new_object()))
+				break;
+			json_object_object_add(stages, latency_stage_name(st),
+					       latency_summary_to_json(&s));
+		}
+		if (reset)
+			latency_reset(i);
+		if (!stages)
+			continue;
+
+		cam = json_object_new_object();
+		if (!cam) {
+			json_object_put(stages);
+			continue;
+		}
+		json_object_object_add(cam, "camera", json_object_new_int(i));
+		json_object_object_add(cam, "stages", stages);
+		json_object_array_add(arr, cam);
+	}
+
+	json_object_object_add(req, "value", arr);
+
+	return 0;
+}
+
+static void latency_metrics_histogram(struct metrics *m, int cam_id, enum latency_stage stage)
+{
+	static const uint64_t bounds_us[] = {
+		100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+		100000, 250000, 500000, 1000000, 2500000,
+	};
+	const struct latency_histogram *h = &latency[cam_id][stage];
+	const char *name = latency_stage_name(stage);
+	uint64_t counts[LWS_ARRAY_SIZE(bounds_us)], total = 0;
+	size_t b = 0;
+	int i;
+
+	if (!__atomic_load_n(&h->count, __ATOMIC_RELAXED))
+		return;
+
+	for (i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+		while (b < LWS_ARRAY_SIZE(bounds_us) && latency_bucket_max(i) > bounds_us[b])
+			counts[b++] = total;
+		total += __atomic_load_n(&h->buckets[i], __ATOMIC_RELAXED);
+	}
+	while (b < LWS_ARRAY_SIZE(bounds_us))
+		counts[b++] = total;
+
+	for (b = 0; b < LWS_ARRAY_SIZE(bounds_us); b++)
+		metrics_printf(m, "etb_camera_stage_seconds_bucket{camera=\"%d\",stage=\"%s\","
+			       "le=\"%g\"} %llu\n", cam_id, name, bounds_us[b] / 1e6,
+			       (unsigned long long)counts[b]);
+
+	metrics_printf(m, "etb_camera_stage_seconds_bucket{camera=\"%d\",stage=\"%s\",le=\"+Inf\"} %llu\n"
+		       "etb_camera_stage_seconds_sum{camera=\"%d\",stage=\"%s\"} %.6f\n"
+		       "etb_camera_stage_seconds_count{camera=\"%d\",stage=\"%s\"} %llu\n",
+		       cam_id, name, (unsigned long long)total,
+		       cam_id, name, __atomic_load_n(&h->sum_us, __ATOMIC_RELAXED) / 1e6,
+		       cam_id, name, (unsigned long long)total);
+}
+
+void latency_metrics(struct metrics *m)
+{
+	int i, st;
+
+	metrics_family(m, "etb_camera_stage_seconds", "histogram",
+		       "Time of a frame in each stage of the pipeline, and end to end");
+
+	for (i = 0; i < NUM_MAX_CAMERAS; i++) {
+		for (st = 0; st < LATENCY_NUM; st++)
+			latency_metrics_histogram(m, i, st);
+	}
+}
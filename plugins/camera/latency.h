@@ -0,0 +1,74 @@
+#ifndef __CAMERA_LATENCY_H__
+#define __CAMERA_LATENCY_H__
+
+#include <stdint.h>
+#include <json-c/json.h>
+
+struct metrics;
+
+/**
+ * Where the time of a frame goes, per camera: each stage of the pipeline
+ * adds its duration to a histogram with log-linear buckets (as in HDR
+ * histograms: 16 per power of two, so within ~6%), from 1 us to ~2 min.
+ * Recording is a few relaxed atomic adds, with no lock and no allocation,
+ * so that it can stay enabled; readers may see a frame half recorded.
+ */
+enum latency_stage {
+	LATENCY_CAPTURE,	/* V4L2 timestamp to dequeued */
+	LATENCY_DEQUEUE,	/* VIDIOC_DQBUF */
+	LATENCY_CONVERT,	/* YUYV to planar 4:2:2 */
+	LATENCY_ENCODE,		/* JPEG */
+	LATENCY_DRPAI_LOAD,	/* frame into the DRP AI input */
+	LATENCY_DRPAI_START,
+	LATENCY_DRPAI_RUN,	/* started to seen done */
+	LATENCY_DRPAI_READ,	/* output tensor */
+	LATENCY_POSTPROC,
+	LATENCY_SERIALIZE,	/* result to JSON text */
+	LATENCY_QUEUE,		/* in the ring, until written */
+	LATENCY_WRITE,		/* lws_write() */
+	LATENCY_VIDEO,		/* end to end: capture to JPEG written */
+	LATENCY_RESULT,		/* end to end: capture to result written */
+	LATENCY_NUM
+};
+
+const char *latency_stage_name(enum latency_stage stage);
+
+void latency_record(int cam_id, enum latency_stage stage, uint64_t us);
+
+/* Records 'to' - 'from', if both were stamped */
+static inline void latency_span(int cam_id, enum latency_stage stage,
+				uint64_t from, uint64_t to)
+{
+	if (from && to >= from)
+		latency_record(cam_id, stage, to - from);
+}
+
+/* When a camera starts streaming again */
+void latency_reset(int cam_id);
+
+struct latency_summary {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t p50_us;
+	uint64_t p90_us;
+	uint64_t p99_us;
+};
+
+/* False if nothing was recorded for the camera and stage */
+int latency_summary_get(int cam_id, enum latency_stage stage, struct latency_summary *s);
+
+/**
+ * "camera-latency-get": the summaries of all cameras that have any, in
+ * microseconds; with "value": { "reset": true } they start over.
+ */
+int latency_get(json_object *req);
+
+/**
+ * etb_camera_stage_seconds, as a histogram with fixed bounds; a count is
+ * put under the first bound above all values of its bucket, so it may go
+ * one bound up (by less than the ~6% width of a bucket).
+ */
+void latency_metrics(struct metrics *m);
+
+#endif /* __CAMERA_LATENCY_H__ */
@@ -6,12 +6,21 @@
 
 #include "protocol.h"
 #include "camera.h"
+#include "latency.h"
+#include "stats.h"
+#include "../../metrics.h"
+#include "../../monotonic.h"
 #include "../drpai/drpai.h"
+#include "../drpai/sched.h"
+#include "../drpai/tracker.h"
+#include "../drpai/motion.h"
 
 #define RING_DEPTH 4096
 
 #define VIDEO_STREAM_ID_SIZE	16
 
+static uint32_t protocol_sessions;
+
 /* one of these created for each message */
 
 enum command {
@@ -19,6 +28,7 @@ enum command {
 	CMD_DEVICES_GET = 0,
 	CMD_DEVICE_PLAY,
 	CMD_DEVICE_STOP,
+	CMD_LATENCY_GET,
 	CMD_MAX,
 };
 
@@ -26,12 +36,17 @@ static const char *command_names[] = {
 	[CMD_DEVICES_GET] = "camera-devices-get",
 	[CMD_DEVICE_PLAY] = "camera-device-play",
 	[CMD_DEVICE_STOP] = "camera-device-stop",
+	[CMD_LATENCY_GET] = "camera-latency-get",
 };
 
 struct msg {
 	uint8_t *send_buf;
 	int send_buf_len;
 	int flags;
+	uint64_t queued_us;
+	/* of the frame this is for, if any; written, it ends 'e2e' */
+	uint64_t capture_us;
+	enum latency_stage e2e;
 };
 
 struct vhd_camera {
@@ -62,9 +77,11 @@ static enum command protocol_get_command_enum(const char *cmd)
 	return CMD_INVALID;
 }
 
-static int queue_json_message(struct lws *wsi, struct per_session_data__camera *pss,
-			      json_object* jo)
+/* 'capture_us' is that of the frame a result is for, or 0 */
+static int __queue_json_message(struct lws *wsi, struct per_session_data__camera *pss,
+				json_object* jo, uint64_t capture_us)
 {
+	uint64_t start = monotonic_now_us();
 	struct msg amsg = {};
 	const char *s;
 	size_t slen;
@@ -87,6 +104,13 @@ static int queue_json_message(struct lws *wsi, struct per_session_data__camera *
 	memcpy(amsg.send_buf + LWS_PRE, s, slen);
 	amsg.flags = lws_write_ws_flags(LWS_WRITE_TEXT, 1, 1);
 
+	amsg.queued_us = monotonic_now_us();
+	if (capture_us) {
+		amsg.capture_us = capture_us;
+		amsg.e2e = LATENCY_RESULT;
+		latency_record(pss->cam_id, LATENCY_SERIALIZE, amsg.queued_us - start);
+	}
+
 	ret = lws_ring_insert(pss->ring, &amsg, 1);
 
 	if (!ret) {
@@ -97,9 +121,15 @@ static int queue_json_message(struct lws *wsi, struct per_session_data__camera *
 	return 0;
 }
 
+static int queue_json_message(struct lws *wsi, struct per_session_data__camera *pss,
+			      json_object* jo)
+{
+	return __queue_json_message(wsi, pss, jo, 0);
+}
+
 static int queue_video_stream(struct lws *wsi, const char *stream_id,
 			      struct per_session_data__camera *pss,
-			      uint8_t* jpeg_buf, int jpeg_buflen)
+			      uint8_t* jpeg_buf, int jpeg_buflen, uint64_t capture_us)
 {
 	struct msg amsg = {};
 	char *s;
@@ -109,7 +139,7 @@ static int queue_video_stream(struct lws *wsi, const char *stream_id,
 	amsg.send_buf = malloc(amsg.send_buf_len + LWS_PRE);
 	if (!amsg.send_buf) {
 		lwsl_warn(" (could not allocate send buffer)\n");
-		return -1;
+		goto err;
 	}
 
 	s = (char *)(amsg.send_buf + LWS_PRE);
@@ -118,21 +148,99 @@ static int queue_video_stream(struct lws *wsi, const char *stream_id,
 
 	// FIXME: hardcoded
 	amsg.flags = lws_write_ws_flags(LWS_WRITE_BINARY, 1, 1);
+	amsg.queued_us = monotonic_now_us();
+	amsg.capture_us = capture_us;
+	amsg.e2e = LATENCY_VIDEO;
 
 	ret = lws_ring_insert(pss->ring, &amsg, 1);
 
 	if (!ret) {
 		lwsl_warn(" (could insert message in ring)\n");
-		return -1;
+		free(amsg.send_buf);
+		goto err;
 	}
 
 	return 0;
+err:
+	/* a camera frame, as opposed to a mask */
+	if (capture_us)
+		camera_stats_add(pss->cam_id, CAMERA_FRAMES_DROPPED, 1);
+	return -1;
+}
+
+/**
+ * A segmentation mask goes out as a binary frame, after its result;
+ * it is in the result as a string so far.
+ */
+static void queue_drpai_result(struct lws *wsi, struct per_session_data__camera *pss,
+			       json_object *res, uint64_t capture_us)
+{
+	json_object *mask = json_object_object_get(res, "mask");
+
+	if (!json_object_is_type(mask, json_type_string)) {
+		__queue_json_message(wsi, pss, res, capture_us);
+		return;
+	}
+
+	json_object_get(mask);
+	json_object_object_del(res, "mask");
+
+	__queue_json_message(wsi, pss, res, capture_us);
+	queue_video_stream(wsi, "drpai-mask", pss,
+			   (uint8_t *)json_object_get_string(mask),
+			   json_object_get_string_len(mask), 0);
+
+	json_object_put(mask);
+}
+
+static void protocol_drpai_client_destroy(struct per_session_data__camera *pss)
+{
+	drpai_sched_client_destroy(pss->drpai);
+	pss->drpai = NULL;
+	drpai_tracker_destroy(pss->tracker);
+	pss->tracker = NULL;
+	motion_gate_free(pss->motion);
+	pss->motion = NULL;
+}
+
+/* Inference is optional; the camera streams fine without a DRP AI */
+/* 'jval' is the "value" of the play request, which the reply replaces */
+static void protocol_drpai_client_create(struct lws *wsi, struct per_session_data__camera *pss,
+					 json_object *jval)
+{
+	json_object *jinf = json_object_object_get(jval, "inference");
+	json_object *jtrk = json_object_object_get(jinf, "tracker");
+	json_object *jmot = json_object_object_get(jinf, "motion");
+	int rc = 0;
+
+	protocol_drpai_client_destroy(pss);
+	pss->drpai = drpai_sched_client_create(lws_get_context(wsi), pss->cam_id, jinf, &rc);
+	if (!pss->drpai) {
+		lwsl_warn("%s: no inference for camera %d: %s\n", __func__,
+			  pss->cam_id, strerror(-rc));
+		return;
+	}
+
+	if (jmot) {
+		pss->motion = motion_gate_create(jmot, &rc);
+		if (!pss->motion)
+			lwsl_warn("%s: no motion gating for camera %d: %s\n", __func__,
+				  pss->cam_id, strerror(-rc));
+	}
+
+	if (!jtrk)
+		return;
+
+	pss->tracker = drpai_tracker_create(jtrk, &rc);
+	if (!pss->tracker)
+		lwsl_warn("%s: no tracking for camera %d: %s\n", __func__,
+			  pss->cam_id, strerror(-rc));
 }
 
 static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__camera *pss,
 				    void *in, size_t len)
 {
-	json_object *req = NULL;
+	json_object *req = NULL, *jval;
 	bool first, final;
 	enum command cmd = CMD_INVALID;
 	bool send_req_back_as_reply = false;
@@ -156,16 +264,22 @@ static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__ca
 			camera_devices_get(req);
 			break;
 		case CMD_DEVICE_PLAY:
+			send_req_back_as_reply = true;
+			jval = json_object_get(json_object_object_get(req, "value"));
 			pss->cam_id = camera_dev_play_start(req);
 			if (pss->cam_id > -1)
-				lws_callback_on_writable(wsi);
-			else
-				send_req_back_as_reply = true;
+				protocol_drpai_client_create(wsi, pss, jval);
+			json_object_put(jval);
 			break;
 		case CMD_DEVICE_STOP:
 			camera_dev_play_stop_req(req);
+			protocol_drpai_client_destroy(pss);
 			pss->cam_id = -1;
 			break;
+		case CMD_LATENCY_GET:
+			send_req_back_as_reply = true;
+			latency_get(req);
+			break;
 		default:
 			break;
 	}
@@ -191,6 +305,7 @@ static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__ca
 
 static int handle_outgoing_message(struct lws *wsi, struct per_session_data__camera *pss)
 {
+	uint64_t start, now;
 	struct msg *pmsg;
 	int w;
 
@@ -200,11 +315,19 @@ static int handle_outgoing_message(struct lws *wsi, struct per_session_data__cam
 		return -1;
 	}
 
+	start = monotonic_now_us();
 	w = lws_write(wsi, pmsg->send_buf + LWS_PRE, pmsg->send_buf_len, pmsg->flags);
 	if (w < pmsg->send_buf_len) {
 		lwsl_err("ERROR %d writing json to ws socket %d\n", w, pmsg->send_buf_len);
 		return -1;
 	}
+	now = monotonic_now_us();
+
+	latency_span(pss->cam_id, LATENCY_QUEUE, pmsg->queued_us, start);
+	latency_record(pss->cam_id, LATENCY_WRITE, now - start);
+	latency_span(pss->cam_id, pmsg->e2e, pmsg->capture_us, now);
+	if (pmsg->capture_us && pmsg->e2e == LATENCY_VIDEO)
+		camera_stats_add(pss->cam_id, CAMERA_FRAMES_SENT, 1);
 
 	lws_ring_consume_single_tail(pss->ring, &pss->tail, 1);
 
@@ -214,54 +337,69 @@ static int handle_outgoing_message(struct lws *wsi, struct per_session_data__cam
 }
 
 static int handle_video_drpai(struct lws *wsi, struct per_session_data__camera *pss,
-			      void *buf, uint8_t* jpeg_buf, int jpeg_buflen)
+			      struct camera_buffer *buf, uint8_t* jpeg_buf, int jpeg_buflen)
 {
-	json_object *res;
+	struct drpai_sched_times times = {};
 	const char *err_msg = NULL;
-	static int get_result = 0;
-
-	struct drpai *d = drpai;
+	json_object *res, *jmotion = NULL;
+	uint64_t now;
+	int rc = 0;
 
-	if (!d || !drpai_active)
+	if (!pss->drpai)
 		return 0;
 
-	if (get_result == 0) {
-		err_msg = drpai_model_load_input(d, buf, DRPAI_BUF_LEN);
-		if (err_msg) {
-			lwsl_warn("drpai_model_load_input: %s\n", err_msg);
-			goto out_send_err;
-		}
-
-		err_msg = drpai_model_start(drpai);
-		if (err_msg) {
-			lwsl_warn("drpai_model_start: %s\n", err_msg);
-			goto out_send_err;
-		}
-
-		get_result = 1;
-		// send a copy to the DRP AI canvas
-		queue_video_stream(wsi, "drpai+camera", pss, jpeg_buf, jpeg_buflen);
-		return 1;
+	/* With tracking, detections only go to the tracker; anything else
+	 * (errors, other results) is passed on as is.
+	 */
+	res = drpai_sched_get_result(pss->drpai, &times);
+	if (res) {
+		latency_record(pss->cam_id, LATENCY_DRPAI_LOAD, times.load_us);
+		latency_record(pss->cam_id, LATENCY_DRPAI_START, times.start_us);
+		latency_record(pss->cam_id, LATENCY_DRPAI_RUN, times.run_us);
+		latency_record(pss->cam_id, LATENCY_DRPAI_READ, times.read_us);
+		latency_record(pss->cam_id, LATENCY_POSTPROC, times.postproc_us);
+
+		motion_gate_attach(pss->motion, res, times.submit_us);
+		if (!pss->tracker || drpai_tracker_update(pss->tracker, res, times.submit_us))
+			queue_drpai_result(wsi, pss, res, times.capture_us);
+		else
+			jmotion = json_object_get(json_object_object_get(res, "motion"));
+		json_object_put(res);
 	}
 
-	if (drpai_is_running(d))
-		return 0;
-
-	res = json_object_new_object();
-	err_msg = drpai_model_get_result(d, res);
-	if (err_msg)
+	/* idle scenes don't need the accelerator */
+	now = monotonic_now_us();
+	if (!pss->motion ||
+	    motion_gate_check(pss->motion, buf->ptr, buf->width, buf->height, now))
+		rc = drpai_sched_submit(pss->drpai, buf->ptr, buf->width, buf->height,
+					buf->timestamp_us, &err_msg);
+	if (rc < 0) {
+		lwsl_warn("drpai_sched_submit: %s\n", err_msg);
+		json_object_put(jmotion);
 		goto out_send_err;
-
-	if (err_msg) {
-		json_object_object_add(res, "error",
-				       json_object_new_string(err_msg));
+	}
+	if (rc > 0 && pss->motion)
+		motion_gate_commit(pss->motion, now);
+
+	/* the tracker has boxes for every frame */
+	if (pss->tracker) {
+		res = drpai_tracker_predict(pss->tracker, now);
+		if (res) {
+			if (jmotion) {
+				json_object_object_add(res, "motion", jmotion);
+				jmotion = NULL;
+			}
+			__queue_json_message(wsi, pss, res, buf->timestamp_us);
+			json_object_put(res);
+		}
+		json_object_put(jmotion);
+	} else if (rc == 0) {
+		return 0;
 	}
 
-	queue_json_message(pss->wsi, pss, res);
-	json_object_put(res);
-	get_result = 0;
-
-	return 0;
+	// send a copy to the DRP AI canvas
+	queue_video_stream(wsi, "drpai+camera", pss, jpeg_buf, jpeg_buflen, buf->timestamp_us);
+	return 1;
 
 out_send_err:
 	res = json_object_new_object();
@@ -279,6 +417,7 @@ out_send_err:
 static int handle_video_stream_out(struct lws *wsi, struct per_session_data__camera *pss)
 {
 	struct camera_buffer buf = {};
+	uint64_t start, convert_us = 0;
 	uint8_t* jpeg_buf;
 	size_t jpeg_buflen = 0;
 	int sent_frame;
@@ -288,19 +427,25 @@ static int handle_video_stream_out(struct lws *wsi, struct per_session_data__cam
 		return -1;
 	}
 
+	start = monotonic_now_us();
 	jpeg_buf = turbo_jpeg_compress(pss->tjpeg_handle, buf.ptr,
 				       buf.width, buf.height,
-				       2, 1, 75, &jpeg_buflen);
+				       2, 1, 75, &jpeg_buflen, &convert_us);
 	if (!jpeg_buf) {
 		lwsl_warn(" (could not compress jpeg)\n");
+		camera_stats_add(pss->cam_id, CAMERA_FRAMES_DROPPED, 1);
 		return -1;
 	}
+	camera_stats_add(pss->cam_id, CAMERA_FRAMES_ENCODED, 1);
+	camera_stats_add(pss->cam_id, CAMERA_ENCODED_BYTES, jpeg_buflen);
+	latency_record(pss->cam_id, LATENCY_CONVERT, convert_us);
+	latency_record(pss->cam_id, LATENCY_ENCODE, monotonic_now_us() - start - convert_us);
 
 	// FIXME: (hack) separate this nicer
-	sent_frame = handle_video_drpai(wsi, pss, buf.ptr, jpeg_buf, jpeg_buflen);
+	sent_frame = handle_video_drpai(wsi, pss, &buf, jpeg_buf, jpeg_buflen);
 
 	if (!sent_frame)
-		queue_video_stream(wsi, "camera", pss, jpeg_buf, jpeg_buflen);
+		queue_video_stream(wsi, "camera", pss, jpeg_buf, jpeg_buflen, buf.timestamp_us);
 
 	tjFree(jpeg_buf);
 
@@ -349,8 +494,18 @@ int callback_camera(struct lws *wsi, enum lws_callback_reasons reason,
 
 		pss->wsi = wsi;
 
+		pss->drpai = NULL;
+		pss->tracker = NULL;
+		pss->motion = NULL;
 		pss->cam_id = -1;
 		pss->tail = 0;
+		pss->session_id = ++protocol_sessions;
+		break;
+
+	case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+		/* a DRP AI decode is done; its result goes out with the next frame */
+		if (vhd)
+			lws_callback_on_writable_all_protocol(vhd->context, lws_get_protocol(wsi));
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
@@ -400,11 +555,19 @@ int callback_camera(struct lws *wsi, enum lws_callback_reasons reason,
 
 	case LWS_CALLBACK_CLOSED:
 		lwsl_info("camera: client disconnected\n");
+		protocol_drpai_client_destroy(pss);
 		camera_dev_play_stop_by_id(pss->cam_id);
 		tjDestroy(pss->tjpeg_handle);
 		lws_ring_destroy(pss->ring);
 		break;
 
+	case METRICS_CALLBACK_SESSION:
+		if (pss->ring)
+			metrics_printf(in, "etb_session_queue_depth{protocol=\"camera\",session=\"%u\"} %zu\n",
+				       pss->session_id,
+				       lws_ring_get_count_waiting_elements(pss->ring, &pss->tail));
+		break;
+
 	default:
 		break;
 	}
@@ -7,14 +7,22 @@
 
 /* FIXME: abstract this better */
 
+struct drpai_sched_client;
+struct drpai_tracker;
+struct motion_gate;
+
 int callback_camera(struct lws *wsi, enum lws_callback_reasons reason,
 		     void *user, void *in, size_t len);
 
 struct per_session_data__camera {
 	struct lws_ring *ring;
+	uint32_t session_id;	/* for the metrics */
 	uint32_t msglen;
 	uint32_t tail;
 	int cam_id;
+	struct drpai_sched_client *drpai;
+	struct drpai_tracker *tracker;
+	struct motion_gate *motion;
 	tjhandle tjpeg_handle;
 	uint8_t flow_controlled:1;
 	struct lws *wsi;
@@ -0,0 +1,51 @@
+
+#include "stats.h"
+#include "camera.h"
+#include "../../metrics.h"
+
+static uint64_t camera_counters[NUM_MAX_CAMERAS][CAMERA_NUM_COUNTERS];
+
+static const struct {
+	const char *name;
+	const char *help;
+} camera_counter_info[] = {
+	[CAMERA_FRAMES_CAPTURED] = { "etb_camera_frames_captured_total",
+				     "Frames dequeued from the camera" },
+	[CAMERA_FRAMES_ENCODED] = { "etb_camera_frames_encoded_total",
+				    "Frames encoded to JPEG" },
+	[CAMERA_FRAMES_SENT] = { "etb_camera_frames_sent_total",
+				 "Video frames written to a session" },
+	[CAMERA_FRAMES_DROPPED] = { "etb_camera_frames_dropped_total",
+				    "Frames captured but not queued for sending" },
+	[CAMERA_ENCODED_BYTES] = { "etb_camera_encoded_bytes_total",
+				   "Size of the encoded frames" },
+};
+
+void camera_stats_add(int cam_id, enum camera_counter counter, uint64_t n)
+{
+	if (cam_id < 0 || cam_id >= NUM_MAX_CAMERAS || counter >= CAMERA_NUM_COUNTERS)
+		return;
+
+	__atomic_fetch_add(&camera_counters[cam_id][counter], n, __ATOMIC_RELAXED);
+}
+
+void camera_stats_metrics(struct metrics *m)
+{
+	uint64_t v;
+	int c, i;
+
+	for (c = 0; c < CAMERA_NUM_COUNTERS; c++) {
+		metrics_family(m, camera_counter_info[c].name, "counter",
+			       camera_counter_info[c].help);
+		/* cameras that never captured stay out */
+		for (i = 0; i < NUM_MAX_CAMERAS; i++) {
+			if (!__atomic_load_n(&camera_counters[i][CAMERA_FRAMES_CAPTURED],
+					     __ATOMIC_RELAXED))
+				continue;
+			v = __atomic_load_n(&camera_counters[i][c], __ATOMIC_RELAXED);
+			metrics_printf(m, "%s{camera=\"%d\"} %llu\n",
+				       camera_counter_info[c].name, i,
+				       (unsigned long long)v);
+		}
+	}
+}
@@ -0,0 +1,22 @@
+#ifndef __CAMERA_STATS_H__
+#define __CAMERA_STATS_H__
+
+#include <stdint.h>
+
+struct metrics;
+
+/* Per camera counters, since the process started; relaxed atomics */
+enum camera_counter {
+	CAMERA_FRAMES_CAPTURED,
+	CAMERA_FRAMES_ENCODED,
+	CAMERA_FRAMES_SENT,	/* video frames written to a session */
+	CAMERA_FRAMES_DROPPED,	/* captured, but not queued for sending */
+	CAMERA_ENCODED_BYTES,
+	CAMERA_NUM_COUNTERS
+};
+
+void camera_stats_add(int cam_id, enum camera_counter counter, uint64_t n);
+
+void camera_stats_metrics(struct metrics *m);
+
+#endif /* __CAMERA_STATS_H__ */
@@ -0,0 +1,991 @@
+
+#include <linux/drpai.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+#include "catalog.h"
+#include "drpai.h"
+#include "models.h"
+#include "pkg.h"
+#include "sha256.h"
+
+#define CATALOG_EVENTS	(IN_CREATE | IN_DELETE | IN_CLOSE_WRITE | IN_MOVED_FROM | \
+			 IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF)
+
+struct catalog_model {
+	char *name;
+	bool stale;		/* to be scanned again */
+	bool seen;		/* by the last scan of the root */
+	bool valid;		/* has all the files it needs, or is a sequence */
+	bool sequence;
+	bool preprocess;	/* needs the DRP parameter info */
+	bool package;		/* a single file, rather than a directory */
+	char *type;
+	int input_width;
+	int input_height;
+	int model_in_w;		/* -1 if not in the config */
+	int model_in_h;
+	int num_labels;
+	uint64_t weight_size;
+	uint8_t stamp[SHA256_SIZE];	/* of the names, sizes and mtimes of its files */
+	bool hashed;		/* 'hash' is of the files as in 'stamp' */
+	bool hashing;		/* or a job is on it */
+	int hash_err;		/* of the files as in 'stamp': not valid */
+	char hash[SHA256_HEX_SIZE];	/* empty until hashed */
+	struct catalog_model *next;	/* by name */
+};
+
+/**
+ * Hashing reads all of a model, which is for the hasher thread rather
+ * than the event loop; a job is of the model as it was scanned, and its
+ * result only goes in if the model still has the same 'stamp'.
+ */
+struct catalog_hash_job {
+	char *name;
+	bool package;
+	bool config;		/* the model config is there, and hashed first */
+	uint8_t stamp[SHA256_SIZE];
+	int err;
+	char hash[SHA256_HEX_SIZE];
+	struct catalog_hash_job *next;
+};
+
+/* A watched directory: the root (no model), a model or a stage of it */
+struct catalog_watch {
+	int wd;
+	char *model;
+};
+
+static struct {
+	int fd;			/* inotify; -1 without */
+	bool rescan_root;
+	struct catalog_model *models;
+	struct catalog_watch *watches;
+	int num_watches;
+	int max_watches;
+	/* the hasher thread and its jobs, under 'lock' */
+	pthread_t hasher;
+	bool hasher_running;
+	bool hasher_stop;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct catalog_hash_job *todo;	/* in order */
+	struct catalog_hash_job *done;
+} catalog = {
+	.fd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct catalog_model *catalog_find(const char *name)
+{
+	struct catalog_model *m;
+
+	for (m = catalog.models; m; m = m->next) {
+		if (!strcmp(m->name, name))
+			return m;
+	}
+
+	return NULL;
+}
+
+static struct catalog_model *catalog_add(const char *name)
+{
+	struct catalog_model *m, **pm;
+
+	m = catalog_find(name);
+	if (m)
+		return m;
+
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		return NULL;
+	m->name = strdup(name);
+	if (!m->name) {
+		free(m);
+		return NULL;
+	}
+	m->stale = true;
+
+	for (pm = &catalog.models; *pm && strcmp((*pm)->name, name) < 0; pm = &(*pm)->next)
+		;
+	m->next = *pm;
+	*pm = m;
+
+	return m;
+}
+
+static void catalog_model_free(struct catalog_model *m)
+{
+	free(m->type);
+	free(m->name);
+	free(m);
+}
+
+static void catalog_remove(const char *name)
+{
+	struct catalog_model *m, **pm;
+
+	for (pm = &catalog.models; (m = *pm); pm = &m->next) {
+		if (strcmp(m->name, name))
+			continue;
+		*pm = m->next;
+		catalog_model_free(m);
+		return;
+	}
+}
+
+static struct catalog_watch *catalog_find_watch(int wd)
+{
+	int i;
+
+	for (i = 0; i < catalog.num_watches; i++) {
+		if (catalog.watches[i].wd == wd)
+			return &catalog.watches[i];
+	}
+
+	return NULL;
+}
+
+/* The same directory gives the same wd, so watching it again is harmless */
+static void catalog_watch(const char *path, const char *model)
+{
+	struct catalog_watch *w;
+	int wd;
+
+	if (catalog.fd < 0)
+		return;
+
+	wd = inotify_add_watch(catalog.fd, path, CATALOG_EVENTS);
+	if (wd < 0) {
+		lwsl_warn("%s: %s: %s\n", __func__, path, strerror(errno));
+		return;
+	}
+	/* a renamed model keeps its wd */
+	w = catalog_find_watch(wd);
+	if (w) {
+		if (model && (!w->model || strcmp(w->model, model))) {
+			free(w->model);
+			w->model = strdup(model);
+		}
+		return;
+	}
+
+	if (catalog.num_watches == catalog.max_watches) {
+		int max = catalog.max_watches + 32;
+
+		w = realloc(catalog.watches, max * sizeof(*w));
+		if (!w)
+			return;
+		catalog.watches = w;
+		catalog.max_watches = max;
+	}
+
+	w = &catalog.watches[catalog.num_watches];
+	w->model = model ? strdup(model) : NULL;
+	if (model && !w->model)
+		return;
+	w->wd = wd;
+	catalog.num_watches++;
+}
+
+static void catalog_unwatch(int wd)
+{
+	struct catalog_watch *w = catalog_find_watch(wd);
+
+	if (!w)
+		return;
+
+	free(w->model);
+	*w = catalog.watches[--catalog.num_watches];
+}
+
+static int catalog_hash_file(struct sha256 *s, const char *path, const char *name,
+			     uint64_t size)
+{
+	uint8_t buf[65536], le[8];
+	ssize_t n;
+	int fd, i;
+
+	/* the name and size first, so that files cannot run into each other */
+	sha256_update(s, name, strlen(name) + 1);
+	for (i = 0; i < 8; i++)
+		le[i] = size >> (8 * i);
+	sha256_update(s, le, sizeof(le));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		sha256_update(s, buf, n);
+
+	close(fd);
+
+	return n < 0 ? -errno : 0;
+}
+
+/* The files of a model directory, and of its stage directories, as catalog_scan_dir() sees them */
+static int catalog_hash_dir(struct sha256 *s, const char *dir, const char *prefix)
+{
+	char path[512], name[512];
+	struct dirent **eps;
+	struct stat st;
+	int i, n, rc = 0;
+
+	n = scandir(dir, &eps, NULL, alphasort);
+	if (n < 0)
+		return -errno;
+
+	for (i = 0; i < n && !rc; i++) {
+		const char *fname = eps[i]->d_name;
+
+		if (!strcmp(fname, ".") || !strcmp(fname, ".."))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, fname);
+		snprintf(name, sizeof(name), "%s%s", prefix, fname);
+		if (stat(path, &st))
+			continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			if (!*prefix) {
+				snprintf(name, sizeof(name), "%s/", fname);
+				rc = catalog_hash_dir(s, path, name);
+			}
+		} else if (S_ISREG(st.st_mode)) {
+			rc = catalog_hash_file(s, path, name, st.st_size);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		free(eps[i]);
+	free(eps);
+
+	return rc;
+}
+
+/* On the hasher thread; a package has its sections checked on the way */
+static void catalog_hash_run(struct catalog_hash_job *j)
+{
+	uint8_t digest[SHA256_SIZE];
+	struct drpai_pkg pkg;
+	char path[512];
+	struct sha256 s;
+	struct stat st;
+
+	if (j->package) {
+		j->err = drpai_pkg_open(&pkg, j->name);
+		if (!j->err)
+			j->err = drpai_pkg_verify(&pkg, digest);
+		drpai_pkg_close(&pkg);
+	} else {
+		sha256_init(&s);
+
+		snprintf(path, sizeof(path), "%s/%s.json", DRPAI_MODELS_ROOT_DIR, j->name);
+		j->err = 0;
+		if (j->config)
+			j->err = stat(path, &st) ? -errno : catalog_hash_file(&s, path, "", st.st_size);
+
+		snprintf(path, sizeof(path), "%s/%s", DRPAI_MODELS_ROOT_DIR, j->name);
+		if (!j->err)
+			j->err = catalog_hash_dir(&s, path, "");
+		sha256_final(&s, digest);
+	}
+
+	if (!j->err)
+		sha256_to_hex(digest, j->hash);
+}
+
+static void catalog_hash_job_free(struct catalog_hash_job *j)
+{
+	free(j->name);
+	free(j);
+}
+
+static void *catalog_hasher(void *arg)
+{
+	struct catalog_hash_job *j;
+
+	pthread_mutex_lock(&catalog.lock);
+	for (;;) {
+		while (!catalog.todo && !catalog.hasher_stop)
+			pthread_cond_wait(&catalog.cond, &catalog.lock);
+		if (catalog.hasher_stop)
+			break;
+
+		j = catalog.todo;
+		catalog.todo = j->next;
+		pthread_mutex_unlock(&catalog.lock);
+
+		catalog_hash_run(j);
+
+		pthread_mutex_lock(&catalog.lock);
+		j->next = catalog.done;
+		catalog.done = j;
+	}
+	pthread_mutex_unlock(&catalog.lock);
+
+	return NULL;
+}
+
+/* Signals are for the event loop */
+static void catalog_hasher_start(void)
+{
+	sigset_t all, old;
+	int rc;
+
+	if (catalog.hasher_running)
+		return;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	catalog.hasher_stop = false;
+	rc = pthread_create(&catalog.hasher, NULL, catalog_hasher, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (rc)
+		lwsl_warn("%s: no hasher thread, the models are hashed inline: %s\n",
+			  __func__, strerror(rc));
+	catalog.hasher_running = !rc;
+}
+
+static void catalog_hasher_stop(void)
+{
+	struct catalog_hash_job *j;
+
+	if (catalog.hasher_running) {
+		pthread_mutex_lock(&catalog.lock);
+		catalog.hasher_stop = true;
+		pthread_cond_broadcast(&catalog.cond);
+		pthread_mutex_unlock(&catalog.lock);
+
+		pthread_join(catalog.hasher, NULL);
+		catalog.hasher_running = false;
+	}
+
+	while ((j = catalog.todo)) {
+		catalog.todo = j->next;
+		catalog_hash_job_free(j);
+	}
+	while ((j = catalog.done)) {
+		catalog.done = j->next;
+		catalog_hash_job_free(j);
+	}
+}
+
+/* A model to be hashed again; a job still waiting for it is brought up to date */
+static void catalog_queue_hash(struct catalog_model *m, bool config)
+{
+	struct catalog_hash_job *j, **pj;
+
+	pthread_mutex_lock(&catalog.lock);
+	for (pj = &catalog.todo; (j = *pj); pj = &j->next) {
+		if (!strcmp(j->name, m->name))
+			break;
+	}
+
+	if (!j) {
+		j = calloc(1, sizeof(*j));
+		if (j)
+			j->name = strdup(m->name);
+		if (!j || !j->name) {
+			pthread_mutex_unlock(&catalog.lock);
+			free(j);
+			lwsl_err("%s: %s: out of memory\n", __func__, m->name);
+			return;
+		}
+		*pj = j;
+	}
+	j->package = m->package;
+	j->config = config;
+	memcpy(j->stamp, m->stamp, sizeof(j->stamp));
+	m->hashing = true;
+
+	if (catalog.hasher_running) {
+		pthread_cond_signal(&catalog.cond);
+		pthread_mutex_unlock(&catalog.lock);
+		return;
+	}
+
+	/* no thread to do it */
+	*pj = j->next;
+	pthread_mutex_unlock(&catalog.lock);
+
+	catalog_hash_run(j);
+	j->next = catalog.done;
+	catalog.done = j;
+}
+
+/* Takes in the hashes worked out since last time */
+static void catalog_collect_hashes(void)
+{
+	struct catalog_hash_job *j, *done;
+	struct catalog_model *m;
+
+	pthread_mutex_lock(&catalog.lock);
+	done = catalog.done;
+	catalog.done = NULL;
+	pthread_mutex_unlock(&catalog.lock);
+
+	while ((j = done)) {
+		done = j->next;
+
+		/* gone, or changed since */
+		m = catalog_find(j->name);
+		if (m && !m->hashed && !memcmp(m->stamp, j->stamp, sizeof(m->stamp))) {
+			m->hashing = false;
+			m->hashed = true;
+			m->hash_err = j->err;
+			if (j->err) {
+				lwsl_warn("%s: %s: %s\n", __func__, m->name, strerror(-j->err));
+				m->valid = false;
+			} else {
+				memcpy(m->hash, j->hash, sizeof(m->hash));
+			}
+		}
+
+		catalog_hash_job_free(j);
+	}
+}
+
+/* What a hash is cached against: the name, size and mtime of a file */
+static void catalog_stamp_file(struct sha256 *stamp, const char *name, const struct stat *st)
+{
+	uint64_t v[3] = { st->st_size, st->st_mtim.tv_sec, st->st_mtim.tv_nsec };
+
+	sha256_update(stamp, name, strlen(name) + 1);
+	sha256_update(stamp, v, sizeof(v));
+}
+
+/**
+ * Size up the files of a model directory, and its stage directories (one
+ * level down), in name order; what they are goes in 'stamp'.
+ */
+static int catalog_scan_dir(struct catalog_model *m, struct sha256 *stamp, const char *dir,
+			    const char *prefix, bool *required, bool *have_addrmap,
+			    bool *have_param_info)
+{
+	char path[512], name[512];
+	struct dirent **eps;
+	struct stat st;
+	int i, n, rc = 0;
+
+	n = scandir(dir, &eps, NULL, alphasort);
+	if (n < 0)
+		return -errno;
+
+	catalog_watch(dir, m->name);
+
+	for (i = 0; i < n; i++) {
+		const char *fname = eps[i]->d_name;
+		int kind;
+
+		if (!strcmp(fname, ".") || !strcmp(fname, ".."))
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", dir, fname);
+		snprintf(name, sizeof(name), "%s%s", prefix, fname);
+		if (stat(path, &st))
+			continue;
+
+		if (S_ISDIR(st.st_mode)) {
+			if (!*prefix) {
+				snprintf(name, sizeof(name), "%s/", fname);
+				rc = catalog_scan_dir(m, stamp, path, name, NULL, NULL, NULL);
+			}
+			if (rc)
+				break;
+			continue;
+		}
+		if (!S_ISREG(st.st_mode))
+			continue;
+
+		kind = drpai_model_file_kind(fname);
+		if (kind == DRPAI_INDEX_WEIGHT)
+			m->weight_size += st.st_size;
+		if (required && kind >= 0)
+			required[kind] = true;
+		if (have_addrmap && kind == DRPAI_MODEL_FILE_ADDRMAP)
+			*have_addrmap = true;
+		if (have_param_info && kind == DRPAI_MODEL_FILE_PARAM_INFO)
+			*have_param_info = true;
+
+		catalog_stamp_file(stamp, name, &st);
+	}
+
+	for (i = 0; i < n; i++)
+		free(eps[i]);
+	free(eps);
+
+	return rc;
+}
+
+/* What the listing tells of the config */
+static void catalog_model_config(struct catalog_model *m, json_object *c)
+{
+	json_object *jpre, *jobj;
+	const char *type;
+
+	m->sequence = json_object_object_get(c, "sequence") != NULL;
+
+	type = json_object_get_string(json_object_object_get(c, "model_type"));
+	m->type = type ? strdup(type) : NULL;
+
+	/* the defaults of the pre-processing */
+	jpre = json_object_object_get(c, "preprocess");
+	m->preprocess = jpre != NULL;
+	m->input_width = drpai_config_get_int(jpre, "input_width", 640);
+	m->input_height = drpai_config_get_int(jpre, "input_height", 480);
+	m->model_in_w = drpai_config_get_int(c, "model_in_w", -1);
+	m->model_in_h = drpai_config_get_int(c, "model_in_h", -1);
+
+	jobj = json_object_object_get(c, "labels");
+	m->num_labels = json_object_is_type(jobj, json_type_array) ?
+			(int)json_object_array_length(jobj) : 0;
+}
+
+static bool catalog_has_required(const bool *required, bool have_addrmap)
+{
+	return required[DRPAI_INDEX_DRP_CFG] &&
+	       required[DRPAI_INDEX_AIMAC_DESC] &&
+	       required[DRPAI_INDEX_DRP_DESC] &&
+	       required[DRPAI_INDEX_DRP_PARAM] &&
+	       required[DRPAI_INDEX_WEIGHT] &&
+	       have_addrmap;
+}
+
+/**
+ * The package was checked when it was opened; the data of its sections
+ * is checked against their hashes by the hasher, and the package stops
+ * being valid if that fails.
+ */
+static int catalog_scan_package(struct catalog_model *m, const struct drpai_pkg *pkg,
+				struct sha256 *stamp)
+{
+	bool required[DRPAI_INDEX_NUM] = { false };
+	const struct drpai_pkg_section *s;
+	bool have_param_info = false;
+	char path[512];
+	struct stat st;
+	json_object *c;
+	int i, rc;
+
+	snprintf(path, sizeof(path), "%s/%s" DRPAI_PKG_SUFFIX, DRPAI_MODELS_ROOT_DIR, m->name);
+	if (stat(path, &st))
+		return -errno;
+	catalog_stamp_file(stamp, "", &st);
+
+	for (i = 0; i < pkg->num_sections; i++) {
+		s = &pkg->sections[i];
+		if (s->type == DRPAI_PKG_PARAM_INFO)
+			have_param_info = true;
+		if (s->type != DRPAI_PKG_REGION || s->index >= DRPAI_INDEX_NUM || !s->size)
+			continue;
+
+		required[s->index] = true;
+		if (s->index == DRPAI_INDEX_WEIGHT)
+			m->weight_size += s->size;
+	}
+
+	c = drpai_pkg_config(pkg, &rc);
+	if (rc && rc != -ENOENT)
+		return rc;
+
+	catalog_model_config(m, c);
+	json_object_put(c);
+
+	/* the address map is in the section table */
+	m->valid = !m->sequence && catalog_has_required(required, true) &&
+		   (!m->preprocess || have_param_info);
+
+	return 0;
+}
+
+static int catalog_scan_dir_model(struct catalog_model *m, struct sha256 *stamp,
+				  bool *config)
+{
+	bool required[DRPAI_INDEX_NUM] = { false };
+	bool have_addrmap = false, have_param_info = false;
+	char path[512];
+	struct stat st;
+	json_object *c;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", DRPAI_MODELS_ROOT_DIR, m->name);
+	if (stat(path, &st) || !S_ISDIR(st.st_mode))
+		return -ENOENT;
+
+	snprintf(path, sizeof(path), "%s/%s.json", DRPAI_MODELS_ROOT_DIR, m->name);
+	c = stat(path, &st) ? NULL : json_object_from_file(path);
+	*config = c != NULL;
+	if (c)
+		catalog_stamp_file(stamp, "", &st);
+
+	snprintf(path, sizeof(path), "%s/%s", DRPAI_MODELS_ROOT_DIR, m->name);
+	rc = catalog_scan_dir(m, stamp, path, "", required, &have_addrmap, &have_param_info);
+	if (!rc) {
+		catalog_model_config(m, c);
+		m->valid = m->sequence ||
+			   (catalog_has_required(required, have_addrmap) &&
+			    (!m->preprocess || have_param_info));
+	}
+
+	json_object_put(c);
+
+	return rc;
+}
+
+/**
+ * False if the model is gone. Its hash is kept if none of its files
+ * changed size or mtime, or else worked out again off the event loop.
+ */
+static bool catalog_scan_model(struct catalog_model *m)
+{
+	uint8_t stamp[SHA256_SIZE];
+	bool config = false;
+	struct drpai_pkg pkg;
+	struct sha256 s;
+	int rc;
+
+	m->stale = false;
+	m->valid = false;
+	m->sequence = false;
+	m->preprocess = false;
+	m->weight_size = 0;
+	free(m->type);
+	m->type = NULL;
+
+	sha256_init(&s);
+
+	/* a package goes before a directory, as when loading */
+	rc = drpai_pkg_open(&pkg, m->name);
+	m->package = !rc;
+	if (!rc) {
+		rc = catalog_scan_package(m, &pkg, &s);
+		drpai_pkg_close(&pkg);
+	} else if (rc == -ENOENT) {
+		rc = catalog_scan_dir_model(m, &s, &config);
+		if (rc == -ENOENT)
+			return false;
+	}
+
+	if (rc) {
+		lwsl_warn("%s: %s: %s\n", __func__, m->name, strerror(-rc));
+		return true;
+	}
+
+	/* the package or the config stands for an empty name, so they differ */
+	sha256_update(&s, m->package ? "p" : "d", 1);
+	sha256_final(&s, stamp);
+	if ((m->hashed || m->hashing) && !memcmp(stamp, m->stamp, sizeof(stamp))) {
+		if (m->hash_err)
+			m->valid = false;
+		return true;
+	}
+
+	memcpy(m->stamp, stamp, sizeof(m->stamp));
+	m->hashed = false;
+	m->hashing = false;
+	m->hash_err = 0;
+	m->hash[0] = '\0';
+	if (m->valid)
+		catalog_queue_hash(m, config);
+
+	return true;
+}
+
+/* 'name' without 'suffix'; false if it does not end with it */
+static bool catalog_strip(char name[NAME_MAX + 1], const char *fname, const char *suffix)
+{
+	size_t len = strlen(fname), slen = strlen(suffix);
+
+	if (len <= slen || len > NAME_MAX || strcmp(fname + len - slen, suffix))
+		return false;
+
+	memcpy(name, fname, len - slen);
+	name[len - slen] = '\0';
+
+	return true;
+}
+
+static int catalog_scan_root(void)
+{
+	struct catalog_model *m, *next;
+	struct dirent *ep;
+	DIR *dp;
+
+	dp = opendir(DRPAI_MODELS_ROOT_DIR);
+	if (!dp)
+		return -errno;
+
+	catalog_watch(DRPAI_MODELS_ROOT_DIR, NULL);
+
+	for (m = catalog.models; m; m = m->next)
+		m->seen = false;
+
+	while ((ep = readdir(dp))) {
+		char name[NAME_MAX + 1];
+
+		/* nor the staging of uploads */
+		if (ep->d_name[0] == '.')
+			continue;
+		if (ep->d_type != DT_DIR && !catalog_strip(name, ep->d_name, DRPAI_PKG_SUFFIX))
+			continue;
+
+		m = catalog_add(ep->d_type == DT_DIR ? ep->d_name : name);
+		if (!m)
+			continue;
+		m->seen = true;
+		/* without inotify, there is no telling what changed */
+		if (catalog.fd < 0)
+			m->stale = true;
+	}
+
+	closedir(dp);
+
+	for (m = catalog.models; m; m = next) {
+		next = m->next;
+		if (!m->seen)
+			catalog_remove(m->name);
+	}
+
+	catalog.rescan_root = false;
+
+	return 0;
+}
+
+static void catalog_handle_event(const struct inotify_event *ev)
+{
+	struct catalog_watch *w;
+	struct catalog_model *m;
+	char name[NAME_MAX + 1];
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		catalog.rescan_root = true;
+		for (m = catalog.models; m; m = m->next)
+			m->stale = true;
+		return;
+	}
+
+	w = catalog_find_watch(ev->wd);
+	if (!w)
+		return;
+
+	if (ev->mask & IN_IGNORED) {
+		if (!w->model)
+			catalog.rescan_root = true;
+		catalog_unwatch(ev->wd);
+		return;
+	}
+
+	/* in a model or stage directory */
+	if (w->model) {
+		m = catalog_find(w->model);
+		if (m)
+			m->stale = true;
+		return;
+	}
+
+	if (!ev->len || ev->name[0] == '.')
+		return;
+
+	/* a model directory, its config or a package; gone or not, a scan tells */
+	if (ev->mask & IN_ISDIR)
+		snprintf(name, sizeof(name), "%s", ev->name);
+	else if (!catalog_strip(name, ev->name, ".json") &&
+		 !catalog_strip(name, ev->name, DRPAI_PKG_SUFFIX))
+		return;
+
+	m = catalog_add(name);
+	if (m)
+		m->stale = true;
+}
+
+/* Takes in what inotify has to tell, without blocking */
+static void catalog_read_events(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		n = read(catalog.fd, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			catalog_handle_event(ev);
+		}
+	}
+}
+
+static int catalog_refresh(void)
+{
+	struct catalog_model *m, *next;
+	int rc = 0;
+
+	catalog_collect_hashes();
+
+	if (catalog.fd >= 0)
+		catalog_read_events();
+
+	if (catalog.rescan_root || catalog.fd < 0) {
+		rc = catalog_scan_root();
+		if (rc)
+			return rc;
+	}
+
+	for (m = catalog.models; m; m = next) {
+		next = m->next;
+		if (m->stale && !catalog_scan_model(m))
+			catalog_remove(m->name);
+	}
+
+	return 0;
+}
+
+int drpai_catalog_init(void)
+{
+	struct catalog_model *m;
+	int rc, n = 0;
+
+	/* one catalog for all vhosts */
+	if (catalog.fd >= 0)
+		return 0;
+
+	catalog.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (catalog.fd < 0)
+		lwsl_warn("%s: no inotify, the models are scanned every time: %s\n",
+			  __func__, strerror(errno));
+
+	catalog_hasher_start();
+
+	catalog.rescan_root = true;
+	rc = catalog_refresh();
+	if (rc) {
+		lwsl_warn("%s: could not open %s: %s\n", __func__,
+			  DRPAI_MODELS_ROOT_DIR, strerror(-rc));
+		return rc;
+	}
+
+	for (m = catalog.models; m; m = m->next)
+		n += m->valid;
+	lwsl_notice("%s: %d models in %s\n", __func__, n, DRPAI_MODELS_ROOT_DIR);
+
+	return 0;
+}
+
+void drpai_catalog_free(void)
+{
+	struct catalog_model *m;
+
+	catalog_hasher_stop();
+
+	while ((m = catalog.models)) {
+		catalog.models = m->next;
+		catalog_model_free(m);
+	}
+
+	while (catalog.num_watches)
+		catalog_unwatch(catalog.watches[0].wd);
+	free(catalog.watches);
+	catalog.watches = NULL;
+	catalog.max_watches = 0;
+
+	if (catalog.fd >= 0)
+		close(catalog.fd);
+	catalog.fd = -1;
+}
+
+static json_object *catalog_model_json(const struct catalog_model *m)
+{
+	json_object *e, *jobj;
+
+	e = json_object_new_object();
+	if (!e)
+		return NULL;
+
+	json_object_object_add(e, "name", json_object_new_string(m->name));
+	if (m->type)
+		json_object_object_add(e, "type", json_object_new_string(m->type));
+	json_object_object_add(e, "sequence", json_object_new_boolean(m->sequence));
+	json_object_object_add(e, "package", json_object_new_boolean(m->package));
+
+	jobj = json_object_new_object();
+	json_object_object_add(jobj, "width", json_object_new_int(m->input_width));
+	json_object_object_add(jobj, "height", json_object_new_int(m->input_height));
+	json_object_object_add(e, "input", jobj);
+
+	if (m->model_in_w > 0 && m->model_in_h > 0) {
+		jobj = json_object_new_object();
+		json_object_object_add(jobj, "width", json_object_new_int(m->model_in_w));
+		json_object_object_add(jobj, "height", json_object_new_int(m->model_in_h));
+		json_object_object_add(e, "model_in", jobj);
+	}
+
+	json_object_object_add(e, "labels", json_object_new_int(m->num_labels));
+	json_object_object_add(e, "weight_size", json_object_new_int64(m->weight_size));
+	/* null while being worked out */
+	json_object_object_add(e, "hash", m->hashed && !m->hash_err ?
+			       json_object_new_string(m->hash) : NULL);
+
+	return e;
+}
+
+int drpai_catalog_get(json_object *req)
+{
+	struct catalog_model *m;
+	json_object *val, *models, *entries;
+	const char *err;
+	int rc;
+
+	rc = catalog_refresh();
+	if (rc) {
+		err = "could not open: " DRPAI_MODELS_ROOT_DIR;
+		goto err;
+	}
+
+	val = json_object_new_object();
+	models = json_object_new_array();
+	entries = json_object_new_array();
+	if (!val || !models || !entries) {
+		json_object_put(val);
+		json_object_put(models);
+		json_object_put(entries);
+		err = "error allocating JSON object";
+		goto err;
+	}
+	json_object_object_add(val, "models", models);
+	json_object_object_add(val, "catalog", entries);
+
+	for (m = catalog.models; m; m = m->next) {
+		if (!m->valid)
+			continue;
+
+		json_object_array_add(models, json_object_new_string(m->name));
+		json_object_array_add(entries, catalog_model_json(m));
+	}
+
+	json_object_object_add(req, "value", val);
+
+	return 0;
+err:
+	json_object_object_add(req, "error", json_object_new_string(err));
+	lwsl_err("%s: %s\n", __func__, err);
+	return -1;
+}
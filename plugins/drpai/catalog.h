@@ -0,0 +1,28 @@
+#ifndef __DRPAI_CATALOG_H__
+#define __DRPAI_CATALOG_H__
+
+#include <json-c/json.h>
+
+/**
+ * The models of DRPAI_MODELS_ROOT_DIR, with their metadata, kept in
+ * memory: the directory is scanned once, and then only the models that
+ * inotify reports changes for are scanned again, when the catalog is
+ * next looked at. Without inotify, every look is a full scan.
+ */
+int drpai_catalog_init(void);
+void drpai_catalog_free(void);
+
+/**
+ * The "value" of a "drpai-models-get" reply: the usable "models", by
+ * name, and their "catalog" entries:
+ *   { "name", "type", "sequence", "package", "input": { "width", "height" },
+ *     "model_in": { "width", "height" } (if in the config),
+ *     "labels": <count>, "weight_size": <bytes>, "hash": <SHA-256> }
+ * The hash is of the model config and all files of the model directory;
+ * for a package, of its section table, once its sections are checked.
+ * It is worked out on a thread of its own, and null until then; it is
+ * kept as long as none of the files of the model change size or mtime.
+ */
+int drpai_catalog_get(json_object *req);
+
+#endif /* __DRPAI_CATALOG_H__ */
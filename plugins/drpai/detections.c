@@ -0,0 +1,119 @@
+
+#include "detections.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+int detections_reserve(struct detections *l, int num)
+{
+	struct nms_detection *d;
+
+	if (num <= l->max)
+		return 0;
+
+	num += 32;
+	d = realloc(l->d, num * sizeof(*d));
+	if (!d)
+		return -ENOMEM;
+	l->d = d;
+	l->max = num;
+
+	return 0;
+}
+
+void detections_free(struct detections *l)
+{
+	free(l->d);
+	memset(l, 0, sizeof(*l));
+}
+
+int detections_add(struct detections *l, const struct drpai_frame *frame,
+		   float center_x, float center_y, float box_w, float box_h,
+		   int pred_class, float probability)
+{
+	struct nms_detection *d;
+	int rc;
+
+	center_x = center_x * frame->width + frame->x;
+	center_y = center_y * frame->height + frame->y;
+	box_w = box_w * frame->width;
+	box_h = box_h * frame->height;
+	drpai_frame_map_box(frame, &center_x, &center_y, &box_w, &box_h);
+
+	center_x = round(center_x);
+	center_y = round(center_y);
+	box_w = round(box_w);
+	box_h = round(box_h);
+
+	rc = detections_reserve(l, l->num + 1);
+	if (rc)
+		return rc;
+	d = &l->d[l->num++];
+	d->pred_class = pred_class;
+	d->probability = probability * 100.0f;
+	d->box.w = box_w;
+	d->box.h = box_h;
+	d->box.x = (int)(center_x - (d->box.w / 2));
+	d->box.y = (int)(center_y - (d->box.h / 2));
+
+	return 0;
+}
+
+int detections_append(struct detections *l, const struct detections *src)
+{
+	int rc;
+
+	if (!src->num)
+		return 0;
+
+	rc = detections_reserve(l, l->num + src->num);
+	if (rc)
+		return rc;
+
+	memcpy(&l->d[l->num], src->d, src->num * sizeof(*src->d));
+	l->num += src->num;
+
+	return 0;
+}
+
+int detections_to_json(const struct detections *l, int num, char **labels,
+		       float min_probability, json_object *result)
+{
+	const struct nms_detection *d;
+	json_object *arr;
+	int i;
+
+	arr = json_object_new_array();
+	if (!arr)
+		return -errno;
+	json_object_object_add(result, "name", json_object_new_string("drpai-object-detection-result"));
+	json_object_object_add(result, "value", arr);
+
+	for (i = 0; i < num; i++) {
+		json_object *jobj, *jbox;
+		d = &l->d[i];
+		if (d->probability < min_probability)
+			continue;
+		jobj = json_object_new_object();
+		jbox = json_object_new_object();
+		if (!jobj || !jbox) {
+			json_object_put(jbox);
+			json_object_put(jobj);
+			return -errno;
+		}
+		json_object_object_add(jobj, "label", json_object_new_string(labels[d->pred_class]));
+		json_object_object_add(jobj, "box", jbox);
+		json_object_object_add(jbox, "x", json_object_new_int(d->box.x));
+		json_object_object_add(jbox, "y", json_object_new_int(d->box.y));
+		json_object_object_add(jbox, "w", json_object_new_int(d->box.w));
+		json_object_object_add(jbox, "h", json_object_new_int(d->box.h));
+
+		json_object_object_add(jobj, "probability", json_object_new_double(d->probability));
+
+		json_object_array_add(arr, jobj);
+	}
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __DRPAI_DETECTIONS_H__
+#define __DRPAI_DETECTIONS_H__
+
+#include <json-c/json.h>
+
+#include "models.h"
+#include "nms.h"
+
+/* Object detections of a frame; grown on demand and kept between frames */
+struct detections {
+	struct nms_detection *d;
+	int num;
+	int max;
+};
+
+int detections_reserve(struct detections *l, int num);
+void detections_free(struct detections *l);
+
+/**
+ * Add a detection; the box (center and size) is relative to the model
+ * input (0..1), and is mapped onto the camera frame here. The probability
+ * is 0..1, and stored in percent.
+ */
+int detections_add(struct detections *l, const struct drpai_frame *frame,
+		   float center_x, float center_y, float box_w, float box_h,
+		   int pred_class, float probability);
+
+/* Add all of 'src' at the end */
+int detections_append(struct detections *l, const struct detections *src);
+
+/**
+ * The first 'num' detections, as a "drpai-object-detection-result";
+ * those below 'min_probability' (in percent) are left out.
+ */
+int detections_to_json(const struct detections *l, int num, char **labels,
+		       float min_probability, json_object *result);
+
+#endif /* __DRPAI_DETECTIONS_H__ */
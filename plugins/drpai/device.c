@@ -0,0 +1,153 @@
+#define DRPAI_DEVICE_PRIVATE_DATA
+#include "device.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/* Environment variable selecting the backend; defaults to the kernel driver */
+#define DRPAI_DEVICE_ENV	"ETB_DRPAI_DEVICE"
+
+static const struct drpai_device_ops *drpai_device_backends[] = {
+	&drpai_device_kernel_ops,
+	&drpai_device_emul_ops,
+	NULL
+};
+
+static const struct drpai_device_ops *drpai_device_backend_get(void)
+{
+	const char *s = getenv(DRPAI_DEVICE_ENV);
+	int i;
+
+	if (!s || !*s)
+		return drpai_device_backends[0];
+
+	for (i = 0; drpai_device_backends[i]; i++) {
+		if (strcmp(s, drpai_device_backends[i]->name) == 0)
+			return drpai_device_backends[i];
+	}
+
+	return NULL;
+}
+
+int drpai_device_count(void)
+{
+	const struct drpai_device_ops *ops = drpai_device_backend_get();
+	int n;
+
+	if (!ops)
+		return 0;
+
+	n = ops->count();
+
+	return n > DRPAI_MAX_DEVICES ? DRPAI_MAX_DEVICES : n;
+}
+
+struct drpai_device *drpai_device_open(int index, int *err)
+{
+	const struct drpai_device_ops *ops;
+	struct drpai_device *dev;
+	int lerr;
+
+	ops = drpai_device_backend_get();
+	if (!ops) {
+		lwsl_err("%s: unknown DRP AI device backend '%s'\n", __func__,
+			 getenv(DRPAI_DEVICE_ENV));
+		lerr = -ENODEV;
+		goto err_store;
+	}
+
+	dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+
+	dev->ops = ops;
+	dev->index = index;
+
+	lerr = ops->open(dev);
+	if (lerr) {
+		free(dev);
+		goto err_store;
+	}
+
+	lwsl_info("%s: opened DRP AI device %d (%s)\n", __func__, index, ops->name);
+
+	return dev;
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void drpai_device_close(struct drpai_device *dev)
+{
+	if (!dev)
+		return;
+
+	dev->ops->close(dev);
+	free(dev);
+}
+
+int drpai_device_ioctl(struct drpai_device *dev, unsigned long req, void *arg)
+{
+	if (!dev)
+		return -EINVAL;
+
+	return dev->ops->ioctl(dev, req, arg);
+}
+
+ssize_t drpai_device_read(struct drpai_device *dev, void *buf, size_t len)
+{
+	if (!dev)
+		return -EINVAL;
+
+	return dev->ops->read(dev, buf, len);
+}
+
+ssize_t drpai_device_write(struct drpai_device *dev, const void *buf, size_t len)
+{
+	if (!dev)
+		return -EINVAL;
+
+	return dev->ops->write(dev, buf, len);
+}
+
+int drpai_device_dmabuf_info(struct drpai_device *dev, uint32_t *phys, uint32_t *size)
+{
+	if (!dev)
+		return -EINVAL;
+
+	return dev->ops->dmabuf_info(dev, phys, size);
+}
+
+void *drpai_device_dmabuf_map(struct drpai_device *dev, size_t len, size_t offs, int prot)
+{
+	if (!dev)
+		return NULL;
+
+	return dev->ops->dmabuf_map(dev, len, offs, prot);
+}
+
+void drpai_device_dmabuf_unmap(struct drpai_device *dev, void *addr, size_t len)
+{
+	if (!dev || !addr)
+		return;
+
+	dev->ops->dmabuf_unmap(dev, addr, len);
+}
+
+int drpai_device_dmabuf_sync(struct drpai_device *dev, size_t offs, size_t len, int dir)
+{
+	if (!dev)
+		return -EINVAL;
+
+	/* backends without a cache in the way */
+	if (!dev->ops->dmabuf_sync)
+		return 0;
+
+	return dev->ops->dmabuf_sync(dev, offs, len, dir);
+}
@@ -0,0 +1,61 @@
+#ifndef __DRPAI_DEVICE_H__
+#define __DRPAI_DEVICE_H__
+
+#include <stdint.h>
+#include <sys/types.h>
+
+struct drpai_device;
+
+/**
+ * A DRP AI device backend; either the kernel driver (+ u-dma-buf), or a
+ * userspace stand-in. All return 0 (or a byte count) on success and
+ * a negative errno value on failure.
+ */
+struct drpai_device_ops {
+	const char *name;
+	int (*count)(void);	/* number of device instances available */
+	int (*open)(struct drpai_device *dev);
+	void (*close)(struct drpai_device *dev);
+	int (*ioctl)(struct drpai_device *dev, unsigned long req, void *arg);
+	ssize_t (*read)(struct drpai_device *dev, void *buf, size_t len);
+	ssize_t (*write)(struct drpai_device *dev, const void *buf, size_t len);
+	/* physically contiguous buffer, shared with the DRP AI */
+	int (*dmabuf_info)(struct drpai_device *dev, uint32_t *phys, uint32_t *size);
+	void *(*dmabuf_map)(struct drpai_device *dev, size_t len, size_t offs, int prot);
+	void (*dmabuf_unmap)(struct drpai_device *dev, void *addr, size_t len);
+	/* cache maintenance of a cached mapping, around the DMA; optional */
+	int (*dmabuf_sync)(struct drpai_device *dev, size_t offs, size_t len, int dir);
+};
+
+struct drpai_device {
+	const struct drpai_device_ops *ops;
+	int index;
+	void *priv;
+};
+
+/* Directions of drpai_device_dmabuf_sync(), numbered as the DMA API does */
+#define DRPAI_DMABUF_TO_DEVICE		1	/* after the CPU wrote */
+#define DRPAI_DMABUF_FROM_DEVICE	2	/* before the CPU reads */
+
+/* Maximum number of DRP AI instances that are used */
+#define DRPAI_MAX_DEVICES	8
+
+int drpai_device_count(void);
+struct drpai_device *drpai_device_open(int index, int *err);
+void drpai_device_close(struct drpai_device *dev);
+
+int drpai_device_ioctl(struct drpai_device *dev, unsigned long req, void *arg);
+ssize_t drpai_device_read(struct drpai_device *dev, void *buf, size_t len);
+ssize_t drpai_device_write(struct drpai_device *dev, const void *buf, size_t len);
+
+int drpai_device_dmabuf_info(struct drpai_device *dev, uint32_t *phys, uint32_t *size);
+void *drpai_device_dmabuf_map(struct drpai_device *dev, size_t len, size_t offs, int prot);
+void drpai_device_dmabuf_unmap(struct drpai_device *dev, void *addr, size_t len);
+int drpai_device_dmabuf_sync(struct drpai_device *dev, size_t offs, size_t len, int dir);
+
+#ifdef DRPAI_DEVICE_PRIVATE_DATA
+extern const struct drpai_device_ops drpai_device_kernel_ops;
+extern const struct drpai_device_ops drpai_device_emul_ops;
+#endif
+
+#endif /* __DRPAI_DEVICE_H__ */
@@ -0,0 +1,435 @@
+#define DRPAI_DEVICE_PRIVATE_DATA
+#include "device.h"
+
+#include <linux/drpai.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Userspace stand-in for the DRP AI driver; used to run and profile the
+ * whole inference path on machines without the accelerator.
+ * It follows the ASSIGN/write/START/GET_STATUS/read flow of the driver,
+ * takes a configurable time per inference, and returns output tensors
+ * recorded from a real device. As the driver, it refuses the
+ * pre-processing ioctls until the DRP parameter info was written.
+ *
+ * Configured via environment variables:
+ *   ETB_DRPAI_EMUL_LATENCY_MS - time per inference (default 100)
+ *   ETB_DRPAI_EMUL_JITTER_MS  - random +/- variation of the above
+ *   ETB_DRPAI_EMUL_OUTPUT     - recorded output tensor file, or a directory
+ *                               of them (played back in name order)
+ *   ETB_DRPAI_EMUL_DEVICES    - number of emulated instances (default 1)
+ */
+
+#define EMUL_AREA_BASE		0x80000000
+#define EMUL_AREA_SIZE		0x20000000
+#define EMUL_DMABUF_BASE	0x58000000
+#define EMUL_DMABUF_SIZE	(16 * 1024 * 1024)
+
+struct emul_tensor {
+	uint8_t *data;
+	size_t size;
+};
+
+struct drpai_emul {
+	drpai_data_t assigned;
+	size_t cursor;
+	drpai_data_t output;
+	/* DRPAI_ASSIGN_PARAM: the info is written next */
+	drpai_data_t param;
+	uint32_t param_info_size;
+	bool param_pending;
+	bool param_ready;
+	bool running;
+	struct timespec done_at;
+	int latency_ms;
+	int jitter_ms;
+	struct emul_tensor *tensors;
+	int num_tensors;
+	int next_tensor;
+	const struct emul_tensor *cur_tensor;
+	uint8_t *dmabuf;
+	/* statistics, for the log when closing */
+	unsigned long runs;
+	unsigned long bytes_written;
+};
+
+static int emul_getenv_int(const char *name, int dflt)
+{
+	const char *s = getenv(name);
+	return (s && *s) ? atoi(s) : dflt;
+}
+
+static int emul_load_tensor(struct drpai_emul *e, const char *path)
+{
+	struct emul_tensor *t;
+	struct stat st;
+	void *tmp;
+	int fd, rc = 0;
+	ssize_t n;
+
+	if (stat(path, &st))
+		return -errno;
+
+	if (!S_ISREG(st.st_mode) || st.st_size == 0)
+		return 0;
+
+	tmp = realloc(e->tensors, (e->num_tensors + 1) * sizeof(*e->tensors));
+	if (!tmp)
+		return -ENOMEM;
+	e->tensors = tmp;
+	t = &e->tensors[e->num_tensors];
+
+	t->size = st.st_size;
+	t->data = malloc(t->size);
+	if (!t->data)
+		return -ENOMEM;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		rc = -errno;
+		goto err_free;
+	}
+
+	n = read(fd, t->data, t->size);
+	close(fd);
+	if (n != (ssize_t)t->size) {
+		rc = -EIO;
+		goto err_free;
+	}
+
+	e->num_tensors++;
+
+	return 0;
+err_free:
+	free(t->data);
+	return rc;
+}
+
+static int emul_load_tensors(struct drpai_emul *e, const char *path)
+{
+	struct dirent **names;
+	char fname[768];
+	struct stat st;
+	int i, n, rc = 0;
+
+	if (stat(path, &st))
+		return -errno;
+
+	if (!S_ISDIR(st.st_mode))
+		return emul_load_tensor(e, path);
+
+	n = scandir(path, &names, NULL, alphasort);
+	if (n < 0)
+		return -errno;
+
+	for (i = 0; i < n; i++) {
+		if (rc == 0 && names[i]->d_name[0] != '.') {
+			snprintf(fname, sizeof(fname), "%s/%s", path, names[i]->d_name);
+			rc = emul_load_tensor(e, fname);
+		}
+		free(names[i]);
+	}
+	free(names);
+
+	return rc;
+}
+
+static int drpai_emul_count(void)
+{
+	return emul_getenv_int("ETB_DRPAI_EMUL_DEVICES", 1);
+}
+
+static int drpai_emul_open(struct drpai_device *dev)
+{
+	struct drpai_emul *e;
+	const char *s;
+	int rc;
+
+	e = calloc(1, sizeof(*e));
+	if (!e)
+		return -ENOMEM;
+
+	e->latency_ms = emul_getenv_int("ETB_DRPAI_EMUL_LATENCY_MS", 100);
+	e->jitter_ms = emul_getenv_int("ETB_DRPAI_EMUL_JITTER_MS", 0);
+	if (e->latency_ms < 0 || e->jitter_ms < 0 || e->jitter_ms > e->latency_ms) {
+		rc = -EINVAL;
+		goto err_free;
+	}
+
+	s = getenv("ETB_DRPAI_EMUL_OUTPUT");
+	if (s && *s) {
+		rc = emul_load_tensors(e, s);
+		if (rc) {
+			lwsl_err("%s: could not load recorded outputs from '%s': %s\n",
+				 __func__, s, strerror(-rc));
+			goto err_free;
+		}
+	}
+
+	e->dmabuf = calloc(1, EMUL_DMABUF_SIZE);
+	if (!e->dmabuf) {
+		rc = -ENOMEM;
+		goto err_free;
+	}
+
+	lwsl_notice("%s: emulated DRP AI %d: %d ms (+/- %d ms) per run, %d recorded output(s)\n",
+		    __func__, dev->index, e->latency_ms, e->jitter_ms, e->num_tensors);
+
+	dev->priv = e;
+
+	return 0;
+err_free:
+	while (e->num_tensors--)
+		free(e->tensors[e->num_tensors].data);
+	free(e->tensors);
+	free(e);
+	return rc;
+}
+
+static void drpai_emul_close(struct drpai_device *dev)
+{
+	struct drpai_emul *e = dev->priv;
+	int i;
+
+	lwsl_info("%s: emulated DRP AI %d: %lu runs, %lu bytes written\n",
+		  __func__, dev->index, e->runs, e->bytes_written);
+
+	for (i = 0; i < e->num_tensors; i++)
+		free(e->tensors[i].data);
+	free(e->tensors);
+	free(e->dmabuf);
+	free(e);
+}
+
+static bool emul_is_running(struct drpai_emul *e)
+{
+	struct timespec now;
+
+	if (!e->running)
+		return false;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec > e->done_at.tv_sec ||
+	    (now.tv_sec == e->done_at.tv_sec && now.tv_nsec >= e->done_at.tv_nsec))
+		e->running = false;
+
+	return e->running;
+}
+
+static int emul_start(struct drpai_emul *e, const drpai_data_t *data)
+{
+	int ms = e->latency_ms;
+
+	if (emul_is_running(e))
+		return -EBUSY;
+
+	if (e->jitter_ms)
+		ms += (rand() % (2 * e->jitter_ms + 1)) - e->jitter_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &e->done_at);
+	e->done_at.tv_sec += ms / 1000;
+	e->done_at.tv_nsec += (ms % 1000) * 1000000L;
+	if (e->done_at.tv_nsec >= 1000000000L) {
+		e->done_at.tv_sec++;
+		e->done_at.tv_nsec -= 1000000000L;
+	}
+
+	e->output = data[DRPAI_INDEX_OUTPUT];
+	e->cur_tensor = NULL;
+	if (e->num_tensors) {
+		e->cur_tensor = &e->tensors[e->next_tensor];
+		e->next_tensor = (e->next_tensor + 1) % e->num_tensors;
+	}
+	e->running = true;
+	e->runs++;
+
+	return 0;
+}
+
+/* The parameters are not patched, but they must be known to the driver */
+static int emul_prepost(struct drpai_emul *e, const drpai_data_t *obj)
+{
+	if (emul_is_running(e))
+		return -EBUSY;
+
+	if (!e->param_ready || obj->address != e->param.address ||
+	    obj->size != e->param.size)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int drpai_emul_ioctl(struct drpai_device *dev, unsigned long req, void *arg)
+{
+	struct drpai_emul *e = dev->priv;
+	drpai_data_dynamic_t *dyn;
+	drpai_assign_param_t *param;
+	drpai_status_t *status;
+	drpai_crop_t *crop;
+	drpai_inout_t *inout;
+	drpai_data_t *data;
+
+	switch (req) {
+	case DRPAI_ASSIGN:
+		e->assigned = *(drpai_data_t *)arg;
+		e->cursor = 0;
+		e->param_pending = false;
+		return 0;
+	case DRPAI_START:
+		return emul_start(e, arg);
+	case DRPAI_RESET:
+		e->running = false;
+		return 0;
+	case DRPAI_GET_STATUS:
+		status = arg;
+		memset(status, 0, sizeof(*status));
+		if (emul_is_running(e)) {
+			status->status = DRPAI_STATUS_RUN;
+			return -EBUSY;
+		}
+		status->status = DRPAI_STATUS_IDLE;
+		return 0;
+	case DRPAI_GET_DRPAI_AREA:
+		data = arg;
+		data->address = EMUL_AREA_BASE;
+		data->size = EMUL_AREA_SIZE;
+		return 0;
+	case DRPAI_ASSIGN_DYNAMIC:
+		/* no relocation to do, the files are not looked at */
+		dyn = arg;
+		e->assigned.address = dyn->start_address;
+		e->assigned.size = dyn->size;
+		e->cursor = 0;
+		e->param_pending = false;
+		return 0;
+	case DRPAI_ASSIGN_PARAM:
+		param = arg;
+		if (!param->info_size || !param->obj.size)
+			return -EINVAL;
+		e->param = param->obj;
+		e->param_info_size = param->info_size;
+		e->cursor = 0;
+		e->param_pending = true;
+		e->param_ready = false;
+		return 0;
+	case DRPAI_PREPOST_CROP:
+		crop = arg;
+		return emul_prepost(e, &crop->obj);
+	case DRPAI_PREPOST_INADDR:
+		inout = arg;
+		return emul_prepost(e, &inout->obj);
+	case DRPAI_SET_SEQ:
+		/* only patches memory we do not emulate */
+		return emul_is_running(e) ? -EBUSY : 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+static ssize_t drpai_emul_read(struct drpai_device *dev, void *buf, size_t len)
+{
+	struct drpai_emul *e = dev->priv;
+	const struct emul_tensor *t = e->cur_tensor;
+	size_t n, avail;
+
+	if (e->cursor >= e->assigned.size)
+		return 0;
+
+	n = e->assigned.size - e->cursor;
+	if (n > len)
+		n = len;
+
+	/* only the output region holds anything meaningful */
+	avail = 0;
+	if (t && e->assigned.address == e->output.address && e->cursor < t->size) {
+		avail = t->size - e->cursor;
+		if (avail > n)
+			avail = n;
+		memcpy(buf, t->data + e->cursor, avail);
+	}
+	memset((uint8_t *)buf + avail, 0, n - avail);
+
+	e->cursor += n;
+
+	return n;
+}
+
+static ssize_t drpai_emul_write(struct drpai_device *dev, const void *buf, size_t len)
+{
+	struct drpai_emul *e = dev->priv;
+	size_t n;
+
+	if (e->param_pending) {
+		n = e->param_info_size - e->cursor;
+		if (n > len)
+			n = len;
+
+		e->cursor += n;
+		if (e->cursor == e->param_info_size) {
+			e->param_pending = false;
+			e->param_ready = true;
+		}
+
+		return n;
+	}
+
+	if (e->cursor >= e->assigned.size)
+		return -ENOSPC;
+
+	n = e->assigned.size - e->cursor;
+	if (n > len)
+		n = len;
+
+	e->cursor += n;
+	e->bytes_written += n;
+
+	return n;
+}
+
+static int drpai_emul_dmabuf_info(struct drpai_device *dev, uint32_t *phys, uint32_t *size)
+{
+	*phys = EMUL_DMABUF_BASE;
+	*size = EMUL_DMABUF_SIZE;
+
+	return 0;
+}
+
+static void *drpai_emul_dmabuf_map(struct drpai_device *dev, size_t len, size_t offs, int prot)
+{
+	struct drpai_emul *e = dev->priv;
+
+	if (offs + len > EMUL_DMABUF_SIZE)
+		return NULL;
+
+	return e->dmabuf + offs;
+}
+
+static void drpai_emul_dmabuf_unmap(struct drpai_device *dev, void *addr, size_t len)
+{
+}
+
+const struct drpai_device_ops drpai_device_emul_ops = {
+	.name = "emul",
+	.count = drpai_emul_count,
+	.open = drpai_emul_open,
+	.close = drpai_emul_close,
+	.ioctl = drpai_emul_ioctl,
+	.read = drpai_emul_read,
+	.write = drpai_emul_write,
+	.dmabuf_info = drpai_emul_dmabuf_info,
+	.dmabuf_map = drpai_emul_dmabuf_map,
+	.dmabuf_unmap = drpai_emul_dmabuf_unmap,
+};
@@ -0,0 +1,240 @@
+#define DRPAI_DEVICE_PRIVATE_DATA
+#include "device.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+/**
+ * Kernel DRP AI driver, plus the u-dma-buf driver found here:
+ *    https://github.com/ikwzm/udmabuf
+ * for a physically contiguous buffer, shared with the DRP AI.
+ * The u-dma-buf instance index matches the DRP AI device index;
+ * DRP AI devices without a matching u-dma-buf are not used.
+ */
+/* The u-dma-buf sysfs attributes for the cache maintenance */
+enum {
+	SYNC_OFFSET,
+	SYNC_SIZE,
+	SYNC_DIRECTION,
+	SYNC_FOR_CPU,
+	SYNC_FOR_DEVICE,
+	SYNC_NUM
+};
+
+static const char *const drpai_sync_attrs[SYNC_NUM] = {
+	[SYNC_OFFSET] = "sync_offset",
+	[SYNC_SIZE] = "sync_size",
+	[SYNC_DIRECTION] = "sync_direction",
+	[SYNC_FOR_CPU] = "sync_for_cpu",
+	[SYNC_FOR_DEVICE] = "sync_for_device",
+};
+
+/**
+ * The buffer is mapped cached (no O_SYNC, which would make the decoders
+ * read the output uncached), so the CPU cache is synced with the memory
+ * the DRP AI accessed around each run, through the sysfs attributes.
+ */
+struct drpai_kernel {
+	int fd;
+	int dmabuf_fd;
+	int sync_fd[SYNC_NUM];	/* -1 if not there */
+};
+
+static int drpai_sysfs_read_ul(const char *path, int base, unsigned long *val)
+{
+	char buf[32];
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	rc = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (rc < 0)
+		return -errno;
+	buf[rc] = '\0';
+
+	*val = strtoul(buf, NULL, base);
+
+	return 0;
+}
+
+static int drpai_sysfs_write_ul(int fd, unsigned long val)
+{
+	char buf[32];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%lu", val);
+	if (pwrite(fd, buf, len, 0) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static int drpai_kernel_count(void)
+{
+	char path[96];
+	int i;
+
+	for (i = 0; ; i++) {
+		snprintf(path, sizeof(path), "/dev/drpai%d", i);
+		if (access(path, F_OK))
+			break;
+
+		snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d", i);
+		if (access(path, F_OK))
+			break;
+	}
+
+	return i;
+}
+
+static int drpai_kernel_open(struct drpai_device *dev)
+{
+	struct drpai_kernel *k;
+	char path[96];
+	int i, rc;
+
+	k = calloc(1, sizeof(*k));
+	if (!k)
+		return -ENOMEM;
+
+	snprintf(path, sizeof(path), "/dev/drpai%d", dev->index);
+	k->fd = open(path, O_RDWR);
+	if (k->fd < 0) {
+		rc = -errno;
+		goto err_free;
+	}
+
+	snprintf(path, sizeof(path), "/dev/udmabuf%d", dev->index);
+	k->dmabuf_fd = open(path, O_RDWR);
+	if (k->dmabuf_fd < 0) {
+		rc = -errno;
+		goto err_close;
+	}
+
+	for (i = 0; i < SYNC_NUM; i++) {
+		snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d/%s",
+			 dev->index, drpai_sync_attrs[i]);
+		k->sync_fd[i] = open(path, O_WRONLY);
+	}
+
+	dev->priv = k;
+
+	return 0;
+err_close:
+	close(k->fd);
+err_free:
+	free(k);
+	return rc;
+}
+
+static void drpai_kernel_close(struct drpai_device *dev)
+{
+	struct drpai_kernel *k = dev->priv;
+	int i;
+
+	for (i = 0; i < SYNC_NUM; i++) {
+		if (k->sync_fd[i] >= 0)
+			close(k->sync_fd[i]);
+	}
+	close(k->dmabuf_fd);
+	close(k->fd);
+	free(k);
+}
+
+static int drpai_kernel_ioctl(struct drpai_device *dev, unsigned long req, void *arg)
+{
+	struct drpai_kernel *k = dev->priv;
+
+	return ioctl(k->fd, req, arg) ? -errno : 0;
+}
+
+static ssize_t drpai_kernel_read(struct drpai_device *dev, void *buf, size_t len)
+{
+	struct drpai_kernel *k = dev->priv;
+	ssize_t rc = read(k->fd, buf, len);
+
+	return rc < 0 ? -errno : rc;
+}
+
+static ssize_t drpai_kernel_write(struct drpai_device *dev, const void *buf, size_t len)
+{
+	struct drpai_kernel *k = dev->priv;
+	ssize_t rc = write(k->fd, buf, len);
+
+	return rc < 0 ? -errno : rc;
+}
+
+static int drpai_kernel_dmabuf_info(struct drpai_device *dev, uint32_t *phys, uint32_t *size)
+{
+	unsigned long val;
+	char path[96];
+	int rc;
+
+	snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d/phys_addr", dev->index);
+	rc = drpai_sysfs_read_ul(path, 16, &val);
+	if (rc)
+		return rc;
+	*phys = val & 0xffffffff;
+
+	/* The size is optional; 0 if unknown */
+	snprintf(path, sizeof(path), "/sys/class/u-dma-buf/udmabuf%d/size", dev->index);
+	*size = drpai_sysfs_read_ul(path, 10, &val) ? 0 : val;
+
+	return 0;
+}
+
+static void *drpai_kernel_dmabuf_map(struct drpai_device *dev, size_t len, size_t offs, int prot)
+{
+	struct drpai_kernel *k = dev->priv;
+	void *p = mmap(NULL, len, prot, MAP_SHARED, k->dmabuf_fd, offs);
+
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static void drpai_kernel_dmabuf_unmap(struct drpai_device *dev, void *addr, size_t len)
+{
+	munmap(addr, len);
+}
+
+static int drpai_kernel_dmabuf_sync(struct drpai_device *dev, size_t offs, size_t len, int dir)
+{
+	struct drpai_kernel *k = dev->priv;
+	int i, rc;
+
+	for (i = 0; i < SYNC_NUM; i++) {
+		if (k->sync_fd[i] < 0)
+			return -EOPNOTSUPP;
+	}
+
+	if ((rc = drpai_sysfs_write_ul(k->sync_fd[SYNC_OFFSET], offs)) ||
+	    (rc = drpai_sysfs_write_ul(k->sync_fd[SYNC_SIZE], len)) ||
+	    (rc = drpai_sysfs_write_ul(k->sync_fd[SYNC_DIRECTION], dir)))
+		return rc;
+
+	return drpai_sysfs_write_ul(dir == DRPAI_DMABUF_FROM_DEVICE ?
+				    k->sync_fd[SYNC_FOR_CPU] :
+				    k->sync_fd[SYNC_FOR_DEVICE], 1);
+}
+
+const struct drpai_device_ops drpai_device_kernel_ops = {
+	.name = "kernel",
+	.count = drpai_kernel_count,
+	.open = drpai_kernel_open,
+	.close = drpai_kernel_close,
+	.ioctl = drpai_kernel_ioctl,
+	.read = drpai_kernel_read,
+	.write = drpai_kernel_write,
+	.dmabuf_info = drpai_kernel_dmabuf_info,
+	.dmabuf_map = drpai_kernel_dmabuf_map,
+	.dmabuf_unmap = drpai_kernel_dmabuf_unmap,
+	.dmabuf_sync = drpai_kernel_dmabuf_sync,
+};
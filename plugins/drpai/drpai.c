@@ -1,7 +1,6 @@
 
 #include <linux/drpai.h>
 #include <sys/stat.h>
-#include <sys/ioctl.h>
 #include <libwebsockets.h>
 
 #include <stdio.h>
@@ -12,11 +11,22 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <stdbool.h>
+#include <time.h>
+#include <math.h>
 
 #include <sys/mman.h>
 
 #include "drpai.h"
+#include "device.h"
+#include "image.h"
 #include "models.h"
+#include "pkg.h"
+#include "plugins.h"
+#include "roi.h"
+#include "sched.h"
+#include "workers.h"
+#include "../../metrics.h"
+#include "../../monotonic.h"
 
 #define min(a, b) ((a) > (b) ? (b) : (a))
 
@@ -25,37 +35,146 @@
 #endif
 
 #define ADDRMAP_INTM_TXT_FILTER	"addrmap_intm.txt"
+/* Table of the DRP parameters, for the pre-processing ioctls */
+#define DRP_PARAM_INFO_FNAME	"drp_param_info.txt"
+
+#define DRPAI_OUTPUT_ALIGN	64
+/* Alignment of the second model of a cascade in DRP AI memory */
+#define DRPAI_CASCADE_ALIGN	0x100000
+/* Alignment of the tile inputs in the u-dma-buf */
+#define DRPAI_TILE_ALIGN	0x1000
 
 struct drpai_param_map {
 	const char *key;   /* key in the ADDRMAP_INTM_TXT file*/
 	int idx;           /* DRPAPI_INDEX_ in the kernel driver */
 	const char *fname_filter; /* filename filter the file that needs to be loaded for this DRPAPI_INDEX_ */
+	uint32_t file_type; /* DRPAI_FILE_TYPE_ for DRPAI_ASSIGN_DYNAMIC */
+};
+
+/* Pre-processing done by the DRP, as described in the model config */
+struct drpai_preproc {
+	bool crop_enabled;
+	bool inaddr_enabled;
+	bool dirty;		/* needs to be re-programmed before start */
+	drpai_crop_t crop;
+	drpai_inout_t inaddr;
+	uint32_t inaddr_base;	/* configured input address */
+	int in_width;		/* size of the image given to the DRP */
+	int in_height;
+	enum image_format in_format;
+};
+
+struct drpai;
+
+/**
+ * A second model (e.g. a classifier) that is run on each object the first
+ * one found. It shares the device and the input image in the u-dma-buf,
+ * lives after the first model in DRP AI memory, and gets each object out
+ * of the image with the DRP pre-processing crop; so no image data is
+ * copied per object.
+ */
+struct drpai_cascade {
+	struct drpai *second;
+	char **labels;		/* only objects with these labels, if any */
+	int num_labels;
+	int max_objects;
+	int min_size;
+	/* the frame in progress */
+	bool pending;
+	json_object *objects;
+	int next;		/* next object to look at */
+	int current;		/* object the second model runs on */
+	int runs;
+	uint64_t detect_us;
+	uint64_t decode_us;
+	uint64_t second_us;
+	uint64_t second_decode_us;
+};
+
+/**
+ * A frame split into tiles; all tiles are resized into their own slot of
+ * the u-dma-buf when the frame is loaded, and then run one after the
+ * other, only moving the input address.
+ */
+struct drpai_tiling {
+	struct drpai_tiles cfg;
+	struct image_letterbox *letterbox;
+	size_t slot_len;
+	int num;		/* 0 if the frame is not tiled */
+	struct drpai_frame tile[DRPAI_MAX_TILES];
+	/* the frame in progress */
+	bool pending;
+	int current;
+	json_object *objects;	/* detections of the tiles done so far */
+	uint64_t start_us;
 };
 
 struct drpai {
 	drpai_data_t input_data[DRPAI_INDEX_NUM];
 	drpai_data_t base;
-	int fd;
+	struct drpai_device *dev;
 	struct {
 		const struct drpai_model_ops *ops;
 		void *priv;
 	} model;
+	struct drpai_preproc preproc;
+	int num_stages;		/* > 0 if a sequence was programmed */
+	bool is_cascade;	/* the second model of a cascade */
+	struct drpai_cascade *cascade;
+	struct drpai_tiles tiles;	/* of the model config; cols = 0 if none */
+	struct drpai_tiling tiling;
+	uint64_t start_us;	/* when the last run was started */
+	uint64_t read_us;	/* reading outputs, in the last get_result() */
 	struct {
-		int fd;
 		uint32_t base;
+		uint32_t size;
 		uint32_t input;
 		void *usrptr;
+		size_t usrptr_len;
 	} udmabuf;
+	/* Letterbox of the camera frame into the model input, and where
+	 * the last loaded frame was placed.
+	 */
+	struct image_letterbox *letterbox;
+	struct drpai_frame input_frame;
+	struct drpai_roi *roi;	/* of the last loaded frame */
+	/* Persistent buffer for the output tensor; either allocated once
+	 * per model load, or a direct mapping of the u-dma-buf region
+	 * when the output address falls inside it.
+	 */
+	struct {
+		void *buf;	/* start of the output tensor */
+		void *map;	/* page-aligned mapping, if 'mapped' */
+		size_t map_len;
+		size_t offs;	/* in the u-dma-buf, if 'mapped' */
+		size_t size;
+		bool mapped;
+	} output;
+	/* format of the output tensor, from the model config */
+	struct drpai_tensor output_format;
+	/* Post-processing on the worker pool, while the event loop goes on;
+	 * 'out' and 'frame' are what it works from.
+	 */
+	struct {
+		bool pending;		/* started, and not collected yet */
+		bool done;		/* set from the pool */
+		int err;
+		struct drpai_tensor out;
+		struct drpai_frame frame;
+		uint64_t start_us;	/* of reading the output */
+	} decode;
+	void (*notify)(void *arg);	/* that a decode is done; NULL to not decode on the pool */
+	void *notify_arg;
 };
 
 static const struct drpai_param_map drpai_param_map[] = {
-	{ "drp_config", DRPAI_INDEX_DRP_CFG,    "drpcfg.mem" },
-	{ "desc_aimac", DRPAI_INDEX_AIMAC_DESC, "aimac_desc.bin" },
-	{ "desc_drp",   DRPAI_INDEX_DRP_DESC,   "drp_desc.bin" },
-	{ "drp_param",  DRPAI_INDEX_DRP_PARAM,  "drp_param.bin" },
-	{ "weight",     DRPAI_INDEX_WEIGHT,     "weight.dat" },
-	{ "data_in",    DRPAI_INDEX_INPUT,      NULL },
-	{ "data_out",   DRPAI_INDEX_OUTPUT,     NULL },
+	{ "drp_config", DRPAI_INDEX_DRP_CFG,    "drpcfg.mem",     DRPAI_FILE_TYPE_DRP_CFG },
+	{ "desc_aimac", DRPAI_INDEX_AIMAC_DESC, "aimac_desc.bin", DRPAI_FILE_TYPE_AIMAC_DESC },
+	{ "desc_drp",   DRPAI_INDEX_DRP_DESC,   "drp_desc.bin",   DRPAI_FILE_TYPE_DRP_DESC },
+	{ "drp_param",  DRPAI_INDEX_DRP_PARAM,  "drp_param.bin",  DRPAI_FILE_TYPE_DRP_PARAM },
+	{ "weight",     DRPAI_INDEX_WEIGHT,     "weight.dat",     DRPAI_FILE_TYPE_WEIGHT },
+	{ "data_in",    DRPAI_INDEX_INPUT,      NULL,             0 },
+	{ "data_out",   DRPAI_INDEX_OUTPUT,     NULL,             0 },
 	{ }
 };
 
@@ -71,17 +190,80 @@ static int drpai_assign(struct drpai *d, const drpai_data_t* data)
 	if (!d)
 		return -EINVAL;
 
-	rc = ioctl(d->fd, DRPAI_ASSIGN, data);
-	return rc ? -errno : 0;
+	rc = drpai_device_ioctl(d->dev, DRPAI_ASSIGN, (void *)data);
+	return rc;
+}
+
+static void drpai_output_release(struct drpai *d)
+{
+	if (d->output.mapped)
+		drpai_device_dmabuf_unmap(d->dev, d->output.map, d->output.map_len);
+	else
+		free(d->output.buf);
+
+	memset(&d->output, 0, sizeof(d->output));
+}
+
+/**
+ * Set up the buffer where the output tensor is read into.
+ * This is done once per model load, so that retrieving a result does not
+ * need any allocation. If the output region lives inside the u-dma-buf
+ * region, it is mapped directly and no read() is needed, only a sync
+ * of the CPU cache.
+ */
+static int drpai_output_prepare(struct drpai *d)
+{
+	const drpai_data_t *addr = &d->input_data[DRPAI_INDEX_OUTPUT];
+	size_t page_size, offs, delta;
+	void *map;
+	int rc;
+
+	drpai_output_release(d);
+
+	if (!addr->size)
+		return -EINVAL;
+
+	d->output.size = addr->size;
+
+	if (d->udmabuf.size &&
+	    addr->address >= d->udmabuf.base &&
+	    (uint64_t)addr->address + addr->size <=
+	    (uint64_t)d->udmabuf.base + d->udmabuf.size) {
+		page_size = sysconf(_SC_PAGESIZE);
+		offs = addr->address - d->udmabuf.base;
+		delta = offs % page_size;
+
+		/* the mapping is cached: only usable if it can be synced */
+		rc = drpai_device_dmabuf_sync(d->dev, offs, addr->size,
+					      DRPAI_DMABUF_FROM_DEVICE);
+		map = rc ? NULL : drpai_device_dmabuf_map(d->dev, addr->size + delta,
+							   offs - delta, PROT_READ);
+		if (map) {
+			d->output.map = map;
+			d->output.map_len = addr->size + delta;
+			d->output.offs = offs;
+			d->output.buf = (uint8_t *)map + delta;
+			d->output.mapped = true;
+			return 0;
+		}
+		lwsl_warn("%s: could not map output region, falling back to read(): %s\n",
+			  __func__, strerror(rc ? -rc : errno));
+	}
+
+	if (posix_memalign(&d->output.buf, DRPAI_OUTPUT_ALIGN, addr->size)) {
+		d->output.buf = NULL;
+		return -ENOMEM;
+	}
+
+	return 0;
 }
 
-static int drpai_read_addrmap_intm_txt(struct drpai *d, const char *dir, const char *fname)
+static int drpai_read_addrmap_intm_txt(const char *dir, const char *fname,
+				       drpai_data_t *addrs)
 {
-	drpai_data_t *addrs = d->input_data;
 	char full_path[768];
 	char *line = NULL;
 	size_t len = 0;
-	uint32_t base;
 	FILE *fp;
 	int i;
 
@@ -91,6 +273,8 @@ static int drpai_read_addrmap_intm_txt(struct drpai *d, const char *dir, const c
 	if (!fp)
 		return -errno;
 
+	memset(addrs, 0, DRPAI_INDEX_NUM * sizeof(*addrs));
+
 	while (getline(&line, &len, fp) != -1) {
 		const char *tok, *skey = NULL, *saddr = NULL, *ssize = NULL;
 		char *rest = line;
@@ -123,22 +307,49 @@ static int drpai_read_addrmap_intm_txt(struct drpai *d, const char *dir, const c
 	fclose(fp);
 	free(line);
 
-	/* A bit of magic to support DRP AI v1 absolute addresses,
-	 * and v2 relative addresses; if the 'data_in' address is non-zero,
-	 * we take that as the base offset, we subtract it, and add the
-	 * base address which the driver gave us.
-	 * This works with v2 (only).
-	 */
-	base = addrs[DRPAI_INDEX_INPUT].address;
+	return 0;
+}
+
+/* Find and parse the address map file in 'dir' */
+static int drpai_read_addrmap(const char *dir, drpai_data_t *addrs)
+{
+	struct dirent *ep;
+	int rc = -ENOENT;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (!dp)
+		return -errno;
+
+	while ((ep = readdir(dp))) {
+		if (!str_endswith(ep->d_name, ADDRMAP_INTM_TXT_FILTER))
+			continue;
+
+		rc = drpai_read_addrmap_intm_txt(dir, ep->d_name, addrs);
+		break;
+	}
+
+	closedir(dp);
+	return rc;
+}
+
+/* A bit of magic to support DRP AI v1 absolute addresses,
+ * and v2 relative addresses; if the 'data_in' address is non-zero,
+ * we take that as the base offset, we subtract it, and add the
+ * base address which the driver gave us.
+ * This works with v2 (only).
+ */
+static void drpai_relocate(struct drpai *d, drpai_data_t *addrs, uint32_t base)
+{
+	int i;
+
 	for (i = 0; i < DRPAI_INDEX_NUM; i++) {
 		addrs[i].address -= base;
 		addrs[i].address += d->base.address;
 	}
-
-	return 0;
 }
 
-static int drpai_find_index(const char *name)
+static const struct drpai_param_map *drpai_find_param(const char *name)
 {
 	int i;
 
@@ -148,27 +359,38 @@ static int drpai_find_index(const char *name)
 			continue;
 
 		if (str_endswith(name, flt))
-			return drpai_param_map[i].idx;
+			return &drpai_param_map[i];
 	}
 
-	return -1;
+	return NULL;
 }
 
-static int drpai_load_file_to_mem(struct drpai *d, const char *model,
-				  const char *fname, int idx)
+static int drpai_find_index(const char *name)
+{
+	const struct drpai_param_map *pm = drpai_find_param(name);
+
+	return pm ? pm->idx : -1;
+}
+
+int drpai_model_file_kind(const char *name)
+{
+	if (str_endswith(name, ADDRMAP_INTM_TXT_FILTER))
+		return DRPAI_MODEL_FILE_ADDRMAP;
+	if (!strcmp(name, DRP_PARAM_INFO_FNAME))
+		return DRPAI_MODEL_FILE_PARAM_INFO;
+
+	return drpai_find_index(name);
+}
+
+/* Write a file into the region that was last assigned */
+static int drpai_write_file(struct drpai *d, const char *path, uint32_t size)
 {
-	const drpai_data_t* addr = &d->input_data[idx];
 	char buf[1024];
 	struct stat st;
 	size_t left_to_read;
 	int fd, rc;
 
-	rc = drpai_assign(d, addr);
-	if (rc)
-		return rc;
-
-	snprintf(buf, sizeof(buf), "%s/%s/%s", DRPAI_MODELS_ROOT_DIR, model, fname);
-	if (stat(buf, &st))
+	if (stat(path, &st))
 		return -errno;
 
 	/* We have a small issue with 2 sources of truth.
@@ -179,14 +401,14 @@ static int drpai_load_file_to_mem(struct drpai *d, const char *model,
 	 * we'll be a bit strict about the file being the exact size as defined in the
 	 * memory region.
 	 */
-	if (st.st_size != addr->size)
+	if (st.st_size != size)
 		return -EIO;
 
-	fd = open(buf, O_RDONLY);
+	fd = open(path, O_RDONLY);
 	if (fd < 0)
 		return -errno;
 
-	left_to_read = addr->size;
+	left_to_read = size;
 	while (left_to_read > 0) {
 		size_t to_read = min(sizeof(buf), left_to_read);
 		rc = read(fd, buf, to_read);
@@ -194,7 +416,7 @@ static int drpai_load_file_to_mem(struct drpai *d, const char *model,
 			goto err_close;
 		left_to_read -= rc;
 
-		rc = write(d->fd, buf, rc);
+		rc = drpai_device_write(d->dev, buf, rc);
 		if (rc < 0)
 			goto err_close;
 	}
@@ -205,470 +427,2220 @@ err_close:
 	return rc;
 }
 
-static int drpai_load_model_config(struct drpai *d, const char *model)
+/* Write data that is already in memory into the region that was last assigned */
+static int drpai_write_data(struct drpai *d, const void *data, size_t size)
 {
-	const struct drpai_model_ops *ops;
-	char model_file[512];
-	json_object *c;
-	const char *s;
-	struct stat st;
-	int rc = 0;
-
-	snprintf(model_file, sizeof(model_file), "%s/%s.json", DRPAI_MODELS_ROOT_DIR, model);
+	const uint8_t *p = data;
+	ssize_t rc;
 
-	if (stat(model_file, &st))
-		return 0;
+	while (size) {
+		rc = drpai_device_write(d->dev, p, size);
+		if (rc < 0)
+			return rc;
+		if (!rc)
+			return -EIO;
+		p += rc;
+		size -= rc;
+	}
 
-	c = json_object_from_file(model_file);
-	if (!c)
-		return -errno;
+	return 0;
+}
 
-	s = json_object_get_string(json_object_object_get(c, "model_type"));
-	if (!s) {
-		rc = -EINVAL;
-		goto out;
-	}
+static int drpai_load_file_to_mem(struct drpai *d, const char *model,
+				  const char *fname, int idx)
+{
+	const drpai_data_t* addr = &d->input_data[idx];
+	char path[1024];
+	int rc;
 
-	ops = d->model.ops = drpai_model_type_to_ops(s);
-	if (!ops)
-		goto out;
+	rc = drpai_assign(d, addr);
+	if (rc)
+		return rc;
 
-	if (!ops->init)
-		goto out;
+	snprintf(path, sizeof(path), "%s/%s/%s", DRPAI_MODELS_ROOT_DIR, model, fname);
 
-	d->model.priv = ops->init(c, &rc);
-out:
-	json_object_put(c);
-	return rc;
+	return drpai_write_file(d, path, addr->size);
 }
 
-static int __drpai_load_model(struct drpai *d, const char *model)
+int drpai_tiles_parse(json_object *cfg, struct drpai_tiles *tiles)
 {
-	char model_dir[512];
-	struct dirent *ep;
-	bool loaded_addmap;
-	int rc = 0;
-	DIR *dp;
+	json_object *jobj;
 
-	if (!d || !model)
+	memset(tiles, 0, sizeof(*tiles));
+	if (!cfg)
+		return 0;
+
+	tiles->cols = drpai_config_get_int(cfg, "cols", 1);
+	tiles->rows = drpai_config_get_int(cfg, "rows", 1);
+	tiles->overlap = 0.2f;
+	tiles->merge = 0.6f;
+	if ((jobj = json_object_object_get(cfg, "overlap")))
+		tiles->overlap = json_object_get_double(jobj);
+	if ((jobj = json_object_object_get(cfg, "merge")))
+		tiles->merge = json_object_get_double(jobj);
+
+	if (tiles->cols < 1 || tiles->rows < 1 ||
+	    tiles->cols > DRPAI_MAX_TILES || tiles->rows > DRPAI_MAX_TILES ||
+	    tiles->cols * tiles->rows > DRPAI_MAX_TILES ||
+	    tiles->overlap < 0 || tiles->overlap >= 1 ||
+	    tiles->merge <= 0 || tiles->merge > 1)
 		return -EINVAL;
 
-	snprintf(model_dir, sizeof(model_dir), "%s/%s", DRPAI_MODELS_ROOT_DIR, model);
+	return 0;
+}
 
-	dp = opendir(model_dir);
-	if (!dp)
-		return -errno;
+/**
+ * Parse the optional "preprocess" section of the model config:
+ *   "preprocess": {
+ *       "input_width": 640, "input_height": 480, "input_format": "yuyv",
+ *       "crop": { "x": 0, "y": 0, "width": 640, "height": 480 },
+ *       "input_node": "<DRP node name>",
+ *       "input_addr": "0x..."
+ *   }
+ * The crop is programmed with DRPAI_PREPOST_CROP, and "input_node" with
+ * DRPAI_PREPOST_INADDR, so that the DRP reads from the given input address
+ * (by default the u-dma-buf input region) and crops/resizes from there.
+ * Both go by the DRP parameter info, given to the driver with the model.
+ */
+static int drpai_load_preproc_config(struct drpai *d, json_object *c)
+{
+	struct drpai_preproc *pp = &d->preproc;
+	json_object *jpre, *jcrop;
+	const char *s;
+	int rc;
 
-	/* Do a pass first to try to load the address map file and any label files */
-	loaded_addmap = false;
-	while ((ep = readdir(dp))) {
-		if (!str_endswith(ep->d_name, ADDRMAP_INTM_TXT_FILTER))
-			continue;
+	memset(pp, 0, sizeof(*pp));
+	/* FIXME: this was the hard-coded size so far */
+	pp->in_width = 640;
+	pp->in_height = 480;
+	pp->in_format = IMAGE_FORMAT_YUYV;
 
-		rc = drpai_read_addrmap_intm_txt(d, model_dir, ep->d_name);
-		if (rc)
-			goto out_closedir;
-		loaded_addmap = true;
-		break;
-	}
+	jpre = json_object_object_get(c, "preprocess");
+	if (!jpre)
+		return 0;
 
-	if (!loaded_addmap) {
-		rc = -ENOENT;
-		goto out_closedir;
-	}
+	pp->in_width = drpai_config_get_int(jpre, "input_width", pp->in_width);
+	pp->in_height = drpai_config_get_int(jpre, "input_height", pp->in_height);
+	if (pp->in_width <= 0 || pp->in_height <= 0)
+		return -EINVAL;
 
-	rewinddir(dp);
-	while ((ep = readdir(dp))) {
-		int idx = drpai_find_index(ep->d_name);
-		if (idx < 0)
-			continue;
+	s = json_object_get_string(json_object_object_get(jpre, "input_format"));
+	if (s) {
+		pp->in_format = image_format_from_string(s);
+		if (pp->in_format == IMAGE_FORMAT_INVALID)
+			return -EINVAL;
+	}
 
-		rc = drpai_load_file_to_mem(d, model, ep->d_name, idx);
+	jcrop = json_object_object_get(jpre, "crop");
+	if (jcrop) {
+		rc = drpai_model_set_crop(d,
+				drpai_config_get_int(jcrop, "x", 0),
+				drpai_config_get_int(jcrop, "y", 0),
+				drpai_config_get_int(jcrop, "width", pp->in_width),
+				drpai_config_get_int(jcrop, "height", pp->in_height));
 		if (rc)
-			break;
+			return rc;
 	}
 
-	rc = drpai_load_model_config(d, model);
+	s = json_object_get_string(json_object_object_get(jpre, "input_node"));
+	if (s) {
+		if (strlen(s) >= sizeof(pp->inaddr.name))
+			return -ENAMETOOLONG;
+		strcpy(pp->inaddr.name, s);
+
+		s = json_object_get_string(json_object_object_get(jpre, "input_addr"));
+		pp->inaddr_base = s ? strtoul(s, NULL, 0) : d->udmabuf.input;
+		pp->inaddr.data.address = pp->inaddr_base;
+		pp->inaddr.data.size = pp->in_width * pp->in_height *
+				       image_format_bytes_per_pixel(pp->in_format);
+		pp->inaddr_enabled = true;
+		pp->dirty = true;
+	}
 
-out_closedir:
-	closedir(dp);
-	return rc;
+	return 0;
 }
 
-int drpai_load_model(struct drpai *d, json_object *req)
+static int drpai_preproc_apply(struct drpai *d)
 {
-	const char *model;
-	json_object *jval;
+	struct drpai_preproc *pp = &d->preproc;
+	const drpai_data_t *param = &d->input_data[DRPAI_INDEX_DRP_PARAM];
 	int rc;
 
-	jval = json_object_object_get(req, "value");
-	model = json_object_get_string(json_object_object_get(jval, "model"));
-	if (!model) {
-		rc = -EINVAL;
-		goto err;
+	if (!pp->dirty)
+		return 0;
+
+	/* Both patch the DRP parameters of the pre-processing in place */
+	if (pp->crop_enabled) {
+		pp->crop.obj = *param;
+		rc = drpai_device_ioctl(d->dev, DRPAI_PREPOST_CROP, &pp->crop);
+		if (rc)
+			return rc;
 	}
 
-	rc = __drpai_load_model(d, model);
-err:
-	if (rc) {
-		const char *err = strerror(-rc);
-		json_object_object_add(req, "error", json_object_new_string(err));
-		lwsl_err("%s: %s\n", __func__, err);
+	if (pp->inaddr_enabled) {
+		pp->inaddr.obj = *param;
+		rc = drpai_device_ioctl(d->dev, DRPAI_PREPOST_INADDR, &pp->inaddr);
+		if (rc)
+			return rc;
 	}
 
-	return rc;
+	pp->dirty = false;
+
+	return 0;
 }
 
-static int drpai_get_base_addr(struct drpai *d)
+int drpai_model_set_crop(struct drpai *d, int x, int y, int width, int height)
 {
-	int rc;
+	struct drpai_preproc *pp;
+
 	if (!d)
 		return -EINVAL;
 
-	rc = ioctl(d->fd, DRPAI_GET_DRPAI_AREA, &d->base);
-	return rc ? -errno : 0;
-}
-
-/**
- * This uses the u-dma-buf driver found here:
- *    https://github.com/ikwzm/udmabuf
- * For the current DRP AI driver, we need to know the
- * physical address of the where we place the input data,
- * as well as an mmap()-ed pointer to the same location,
- * to be able to memcpy() data.
- * This driver works fine, because most embedded systems
- * have less than 4 GB of RAM.
- *
- * FIXME: we could do a zero-copy version here using the same
- *        u-dma-buf, but since the u-dma-buf is not part of the
- *        standard/base kernel source code: ¯\_(ツ)_/¯
- */
-static int drpai_get_input_mem_addr(struct drpai *d)
-{
-	/* FIXME: 'input_mem_offset is chosen arbitrarily at this point */
-	const uint32_t input_mem_offset = 0x10000;
-	char buf[32];
-	int fd, rc;
-
-	fd = open("/sys/class/u-dma-buf/udmabuf0/phys_addr", O_RDONLY);
-	if (fd < 0)
-		return -errno;
+	pp = &d->preproc;
+	if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+	    x + width > pp->in_width || y + height > pp->in_height)
+		return -ERANGE;
 
-	rc = read(fd, buf, sizeof(buf));
-	close(fd);
-	if (rc < 0)
-		return -errno;
+	if (pp->crop_enabled && pp->crop.pos_x == x && pp->crop.pos_y == y &&
+	    pp->crop.img_owidth == width && pp->crop.img_oheight == height)
+		return 0;
 
-	d->udmabuf.base = strtoul(buf, NULL, 16) & 0xffffffff;
-	d->udmabuf.input = d->udmabuf.base + input_mem_offset;
+	pp->crop.pos_x = x;
+	pp->crop.pos_y = y;
+	pp->crop.img_owidth = width;
+	pp->crop.img_oheight = height;
+	pp->crop_enabled = true;
+	pp->dirty = true;
 
-	fd = open("/dev/udmabuf0", O_RDWR);
-	if (fd < 0)
-		return -errno;
+	return 0;
+}
 
-	d->udmabuf.fd = fd;
-	/* FIXME: size is hard-coded */
-	d->udmabuf.usrptr = mmap(NULL, 640 * 480 * 2, PROT_READ | PROT_WRITE,
-				 MAP_SHARED, fd, input_mem_offset);
-	if (d->udmabuf.usrptr == MAP_FAILED) {
-		close(fd);
-		return -errno;
+static void drpai_model_get_frame(struct drpai *d, struct drpai_frame *frame)
+{
+	const struct drpai_preproc *pp = &d->preproc;
+
+	/* placement of the camera frame inside the model input */
+	*frame = d->input_frame;
+
+	if (pp->crop_enabled) {
+		frame->x = pp->crop.pos_x;
+		frame->y = pp->crop.pos_y;
+		frame->width = pp->crop.img_owidth;
+		frame->height = pp->crop.img_oheight;
+	} else {
+		frame->x = 0;
+		frame->y = 0;
+		frame->width = pp->in_width;
+		frame->height = pp->in_height;
 	}
-
-	return 0;
 }
 
-struct drpai *drpai_init(int *err)
+static json_object *drpai_model_config_open(const char *model, int *err)
 {
-	struct drpai *d;
-	int lerr = 0;
+	char model_file[512];
+	struct drpai_pkg pkg;
+	struct stat st;
+	json_object *c;
 
-	d = calloc(1, sizeof(*d));
-	if (!d) {
-		lerr = -ENOMEM;
-		goto err_assign_err_code;
+	/* a package has its config inside */
+	*err = drpai_pkg_open(&pkg, model);
+	if (!*err) {
+		c = drpai_pkg_config(&pkg, err);
+		drpai_pkg_close(&pkg);
+		return c;
 	}
+	if (*err != -ENOENT)
+		return NULL;
 
-	d->fd = open("/dev/drpai0", O_RDWR);
-	if (d->fd < 0) {
-		lerr = -errno;
-		goto err_free_work_data;
-	}
+	snprintf(model_file, sizeof(model_file), "%s/%s.json", DRPAI_MODELS_ROOT_DIR, model);
 
-	if ((lerr = drpai_get_base_addr(d)))
-		goto err_close;
+	*err = 0;
+	if (stat(model_file, &st))
+		return NULL;
 
-	if ((lerr = drpai_get_input_mem_addr(d)))
-		goto err_close;
+	c = json_object_from_file(model_file);
+	if (!c)
+		*err = errno ? -errno : -EINVAL;
 
-	return d;
-err_close:
-	close(d->fd);
-err_free_work_data:
-	free(d);
-err_assign_err_code:
-	if (err)
-		*err = lerr;
-	return NULL;
+	return c;
 }
 
-void drpai_free(struct drpai *d)
+static int drpai_load_model_config(struct drpai *d, json_object *c)
 {
 	const struct drpai_model_ops *ops;
+	const char *s;
+	int rc = 0;
 
-	if (!d)
-		return;
-
-	close(d->udmabuf.fd);
-	close(d->fd);
+	/* also waits for a decode still on the pool */
 	ops = d->model.ops;
 	if (ops && ops->cleanup)
-		d->model.ops->cleanup(d->model.priv);
+		ops->cleanup(d->model.priv);
+	d->model.ops = NULL;
+	d->model.priv = NULL;
+	d->decode.pending = false;
 
-	free(d);
-}
+	/* without a config, there is no pre-processing either */
+	drpai_load_preproc_config(d, NULL);
+	memset(&d->tiles, 0, sizeof(d->tiles));
+	drpai_tensor_parse(NULL, &d->output_format);
 
-static int drpai_load(struct drpai *d, void *addr, size_t len)
-{
-	if (!d)
-		return -EINVAL;
+	if (!c)
+		return 0;
+
+	rc = drpai_load_preproc_config(d, c);
+	if (rc)
+		return rc;
+
+	rc = drpai_tiles_parse(json_object_object_get(c, "tiles"), &d->tiles);
+	if (rc)
+		return rc;
+
+	rc = drpai_tensor_parse(json_object_object_get(c, "output"), &d->output_format);
+	if (rc)
+		return rc;
+
+	s = json_object_get_string(json_object_object_get(c, "model_type"));
+	if (!s)
+		return -EINVAL;
+
+	ops = d->model.ops = drpai_model_type_to_ops(s);
+	if (!ops || !ops->init)
+		return 0;
+
+	d->model.priv = ops->init(c, &rc);
+
+	return rc;
+}
+
+/* Single stage model; all files are in the model directory */
+static int drpai_load_model_files(struct drpai *d, const char *model)
+{
+	char model_dir[512];
+	struct dirent *ep;
+	int rc = 0;
+	DIR *dp;
+
+	snprintf(model_dir, sizeof(model_dir), "%s/%s", DRPAI_MODELS_ROOT_DIR, model);
+
+	rc = drpai_read_addrmap(model_dir, d->input_data);
+	if (rc)
+		return rc;
+	drpai_relocate(d, d->input_data, d->input_data[DRPAI_INDEX_INPUT].address);
+
+	dp = opendir(model_dir);
+	if (!dp)
+		return -errno;
+
+	while ((ep = readdir(dp))) {
+		int idx = drpai_find_index(ep->d_name);
+		if (idx < 0)
+			continue;
+
+		rc = drpai_load_file_to_mem(d, model, ep->d_name, idx);
+		if (rc)
+			break;
+	}
+
+	closedir(dp);
+	return rc;
+}
+
+/*
+ * Single stage model in a package: the address map is in the section
+ * table, and the data is written to the device straight from the mapping.
+ */
+static int drpai_load_model_package(struct drpai *d, const struct drpai_pkg *pkg)
+{
+	const struct drpai_pkg_section *s;
+	int i, rc;
+
+	memset(d->input_data, 0, sizeof(d->input_data));
+	for (i = 0; i < pkg->num_sections; i++) {
+		s = &pkg->sections[i];
+		if (s->type != DRPAI_PKG_REGION || s->index >= DRPAI_INDEX_NUM)
+			continue;
+
+		d->input_data[s->index].address = s->address;
+		d->input_data[s->index].size = s->region_size;
+	}
+	drpai_relocate(d, d->input_data, d->input_data[DRPAI_INDEX_INPUT].address);
+
+	for (i = 0; i < pkg->num_sections; i++) {
+		s = &pkg->sections[i];
+		if (s->type != DRPAI_PKG_REGION || s->index >= DRPAI_INDEX_NUM || !s->size)
+			continue;
+
+		/* as strict as with the files */
+		if (s->size != s->region_size)
+			return -EIO;
+
+		rc = drpai_assign(d, &d->input_data[s->index]);
+		if (rc)
+			return rc;
+
+		rc = drpai_write_data(d, drpai_pkg_data(pkg, s), s->size);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+struct drpai_stage {
+	uint32_t exe;		/* DRPAI_EXE_DRP or DRPAI_EXE_AI */
+	char dir[512];
+	drpai_data_t data[DRPAI_INDEX_NUM];
+};
+
+static int drpai_stage_parse(json_object *e, const char *model, struct drpai_stage *st)
+{
+	const char *exe, *dir;
+	int rc;
+
+	exe = json_object_get_string(json_object_object_get(e, "exe"));
+	dir = json_object_get_string(json_object_object_get(e, "dir"));
+	if (!exe || !dir || strstr(dir, ".."))
+		return -EINVAL;
+
+	if (!strcmp(exe, "drp"))
+		st->exe = DRPAI_EXE_DRP;
+	else if (!strcmp(exe, "ai"))
+		st->exe = DRPAI_EXE_AI;
+	else
+		return -EINVAL;
+
+	rc = snprintf(st->dir, sizeof(st->dir), "%s/%s/%s", DRPAI_MODELS_ROOT_DIR, model, dir);
+	if (rc >= (int)sizeof(st->dir))
+		return -ENAMETOOLONG;
+
+	return drpai_read_addrmap(st->dir, st->data);
+}
+
+/**
+ * Load the files of one stage. They were compiled for addresses relative
+ * to the first stage's input; the driver patches the descriptors and
+ * parameters by 'offset' when they are loaded with DRPAI_ASSIGN_DYNAMIC.
+ */
+static int drpai_stage_load(struct drpai *d, const struct drpai_stage *st, uint32_t offset)
+{
+	const struct drpai_param_map *pm;
+	drpai_data_dynamic_t dyn;
+	char path[1024];
+	struct dirent *ep;
+	int rc = 0;
+	DIR *dp;
+
+	dp = opendir(st->dir);
+	if (!dp)
+		return -errno;
+
+	while ((ep = readdir(dp))) {
+		const drpai_data_t *addr;
+
+		pm = drpai_find_param(ep->d_name);
+		if (!pm)
+			continue;
+
+		addr = &st->data[pm->idx];
+		if (!addr->size)
+			continue;
+
+		dyn.start_address = addr->address;
+		dyn.offset = offset;
+		dyn.size = addr->size;
+		dyn.file_type = pm->file_type;
+		rc = drpai_device_ioctl(d->dev, DRPAI_ASSIGN_DYNAMIC, &dyn);
+		if (rc)
+			break;
+
+		snprintf(path, sizeof(path), "%s/%s", st->dir, ep->d_name);
+		rc = drpai_write_file(d, path, addr->size);
+		if (rc)
+			break;
+	}
+
+	closedir(dp);
+	return rc;
+}
+
+/**
+ * Parse the optional "sequence" section of the model config, for models
+ * split into stages that the DRP AI runs back to back, without going
+ * through the CPU in between:
+ *   "sequence": [
+ *       { "exe": "drp", "dir": "preprocess" },
+ *       { "exe": "ai",  "dir": "network" },
+ *       { "exe": "drp", "dir": "postprocess" }
+ *   ]
+ * Each stage directory (inside the model directory) holds the address map
+ * and files of that stage. A stage reads the output of the one before it,
+ * so the model input is that of the first stage, and the model output is
+ * that of the last one.
+ */
+static int drpai_load_model_sequence(struct drpai *d, const char *model, json_object *jseq)
+{
+	struct drpai_stage *stages;
+	drpai_seq_t seq = { 0 };
+	uint32_t base, offset;
+	int i, num, rc = 0;
+
+	num = json_object_array_length(jseq);
+	if (num < 1 || num > DRPAI_SEQ_NUM)
+		return -EINVAL;
+
+	stages = calloc(num, sizeof(*stages));
+	if (!stages)
+		return -ENOMEM;
+
+	for (i = 0; i < num; i++) {
+		rc = drpai_stage_parse(json_object_array_get_idx(jseq, i), model, &stages[i]);
+		if (rc)
+			goto out;
+	}
+
+	base = stages[0].data[DRPAI_INDEX_INPUT].address;
+	offset = d->base.address - base;
+	for (i = 0; i < num; i++) {
+		drpai_relocate(d, stages[i].data, base);
+
+		if (i > 0 && stages[i].data[DRPAI_INDEX_INPUT].address !=
+			     stages[i - 1].data[DRPAI_INDEX_OUTPUT].address) {
+			lwsl_err("%s: stage %d does not read the output of stage %d\n",
+				 __func__, i, i - 1);
+			rc = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < num; i++) {
+		rc = drpai_stage_load(d, &stages[i], offset);
+		if (rc)
+			goto out;
+		seq.order[i] = stages[i].exe;
+	}
+
+	seq.num = num;
+	rc = drpai_device_ioctl(d->dev, DRPAI_SET_SEQ, &seq);
+	if (rc)
+		goto out;
+	d->num_stages = num;
+
+	memcpy(d->input_data, stages[0].data, sizeof(d->input_data));
+	d->input_data[DRPAI_INDEX_OUTPUT] = stages[num - 1].data[DRPAI_INDEX_OUTPUT];
+out:
+	free(stages);
+	return rc;
+}
+
+/*
+ * Hand the table of the DRP parameters to the driver: DRPAI_PREPOST_CROP
+ * and DRPAI_PREPOST_INADDR look up there what to patch in the DRP_PARAM
+ * region, so they fail without it.
+ */
+static int drpai_assign_param_info(struct drpai *d, const void *info, size_t size)
+{
+	drpai_assign_param_t param = {
+		.info_size = size,
+		.obj = d->input_data[DRPAI_INDEX_DRP_PARAM],
+	};
+	int rc;
+
+	if (!size || !param.obj.size)
+		return -EINVAL;
+
+	rc = drpai_device_ioctl(d->dev, DRPAI_ASSIGN_PARAM, &param);
+	if (rc)
+		return rc;
+
+	return drpai_write_data(d, info, size);
+}
+
+static int drpai_load_param_info_file(struct drpai *d, const char *dir)
+{
+	char path[1024];
+	struct stat st;
+	void *info;
+	ssize_t n;
+	int fd, rc;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, DRP_PARAM_INFO_FNAME);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		goto err_close;
+	}
+
+	info = malloc(st.st_size + 1);
+	if (!info) {
+		rc = -ENOMEM;
+		goto err_close;
+	}
+
+	n = read(fd, info, st.st_size);
+	if (n < 0)
+		rc = -errno;
+	else if (n != st.st_size)
+		rc = -EIO;
+	else
+		rc = drpai_assign_param_info(d, info, n);
+
+	free(info);
+err_close:
+	close(fd);
+	return rc;
+}
+
+/*
+ * Models with a "preprocess" section need their DRP parameter info
+ * (drp_param_info.txt of the model directory, of the first stage of a
+ * sequence, or the section of a package); it is required here, rather
+ * than have the first start fail.
+ */
+static int drpai_load_param_info(struct drpai *d, const char *model, json_object *c,
+				 const struct drpai_pkg *pkg)
+{
+	const struct drpai_pkg_section *s;
+	const char *dir = "";
+	char path[512];
+	json_object *jseq;
+	int i, rc;
+
+	if (!json_object_object_get(c, "preprocess"))
+		return 0;
+
+	if (pkg->map) {
+		rc = -ENOENT;
+		for (i = 0; i < pkg->num_sections; i++) {
+			s = &pkg->sections[i];
+			if (s->type == DRPAI_PKG_PARAM_INFO) {
+				rc = drpai_assign_param_info(d, drpai_pkg_data(pkg, s), s->size);
+				break;
+			}
+		}
+	} else {
+		/* the stage was checked when the sequence was loaded */
+		jseq = json_object_object_get(c, "sequence");
+		if (jseq)
+			dir = json_object_get_string(json_object_object_get(
+					json_object_array_get_idx(jseq, 0), "dir"));
+
+		snprintf(path, sizeof(path), "%s/%s/%s", DRPAI_MODELS_ROOT_DIR, model, dir);
+		rc = drpai_load_param_info_file(d, path);
+	}
+
+	if (rc)
+		lwsl_err("%s: %s: DRP parameter info for the pre-processing: %s\n",
+			 __func__, model, strerror(-rc));
+
+	return rc;
+}
+
+/* End of the DRP AI memory used by the loaded model */
+static uint32_t drpai_model_mem_end(const struct drpai *d)
+{
+	uint32_t end = d->base.address;
+	int i;
+
+	for (i = 0; i < DRPAI_INDEX_NUM; i++) {
+		const drpai_data_t *r = &d->input_data[i];
+
+		if (r->size && r->address + r->size > end)
+			end = r->address + r->size;
+	}
+
+	return end;
+}
+
+static void drpai_cascade_free(struct drpai_cascade *cas)
+{
+	struct drpai *s;
+
+	if (!cas)
+		return;
+
+	/* the device and u-dma-buf mapping belong to the first model */
+	s = cas->second;
+	if (s) {
+		if (s->model.ops && s->model.ops->cleanup)
+			s->model.ops->cleanup(s->model.priv);
+		drpai_output_release(s);
+		free(s);
+	}
+
+	drpai_model_free_labels(cas->labels, cas->num_labels);
+	free(cas);
+}
+
+static int __drpai_load_model(struct drpai *d, const char *model);
+
+/**
+ * Parse the optional "cascade" section of the model config:
+ *   "cascade": {
+ *       "model": "<second model>",
+ *       "labels": [ only objects with these labels; all if not given ],
+ *       "max_objects": 8,
+ *       "min_size": 16
+ *   }
+ * The second model reads the same input image (so its pre-processing must
+ * take the same size and format), cropped to each object; objects smaller
+ * than 'min_size' model input pixels are skipped.
+ */
+static int drpai_cascade_load(struct drpai *d, json_object *c)
+{
+	const struct drpai_preproc *pp = &d->preproc;
+	struct drpai_cascade *cas;
+	uint32_t start, end;
+	const char *model;
+	json_object *jcas;
+	struct drpai *s;
+	int rc;
+
+	jcas = json_object_object_get(c, "cascade");
+	if (!jcas)
+		return 0;
+
+	/* no cascades of cascades, and the sequence is per device */
+	if (d->is_cascade || d->num_stages)
+		return -EOPNOTSUPP;
+
+	model = json_object_get_string(json_object_object_get(jcas, "model"));
+	if (!model)
+		return -EINVAL;
+
+	cas = calloc(1, sizeof(*cas));
+	if (!cas)
+		return -ENOMEM;
+
+	if (json_object_object_get(jcas, "labels")) {
+		cas->labels = drpai_model_config_get_labels(jcas, &rc);
+		if (!cas->labels)
+			goto err;
+		cas->num_labels = rc;
+	}
+
+	cas->max_objects = drpai_config_get_int(jcas, "max_objects", 8);
+	cas->min_size = drpai_config_get_int(jcas, "min_size", 16);
+	if (cas->max_objects < 1 || cas->min_size < 1) {
+		rc = -EINVAL;
+		goto err;
+	}
+
+	/* right after the first model */
+	start = drpai_model_mem_end(d);
+	start = (start + DRPAI_CASCADE_ALIGN - 1) & ~(DRPAI_CASCADE_ALIGN - 1);
+	end = d->base.address + d->base.size;
+	if (start >= end) {
+		rc = -ENOSPC;
+		goto err;
+	}
+
+	s = cas->second = calloc(1, sizeof(*s));
+	if (!s) {
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	s->dev = d->dev;
+	s->is_cascade = true;
+	s->base.address = start;
+	s->base.size = end - start;
+	s->udmabuf = d->udmabuf;
+
+	rc = __drpai_load_model(s, model);
+	if (rc)
+		goto err;
+
+	if (drpai_model_mem_end(s) > end) {
+		rc = -ENOSPC;
+		goto err;
+	}
+
+	if (!s->model.ops || !s->model.ops->postprocessing ||
+	    s->preproc.in_width != pp->in_width ||
+	    s->preproc.in_height != pp->in_height ||
+	    s->preproc.in_format != pp->in_format) {
+		lwsl_err("%s: '%s' cannot run on the input of the first model\n",
+			 __func__, model);
+		rc = -EINVAL;
+		goto err;
+	}
+
+	d->cascade = cas;
+
+	return 0;
+err:
+	drpai_cascade_free(cas);
+	return rc;
+}
+
+static int __drpai_load_model(struct drpai *d, const char *model)
+{
+	json_object *c, *jseq;
+	drpai_seq_t seq = { 0 };
+	struct drpai_pkg pkg;
+	int rc;
+
+	if (!d || !model)
+		return -EINVAL;
+
+	/* the model memory, and the output, are about to be overwritten */
+	drpai_cascade_free(d->cascade);
+	d->cascade = NULL;
+	drpai_load_model_config(d, NULL);
+
+	rc = drpai_pkg_open(&pkg, model);
+	if (rc && rc != -ENOENT)
+		return rc;
+
+	c = pkg.map ? drpai_pkg_config(&pkg, &rc) : drpai_model_config_open(model, &rc);
+	if (rc)
+		goto out;
+
+	jseq = json_object_object_get(c, "sequence");
+	if (jseq && (d->is_cascade || pkg.map)) {
+		rc = -EOPNOTSUPP;
+	} else if (jseq) {
+		rc = drpai_load_model_sequence(d, model, jseq);
+	} else {
+		/* back to the default, single stage run */
+		if (d->num_stages) {
+			rc = drpai_device_ioctl(d->dev, DRPAI_SET_SEQ, &seq);
+			if (rc)
+				goto out;
+			d->num_stages = 0;
+		}
+		if (pkg.map)
+			rc = drpai_load_model_package(d, &pkg);
+		else
+			rc = drpai_load_model_files(d, model);
+	}
+	if (!rc)
+		rc = drpai_load_param_info(d, model, c, &pkg);
+	/* all of it is in the device now */
+	drpai_pkg_close(&pkg);
+	if (rc)
+		goto out;
+
+	rc = drpai_output_prepare(d);
+	if (rc)
+		goto out;
+
+	rc = drpai_load_model_config(d, c);
+	if (rc)
+		goto out;
+
+	rc = drpai_cascade_load(d, c);
+out:
+	drpai_pkg_close(&pkg);
+	json_object_put(c);
+	return rc;
+}
+
+/* The devices are shared by all websocket sessions and cameras */
+static struct drpai *drpai_instances[DRPAI_MAX_DEVICES];
+static int drpai_num_instances;
+static int drpai_refcount;
+
+/* Of drpai_load_model(), for the metrics: relaxed atomics, as all counters */
+static struct {
+	unsigned long loads;
+	unsigned long failures;
+	uint64_t load_us;	/* of all loads */
+	uint64_t last_us;
+	char last_model[64];
+} drpai_load_stats;
+
+/* What the instances run, to go back to if a load fails half way */
+static char drpai_loaded_model[256];
+
+/* Loads 'model' on the first 'n' instances, or unloads them if NULL */
+static int drpai_load_instances(const char *model, int n)
+{
+	int i, rc = 0;
+
+	for (i = 0; i < n; i++) {
+		if (!model) {
+			drpai_cascade_free(drpai_instances[i]->cascade);
+			drpai_instances[i]->cascade = NULL;
+			drpai_load_model_config(drpai_instances[i], NULL);
+			continue;
+		}
+		rc = __drpai_load_model(drpai_instances[i], model);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* The same model is loaded on every instance */
+int drpai_load_model(json_object *req)
+{
+	const char *model;
+	json_object *jval;
+	uint64_t t;
+	int i, rc;
+
+	jval = json_object_object_get(req, "value");
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+	if (!model) {
+		rc = -EINVAL;
+		goto err;
+	}
+
+	if (!drpai_num_instances) {
+		rc = -ENODEV;
+		goto err;
+	}
+
+	/* the instances are shared: no frame may be on them as they change */
+	rc = drpai_sched_drain();
+	if (rc) {
+		lwsl_err("%s: frames still in flight\n", __func__);
+		goto err;
+	}
+
+	t = monotonic_now_us();
+	for (i = 0; i < drpai_num_instances; i++) {
+		rc = __drpai_load_model(drpai_instances[i], model);
+		if (rc)
+			break;
+	}
+	t = monotonic_now_us() - t;
+
+	if (rc) {
+		__atomic_fetch_add(&drpai_load_stats.failures, 1, __ATOMIC_RELAXED);
+
+		/* all instances run the same model, the previous one or none */
+		if (!drpai_loaded_model[0] ||
+		    drpai_load_instances(drpai_loaded_model, i + 1)) {
+			lwsl_err("%s: no model left loaded\n", __func__);
+			drpai_load_instances(NULL, drpai_num_instances);
+			drpai_loaded_model[0] = '\0';
+			drpai_active = false;
+		}
+	} else {
+		snprintf(drpai_loaded_model, sizeof(drpai_loaded_model), "%s", model);
+		__atomic_fetch_add(&drpai_load_stats.loads, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&drpai_load_stats.load_us, t, __ATOMIC_RELAXED);
+		__atomic_store_n(&drpai_load_stats.last_us, t, __ATOMIC_RELAXED);
+		/* only ever written and read on the event loop */
+		snprintf(drpai_load_stats.last_model, sizeof(drpai_load_stats.last_model),
+			 "%s", model);
+	}
+err:
+	if (rc) {
+		const char *err = strerror(-rc);
+		json_object_object_add(req, "error", json_object_new_string(err));
+		lwsl_err("%s: %s\n", __func__, err);
+	}
+
+	return rc;
+}
+
+static int drpai_get_base_addr(struct drpai *d)
+{
+	int rc;
+	if (!d)
+		return -EINVAL;
+
+	rc = drpai_device_ioctl(d->dev, DRPAI_GET_DRPAI_AREA, &d->base);
+	return rc;
+}
+
+/**
+ * For the current DRP AI driver, we need to know the
+ * physical address of the where we place the input data,
+ * as well as an mmap()-ed pointer to the same location,
+ * to be able to memcpy() data.
+ * The device backend provides both (on hardware, via u-dma-buf).
+ *
+ * FIXME: we could do a zero-copy version here using the same
+ *        u-dma-buf, but since the u-dma-buf is not part of the
+ *        standard/base kernel source code: ¯\_(ツ)_/¯
+ */
+static int drpai_get_input_mem_addr(struct drpai *d)
+{
+	/* FIXME: 'input_mem_offset is chosen arbitrarily at this point */
+	const uint32_t input_mem_offset = 0x10000;
+	int rc;
+
+	rc = drpai_device_dmabuf_info(d->dev, &d->udmabuf.base, &d->udmabuf.size);
+	if (rc)
+		return rc;
+
+	d->udmabuf.input = d->udmabuf.base + input_mem_offset;
+
+	/* Map everything after the input offset, so that any model input size fits */
+	if (d->udmabuf.size > input_mem_offset)
+		d->udmabuf.usrptr_len = d->udmabuf.size - input_mem_offset;
+	else
+		d->udmabuf.usrptr_len = 640 * 480 * 2;
+	d->udmabuf.usrptr = drpai_device_dmabuf_map(d->dev, d->udmabuf.usrptr_len,
+						    input_mem_offset,
+						    PROT_READ | PROT_WRITE);
+	if (!d->udmabuf.usrptr)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static struct drpai *drpai_init(int index, int *err)
+{
+	struct drpai *d;
+	int lerr = 0;
+
+	d = calloc(1, sizeof(*d));
+	if (!d) {
+		lerr = -ENOMEM;
+		goto err_assign_err_code;
+	}
+
+	d->dev = drpai_device_open(index, &lerr);
+	if (!d->dev)
+		goto err_free_work_data;
+
+	if ((lerr = drpai_get_base_addr(d)))
+		goto err_close;
+
+	if ((lerr = drpai_get_input_mem_addr(d)))
+		goto err_close;
+
+	return d;
+err_close:
+	drpai_device_close(d->dev);
+err_free_work_data:
+	free(d);
+err_assign_err_code:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+static void drpai_free(struct drpai *d)
+{
+	const struct drpai_model_ops *ops;
+
+	if (!d)
+		return;
+
+	/* first, as a decode may be using the output */
+	ops = d->model.ops;
+	if (ops && ops->cleanup)
+		d->model.ops->cleanup(d->model.priv);
+
+	drpai_cascade_free(d->cascade);
+	drpai_output_release(d);
+	json_object_put(d->tiling.objects);
+	image_letterbox_free(d->tiling.letterbox);
+	drpai_roi_put(d->roi);
+	image_letterbox_free(d->letterbox);
+	drpai_device_dmabuf_unmap(d->dev, d->udmabuf.usrptr, d->udmabuf.usrptr_len);
+	drpai_device_close(d->dev);
+
+	free(d);
+}
+
+/**
+ * Opens all DRP AI instances on the first reference.
+ * Instances that fail to open are skipped; it is only an error if none
+ * could be opened.
+ */
+int drpai_get(void)
+{
+	int i, n, rc = -ENODEV;
+
+	if (drpai_refcount) {
+		drpai_refcount++;
+		return 0;
+	}
+
+	n = drpai_device_count();
+	for (i = 0; i < n; i++) {
+		struct drpai *d = drpai_init(i, &rc);
+		if (!d) {
+			lwsl_warn("%s: could not open DRP AI %d: %s\n", __func__,
+				  i, strerror(-rc));
+			continue;
+		}
+		drpai_instances[drpai_num_instances++] = d;
+	}
+
+	if (!drpai_num_instances)
+		return rc;
+
+	lwsl_notice("%s: using %d DRP AI instance(s)\n", __func__, drpai_num_instances);
+	drpai_refcount = 1;
+	drpai_sched_instances_init();
+
+	return 0;
+}
+
+void drpai_put(void)
+{
+	int i;
+
+	if (!drpai_refcount || --drpai_refcount > 0)
+		return;
+
+	drpai_active = false;
+	drpai_sched_instances_release();
+	for (i = 0; i < drpai_num_instances; i++) {
+		drpai_free(drpai_instances[i]);
+		drpai_instances[i] = NULL;
+	}
+	drpai_num_instances = 0;
+	drpai_loaded_model[0] = '\0';
+
+	/* no model uses them any more */
+	drpai_plugins_unload();
+}
+
+int drpai_instances_count(void)
+{
+	return drpai_num_instances;
+}
+
+struct drpai *drpai_instance(int idx)
+{
+	if (idx < 0 || idx >= drpai_num_instances)
+		return NULL;
+
+	return drpai_instances[idx];
+}
+
+/* Input slot 'idx' of the u-dma-buf is what the next run reads */
+static void drpai_input_select(struct drpai *d, int idx)
+{
+	struct drpai_preproc *pp = &d->preproc;
+	uint32_t offs = idx * d->tiling.slot_len;
+
+	/* FIXME: this provides the physical address */
+	d->input_data[DRPAI_INDEX_INPUT].address = d->udmabuf.input + offs;
+
+	if (pp->inaddr_enabled && pp->inaddr.data.address != pp->inaddr_base + offs) {
+		pp->inaddr.data.address = pp->inaddr_base + offs;
+		pp->dirty = true;
+	}
+
+	if (d->tiling.num)
+		d->input_frame = d->tiling.tile[idx];
+}
+
+static void drpai_tiling_reset(struct drpai *d)
+{
+	struct drpai_tiling *tl = &d->tiling;
+
+	json_object_put(tl->objects);
+	tl->objects = NULL;
+	tl->pending = false;
+	tl->current = 0;
+	tl->num = 0;
+}
+
+/* Tile size along one side, so that 'n' tiles overlapping by 'overlap' cover 'size' */
+static int drpai_tiles_span(int size, int n, float overlap, int align)
+{
+	int len = ceilf(size / (n - (n - 1) * overlap));
+
+	len = (len + align - 1) / align * align;
+
+	return len < size ? len : size;
+}
+
+/* Tiles of the 'width' x 'height' region at (x, y) of the frame, starting at 'src' */
+/* The CPU wrote 'len' bytes of input through the cached mapping */
+static int drpai_input_flush(struct drpai *d, size_t len)
+{
+	int rc;
+
+	rc = drpai_device_dmabuf_sync(d->dev, d->udmabuf.input - d->udmabuf.base,
+				      len, DRPAI_DMABUF_TO_DEVICE);
+
+	/* a u-dma-buf without the sync attributes: as it always was */
+	return rc == -EOPNOTSUPP ? 0 : rc;
+}
+
+static int drpai_load_tiles(struct drpai *d, const uint8_t *src, int stride,
+			    int x, int y, int width, int height,
+			    const struct drpai_tiles *t)
+{
+	const drpai_data_t *out = &d->input_data[DRPAI_INDEX_OUTPUT];
+	const struct drpai_preproc *pp = &d->preproc;
+	struct drpai_tiling *tl = &d->tiling;
+	int num = t->cols * t->rows;
+	int tw, th, r, c, rc = 0;
+	size_t len, slot;
+	uint32_t end;
+
+	/* the cascade crops objects out of one whole frame */
+	if (d->cascade || (pp->inaddr_enabled && pp->inaddr_base != d->udmabuf.input))
+		return -EOPNOTSUPP;
+
+	len = pp->in_width * pp->in_height * image_format_bytes_per_pixel(pp->in_format);
+	slot = (len + DRPAI_TILE_ALIGN - 1) & ~(size_t)(DRPAI_TILE_ALIGN - 1);
+	if (slot * num > d->udmabuf.usrptr_len)
+		return -ENOSPC;
+
+	/* the output may live in the u-dma-buf too */
+	end = d->udmabuf.input + slot * num;
+	if (out->size && out->address < end &&
+	    out->address + out->size > d->udmabuf.input)
+		return -ENOSPC;
+
+	tw = drpai_tiles_span(width, t->cols, t->overlap, 2);
+	th = drpai_tiles_span(height, t->rows, t->overlap, 1);
+
+	if (!image_letterbox_matches(tl->letterbox, tw, th,
+				     pp->in_width, pp->in_height, pp->in_format)) {
+		image_letterbox_free(tl->letterbox);
+		tl->letterbox = image_letterbox_create(tw, th,
+						       pp->in_width, pp->in_height,
+						       pp->in_format, &rc);
+		if (!tl->letterbox)
+			return rc;
+	}
+
+	for (r = 0; r < t->rows; r++) {
+		for (c = 0; c < t->cols; c++) {
+			int i = r * t->cols + c;
+			struct drpai_frame *f = &tl->tile[i];
+			int tx = 0, ty = 0;
+
+			/* evenly spread; the last tile ends at the region border */
+			if (t->cols > 1)
+				tx = ((width - tw) * c / (t->cols - 1)) & ~1;
+			if (t->rows > 1)
+				ty = (height - th) * r / (t->rows - 1);
+
+			image_letterbox_run_stride(tl->letterbox, src + ty * stride + tx * 2,
+						   stride,
+						   (uint8_t *)d->udmabuf.usrptr + i * slot);
+
+			image_letterbox_get_placement(tl->letterbox, &f->scale,
+						      &f->pad_x, &f->pad_y);
+			f->src_x = x + tx;
+			f->src_y = y + ty;
+			f->frame_width = tw;
+			f->frame_height = th;
+			f->roi = d->roi;
+		}
+	}
+
+	rc = drpai_input_flush(d, slot * num);
+	if (rc)
+		return rc;
+
+	tl->cfg = *t;
+	tl->slot_len = slot;
+	tl->num = num;
+	drpai_input_select(d, 0);
+
+	return 0;
+}
+
+/**
+ * Resize the YUYV camera frame into the model input (keeping the aspect
+ * ratio, with borders), straight into the u-dma-buf input region.
+ * The letterbox LUTs are kept for as long as the frame size and model
+ * input stay the same.
+ * With a ROI, only its bounding box is resized, so the model sees it
+ * at a higher resolution and nothing outside it.
+ */
+static int drpai_load(struct drpai *d, const void *addr, int width, int height,
+		      const struct drpai_tiles *tiles, struct drpai_roi *roi)
+{
+	const struct drpai_preproc *pp;
+	const uint8_t *src;
+	struct drpai_frame *f;
+	int rc = 0, x, y, w, h;
+	size_t len;
+
+	if (!d || !addr)
+		return -EINVAL;
+
+	drpai_tiling_reset(d);
+	if (roi != d->roi) {
+		drpai_roi_put(d->roi);
+		d->roi = drpai_roi_get(roi);
+	}
+
+	if (!drpai_roi_bounds(roi, width, height, &x, &y, &w, &h))
+		return -ERANGE;
+	src = (const uint8_t *)addr + (y * width + x) * 2;
+
+	if (!tiles)
+		tiles = &d->tiles;
+	if (tiles->cols * tiles->rows > 1)
+		return drpai_load_tiles(d, src, width * 2, x, y, w, h, tiles);
+
+	pp = &d->preproc;
+	len = pp->in_width * pp->in_height * image_format_bytes_per_pixel(pp->in_format);
+	if (len > d->udmabuf.usrptr_len)
+		return -ENOSPC;
+
+	if (!image_letterbox_matches(d->letterbox, w, h,
+				     pp->in_width, pp->in_height, pp->in_format)) {
+		image_letterbox_free(d->letterbox);
+		d->letterbox = image_letterbox_create(w, h,
+						      pp->in_width, pp->in_height,
+						      pp->in_format, &rc);
+		if (!d->letterbox)
+			return rc;
+	}
+
+	drpai_input_select(d, 0);
+	image_letterbox_run_stride(d->letterbox, src, width * 2, d->udmabuf.usrptr);
+	rc = drpai_input_flush(d, len);
+	if (rc)
+		return rc;
+
+	f = &d->input_frame;
+	image_letterbox_get_placement(d->letterbox, &f->scale, &f->pad_x, &f->pad_y);
+	f->src_x = x;
+	f->src_y = y;
+	f->frame_width = w;
+	f->frame_height = h;
+	f->roi = d->roi;
+
+	return 0;
+}
+
+static int drpai_start(struct drpai *d)
+{
+	int rc;
+
+	if (!d)
+		return -EINVAL;
+
+	rc = drpai_preproc_apply(d);
+	if (rc)
+		return rc;
+
+	rc = drpai_device_ioctl(d->dev, DRPAI_START, d->input_data);
+	if (rc)
+		return rc;
+
+	d->start_us = monotonic_now_us();
+
+	return 0;
+}
+
+int drpai_is_running(struct drpai *d)
+{
+	drpai_status_t drp_status;
+	int rc;
+
+	if (!d)
+		return 0;
+
+	rc = drpai_device_ioctl(d->dev, DRPAI_GET_STATUS, &drp_status);
+	if (rc)
+		return (rc == -EBUSY);
+
+	return !drp_status.err && drp_status.status == DRPAI_STATUS_RUN;
+}
+
+static int __drpai_get_result_tensor(struct drpai *d, struct drpai_tensor *out)
+{
+	const drpai_data_t* addr;
+	uint8_t *output;
+	size_t left_to_read, total_read;
+	int lerr;
+
+	if (!d || !d->output.buf)
+		return -EINVAL;
+
+	*out = d->output_format;
+	out->data = d->output.buf;
+	out->num = d->output.size / drpai_dtype_size(out->dtype);
+
+	/* Directly mapped; the DRP AI wrote the result there, past the cache */
+	if (d->output.mapped)
+		return drpai_device_dmabuf_sync(d->dev, d->output.offs, d->output.size,
+						DRPAI_DMABUF_FROM_DEVICE);
+
+	addr = &d->input_data[DRPAI_INDEX_OUTPUT];
+	if ((lerr = drpai_assign(d, addr)))
+		return lerr;
+
+	output = d->output.buf;
+	total_read = 0;
+	left_to_read = d->output.size;
+	while (left_to_read > 0) {
+		ssize_t rc = drpai_device_read(d->dev, output + total_read, left_to_read);
+		if (rc == -EINTR)
+			continue;
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			return -EIO;
+
+		left_to_read -= rc;
+		total_read += rc;
+	}
+
+	return 0;
+}
+
+/* The output tensor of the last run, in the format of the model config */
+static int drpai_get_result_tensor(struct drpai *d, struct drpai_tensor *out)
+{
+	uint64_t t = monotonic_now_us();
+	int rc;
+
+	rc = __drpai_get_result_tensor(d, out);
+	if (d)
+		d->read_us += monotonic_now_us() - t;
+
+	return rc;
+}
+
+const char *drpai_model_load_input(struct drpai *d, const void *addr, int width, int height,
+				   const struct drpai_tiles *tiles, struct drpai_roi *roi)
+{
+	int rc;
+
+	if (!d) {
+		return "DRP AI object not initialized";
+	}
+
+	rc = drpai_load(d, addr, width, height, tiles, roi);
+	if (rc) {
+		lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
+		return "DRP AI load error";
+	}
+
+	return NULL;
+}
+
+const char *drpai_model_start(struct drpai *d)
+{
+	int rc;
+
+	if (!d) {
+		return "DRP AI object not initialized";
+	}
+
+	rc = drpai_start(d);
+	if (rc) {
+		lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
+		return "DRP AI start error";
+	}
+
+	return NULL;
+}
+
+static bool drpai_cascade_wants(const struct drpai_cascade *cas, json_object *obj)
+{
+	const char *label;
+	int i;
+
+	if (!cas->num_labels)
+		return true;
+
+	label = json_object_get_string(json_object_object_get(obj, "label"));
+	if (!label)
+		return false;
+
+	for (i = 0; i < cas->num_labels; i++) {
+		if (!strcmp(label, cas->labels[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/* Start the second model on the next object, if there is one left */
+static int drpai_cascade_next(struct drpai *d)
+{
+	struct drpai_cascade *cas = d->cascade;
+	const struct drpai_frame *f = &d->input_frame;
+	const struct drpai_preproc *pp = &d->preproc;
+	struct drpai *s = cas->second;
+	int num = json_object_array_length(cas->objects);
+	int rc;
+
+	cas->pending = false;
+
+	while (cas->next < num && cas->runs < cas->max_objects) {
+		json_object *obj = json_object_array_get_idx(cas->objects, cas->next++);
+		json_object *jbox = json_object_object_get(obj, "box");
+		int x0, y0, x1, y1;
+
+		if (!jbox || !drpai_cascade_wants(cas, obj))
+			continue;
+
+		/* back from camera frame to model input coordinates */
+		x0 = (drpai_config_get_int(jbox, "x", 0) - f->src_x) * f->scale + f->pad_x;
+		y0 = (drpai_config_get_int(jbox, "y", 0) - f->src_y) * f->scale + f->pad_y;
+		x1 = x0 + drpai_config_get_int(jbox, "w", 0) * f->scale;
+		y1 = y0 + drpai_config_get_int(jbox, "h", 0) * f->scale;
+		if (x0 < 0)
+			x0 = 0;
+		if (y0 < 0)
+			y0 = 0;
+		if (x1 > pp->in_width)
+			x1 = pp->in_width;
+		if (y1 > pp->in_height)
+			y1 = pp->in_height;
+		if (x1 - x0 < cas->min_size || y1 - y0 < cas->min_size)
+			continue;
+
+		rc = drpai_model_set_crop(s, x0, y0, x1 - x0, y1 - y0);
+		if (rc)
+			return rc;
+
+		s->input_data[DRPAI_INDEX_INPUT].address = d->udmabuf.input;
+		s->input_frame = d->input_frame;
+		rc = drpai_start(s);
+		if (rc)
+			return rc;
+
+		cas->current = cas->next - 1;
+		cas->runs++;
+		cas->pending = true;
+		break;
+	}
+
+	return 0;
+}
+
+/* Merge the result of the second model into its object */
+static int drpai_cascade_collect(struct drpai *d)
+{
+	struct drpai_cascade *cas = d->cascade;
+	struct drpai *s = cas->second;
+	struct drpai_frame frame;
+	struct drpai_tensor out;
+	json_object *res, *obj;
+	uint64_t t = monotonic_now_us();
+	int rc;
+
+	cas->second_us += t - s->start_us;
+
+	rc = drpai_get_result_tensor(s, &out);
+	if (rc)
+		return rc;
+
+	res = json_object_new_object();
+	if (!res)
+		return -ENOMEM;
+
+	drpai_model_get_frame(s, &frame);
+	rc = s->model.ops->postprocessing(s->model.priv, &out, &frame, res);
+	if (!rc) {
+		obj = json_object_array_get_idx(cas->objects, cas->current);
+		json_object_object_add(obj, "class",
+				       json_object_get(json_object_object_get(res, "value")));
+	}
+	json_object_put(res);
+
+	cas->second_decode_us += monotonic_now_us() - t;
+
+	return rc;
+}
+
+static void drpai_cascade_timings(struct drpai_cascade *cas, json_object *result)
+{
+	json_object *jt = json_object_new_object();
+
+	if (!jt)
+		return;
+
+	json_object_object_add(jt, "detect_ms", json_object_new_double(cas->detect_us / 1000.0));
+	json_object_object_add(jt, "decode_ms", json_object_new_double(cas->decode_us / 1000.0));
+	json_object_object_add(jt, "cascade_ms", json_object_new_double(cas->second_us / 1000.0));
+	json_object_object_add(jt, "cascade_decode_ms",
+			       json_object_new_double(cas->second_decode_us / 1000.0));
+	json_object_object_add(jt, "cascade_runs", json_object_new_int(cas->runs));
+	json_object_object_add(result, "timings", jt);
+}
+
+/**
+ * Called each time the device is done while the cascade is pending;
+ * the result is complete once it is no longer pending.
+ */
+static const char *drpai_cascade_step(struct drpai *d, json_object *result)
+{
+	struct drpai_cascade *cas = d->cascade;
+	int rc;
+
+	if (cas->pending) {
+		rc = drpai_cascade_collect(d);
+		if (rc) {
+			lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
+			cas->pending = false;
+			return "DRP AI cascade post-processing error";
+		}
+	}
+
+	rc = drpai_cascade_next(d);
+	if (rc) {
+		lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
+		cas->pending = false;
+		return "DRP AI cascade start error";
+	}
 
-	/* FIXME: this provides the physical address */
-	d->input_data[DRPAI_INDEX_INPUT].address = d->udmabuf.input;
-	memcpy(d->udmabuf.usrptr, addr, len); /* copy the data */
+	if (!cas->pending) {
+		drpai_cascade_timings(cas, result);
+		cas->objects = NULL;
+	}
 
-	return 0;
+	return NULL;
 }
 
-static int drpai_start(struct drpai *d)
+/* Detections of the tile that just ran; already in frame coordinates */
+static int drpai_tiles_collect(struct drpai *d, json_object *result)
 {
-	if (!d)
-		return -EINVAL;
+	struct drpai_tiling *tl = &d->tiling;
+	struct drpai_frame frame;
+	struct drpai_tensor out;
+	json_object *res, *arr;
+	int i, num, rc;
 
-	if (ioctl(d->fd, DRPAI_START, d->input_data))
-		return -errno;
+	rc = drpai_get_result_tensor(d, &out);
+	if (rc)
+		return rc;
 
-	return 0;
+	res = json_object_new_object();
+	if (!res)
+		return -ENOMEM;
+
+	drpai_model_get_frame(d, &frame);
+	rc = d->model.ops->postprocessing(d->model.priv, &out, &frame, res);
+	if (rc)
+		goto out;
+
+	/* only object detections can be put back together */
+	arr = json_object_object_get(res, "value");
+	if (!json_object_is_type(arr, json_type_array)) {
+		rc = -EOPNOTSUPP;
+		goto out;
+	}
+
+	if (!json_object_object_get(result, "name"))
+		json_object_object_add(result, "name",
+				       json_object_get(json_object_object_get(res, "name")));
+
+	num = json_object_array_length(arr);
+	for (i = 0; i < num; i++) {
+		json_object *obj = json_object_array_get_idx(arr, i);
+
+		if (!json_object_object_get(obj, "box"))
+			continue;
+
+		json_object_object_add(obj, "tile", json_object_new_int(tl->current));
+		json_object_array_add(tl->objects, json_object_get(obj));
+	}
+out:
+	json_object_put(res);
+	return rc;
 }
 
-int drpai_is_running(struct drpai *d)
+struct drpai_tile_det {
+	json_object *obj;
+	const char *label;
+	float prob;
+	int tile;
+	int x0, y0, x1, y1;
+	bool merged;
+};
+
+/* highest probability first */
+static int drpai_tile_det_cmp(const void *a, const void *b)
 {
-	drpai_status_t drp_status;
-	int rc;
+	const struct drpai_tile_det *da = a, *db = b;
 
-	if (!d)
-		return 0;
+	return (da->prob < db->prob) - (da->prob > db->prob);
+}
 
-	rc = ioctl(d->fd, DRPAI_GET_STATUS, &drp_status);
-	if (rc)
-		return (errno == EBUSY);
+static bool drpai_tile_det_same_label(const struct drpai_tile_det *a,
+				      const struct drpai_tile_det *b)
+{
+	if (!a->label || !b->label)
+		return a->label == b->label;
 
-	return !drp_status.err && drp_status.status == DRPAI_STATUS_RUN;
+	return !strcmp(a->label, b->label);
 }
 
-static float *drpai_get_result_raw(struct drpai *d, int *err)
+/**
+ * NMS across the tile seams: an object in the overlap is found by more
+ * than one tile, and an object cut by a seam shows up as a part in each.
+ * So detections of the same label from different tiles are merged when
+ * the smaller box mostly lies within the larger, and the merged box
+ * covers both. Detections of the same tile were already filtered by the
+ * model post-processing.
+ */
+static json_object *drpai_tiles_merge(struct drpai_tiling *tl)
 {
-	const drpai_data_t* addr;
-	float *output;
-	size_t left_to_read, total_read;
-	int lerr;
+	int num = json_object_array_length(tl->objects);
+	struct drpai_tile_det *dets;
+	json_object *arr;
+	int i, j;
+
+	arr = json_object_new_array();
+	dets = calloc(num ? num : 1, sizeof(*dets));
+	if (!arr || !dets) {
+		json_object_put(arr);
+		free(dets);
+		return NULL;
+	}
 
-	if (!d) {
-		lerr = -EINVAL;
-		goto err_store;
+	for (i = 0; i < num; i++) {
+		struct drpai_tile_det *e = &dets[i];
+		json_object *jbox;
+
+		e->obj = json_object_array_get_idx(tl->objects, i);
+		jbox = json_object_object_get(e->obj, "box");
+		e->label = json_object_get_string(json_object_object_get(e->obj, "label"));
+		e->prob = json_object_get_double(json_object_object_get(e->obj, "probability"));
+		e->tile = drpai_config_get_int(e->obj, "tile", 0);
+		e->x0 = drpai_config_get_int(jbox, "x", 0);
+		e->y0 = drpai_config_get_int(jbox, "y", 0);
+		e->x1 = e->x0 + drpai_config_get_int(jbox, "w", 0);
+		e->y1 = e->y0 + drpai_config_get_int(jbox, "h", 0);
 	}
 
-	addr = &d->input_data[DRPAI_INDEX_OUTPUT];
-	if ((lerr = drpai_assign(d, addr)))
-		goto err_store;
+	if (num > 1)
+		qsort(dets, num, sizeof(*dets), drpai_tile_det_cmp);
 
-	output = malloc(addr->size);
-	if (!output) {
-		lerr = -ENOMEM;
-		goto err_store;
-	}
+	for (i = 0; i < num; i++) {
+		struct drpai_tile_det *a = &dets[i];
+		bool grown = false;
 
-	total_read = 0;
-	left_to_read = addr->size;
-	while (left_to_read > 0) {
-		int rc = read(d->fd, &output[total_read], left_to_read);
-		if (rc == 0)
-			break;
-		if (rc < 0) {
-			lerr = -errno;
-			goto err_free;
+		if (a->merged)
+			continue;
+
+		for (j = i + 1; j < num; j++) {
+			struct drpai_tile_det *b = &dets[j];
+			int64_t iw, ih, area_a, area_b;
+
+			if (b->merged || b->tile == a->tile || !drpai_tile_det_same_label(a, b))
+				continue;
+
+			iw = min(a->x1, b->x1) - (a->x0 > b->x0 ? a->x0 : b->x0);
+			ih = min(a->y1, b->y1) - (a->y0 > b->y0 ? a->y0 : b->y0);
+			if (iw <= 0 || ih <= 0)
+				continue;
+
+			area_a = (int64_t)(a->x1 - a->x0) * (a->y1 - a->y0);
+			area_b = (int64_t)(b->x1 - b->x0) * (b->y1 - b->y0);
+			if (iw * ih < tl->cfg.merge * min(area_a, area_b))
+				continue;
+
+			a->x0 = min(a->x0, b->x0);
+			a->y0 = min(a->y0, b->y0);
+			a->x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+			a->y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+			b->merged = true;
+			grown = true;
 		}
 
-		left_to_read -= rc;
-		total_read += rc;
+		if (grown) {
+			json_object *jbox = json_object_object_get(a->obj, "box");
+
+			json_object_object_add(jbox, "x", json_object_new_int(a->x0));
+			json_object_object_add(jbox, "y", json_object_new_int(a->y0));
+			json_object_object_add(jbox, "w", json_object_new_int(a->x1 - a->x0));
+			json_object_object_add(jbox, "h", json_object_new_int(a->y1 - a->y0));
+		}
+
+		json_object_array_add(arr, json_object_get(a->obj));
 	}
 
-	return output;
-err_free:
-	free(output);
-err_store:
-	if (err)
-		*err = lerr;
-	return NULL;
+	free(dets);
+
+	return arr;
 }
 
-const char *drpai_model_load_input(struct drpai *d, void *addr, int len)
+/**
+ * Called each time a tile is done; starts the next one, and once all are
+ * done, puts the merged detections in the result.
+ */
+static const char *drpai_tiles_step(struct drpai *d, json_object *result)
 {
+	struct drpai_tiling *tl = &d->tiling;
+	const char *err_msg = "DRP AI tile post-processing error";
+	json_object *arr;
 	int rc;
 
-	if (!d) {
-		return "DRP AI object not initialized";
+	if (!tl->pending) {
+		json_object_put(tl->objects);
+		tl->objects = json_object_new_array();
+		if (!tl->objects) {
+			rc = -ENOMEM;
+			goto err;
+		}
+		tl->start_us = d->start_us;
 	}
 
-	rc = drpai_load(d, addr, len);
-	if (rc) {
-		lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
-		return "DRP AI load error";
+	rc = drpai_tiles_collect(d, result);
+	if (rc)
+		goto err;
+
+	if (++tl->current < tl->num) {
+		drpai_input_select(d, tl->current);
+		rc = drpai_start(d);
+		if (rc) {
+			err_msg = "DRP AI tile start error";
+			goto err;
+		}
+		tl->pending = true;
+		return NULL;
+	}
+
+	tl->pending = false;
+
+	arr = drpai_tiles_merge(tl);
+	if (!arr) {
+		rc = -ENOMEM;
+		goto err;
 	}
+	json_object_object_add(result, "value", arr);
+	json_object_object_add(result, "tiles", json_object_new_int(tl->num));
+	json_object_object_add(result, "tiles_ms",
+			       json_object_new_double((monotonic_now_us() - tl->start_us) / 1000.0));
+
+	json_object_put(tl->objects);
+	tl->objects = NULL;
 
 	return NULL;
+err:
+	lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
+	tl->pending = false;
+	json_object_put(tl->objects);
+	tl->objects = NULL;
+	return err_msg;
 }
 
-const char *drpai_model_start(struct drpai *d)
+bool drpai_model_pending(struct drpai *d)
 {
-	int rc;
+	return d && ((d->cascade && d->cascade->pending) || d->tiling.pending ||
+		     d->decode.pending);
+}
 
-	if (!d) {
-		return "DRP AI object not initialized";
-	}
+bool drpai_model_decoding(struct drpai *d)
+{
+	return d && d->decode.pending && !__atomic_load_n(&d->decode.done, __ATOMIC_ACQUIRE);
+}
+
+void drpai_model_set_notify(struct drpai *d, void (*notify)(void *arg), void *arg)
+{
+	d->notify = notify;
+	d->notify_arg = arg;
+}
+
+/* On the thread that ran the last job of the decode */
+static void drpai_decode_done(void *arg, int err)
+{
+	struct drpai *d = arg;
+
+	d->decode.err = err;
+	__atomic_store_n(&d->decode.done, true, __ATOMIC_RELEASE);
+	d->notify(d->notify_arg);
+}
+
+/* The output of the model is post-processed; a cascade goes on from there */
+static const char *drpai_postprocessed(struct drpai *d, int rc, json_object *result)
+{
+	struct drpai_cascade *cas = d->cascade;
 
-	rc = drpai_start(d);
 	if (rc) {
-		lwsl_warn("%s %d err %s\n", __func__, __LINE__, strerror(-rc));
-		return "DRP AI start error";
+		return "DRP AI post-processing error";
 	}
 
-	return NULL;
+	if (!cas)
+		return NULL;
+
+	cas->detect_us = d->decode.start_us - d->start_us;
+	cas->decode_us = monotonic_now_us() - d->decode.start_us;
+	cas->second_us = 0;
+	cas->second_decode_us = 0;
+	cas->runs = 0;
+	cas->next = 0;
+	cas->objects = json_object_object_get(result, "value");
+	if (!json_object_is_type(cas->objects, json_type_array)) {
+		cas->objects = NULL;
+		return NULL;
+	}
+
+	return drpai_cascade_step(d, result);
+}
+
+static const char *drpai_decode_collect(struct drpai *d, json_object *result)
+{
+	const struct drpai_model_ops *ops = d->model.ops;
+
+	d->decode.pending = false;
+
+	return drpai_postprocessed(d, ops->postprocessing_finish(d->model.priv,
+								   d->decode.err, result),
+				   result);
+}
+
+uint64_t drpai_model_read_us(struct drpai *d)
+{
+	return d ? d->read_us : 0;
 }
 
 const char *drpai_model_get_result(struct drpai *d, json_object* result)
 {
 	const struct drpai_model_ops *ops;
-	float *raw = NULL;
-	int rc = 0;
+	struct drpai_cascade *cas;
+	int rc;
+
+	d->read_us = 0;
+
+	if (d->decode.pending)
+		return drpai_decode_collect(d, result);
+
+	cas = d->cascade;
+	if (cas && cas->pending)
+		return drpai_cascade_step(d, result);
 
 	/* Yep, a bit weird to run DRP AI and not do any post-processing */
 	ops = d->model.ops;
 	if (!ops || !ops->postprocessing)
 		return NULL;
 
-	raw = drpai_get_result_raw(d, &rc);
-	if (!raw || rc) {
+	if (d->tiling.num)
+		return drpai_tiles_step(d, result);
+
+	d->decode.start_us = monotonic_now_us();
+
+	rc = drpai_get_result_tensor(d, &d->decode.out);
+	if (rc) {
 		return "DRP AI error retrieving result";
 	}
 
-	/* FIXME: find a neat way to pass width, height */
-	rc = ops->postprocessing(d->model.priv, raw, 640, 480, result);
-	free(raw);
-	if (rc) {
-		return "DRP AI post-processing error";
+	drpai_model_get_frame(d, &d->decode.frame);
+
+	/* off the event loop, if there is someone to tell when it is done */
+	if (d->notify && ops->postprocessing_start && ops->postprocessing_finish) {
+		__atomic_store_n(&d->decode.done, false, __ATOMIC_RELAXED);
+		rc = ops->postprocessing_start(d->model.priv, &d->decode.out, &d->decode.frame,
+					       drpai_decode_done, d);
+		if (!rc) {
+			d->decode.pending = true;
+			/* without threads, it is done already */
+			return drpai_model_decoding(d) ? NULL : drpai_decode_collect(d, result);
+		}
+		if (rc != -EOPNOTSUPP)
+			return drpai_postprocessed(d, rc, result);
 	}
 
-	return NULL;
+	rc = ops->postprocessing(d->model.priv, &d->decode.out, &d->decode.frame, result);
+
+	return drpai_postprocessed(d, rc, result);
+}
+
+int drpai_plugin_bench(json_object *req)
+{
+	json_object *jval, *c, *val = NULL;
+	const char *model;
+	int rc, iterations;
+
+	jval = json_object_object_get(req, "value");
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+	iterations = json_object_get_int(json_object_object_get(jval, "iterations"));
+	if (!model || strchr(model, '/')) {
+		rc = -EINVAL;
+		goto err;
+	}
+
+	c = drpai_model_config_open(model, &rc);
+	if (!c) {
+		rc = rc ? rc : -ENOENT;
+		goto err;
+	}
+
+	val = json_object_new_object();
+	if (!val) {
+		json_object_put(c);
+		rc = -ENOMEM;
+		goto err;
+	}
+
+	rc = drpai_plugins_bench(c, iterations ? iterations : 100, val);
+	json_object_put(c);
+	if (rc)
+		goto err;
+
+	json_object_object_add(req, "value", val);
+
+	return 0;
+err:
+	json_object_put(val);
+	json_object_object_add(req, "error", json_object_new_string(strerror(-rc)));
+	lwsl_err("%s: %s\n", __func__, strerror(-rc));
+	return rc;
 }
 
-static bool drpai_model_has_required_files(const char *name)
+/*
+ * Pack a single stage model directory, with its config, into a package;
+ * the package is then what gets loaded. On the worker pool.
+ */
+static int __drpai_model_pack(const char *model)
 {
-	bool required_files[DRPAI_INDEX_NUM];
-	bool have_addrmap_file = false;
+	struct drpai_pkg_input in[DRPAI_INDEX_NUM + 2];
+	char paths[DRPAI_INDEX_NUM][768];
+	drpai_data_t addrs[DRPAI_INDEX_NUM];
+	char dir[512], config[512], param_info[768];
+	json_object *c;
 	struct dirent *ep;
-	char path[512];
+	bool has_config;
+	struct stat st;
+	int i, idx, n = 0, rc;
 	DIR *dp;
 
-	snprintf(path, sizeof(path), "%s/%s", DRPAI_MODELS_ROOT_DIR, name);
+	/* the config file, not what may be in a package already */
+	snprintf(config, sizeof(config), "%s/%s.json", DRPAI_MODELS_ROOT_DIR, model);
+	has_config = !stat(config, &st);
+	c = has_config ? json_object_from_file(config) : NULL;
+	rc = has_config && !c ? -EINVAL : 0;
+	if (json_object_object_get(c, "sequence"))
+		rc = -EOPNOTSUPP;
+	json_object_put(c);
+	if (rc)
+		return rc;
+
+	snprintf(dir, sizeof(dir), "%s/%s", DRPAI_MODELS_ROOT_DIR, model);
+	rc = drpai_read_addrmap(dir, addrs);
+	if (rc)
+		return rc;
 
-	dp = opendir(path);
+	dp = opendir(dir);
 	if (!dp)
-		return false;
+		return -errno;
 
+	memset(paths, 0, sizeof(paths));
 	while ((ep = readdir(dp))) {
-		int idx;
-		if (strcmp(ep->d_name, ".") == 0)
-			continue;
+		idx = drpai_find_index(ep->d_name);
+		if (idx >= 0)
+			snprintf(paths[idx], sizeof(paths[idx]), "%s/%s", dir, ep->d_name);
+	}
 
-		if (strcmp(ep->d_name, "..") == 0)
-			continue;
+	closedir(dp);
 
-		if (str_endswith(ep->d_name, ADDRMAP_INTM_TXT_FILTER)) {
-			have_addrmap_file = true;
+	memset(in, 0, sizeof(in));
+	if (has_config) {
+		in[n].section.type = DRPAI_PKG_CONFIG;
+		in[n++].path = config;
+	}
+	for (i = 0; i < DRPAI_INDEX_NUM; i++) {
+		if (!addrs[i].size && !paths[i][0])
 			continue;
-		}
 
-		idx = drpai_find_index(ep->d_name);
-		if (idx < 0)
-			continue;
+		in[n].section.type = DRPAI_PKG_REGION;
+		in[n].section.index = i;
+		in[n].section.address = addrs[i].address;
+		in[n].section.region_size = addrs[i].size;
+		in[n++].path = paths[i][0] ? paths[i] : NULL;
+	}
 
-		required_files[idx] = true;
+	snprintf(param_info, sizeof(param_info), "%s/%s", dir, DRP_PARAM_INFO_FNAME);
+	if (!stat(param_info, &st)) {
+		in[n].section.type = DRPAI_PKG_PARAM_INFO;
+		in[n++].path = param_info;
 	}
 
-	closedir(dp);
+	return drpai_pkg_write(model, in, n);
+}
+
+/* A drpai_model_pack() on the worker pool */
+struct drpai_pack {
+	struct workers_batch batch;
+	struct workers *workers;
+	json_object *req;
+	char model[256];
+	void (*notify)(void *arg);
+	void *notify_arg;
+	int rc;
+	bool done;
+	struct drpai_pack *next;	/* in drpai_pack_orphans */
+};
 
-	return required_files[DRPAI_INDEX_DRP_CFG] &&
-		required_files[DRPAI_INDEX_AIMAC_DESC] &&
-		required_files[DRPAI_INDEX_DRP_DESC] &&
-		required_files[DRPAI_INDEX_DRP_PARAM] &&
-		required_files[DRPAI_INDEX_WEIGHT] &&
-		have_addrmap_file;
+/* Of sessions that went away before their pack was done */
+static struct drpai_pack *drpai_pack_orphans;
+
+static int drpai_pack_job(void *arg, int job)
+{
+	struct drpai_pack *p = arg;
+
+	return __drpai_model_pack(p->model);
 }
 
-int drpai_models_get(json_object *req)
+/* On the worker thread, which still holds the batch */
+static void drpai_pack_done(void *arg, int err)
 {
-	json_object *val = NULL;
-	json_object *models;
-	struct dirent *ep;
-	const char *err;
-	DIR *dp;
+	struct drpai_pack *p = arg;
+
+	p->rc = err;
+	__atomic_store_n(&p->done, true, __ATOMIC_RELEASE);
+	if (p->notify)
+		p->notify(p->notify_arg);
+}
+
+static void drpai_pack_release(struct drpai_pack *p)
+{
+	workers_wait(p->workers, &p->batch);
+	workers_put(p->workers);
+	json_object_put(p->req);
+	free(p);
+}
+
+static void drpai_pack_reap(void)
+{
+	struct drpai_pack **pp = &drpai_pack_orphans, *p;
+
+	while ((p = *pp)) {
+		if (__atomic_load_n(&p->done, __ATOMIC_ACQUIRE)) {
+			*pp = p->next;
+			drpai_pack_release(p);
+		} else {
+			pp = &p->next;
+		}
+	}
+}
+
+int drpai_model_pack(json_object *req, struct drpai_pack **pack,
+		     void (*notify)(void *arg), void *arg)
+{
+	struct drpai_pack *p = NULL;
+	json_object *jval;
+	const char *model;
+	int rc;
 
-	dp = opendir(DRPAI_MODELS_ROOT_DIR);
-	if (!dp) {
-		err = "could not open: " DRPAI_MODELS_ROOT_DIR;
+	drpai_pack_reap();
+
+	jval = json_object_object_get(req, "value");
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+	if (!model || strchr(model, '/') || model[0] == '.' ||
+	    strlen(model) >= sizeof(p->model)) {
+		rc = -EINVAL;
 		goto err;
 	}
 
-	val = json_object_new_object();
-	if (!val) {
-		err = "error allocating JSON object";
+	/* one at a time, per session */
+	if (*pack) {
+		rc = -EBUSY;
 		goto err;
 	}
 
-	/* allocate JSON array for model names */
-	models = json_object_new_array();
-	if (!models) {
-		err = "error creating JSON array for model names";
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		rc = -ENOMEM;
 		goto err;
 	}
-	json_object_object_add(val, "models", models);
 
-	while ((ep = readdir(dp))) {
-		if (ep->d_type != DT_DIR)
-			continue;
+	p->workers = workers_get(1, &rc);
+	if (!p->workers)
+		goto err;
 
-		if (strcmp(ep->d_name, ".") == 0)
-			continue;
+	snprintf(p->model, sizeof(p->model), "%s", model);
+	p->req = json_object_get(req);
+	p->notify = notify;
+	p->notify_arg = arg;
+	*pack = p;
 
-		if (strcmp(ep->d_name, "..") == 0)
-			continue;
+	/* it copies, and syncs, the whole model */
+	workers_post(p->workers, &p->batch, 1, drpai_pack_job, p, drpai_pack_done, p);
 
-		if (!drpai_model_has_required_files(ep->d_name))
-			continue;
+	return 1;
+err:
+	free(p);
+	json_object_object_add(req, "error", json_object_new_string(strerror(-rc)));
+	lwsl_err("%s: %s\n", __func__, strerror(-rc));
+	return rc;
+}
+
+json_object *drpai_model_pack_reply(struct drpai_pack **pack)
+{
+	struct drpai_pack *p = *pack;
+	json_object *req, *val;
+
+	if (!p || !__atomic_load_n(&p->done, __ATOMIC_ACQUIRE))
+		return NULL;
 
-		json_object_array_add(models, json_object_new_string(ep->d_name));
+	req = json_object_get(p->req);
+	if (p->rc) {
+		json_object_object_add(req, "error", json_object_new_string(strerror(-p->rc)));
+		lwsl_err("%s: %s: %s\n", __func__, p->model, strerror(-p->rc));
+	} else {
+		/* 'model' goes away with the old "value" */
+		val = json_object_new_object();
+		json_object_object_add(val, "model", json_object_new_string(p->model));
+		json_object_object_add(req, "value", val);
+		lwsl_notice("%s: %s\n", __func__, p->model);
 	}
 
-	json_object_object_add(req, "value", val);
+	drpai_pack_release(p);
+	*pack = NULL;
 
-	closedir(dp);
+	return req;
+}
 
-	return 0;
-err:
-	json_object_put(val);
-	closedir(dp);
-	json_object_object_add(req, "error", json_object_new_string(err));
-	lwsl_err("%s: %s\n", __func__, err);
-	return -1;
+void drpai_model_pack_free(struct drpai_pack *pack)
+{
+	drpai_pack_reap();
+	if (!pack)
+		return;
+
+	/* the worker still has it */
+	if (!__atomic_load_n(&pack->done, __ATOMIC_ACQUIRE)) {
+		pack->next = drpai_pack_orphans;
+		drpai_pack_orphans = pack;
+		return;
+	}
+
+	drpai_pack_release(pack);
+}
+
+void drpai_metrics(struct metrics *m)
+{
+	const struct drpai *d;
+	uint32_t end;
+	int i;
+
+	metrics_family(m, "etb_drpai_model_loads_total", "counter",
+		       "Models loaded on the DRP AI instances");
+	metrics_printf(m, "etb_drpai_model_loads_total{result=\"ok\"} %lu\n"
+		       "etb_drpai_model_loads_total{result=\"error\"} %lu\n",
+		       __atomic_load_n(&drpai_load_stats.loads, __ATOMIC_RELAXED),
+		       __atomic_load_n(&drpai_load_stats.failures, __ATOMIC_RELAXED));
+
+	metrics_family(m, "etb_drpai_model_load_seconds_total", "counter",
+		       "Time taken by the model loads that succeeded");
+	metrics_printf(m, "etb_drpai_model_load_seconds_total %.6f\n",
+		       __atomic_load_n(&drpai_load_stats.load_us, __ATOMIC_RELAXED) / 1e6);
+
+	metrics_family(m, "etb_drpai_model_last_load_seconds", "gauge",
+		       "Time taken by the last model load that succeeded");
+	if (__atomic_load_n(&drpai_load_stats.loads, __ATOMIC_RELAXED)) {
+		metrics_printf(m, "etb_drpai_model_last_load_seconds{model=\"");
+		metrics_label(m, drpai_load_stats.last_model);
+		metrics_printf(m, "\"} %.6f\n",
+			       __atomic_load_n(&drpai_load_stats.last_us, __ATOMIC_RELAXED) / 1e6);
+	}
+
+	metrics_family(m, "etb_drpai_memory_bytes", "gauge",
+		       "DRP AI memory area of an instance");
+	for (i = 0; i < drpai_num_instances; i++)
+		metrics_printf(m, "etb_drpai_memory_bytes{instance=\"%d\"} %u\n",
+			       i, drpai_instances[i]->base.size);
+
+	metrics_family(m, "etb_drpai_memory_used_bytes", "gauge",
+		       "DRP AI memory taken by the loaded model(s) of an instance");
+	for (i = 0; i < drpai_num_instances; i++) {
+		d = drpai_instances[i];
+		end = drpai_model_mem_end(d);
+		if (d->cascade && drpai_model_mem_end(d->cascade->second) > end)
+			end = drpai_model_mem_end(d->cascade->second);
+		metrics_printf(m, "etb_drpai_memory_used_bytes{instance=\"%d\"} %u\n",
+			       i, end - d->base.address);
+	}
 }
@@ -4,26 +4,103 @@
 #include <json-c/json.h>
 #include "models.h"
 
-// FIXME hard-coded
-#define DRPAI_BUF_LEN	(640 * 480 * 2)
-
 extern bool drpai_active;
-extern struct drpai *drpai;
 
 struct drpai;
+struct metrics;
+
+/* Reference counted; all instances are opened on the first drpai_get() */
+int drpai_get(void);
+void drpai_put(void);
 
-struct drpai *drpai_init(int *err);
-void drpai_free(struct drpai *d);
+int drpai_instances_count(void);
+struct drpai *drpai_instance(int idx);
+
+/* Model loads, and the DRP AI memory the models take */
+void drpai_metrics(struct metrics *m);
 
 int drpai_is_running(struct drpai *d);
 
-const char *drpai_model_load_input(struct drpai *d, void *addr, int len);
+/**
+ * Tiling of high resolution frames: the frame is split into 'cols' x 'rows'
+ * overlapping tiles, each run through the model at full input resolution,
+ * and the detections are merged back into frame coordinates.
+ *   "tiles": { "cols": 2, "rows": 2,
+ *              "overlap": <fraction of a tile shared with its neighbour>,
+ *              "merge": <overlap of the smaller box above which detections
+ *                        from different tiles are merged, 0..1> }
+ */
+struct drpai_tiles {
+	int cols;
+	int rows;
+	float overlap;
+	float merge;
+};
+
+#define DRPAI_MAX_TILES		16
+
+int drpai_tiles_parse(json_object *cfg, struct drpai_tiles *tiles);
+
+/* 'tiles' overrides the tiling of the model config; NULL to keep it.
+ * With a 'roi', only its bounding box is given to the model, and object
+ * detection skips whatever is outside of it.
+ */
+const char *drpai_model_load_input(struct drpai *d, const void *addr, int width, int height,
+				   const struct drpai_tiles *tiles, struct drpai_roi *roi);
 const char *drpai_model_start(struct drpai *d);
 const char *drpai_model_get_result(struct drpai *d, json_object* result);
+/* True if drpai_model_get_result() started more runs on the same frame
+ * (cascade, tiles), or a decode on the worker pool; it is to be called
+ * again, with the same result object, once the device is done and
+ * drpai_model_decoding() is false.
+ */
+bool drpai_model_pending(struct drpai *d);
+bool drpai_model_decoding(struct drpai *d);
+/**
+ * Decoders that can, then run on the worker pool rather than in
+ * drpai_model_get_result(); 'notify' is called from the pool when one
+ * is done, e.g. to wake up the event loop.
+ */
+void drpai_model_set_notify(struct drpai *d, void (*notify)(void *arg), void *arg);
+/* Of the time in the last drpai_model_get_result(), how much went to
+ * reading the output of the device; the rest is post-processing.
+ */
+uint64_t drpai_model_read_us(struct drpai *d);
+
+int drpai_model_set_crop(struct drpai *d, int x, int y, int width, int height);
+
+int drpai_load_model(json_object *req);
+
+#define DRPAI_MODEL_FILE_ADDRMAP	-2
+#define DRPAI_MODEL_FILE_PARAM_INFO	-3
+
+/* The DRPAI_INDEX_* of a model file, DRPAI_MODEL_FILE_ADDRMAP for the
+ * address map, DRPAI_MODEL_FILE_PARAM_INFO for the DRP parameter info,
+ * or -1 for any other file.
+ */
+int drpai_model_file_kind(const char *name);
+
+/* Time the decoder of a plugin model ("value": { "model", "iterations" }) */
+int drpai_plugin_bench(json_object *req);
+
+/* A model pack going on; opaque */
+struct drpai_pack;
+
+/**
+ * Pack a model directory into a single file ("value": { "model" }); see
+ * pkg.h. That reads and writes the whole model, so it runs on the worker
+ * pool: returns 1 with '*pack' set, and 'notify' is called from there
+ * once drpai_model_pack_reply() has the reply. Otherwise 'req' has the
+ * error already.
+ */
+int drpai_model_pack(json_object *req, struct drpai_pack **pack,
+		     void (*notify)(void *arg), void *arg);
 
-int drpai_load_model(struct drpai *d, json_object *req);
+/* 'req' with its "value" or "error" (to be put), once the pack is done */
+json_object *drpai_model_pack_reply(struct drpai_pack **pack);
 
-int drpai_models_get(json_object *req);
+/* Of a session that goes away; a pack still going is left to finish */
+void drpai_model_pack_free(struct drpai_pack *pack);
 
 // FIXME: hack
 int drpai_model_run_and_wait_hack(void *addr, json_object *result);
@@ -0,0 +1,396 @@
+
+#include "image.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* Value used to fill the borders; mid-gray, like the Darknet letterbox */
+#define LETTERBOX_FILL	128
+
+struct image_lut {
+	int a0;		/* first source offset */
+	int a1;		/* second source offset */
+	uint8_t w;	/* weight of the second sample, out of 256 */
+};
+
+struct image_letterbox {
+	int src_w;
+	int src_h;
+	int dst_w;
+	int dst_h;
+	enum image_format fmt;
+	/* resized frame size and its offset inside the destination */
+	int out_w;
+	int out_h;
+	int pad_x;
+	int pad_y;
+	float scale;
+	/* horizontal LUT is per output byte of a YUYV row, vertical per row */
+	struct image_lut *hlut;
+	struct image_lut *vlut;
+	/* two horizontally resampled source rows, and which rows they are */
+	uint8_t *rows[2];
+	int row_idx[2];
+	/* vertically blended YUYV row, when converting to RGB */
+	uint8_t *tmp;
+};
+
+static const struct {
+	const char *name;
+	enum image_format fmt;
+	int bpp;
+} image_formats[] = {
+	{ "yuyv",	IMAGE_FORMAT_YUYV,	2 },
+	{ "rgb",	IMAGE_FORMAT_RGB,	3 },
+	{ "bgr",	IMAGE_FORMAT_BGR,	3 },
+	{ }
+};
+
+enum image_format image_format_from_string(const char *s)
+{
+	int i;
+
+	if (!s)
+		return IMAGE_FORMAT_INVALID;
+
+	for (i = 0; image_formats[i].name; i++) {
+		if (strcmp(s, image_formats[i].name) == 0)
+			return image_formats[i].fmt;
+	}
+
+	return IMAGE_FORMAT_INVALID;
+}
+
+int image_format_bytes_per_pixel(enum image_format fmt)
+{
+	int i;
+
+	for (i = 0; image_formats[i].name; i++) {
+		if (image_formats[i].fmt == fmt)
+			return image_formats[i].bpp;
+	}
+
+	return 0;
+}
+
+static void image_lut_entry(struct image_lut *e, float pos, int max, int stride, int offs)
+{
+	int i0, i1, w;
+
+	if (pos < 0)
+		pos = 0;
+	if (pos > max)
+		pos = max;
+
+	i0 = (int)pos;
+	i1 = i0 < max ? i0 + 1 : i0;
+
+	/* out of 256, as the blends shift by 8 */
+	w = lrintf((pos - i0) * 256.0f);
+	if (w == 256) {
+		i0 = i1;
+		w = 0;
+	}
+
+	e->a0 = i0 * stride + offs;
+	e->a1 = i1 * stride + offs;
+	e->w = w;
+}
+
+/**
+ * The horizontal LUT works directly on YUYV bytes: even bytes are luma
+ * and sample from neighbouring source pixels; odd bytes are U or V and
+ * sample from neighbouring source macro-pixels. This way one gather loop
+ * handles both.
+ */
+static void image_letterbox_build_luts(struct image_letterbox *lb)
+{
+	const float rx = (float)lb->src_w / lb->out_w;
+	const float ry = (float)lb->src_h / lb->out_h;
+	int b, y;
+
+	for (b = 0; b < lb->out_w * 2; b++) {
+		int px = b / 2;
+		float pos;
+
+		if ((b & 1) == 0) {
+			pos = (px + 0.5f) * rx - 0.5f;
+			image_lut_entry(&lb->hlut[b], pos, lb->src_w - 1, 2, 0);
+		} else {
+			/* chroma of output macro-pixel, centred between its two pixels */
+			pos = ((px & ~1) + 1.0f) * rx - 0.5f;
+			pos = (pos - 0.5f) / 2.0f;
+			image_lut_entry(&lb->hlut[b], pos, lb->src_w / 2 - 1, 4,
+					(px & 1) ? 3 : 1);
+		}
+	}
+
+	for (y = 0; y < lb->out_h; y++) {
+		float pos = (y + 0.5f) * ry - 0.5f;
+		image_lut_entry(&lb->vlut[y], pos, lb->src_h - 1, 1, 0);
+	}
+}
+
+struct image_letterbox *image_letterbox_create(int src_w, int src_h,
+					       int dst_w, int dst_h,
+					       enum image_format fmt, int *err)
+{
+	struct image_letterbox *lb;
+	int i, lerr = -ENOMEM;
+
+	/* YUYV needs even widths */
+	if (src_w < 2 || src_h < 1 || dst_w < 2 || dst_h < 1 ||
+	    (src_w & 1) || (dst_w & 1) || !image_format_bytes_per_pixel(fmt)) {
+		lerr = -EINVAL;
+		goto err_store;
+	}
+
+	lb = calloc(1, sizeof(*lb));
+	if (!lb)
+		goto err_store;
+
+	lb->src_w = src_w;
+	lb->src_h = src_h;
+	lb->dst_w = dst_w;
+	lb->dst_h = dst_h;
+	lb->fmt = fmt;
+
+	lb->scale = (float)dst_w / src_w;
+	if ((float)dst_h / src_h < lb->scale)
+		lb->scale = (float)dst_h / src_h;
+
+	lb->out_w = ((int)lrintf(src_w * lb->scale)) & ~1;
+	lb->out_h = (int)lrintf(src_h * lb->scale);
+	if (lb->out_w > dst_w)
+		lb->out_w = dst_w;
+	if (lb->out_h > dst_h)
+		lb->out_h = dst_h;
+	if (lb->out_w < 2 || lb->out_h < 1) {
+		lerr = -EINVAL;
+		goto err_free;
+	}
+
+	lb->pad_x = ((dst_w - lb->out_w) / 2) & ~1;
+	lb->pad_y = (dst_h - lb->out_h) / 2;
+
+	lb->hlut = malloc(sizeof(*lb->hlut) * lb->out_w * 2);
+	lb->vlut = malloc(sizeof(*lb->vlut) * lb->out_h);
+	lb->tmp = malloc(lb->out_w * 2);
+	if (!lb->hlut || !lb->vlut || !lb->tmp)
+		goto err_free;
+
+	for (i = 0; i < 2; i++) {
+		lb->rows[i] = malloc(lb->out_w * 2);
+		if (!lb->rows[i])
+			goto err_free;
+		lb->row_idx[i] = -1;
+	}
+
+	image_letterbox_build_luts(lb);
+
+	return lb;
+err_free:
+	image_letterbox_free(lb);
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void image_letterbox_free(struct image_letterbox *lb)
+{
+	if (!lb)
+		return;
+
+	free(lb->hlut);
+	free(lb->vlut);
+	free(lb->rows[0]);
+	free(lb->rows[1]);
+	free(lb->tmp);
+	free(lb);
+}
+
+bool image_letterbox_matches(const struct image_letterbox *lb,
+			     int src_w, int src_h, int dst_w, int dst_h,
+			     enum image_format fmt)
+{
+	return lb && lb->src_w == src_w && lb->src_h == src_h &&
+		lb->dst_w == dst_w && lb->dst_h == dst_h && lb->fmt == fmt;
+}
+
+void image_letterbox_get_placement(const struct image_letterbox *lb,
+				   float *scale, int *pad_x, int *pad_y)
+{
+	*scale = lb->scale;
+	*pad_x = lb->pad_x;
+	*pad_y = lb->pad_y;
+}
+
+static void image_hresample(const struct image_lut *lut, const uint8_t *src,
+			    uint8_t *dst, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		const struct image_lut *e = &lut[i];
+		dst[i] = (src[e->a0] * (256 - e->w) + src[e->a1] * e->w + 128) >> 8;
+	}
+}
+
+/* dst = (a * (256 - w) + b * w) / 256, with w in 1..255 */
+static void image_vblend(const uint8_t *a, const uint8_t *b, uint8_t *dst,
+			 int n, uint8_t w)
+{
+	const uint8_t wa = 256 - w;
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	const uint8x16_t vwa = vdupq_n_u8(wa);
+	const uint8x16_t vwb = vdupq_n_u8(w);
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t va = vld1q_u8(a + i);
+		uint8x16_t vb = vld1q_u8(b + i);
+		uint16x8_t lo = vmull_u8(vget_low_u8(va), vget_low_u8(vwa));
+		uint16x8_t hi = vmull_u8(vget_high_u8(va), vget_high_u8(vwa));
+
+		lo = vmlal_u8(lo, vget_low_u8(vb), vget_low_u8(vwb));
+		hi = vmlal_u8(hi, vget_high_u8(vb), vget_high_u8(vwb));
+		vst1q_u8(dst + i, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+	}
+#elif defined(__SSE2__)
+	const __m128i vwa = _mm_set1_epi16(wa);
+	const __m128i vwb = _mm_set1_epi16(w);
+	const __m128i vround = _mm_set1_epi16(128);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i lo, hi;
+
+		lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), vwa),
+				   _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), vwb));
+		hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), vwa),
+				   _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), vwb));
+		lo = _mm_srli_epi16(_mm_add_epi16(lo, vround), 8);
+		hi = _mm_srli_epi16(_mm_add_epi16(hi, vround), 8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = (a[i] * wa + b[i] * w + 128) >> 8;
+}
+
+static inline uint8_t clamp_u8(int v)
+{
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+/* BT.601, limited range */
+static void image_yuyv_to_rgb(const uint8_t *src, uint8_t *dst, int width, bool bgr)
+{
+	const int ri = bgr ? 2 : 0;
+	const int bi = bgr ? 0 : 2;
+	int x;
+
+	for (x = 0; x < width; x += 2, src += 4) {
+		int d = src[1] - 128;
+		int e = src[3] - 128;
+		int cr = 409 * e + 128;
+		int cg = -100 * d - 208 * e + 128;
+		int cb = 516 * d + 128;
+		int k;
+
+		for (k = 0; k < 2; k++, dst += 3) {
+			int c = 298 * (src[2 * k] - 16);
+			dst[ri] = clamp_u8((c + cr) >> 8);
+			dst[1]  = clamp_u8((c + cg) >> 8);
+			dst[bi] = clamp_u8((c + cb) >> 8);
+		}
+	}
+}
+
+static const uint8_t *image_letterbox_row(struct image_letterbox *lb,
+					  const uint8_t *src, int src_stride, int row)
+{
+	int slot;
+
+	for (slot = 0; slot < 2; slot++) {
+		if (lb->row_idx[slot] == row)
+			return lb->rows[slot];
+	}
+
+	/* rows are consumed in increasing order; replace the older one */
+	slot = lb->row_idx[0] < lb->row_idx[1] ? 0 : 1;
+	image_hresample(lb->hlut, src + row * src_stride,
+			lb->rows[slot], lb->out_w * 2);
+	lb->row_idx[slot] = row;
+
+	return lb->rows[slot];
+}
+
+void image_letterbox_run_stride(struct image_letterbox *lb, const uint8_t *src,
+				int src_stride, uint8_t *dst)
+{
+	const int bpp = image_format_bytes_per_pixel(lb->fmt);
+	const int dst_stride = lb->dst_w * bpp;
+	const int out_bytes = lb->out_w * bpp;
+	const int left = lb->pad_x * bpp;
+	const int right = dst_stride - left - out_bytes;
+	int y;
+
+	if (lb->fmt == IMAGE_FORMAT_YUYV &&
+	    lb->src_w == lb->dst_w && lb->src_h == lb->dst_h) {
+		if (src_stride == dst_stride) {
+			memcpy(dst, src, lb->src_h * dst_stride);
+			return;
+		}
+		for (y = 0; y < lb->src_h; y++)
+			memcpy(dst + y * dst_stride, src + y * src_stride, dst_stride);
+		return;
+	}
+
+	lb->row_idx[0] = -1;
+	lb->row_idx[1] = -1;
+
+	memset(dst, LETTERBOX_FILL, lb->pad_y * dst_stride);
+
+	for (y = 0; y < lb->out_h; y++) {
+		const struct image_lut *e = &lb->vlut[y];
+		uint8_t *drow = dst + (lb->pad_y + y) * dst_stride;
+		uint8_t *out = lb->fmt == IMAGE_FORMAT_YUYV ? drow + left : lb->tmp;
+		const uint8_t *r0, *r1;
+
+		memset(drow, LETTERBOX_FILL, left);
+		memset(drow + left + out_bytes, LETTERBOX_FILL, right);
+
+		r0 = image_letterbox_row(lb, src, src_stride, e->a0);
+		if (e->w == 0) {
+			memcpy(out, r0, lb->out_w * 2);
+		} else {
+			r1 = image_letterbox_row(lb, src, src_stride, e->a1);
+			image_vblend(r0, r1, out, lb->out_w * 2, e->w);
+		}
+
+		if (lb->fmt != IMAGE_FORMAT_YUYV)
+			image_yuyv_to_rgb(lb->tmp, drow + left, lb->out_w,
+					  lb->fmt == IMAGE_FORMAT_BGR);
+	}
+
+	y = lb->pad_y + lb->out_h;
+	memset(dst + y * dst_stride, LETTERBOX_FILL, (lb->dst_h - y) * dst_stride);
+}
+
+void image_letterbox_run(struct image_letterbox *lb, const uint8_t *src, uint8_t *dst)
+{
+	image_letterbox_run_stride(lb, src, lb->src_w * 2, dst);
+}
@@ -0,0 +1,39 @@
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum image_format {
+	IMAGE_FORMAT_INVALID = -1,
+	IMAGE_FORMAT_YUYV,
+	IMAGE_FORMAT_RGB,
+	IMAGE_FORMAT_BGR,
+};
+
+/* Opaque type; letterbox resize of a YUYV frame into a model input */
+struct image_letterbox;
+
+enum image_format image_format_from_string(const char *s);
+int image_format_bytes_per_pixel(enum image_format fmt);
+
+struct image_letterbox *image_letterbox_create(int src_w, int src_h,
+					       int dst_w, int dst_h,
+					       enum image_format fmt, int *err);
+void image_letterbox_free(struct image_letterbox *lb);
+
+bool image_letterbox_matches(const struct image_letterbox *lb,
+			     int src_w, int src_h, int dst_w, int dst_h,
+			     enum image_format fmt);
+
+/* Placement of the resized frame: dst = src * scale + pad */
+void image_letterbox_get_placement(const struct image_letterbox *lb,
+				   float *scale, int *pad_x, int *pad_y);
+
+void image_letterbox_run(struct image_letterbox *lb, const uint8_t *src, uint8_t *dst);
+
+/* Same, for a source that is part of a larger frame, 'src_stride' bytes per row */
+void image_letterbox_run_stride(struct image_letterbox *lb, const uint8_t *src,
+				int src_stride, uint8_t *dst);
+
+#endif /* __IMAGE_H__ */
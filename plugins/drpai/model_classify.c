@@ -0,0 +1,202 @@
+
+#include "models.h"
+#include "vmath.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Image classification; the output tensor is one score per label.
+ * Config:
+ *   "labels": [ ... ],
+ *   "softmax": true, if the scores are logits
+ *   "thresh_prob": minimum probability (0..1) to report a class
+ *   "top_k": how many of the best classes to report (1 by default); the
+ *            best one is the "value", as before, and with top_k > 1 the
+ *            result also has them all, best first, in "top"
+ */
+struct classify_model_params {
+	char **labels;
+	int num_labels;
+	bool softmax;
+	float thresh_prob;
+	int top_k;
+	int *top;
+	float *exp;
+	/* the scores as floats, for narrow output types */
+	float *scores;
+	size_t num_scores;
+};
+
+/**
+ * The 'k' best scores, best first; returns how many. 'k' is a handful at
+ * most, so this keeps them in a sorted array, which most scores do not
+ * even get into, rather than sorting them all.
+ */
+static int classify_top_k(const float *data, int n, int k, int *top)
+{
+	int i, j, num = 0;
+
+	if (k == 1) {
+		top[0] = vmath_argmax(data, n, NULL);
+		return top[0] < 0 ? 0 : 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (num == k && !(data[i] > data[top[num - 1]]))
+			continue;
+		if (num < k)
+			num++;
+		/* later ones go after equal scores, like a stable sort */
+		for (j = num - 1; j > 0 && data[i] > data[top[j - 1]]; j--)
+			top[j] = top[j - 1];
+		top[j] = i;
+	}
+
+	return num;
+}
+
+static json_object *classify_class_new(const char *label, float prob)
+{
+	json_object *jobj = json_object_new_object();
+
+	if (!jobj)
+		return NULL;
+
+	json_object_object_add(jobj, "label", json_object_new_string(label));
+	json_object_object_add(jobj, "probability", json_object_new_double(prob * 100.0f));
+
+	return jobj;
+}
+
+static int classify_postprocessing(void *model_params, const struct drpai_tensor *out,
+				   const struct drpai_frame *frame,
+				   json_object *result)
+{
+	struct classify_model_params *p = model_params;
+	float sum = 0, prob;
+	const float *data;
+	json_object *jobj, *arr;
+	int i, num;
+
+	if (out->num < (size_t)p->num_labels)
+		return -EINVAL;
+
+	data = drpai_tensor_floats(out, &p->scores, &p->num_scores);
+	if (!data)
+		return -ENOMEM;
+
+	num = classify_top_k(data, p->num_labels, p->top_k, p->top);
+	if (!num)
+		return -EINVAL;
+
+	/* only the normalization is needed, not the whole softmax */
+	if (p->softmax) {
+		for (i = 0; i < p->num_labels; i++)
+			p->exp[i] = data[i] - data[p->top[0]];
+		vmath_exp(p->exp, p->exp, p->num_labels);
+		for (i = 0; i < p->num_labels; i++)
+			sum += p->exp[i];
+	}
+
+	jobj = json_object_new_object();
+	if (!jobj)
+		return -ENOMEM;
+
+	json_object_object_add(result, "name", json_object_new_string("drpai-classification-result"));
+	json_object_object_add(result, "value", jobj);
+
+	arr = p->top_k > 1 ? json_object_new_array() : NULL;
+	if (arr)
+		json_object_object_add(result, "top", arr);
+
+	for (i = 0; i < num; i++) {
+		int c = p->top[i];
+
+		prob = p->softmax ? p->exp[c] / sum : data[c];
+		if (prob < p->thresh_prob)
+			break;
+
+		if (!i) {
+			json_object_object_add(jobj, "label", json_object_new_string(p->labels[c]));
+			json_object_object_add(jobj, "probability",
+					       json_object_new_double(prob * 100.0f));
+		}
+		if (arr)
+			json_object_array_add(arr, classify_class_new(p->labels[c], prob));
+	}
+
+	return 0;
+}
+
+static void classify_cleanup(void *model_params)
+{
+	struct classify_model_params *p = model_params;
+
+	if (!p)
+		return;
+
+	drpai_model_free_labels(p->labels, p->num_labels);
+	free(p->scores);
+	free(p->top);
+	free(p->exp);
+	free(p);
+}
+
+static void *classify_init(json_object *config, int *err)
+{
+	struct classify_model_params *p;
+	json_object *jobj;
+	int lret = 0;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		lret = -ENOMEM;
+		goto err_store;
+	}
+
+	p->labels = drpai_model_config_get_labels(config, &p->num_labels);
+	if (!p->labels) {
+		lret = p->num_labels;
+		goto err_free;
+	}
+
+	if ((jobj = json_object_object_get(config, "softmax")))
+		p->softmax = json_object_get_boolean(jobj);
+	if ((jobj = json_object_object_get(config, "thresh_prob")))
+		p->thresh_prob = json_object_get_double(jobj);
+
+	p->top_k = 1;
+	if ((jobj = json_object_object_get(config, "top_k")))
+		p->top_k = json_object_get_int(jobj);
+	if (p->top_k < 1 || !p->num_labels) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+	if (p->top_k > p->num_labels)
+		p->top_k = p->num_labels;
+
+	p->top = malloc(sizeof(*p->top) * p->top_k);
+	p->exp = malloc(sizeof(*p->exp) * p->num_labels);
+	if (!p->top || !p->exp) {
+		lret = -ENOMEM;
+		goto err_free;
+	}
+
+	return p;
+err_free:
+	classify_cleanup(p);
+err_store:
+	if (err)
+		*err = lret;
+	return NULL;
+}
+
+const struct drpai_model_ops classify_model_ops = {
+	.init = classify_init,
+	.cleanup = classify_cleanup,
+	.postprocessing = classify_postprocessing,
+};
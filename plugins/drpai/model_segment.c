@@ -0,0 +1,310 @@
+
+#include "models.h"
+#include "vmath.h"
+#include "workers.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Semantic segmentation; the output tensor is one score plane per label
+ * (labels x height x width), and the result is the class of each pixel.
+ * That goes out as a compact mask, in the "mask" string of the result,
+ * which the camera protocol sends on as a binary frame of its own:
+ *   "rle": runs of (class byte, LEB128 length), in row-major order;
+ *   "raw": a class byte per pixel, if that is smaller.
+ * The "value" has the mask size and encoding, the part of the camera
+ * frame that it covers ("box") and the pixel count of each class found.
+ * Config:
+ *   "labels": [ ... ], 256 at most,
+ *   "model_out_w": 160, "model_out_h": 120, the size of the planes,
+ *   "decode_threads": threads besides the calling one
+ */
+
+#define SEGMENT_MAX_CLASSES	256
+
+/* A band of pixels, as a job for the worker pool; see model_yolo.c */
+struct segment_job {
+	int start;
+	int num;
+	float *max;
+	int32_t *idx;
+	float *row;		/* narrow output types: a plane band, as floats */
+	int pixels[SEGMENT_MAX_CLASSES];
+};
+
+#define SEGMENT_JOB_PIXELS	4096
+
+struct segment_model_params {
+	char **labels;
+	int num_labels;
+	int width;
+	int height;
+	int num_pixels;
+	uint8_t *mask;
+	uint8_t *rle;
+	struct segment_job *jobs;
+	int num_jobs;
+	struct workers *workers;
+	/* the frame being decoded */
+	const struct drpai_tensor *out;
+};
+
+/* The planes are gone through a band at a time, so the running max stays in cache */
+static int segment_decode_job(void *arg, int idx)
+{
+	struct segment_model_params *p = arg;
+	const struct drpai_tensor *out = p->out;
+	struct segment_job *j = &p->jobs[idx];
+	int c, i;
+
+	for (c = 0; c < p->num_labels; c++) {
+		size_t start = (size_t)c * p->num_pixels + j->start;
+		const float *src;
+
+		if (out->dtype == DRPAI_DTYPE_FP32) {
+			src = (const float *)out->data + start;
+		} else {
+			drpai_tensor_read(out, start, 1, j->num, j->row);
+			src = j->row;
+		}
+
+		if (c) {
+			vmath_argmax_update(j->max, j->idx, src, j->num, c);
+		} else {
+			memcpy(j->max, src, j->num * sizeof(*j->max));
+			memset(j->idx, 0, j->num * sizeof(*j->idx));
+		}
+	}
+
+	memset(j->pixels, 0, sizeof(j->pixels));
+	for (i = 0; i < j->num; i++) {
+		p->mask[j->start + i] = j->idx[i];
+		j->pixels[j->idx[i]]++;
+	}
+
+	return 0;
+}
+
+/* Returns the size of the runs, or 0 if they would be no smaller than the mask */
+static size_t segment_encode_rle(struct segment_model_params *p)
+{
+	const uint8_t *m = p->mask;
+	size_t n = p->num_pixels, i = 0, len = 0;
+
+	while (i < n) {
+		size_t run = 1;
+
+		while (i + run < n && m[i + run] == m[i])
+			run++;
+
+		/* a class byte, and at most 5 bytes of length */
+		if (len + 6 >= n)
+			return 0;
+
+		p->rle[len++] = m[i];
+		i += run;
+		for (; run >= 0x80; run >>= 7)
+			p->rle[len++] = (run & 0x7f) | 0x80;
+		p->rle[len++] = run;
+	}
+
+	return len;
+}
+
+static int segment_postprocessing(void *model_params, const struct drpai_tensor *out,
+				  const struct drpai_frame *frame, json_object *result)
+{
+	struct segment_model_params *p = model_params;
+	float cx, cy, w, h;
+	json_object *jobj, *jbox, *arr;
+	size_t len;
+	int c, i, rc, pixels;
+
+	if (out->num < (size_t)p->num_labels * p->num_pixels)
+		return -EINVAL;
+
+	p->out = out;
+	rc = workers_run(p->workers, p->num_jobs, segment_decode_job, p);
+	p->out = NULL;
+	if (rc)
+		return rc;
+
+	len = segment_encode_rle(p);
+
+	/* the whole model input, in camera frame coordinates */
+	cx = 0.5f * frame->width + frame->x;
+	cy = 0.5f * frame->height + frame->y;
+	w = frame->width;
+	h = frame->height;
+	drpai_frame_map_box(frame, &cx, &cy, &w, &h);
+
+	jobj = json_object_new_object();
+	jbox = json_object_new_object();
+	arr = json_object_new_array();
+	if (!jobj || !jbox || !arr) {
+		json_object_put(jobj);
+		json_object_put(jbox);
+		json_object_put(arr);
+		return -ENOMEM;
+	}
+
+	json_object_object_add(result, "name", json_object_new_string("drpai-segmentation-result"));
+	json_object_object_add(result, "value", jobj);
+	json_object_object_add(jobj, "width", json_object_new_int(p->width));
+	json_object_object_add(jobj, "height", json_object_new_int(p->height));
+	json_object_object_add(jobj, "encoding", json_object_new_string(len ? "rle" : "raw"));
+	json_object_object_add(jobj, "box", jbox);
+	json_object_object_add(jbox, "x", json_object_new_int((int)(cx - w / 2)));
+	json_object_object_add(jbox, "y", json_object_new_int((int)(cy - h / 2)));
+	json_object_object_add(jbox, "w", json_object_new_int((int)w));
+	json_object_object_add(jbox, "h", json_object_new_int((int)h));
+	json_object_object_add(jobj, "classes", arr);
+
+	for (c = 0; c < p->num_labels; c++) {
+		json_object *jc;
+
+		for (i = 0, pixels = 0; i < p->num_jobs; i++)
+			pixels += p->jobs[i].pixels[c];
+		if (!pixels)
+			continue;
+
+		jc = json_object_new_object();
+		if (!jc)
+			return -ENOMEM;
+		json_object_object_add(jc, "label", json_object_new_string(p->labels[c]));
+		json_object_object_add(jc, "index", json_object_new_int(c));
+		json_object_object_add(jc, "pixels", json_object_new_int(pixels));
+		json_object_array_add(arr, jc);
+	}
+
+	if (len)
+		jobj = json_object_new_string_len((const char *)p->rle, len);
+	else
+		jobj = json_object_new_string_len((const char *)p->mask, p->num_pixels);
+	if (!jobj)
+		return -ENOMEM;
+	json_object_object_add(result, "mask", jobj);
+
+	return 0;
+}
+
+static void segment_free_jobs(struct segment_model_params *p)
+{
+	int i;
+
+	for (i = 0; p->jobs && i < p->num_jobs; i++) {
+		free(p->jobs[i].max);
+		free(p->jobs[i].idx);
+		free(p->jobs[i].row);
+	}
+	free(p->jobs);
+}
+
+static int segment_build_jobs(struct segment_model_params *p)
+{
+	int i;
+
+	p->num_jobs = (p->num_pixels + SEGMENT_JOB_PIXELS - 1) / SEGMENT_JOB_PIXELS;
+	p->jobs = calloc(p->num_jobs, sizeof(*p->jobs));
+	if (!p->jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < p->num_jobs; i++) {
+		struct segment_job *j = &p->jobs[i];
+
+		j->start = i * SEGMENT_JOB_PIXELS;
+		j->num = p->num_pixels - j->start;
+		if (j->num > SEGMENT_JOB_PIXELS)
+			j->num = SEGMENT_JOB_PIXELS;
+		j->max = malloc(sizeof(*j->max) * j->num);
+		j->idx = malloc(sizeof(*j->idx) * j->num);
+		j->row = malloc(sizeof(*j->row) * j->num);
+		if (!j->max || !j->idx || !j->row)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void segment_cleanup(void *model_params)
+{
+	struct segment_model_params *p = model_params;
+
+	if (!p)
+		return;
+
+	workers_put(p->workers);
+	segment_free_jobs(p);
+	free(p->mask);
+	free(p->rle);
+	drpai_model_free_labels(p->labels, p->num_labels);
+	free(p);
+}
+
+static void *segment_init(json_object *config, int *err)
+{
+	struct segment_model_params *p;
+	int lret = 0, threads;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		lret = -ENOMEM;
+		goto err_store;
+	}
+
+	p->labels = drpai_model_config_get_labels(config, &p->num_labels);
+	if (!p->labels) {
+		lret = p->num_labels;
+		p->num_labels = 0;
+		goto err_free;
+	}
+	/* the mask has a byte per pixel */
+	if (!p->num_labels || p->num_labels > SEGMENT_MAX_CLASSES) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	p->width = drpai_config_get_int(config, "model_out_w", -1);
+	p->height = drpai_config_get_int(config, "model_out_h", -1);
+	if (p->width <= 0 || p->height <= 0) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+	p->num_pixels = p->width * p->height;
+
+	p->mask = malloc(p->num_pixels);
+	p->rle = malloc(p->num_pixels);
+	if (!p->mask || !p->rle) {
+		lret = -ENOMEM;
+		goto err_free;
+	}
+
+	lret = segment_build_jobs(p);
+	if (lret)
+		goto err_free;
+
+	threads = drpai_config_get_int(config, "decode_threads", -1);
+	if (threads) {
+		p->workers = workers_get(threads, &lret);
+		if (!p->workers)
+			goto err_free;
+	}
+
+	return p;
+err_free:
+	segment_cleanup(p);
+err_store:
+	if (err)
+		*err = lret;
+	return NULL;
+}
+
+const struct drpai_model_ops segment_model_ops = {
+	.init = segment_init,
+	.cleanup = segment_cleanup,
+	.postprocessing = segment_postprocessing,
+};
@@ -0,0 +1,327 @@
+
+#include "detections.h"
+#include "models.h"
+#include "nms.h"
+#include "vmath.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/**
+ * SSD and MobileNet-SSD: the output holds the box regressions of all
+ * priors ([priors][4]: dx, dy, dw, dh), followed by their class scores
+ * ([priors][classes], the background being class 0, so the first label).
+ * The priors are generated like Caffe's PriorBox layers do:
+ *   "priors": { "feature_maps": [ 19, 10, 5, 3, 2, 1 ],
+ *               "min_sizes": [ 60, 105, 150, 195, 240, 285 ],
+ *               "max_sizes": [ 0, 150, 195, 240, 285, 300 ], (0 for none)
+ *               "aspect_ratios": [ [ 2 ], [ 2, 3 ], ... ], (and 1 / each)
+ *               "clip": false }
+ * Config:
+ *   "labels": [ "background", ... ],
+ *   "model_in_w": 300, "model_in_h": 300,
+ *   "variances": [ 0.1, 0.1, 0.2, 0.2 ],
+ *   "softmax": true, if the scores are logits,
+ *   "thresh_prob": minimum probability (0..1),
+ * and the NMS settings of nms_create().
+ */
+
+#define SSD_MAX_ASPECT_RATIOS	4
+
+struct ssd_prior {
+	float cx, cy, w, h;
+};
+
+struct ssd_model_params {
+	char **labels;
+	int num_labels;
+	int model_in_w;
+	int model_in_h;
+	struct ssd_prior *priors;
+	int num_priors;
+	float variances[4];
+	bool softmax;
+	float thresh_prob;
+	float thresh_logit;	/* thresh_prob as a score margin over the background */
+	struct nms *nms;
+	/* narrow output types: the scores of a prior, as floats */
+	float *scores;
+	float *tmp;
+	struct detections dets;
+};
+
+/**
+ * With softmax, p(best) <= e^best / (e^best + e^background), so a prior can
+ * only pass if best - background >= logit(thresh_prob); the exponentials are
+ * only worked out for those.
+ */
+static int ssd_postprocessing(void *model_params, const struct drpai_tensor *out,
+			      const struct drpai_frame *frame, json_object *result)
+{
+	struct ssd_model_params *p = model_params;
+	const int num_class = p->num_labels;
+	const size_t conf = 4 * (size_t)p->num_priors;
+	int i, c, rc, num_detections;
+
+	if (out->num < conf + (size_t)p->num_priors * num_class)
+		return -EINVAL;
+
+	p->dets.num = 0;
+
+	for (i = 0; i < p->num_priors; i++) {
+		const struct ssd_prior *pr = &p->priors[i];
+		float center_x, center_y, box_w, box_h;
+		float best, probability;
+		const float *s;
+		int pred_class;
+
+		if (out->dtype == DRPAI_DTYPE_FP32) {
+			s = (const float *)out->data + conf + (size_t)i * num_class;
+		} else {
+			drpai_tensor_read(out, conf + (size_t)i * num_class, 1, num_class, p->scores);
+			s = p->scores;
+		}
+
+		pred_class = vmath_argmax(s + 1, num_class - 1, &best) + 1;
+
+		if (p->softmax) {
+			float max = best > s[0] ? best : s[0], sum = 0;
+
+			if (best - s[0] < p->thresh_logit)
+				continue;
+
+			for (c = 0; c < num_class; c++)
+				p->tmp[c] = s[c] - max;
+			vmath_exp(p->tmp, p->tmp, num_class);
+			for (c = 0; c < num_class; c++)
+				sum += p->tmp[c];
+			probability = p->tmp[pred_class] / sum;
+		} else {
+			probability = best;
+		}
+
+		if (probability < p->thresh_prob)
+			continue;
+
+		/* center-size coding, scaled by the variances */
+		center_x = pr->cx + drpai_tensor_get(out, 4 * i + 0) * p->variances[0] * pr->w;
+		center_y = pr->cy + drpai_tensor_get(out, 4 * i + 1) * p->variances[1] * pr->h;
+		box_w = pr->w * vmath_expf(drpai_tensor_get(out, 4 * i + 2) * p->variances[2]);
+		box_h = pr->h * vmath_expf(drpai_tensor_get(out, 4 * i + 3) * p->variances[3]);
+
+		if (!drpai_frame_in_roi(frame, center_x, center_y))
+			continue;
+
+		rc = detections_add(&p->dets, frame, center_x, center_y, box_w, box_h,
+				    pred_class, probability);
+		if (rc)
+			return rc;
+	}
+
+	num_detections = nms_run(p->nms, p->dets.d, p->dets.num);
+	if (num_detections < 0)
+		return num_detections;
+
+	return detections_to_json(&p->dets, num_detections, p->labels,
+				  p->thresh_prob * 100.0f, result);
+}
+
+static float ssd_array_get_float(json_object *arr, int idx, float dflt)
+{
+	json_object *jobj = json_object_array_get_idx(arr, idx);
+	return jobj ? json_object_get_double(jobj) : dflt;
+}
+
+static void ssd_prior_add(struct ssd_model_params *p, float cx, float cy,
+			  float w, float h, bool clip)
+{
+	struct ssd_prior *pr = &p->priors[p->num_priors++];
+
+	pr->cx = cx;
+	pr->cy = cy;
+	pr->w = w;
+	pr->h = h;
+
+	/* the corners, like Caffe */
+	if (clip) {
+		float x0 = fmaxf(cx - w / 2, 0), x1 = fminf(cx + w / 2, 1);
+		float y0 = fmaxf(cy - h / 2, 0), y1 = fminf(cy + h / 2, 1);
+
+		pr->cx = (x0 + x1) / 2;
+		pr->cy = (y0 + y1) / 2;
+		pr->w = x1 - x0;
+		pr->h = y1 - y0;
+	}
+}
+
+/* Per cell: the min size box, the sqrt(min * max) one, then each aspect ratio and its inverse */
+static int ssd_build_priors(json_object *cfg, struct ssd_model_params *p)
+{
+	json_object *jmaps, *jmin, *jmax, *jars;
+	float ars[SSD_MAX_ASPECT_RATIOS];
+	int n, i, x, y, num_layers, num = 0;
+	bool clip;
+
+	jmaps = json_object_object_get(cfg, "feature_maps");
+	jmin = json_object_object_get(cfg, "min_sizes");
+	jmax = json_object_object_get(cfg, "max_sizes");
+	jars = json_object_object_get(cfg, "aspect_ratios");
+	clip = json_object_get_boolean(json_object_object_get(cfg, "clip"));
+
+	if (!json_object_is_type(jmaps, json_type_array) ||
+	    !json_object_is_type(jmin, json_type_array))
+		return -EINVAL;
+
+	num_layers = json_object_array_length(jmaps);
+	if (!num_layers || (int)json_object_array_length(jmin) != num_layers)
+		return -EINVAL;
+
+	/* count first */
+	for (n = 0; n < num_layers; n++) {
+		int fm = json_object_get_int(json_object_array_get_idx(jmaps, n));
+		json_object *jar = json_object_array_get_idx(jars, n);
+		int per_cell = 1 + 2 * (jar ? json_object_array_length(jar) : 0);
+
+		if (jmax && ssd_array_get_float(jmax, n, 0) > 0)
+			per_cell++;
+		if (fm <= 0 || (jar && json_object_array_length(jar) > SSD_MAX_ASPECT_RATIOS))
+			return -EINVAL;
+		num += fm * fm * per_cell;
+	}
+
+	p->priors = malloc(sizeof(*p->priors) * num);
+	if (!p->priors)
+		return -ENOMEM;
+
+	for (n = 0; n < num_layers; n++) {
+		int fm = json_object_get_int(json_object_array_get_idx(jmaps, n));
+		json_object *jar = json_object_array_get_idx(jars, n);
+		int num_ars = jar ? json_object_array_length(jar) : 0;
+		float min_w = ssd_array_get_float(jmin, n, 0) / p->model_in_w;
+		float min_h = ssd_array_get_float(jmin, n, 0) / p->model_in_h;
+		float max_size = jmax ? ssd_array_get_float(jmax, n, 0) : 0;
+		float big_w = sqrtf(min_w * max_size / p->model_in_w);
+		float big_h = sqrtf(min_h * max_size / p->model_in_h);
+
+		for (i = 0; i < num_ars; i++) {
+			ars[i] = sqrtf(ssd_array_get_float(jar, i, 1));
+			if (ars[i] <= 0)
+				return -EINVAL;
+		}
+
+		for (y = 0; y < fm; y++) {
+			for (x = 0; x < fm; x++) {
+				float cx = (x + 0.5f) / fm;
+				float cy = (y + 0.5f) / fm;
+
+				ssd_prior_add(p, cx, cy, min_w, min_h, clip);
+				if (max_size > 0)
+					ssd_prior_add(p, cx, cy, big_w, big_h, clip);
+				for (i = 0; i < num_ars; i++) {
+					ssd_prior_add(p, cx, cy, min_w * ars[i], min_h / ars[i], clip);
+					ssd_prior_add(p, cx, cy, min_w / ars[i], min_h * ars[i], clip);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static void ssd_cleanup(void *model_params)
+{
+	struct ssd_model_params *p = model_params;
+
+	if (!p)
+		return;
+
+	free(p->priors);
+	free(p->scores);
+	free(p->tmp);
+	detections_free(&p->dets);
+	nms_free(p->nms);
+	drpai_model_free_labels(p->labels, p->num_labels);
+	free(p);
+}
+
+static void *ssd_init(json_object *config, int *err)
+{
+	static const float default_variances[4] = { 0.1f, 0.1f, 0.2f, 0.2f };
+	json_object *jobj;
+	struct ssd_model_params *p;
+	int i, lret = 0;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		lret = -ENOMEM;
+		goto err_store;
+	}
+
+	p->labels = drpai_model_config_get_labels(config, &p->num_labels);
+	if (!p->labels) {
+		lret = p->num_labels;
+		p->num_labels = 0;
+		goto err_free;
+	}
+	/* the background, and at least one class */
+	if (p->num_labels < 2) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	p->model_in_w = drpai_config_get_int(config, "model_in_w", 300);
+	p->model_in_h = drpai_config_get_int(config, "model_in_h", 300);
+	if (p->model_in_w <= 0 || p->model_in_h <= 0) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	jobj = json_object_object_get(config, "variances");
+	for (i = 0; i < 4; i++)
+		p->variances[i] = jobj ? ssd_array_get_float(jobj, i, default_variances[i]) :
+					 default_variances[i];
+
+	if ((jobj = json_object_object_get(config, "softmax")))
+		p->softmax = json_object_get_boolean(jobj);
+
+	p->thresh_prob = drpai_config_get_float(config, "thresh_prob", -1.);
+	if (p->thresh_prob < 0) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+	p->thresh_logit = vmath_logitf(p->thresh_prob) - 1e-3f;
+
+	/* probabilities are in percent by then */
+	p->nms = nms_create(config, p->thresh_prob * 100.0f, &lret);
+	if (!p->nms)
+		goto err_free;
+
+	lret = ssd_build_priors(json_object_object_get(config, "priors"), p);
+	if (lret)
+		goto err_free;
+
+	p->scores = malloc(sizeof(*p->scores) * p->num_labels);
+	p->tmp = malloc(sizeof(*p->tmp) * p->num_labels);
+	if (!p->scores || !p->tmp) {
+		lret = -ENOMEM;
+		goto err_free;
+	}
+
+	return p;
+err_free:
+	ssd_cleanup(p);
+err_store:
+	if (err)
+		*err = lret;
+	return NULL;
+}
+
+const struct drpai_model_ops ssd_model_ops = {
+	.init = ssd_init,
+	.cleanup = ssd_cleanup,
+	.postprocessing = ssd_postprocessing,
+};
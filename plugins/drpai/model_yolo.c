@@ -1,156 +1,491 @@
 
+#include "detections.h"
 #include "models.h"
+#include "nms.h"
+#include "vmath.h"
+#include "workers.h"
 
 #include <errno.h>
 #include <math.h>
-#include <float.h>
+#include <stdbool.h>
 
 #include <libwebsockets.h>
 
-#define max(a, b)	((a) > (b) ? (a) : (b))
+struct yolo_model_params;
+struct yolo_job;
+
+typedef int (*yolo_decode_fn)(struct yolo_model_params *p, struct yolo_job *j,
+			      int num_cells);
+
+/**
+ * The decode plan: everything about the output layout that stays the
+ * same from frame to frame, worked out once at init. There is one plane
+ * per layer and anchor; the box of a cell is
+ *   center = (cell + sigmoid(t)) * c_mul + c_add
+ *   size   = exp(t) * anchor
+ * with the correct_yolo/region_boxes adjustment folded in; or for YOLOv5
+ *   center = (cell + 2 * sigmoid(t) - 0.5) * c_mul
+ *   size   = (2 * sigmoid(t))^2 * anchor
+ */
+struct yolo_plane {
+	int layer;
+	int offset;		/* of its first channel (tx) in the output */
+	int num_grid;
+	int mask_offset;	/* of the ROI mask of its layer */
+	float cx_mul, cx_add;
+	float cy_mul, cy_add;
+	float anchor_w;
+	float anchor_h;
+};
+
+/**
+ * The planes are decoded in bands of rows, as jobs for the worker pool;
+ * each job has its own buffers and detections, which are put together in
+ * job order afterwards. That is the order of a plain loop over the
+ * planes, so the result is the same with any number of threads.
+ */
+struct yolo_job {
+	const struct yolo_plane *pl;
+	int start;		/* first cell of the band */
+	int num;
+	int *cells;		/* of the band, to decode */
+	float *classes;
+	/* narrow output types: the objectness of the band, and the channels of a cell */
+	float *obj;
+	float *vals;
+	struct detections dets;
+};
+
+/* Cells per job, roughly; a 52x52 plane is a few jobs */
+#define YOLO_JOB_CELLS	1024
 
 struct yolo_model_params {
 	int ver;
 	char **labels;
 	int num_labels;
-	float *classes;
 	int num_inf_out_layer;
 	int *num_grids;
 	int num_bb;
 	float thresh_prob;
-	float thresh_nms;
+	float thresh_obj;	/* thresh_prob as a raw objectness score */
+	struct nms *nms;
 	int model_in_w;
 	int model_in_h;
 	double *anchors;
+	int num_anchors;
+	/* decode plan */
+	struct yolo_plane *planes;
+	int num_planes;
+	size_t num_values;	/* of the output tensor */
+	float box_sx;		/* model input area of the image, per side */
+	float box_sy;
+	yolo_decode_fn decode;
+	struct yolo_job *jobs;
+	int num_jobs;
+	struct workers *workers;	/* NULL to decode on the calling thread */
+	struct workers_batch batch;	/* of postprocessing_start() */
+	/* the frame being decoded */
+	const struct drpai_tensor *out;
+	const struct drpai_frame *frame;
+	int thresh_q;		/* thresh_obj, quantized */
+	/* boxes already decoded by a DRP stage of the model sequence */
+	bool drp_decode;
+	int max_boxes;
+	/* all detections, before NMS */
+	struct detections dets;
+	/* DRP decoded boxes as floats, for narrow output types */
+	float *records;
+	size_t num_records;
+	/* grid cells inside the ROI, per layer */
+	uint8_t *cell_mask;
 };
 
-struct box {
-	int x;
-	int y;
-	int w;
-	int h;
-};
+/* The objectness pre-filter is conservative by this much */
+#define YOLO_OBJ_SLACK	1e-3f
+
+/**
+ * With "decode": "drp", a DRP post-processing stage of the model sequence
+ * has already decoded the boxes. The output tensor then holds a count,
+ * followed by that many records of:
+ *   { center x, center y, width, height, class, probability }
+ * with the box relative to the model input (0..1).
+ * Only mapping onto the camera frame and NMS are left to do here.
+ */
+static int yolo_postprocessing_decoded(struct yolo_model_params *p,
+				       const struct drpai_tensor *out,
+				       const struct drpai_frame *frame,
+				       json_object *result)
+{
+	const float *data;
+	int num_detections;
+	int i, num, rc;
 
-struct detection {
-	struct box box;
-	int pred_class;
-	float probability;
-};
+	if (!out->num)
+		return -EINVAL;
 
-static int yolo_index(int num_grid, int offs, int channel)
-{
-	return offs + channel * num_grid * num_grid;
-}
+	data = drpai_tensor_floats(out, &p->records, &p->num_records);
+	if (!data)
+		return -ENOMEM;
 
-static int yolo_offset(int n, int b, int y, int x, const int* num_grids, int numBB, int32_t numClass)
-{
-	int num = num_grids[n];
-	int i, prev_layer_num = 0;
+	p->dets.num = 0;
+	num = data[0];
+	if (num < 0)
+		return -EINVAL;
+	if (num > p->max_boxes)
+		num = p->max_boxes;
+	if ((size_t)num > (out->num - 1) / 6)
+		num = (out->num - 1) / 6;
+
+	for (i = 0; i < num; i++) {
+		const float *r = &data[1 + i * 6];
+		int pred_class = r[4];
+
+		if (pred_class < 0 || pred_class >= p->num_labels)
+			continue;
 
-	for (i = 0; i < n; i++) {
-		prev_layer_num += numBB * (numClass + 5) * num_grids[i] * num_grids[i];
+		/* Store the result into the list if the probability is more than the threshold */
+		if (r[5] < p->thresh_prob)
+			continue;
+
+		if (!drpai_frame_in_roi(frame, r[0], r[1]))
+			continue;
+
+		rc = detections_add(&p->dets, frame, r[0], r[1], r[2], r[3],
+					pred_class, r[5]);
+		if (rc)
+			return rc;
 	}
-	return prev_layer_num + b * (numClass + 5) * num * num + y * num + x;
+
+	/* Non-Maximum Supression filter */
+	num_detections = nms_run(p->nms, p->dets.d, p->dets.num);
+	if (num_detections < 0)
+		return num_detections;
+
+	return detections_to_json(&p->dets, num_detections, p->labels,
+				  p->thresh_prob * 100.0f, result);
 }
 
-static double sigmoid(double x)
+/**
+ * Which cells of the grid have their centre inside the ROI; the others
+ * are skipped before anything of them is decoded. The correct_yolo/
+ * region_boxes adjustment is undone like for the boxes.
+ */
+static void yolo_roi_mask(struct yolo_model_params *p, const struct drpai_frame *frame,
+			  int num_grid, uint8_t *mask)
 {
-	return 1.0 / (1.0 + exp(-x));
+	const float sx = p->box_sx;
+	const float sy = p->box_sy;
+	const float ox = (1.0f - sx) / 2;
+	const float oy = (1.0f - sy) / 2;
+	int x, y;
+
+	for (y = 0; y < num_grid; y++) {
+		float cy = ((y + 0.5f) / num_grid - oy) / sy;
+
+		for (x = 0; x < num_grid; x++) {
+			float cx = ((x + 0.5f) / num_grid - ox) / sx;
+
+			mask[y * num_grid + x] = drpai_frame_in_roi(frame, cx, cy);
+		}
+	}
 }
 
-static void softmax(float *val, int num)
+/**
+ * Decode the cells that passed the objectness scan; the class scores come
+ * first, so that the box is only worked out for cells that make it.
+ * Inlined into a variant per version, and for the common class counts, so
+ * that the class loops have a constant trip count.
+ */
+static inline __attribute__((always_inline))
+int yolo_decode_cells(struct yolo_model_params *p, struct yolo_job *j,
+		      int num_cells, const int ver, const int num_class)
 {
-	float max_num = -FLT_MAX;
-	float sum = 0;
-	int i;
+	const struct drpai_tensor *out = p->out;
+	const struct yolo_plane *pl = j->pl;
+	const int num_grid = pl->num_grid;
+	const int gg = num_grid * num_grid;
+	float *classes = j->classes;
+	int i, k, rc;
+
+	for (k = 0; k < num_cells; k++) {
+		const int cell = j->start + j->cells[k];
+		const float *c, *cls;
+		float objectness, max_pred, probability;
+		float center_x, center_y, box_w, box_h;
+		int pred_class = 0;
+		int cs;		/* channel stride */
+
+		/* narrow types: only the channels of the cell are converted */
+		if (out->dtype == DRPAI_DTYPE_FP32) {
+			c = (const float *)out->data + pl->offset + cell;
+			cs = gg;
+		} else {
+			drpai_tensor_read(out, pl->offset + cell, gg, 5 + num_class, j->vals);
+			c = j->vals;
+			cs = 1;
+		}
+		cls = &c[5 * cs];
+
+		objectness = vmath_sigmoidf(c[4 * cs]);
+
+		/* Get the class prediction */
+		if (ver == 2) {
+			for (i = 0; i < num_class; i++)
+				classes[i] = cls[i * cs];
+			max_pred = vmath_softmax(classes, num_class, &pred_class);
+		} else {
+			/* the sigmoid keeps the order; only the best one is needed */
+			max_pred = cls[0];
+			for (i = 1; i < num_class; i++) {
+				if (cls[i * cs] > max_pred) {
+					max_pred = cls[i * cs];
+					pred_class = i;
+				}
+			}
+			max_pred = vmath_sigmoidf(max_pred);
+		}
 
-	for (i = 0 ; i < num ; i++)
-		max_num = max(max_num, val[i]);
+		probability = max_pred * objectness;
+
+		/* Store the result into the list if the probability is more than the threshold */
+		if (probability < p->thresh_prob)
+			continue;
 
-	for (i = 0 ; i < num ; i++) {
-		val[i]= (float) exp(val[i] - max_num);
-		sum+= val[i];
+		/* Compute the bounding box */
+		if (ver == 5) {
+			float sw = 2 * vmath_sigmoidf(c[2 * cs]);
+			float sh = 2 * vmath_sigmoidf(c[3 * cs]);
+
+			center_x = (cell % num_grid + 2 * vmath_sigmoidf(c[0]) - 0.5f) * pl->cx_mul;
+			center_y = (cell / num_grid + 2 * vmath_sigmoidf(c[cs]) - 0.5f) * pl->cy_mul;
+			box_w = sw * sw * pl->anchor_w;
+			box_h = sh * sh * pl->anchor_h;
+		} else {
+			/* get_yolo_box/get_region_box in paper implementation*/
+			center_x = (cell % num_grid + vmath_sigmoidf(c[0])) * pl->cx_mul + pl->cx_add;
+			center_y = (cell / num_grid + vmath_sigmoidf(c[cs])) * pl->cy_mul + pl->cy_add;
+			box_w = vmath_expf(c[2 * cs]) * pl->anchor_w;
+			box_h = vmath_expf(c[3 * cs]) * pl->anchor_h;
+		}
+
+		rc = detections_add(&j->dets, p->frame,
+					center_x, center_y, box_w, box_h,
+					pred_class, probability);
+		if (rc)
+			return rc;
 	}
 
-	for (i = 0 ; i < num ; i++)
-		val[i]= val[i] / sum;
+	return 0;
 }
 
-static float overlap(float x1, float w1, float x2, float w2)
-{
-	float l1 = x1 - w1 / 2;
-	float l2 = x2 - w2 / 2;
-	float left = l1 > l2 ? l1 : l2;
-	float r1 = x1 + w1 / 2;
-	float r2 = x2 + w2 / 2;
-	float right = r1 < r2 ? r1 : r2;
-	return right - left;
+#define YOLO_DECODER(name, ver, num_class)						\
+static int name(struct yolo_model_params *p, struct yolo_job *j, int num_cells)	\
+{											\
+	return yolo_decode_cells(p, j, num_cells, ver, num_class);			\
 }
 
-static float box_intersection(struct box *a, struct box *b)
+YOLO_DECODER(yolo_decode_v5, 5, p->num_labels)
+YOLO_DECODER(yolo_decode_v5_coco, 5, 80)
+YOLO_DECODER(yolo_decode_v3, 3, p->num_labels)
+YOLO_DECODER(yolo_decode_v3_coco, 3, 80)
+YOLO_DECODER(yolo_decode_v3_voc, 3, 20)
+YOLO_DECODER(yolo_decode_v2, 2, p->num_labels)
+YOLO_DECODER(yolo_decode_v2_coco, 2, 80)
+YOLO_DECODER(yolo_decode_v2_voc, 2, 20)
+
+static const struct {
+	int ver;
+	int num_class;		/* 0 for any */
+	yolo_decode_fn decode;
+} yolo_decoders[] = {
+	{ 5, 80, yolo_decode_v5_coco },
+	{ 5, 0,  yolo_decode_v5 },
+	{ 3, 80, yolo_decode_v3_coco },
+	{ 3, 20, yolo_decode_v3_voc },
+	{ 3, 0,  yolo_decode_v3 },
+	{ 2, 80, yolo_decode_v2_coco },
+	{ 2, 20, yolo_decode_v2_voc },
+	{ 2, 0,  yolo_decode_v2 },
+	{ }
+};
+
+/**
+ * The output is channel-major: for each layer and anchor, a plane of
+ * num_grid x num_grid values per channel (tx, ty, tw, th, objectness,
+ * classes). Since the class scores are at most 1, a cell can only pass
+ * 'thresh_prob' if its objectness does; so the objectness plane is
+ * scanned first, against the threshold turned into a raw score (no
+ * sigmoid needed), and only the cells left get decoded. Quantized
+ * outputs are scanned as they are, against a quantized threshold.
+ * Runs on any thread of the pool; only touches what is its job's.
+ */
+static int yolo_decode_job(void *arg, int idx)
 {
-	float w = overlap(a->x, a->w, b->x, b->w);
-	float h = overlap(a->y, a->h, b->y, b->h);
-	if (w < 0 || h < 0)
+	struct yolo_model_params *p = arg;
+	const struct drpai_tensor *out = p->out;
+	struct yolo_job *j = &p->jobs[idx];
+	const struct yolo_plane *pl = j->pl;
+	const uint8_t *mask = NULL;
+	size_t obj = pl->offset + 4 * pl->num_grid * pl->num_grid + j->start;
+	int num_cells;
+
+	j->dets.num = 0;
+
+	if (p->frame->roi)
+		mask = &p->cell_mask[pl->mask_offset + j->start];
+
+	switch (out->dtype) {
+	case DRPAI_DTYPE_INT8:
+		num_cells = vmath_select_ge_s8((const int8_t *)out->data + obj, j->num,
+					       p->thresh_q, mask, j->cells);
+		break;
+	case DRPAI_DTYPE_UINT8:
+		num_cells = vmath_select_ge_u8((const uint8_t *)out->data + obj, j->num,
+					       p->thresh_q, mask, j->cells);
+		break;
+	case DRPAI_DTYPE_FP16:
+		drpai_tensor_read(out, obj, 1, j->num, j->obj);
+		num_cells = vmath_select_ge(j->obj, j->num, p->thresh_obj, mask, j->cells);
+		break;
+	default:
+		num_cells = vmath_select_ge((const float *)out->data + obj, j->num,
+					    p->thresh_obj, mask, j->cells);
+		break;
+	}
+	if (!num_cells)
 		return 0;
-	return w * h;
-}
 
-static float box_union(float box_intersection, float area_a, float area_b)
-{
-	float i = box_intersection;
-	float u = area_a + area_b - i;
-	return u;
+	return p->decode(p, j, num_cells);
 }
 
-static float box_iou(float box_intersection, float area_a, float area_b)
+/* q >= thresh_q  <=>  (q - zero_point) * scale >= thresh_obj, for the quantized types */
+static int yolo_thresh_quantized(const struct yolo_model_params *p,
+				 const struct drpai_tensor *out)
 {
-    return box_intersection / box_union(box_intersection, area_a, area_b);
+	float q = ceilf(p->thresh_obj / out->scale + out->zero_point);
+
+	/* beyond the range of any of the types */
+	if (q < -512)
+		return -512;
+	if (q > 512)
+		return 512;
+
+	return q;
 }
 
-static void filter_boxes_nms(struct detection *d, int size, float th_nms)
+/* What the jobs of a frame work from */
+static int yolo_decode_prepare(struct yolo_model_params *p, const struct drpai_tensor *out,
+			       const struct drpai_frame *frame)
 {
-	float b_intersection, area_a, area_b;
-	int i, j;
-	for (i = 0; i < size; i++) {
-		struct box *a = &d[i].box;
-		for (j = 0; j < size; j++) {
-			struct box *b;
-			if (i == j)
-				continue;
-			if (d[i].pred_class != d[j].pred_class)
+	int i;
+
+	if (out->num < p->num_values)
+		return -EINVAL;
+
+	if (frame->roi) {
+		for (i = 0; i < p->num_planes; i++) {
+			const struct yolo_plane *pl = &p->planes[i];
+
+			if (i && pl->layer == p->planes[i - 1].layer)
 				continue;
-			b = &d[j].box;
-			area_a = a->h * a->w;
-			area_b = b->h * b->w;
-			b_intersection = box_intersection(a, b);
-			if ((box_iou(b_intersection, area_a, area_b) > th_nms) ||
-			    (b_intersection >= area_a - 1) ||
-			    (b_intersection >= area_b - 1)) {
-				if (d[i].probability > d[j].probability)
-					d[j].probability = 0;
-				else
-					d[i].probability = 0;
-			}
+			yolo_roi_mask(p, frame, pl->num_grid, &p->cell_mask[pl->mask_offset]);
 		}
 	}
+
+	p->out = out;
+	p->frame = frame;
+	p->thresh_q = yolo_thresh_quantized(p, out);
+
+	return 0;
+}
+
+/* Put together the detections of the jobs, after they ran with 'err' */
+static int yolo_decode_finish(struct yolo_model_params *p, int err, json_object *result)
+{
+	int i, rc, num_detections;
+
+	p->out = NULL;
+	p->frame = NULL;
+	if (err)
+		return err;
+
+	/* in job order */
+	p->dets.num = 0;
+	for (i = 0; i < p->num_jobs; i++) {
+		rc = detections_append(&p->dets, &p->jobs[i].dets);
+		if (rc)
+			return rc;
+	}
+
+	/* Non-Maximum Supression filter */
+	num_detections = nms_run(p->nms, p->dets.d, p->dets.num);
+	if (num_detections < 0)
+		return num_detections;
+
+	return detections_to_json(&p->dets, num_detections, p->labels,
+				  p->thresh_prob * 100.0f, result);
 }
 
-static int yolo_postprocessing(void *model_params, float *data, int width, int height, json_object *result)
+static int yolo_postprocessing(void *model_params, const struct drpai_tensor *out,
+			       const struct drpai_frame *frame, json_object *result)
 {
 	struct yolo_model_params *p = model_params;
-	struct detection *d, *detections = NULL;
-	int num_detections = 0, allocated = 0;
-	int num_class = p->num_labels;
-	int i, n, b, y, x, rc;
-	json_object *arr, *obj;
-	float *classes = p->classes;
+	int rc;
+
+	if (p->drp_decode)
+		return yolo_postprocessing_decoded(p, out, frame, result);
 
+	rc = yolo_decode_prepare(p, out, frame);
+	if (rc)
+		return rc;
+
+	rc = workers_run(p->workers, p->num_jobs, yolo_decode_job, p);
+
+	return yolo_decode_finish(p, rc, result);
+}
+
+/* The jobs run on the pool, while the caller gets back to its event loop */
+static int yolo_postprocessing_start(void *model_params, const struct drpai_tensor *out,
+				     const struct drpai_frame *frame,
+				     void (*done)(void *arg, int err), void *arg)
+{
+	struct yolo_model_params *p = model_params;
+	int rc;
+
+	/* nothing worth a thread */
+	if (p->drp_decode || !p->workers)
+		return -EOPNOTSUPP;
+
+	rc = yolo_decode_prepare(p, out, frame);
+	if (rc)
+		return rc;
+
+	return workers_post(p->workers, &p->batch, p->num_jobs, yolo_decode_job, p,
+			    done, arg);
+}
+
+static int yolo_postprocessing_finish(void *model_params, int err, json_object *result)
+{
+	return yolo_decode_finish(model_params, err, result);
+}
+
+/**
+ * Work out the decode plan; the layers follow each other in the output,
+ * each with 'num_bb' planes of (5 + classes) channels.
+ */
+static int yolo_build_plan(struct yolo_model_params *p)
+{
 	/* Following variables are required for correct_yolo/region_boxes in Darknet implementation*/
 	/* Note: This implementation refers to the "darknet detector test" */
-	float new_w, new_h;
 	const float correct_w = 1.;
 	const float correct_h = 1.;
+	int channels = p->num_labels + 5;
+	int n, b, i, offset = 0, mask_offset = 0;
+	float new_w, new_h;
+
+	if (!p->num_labels || p->num_anchors < 2 * p->num_bb * p->num_inf_out_layer)
+		return -EINVAL;
+
 	if ((float)(p->model_in_w / correct_w) < (float)(p->model_in_h / correct_h)) {
 		new_w = (float)p->model_in_w;
 		new_h = correct_h * p->model_in_w / correct_w;
@@ -158,207 +493,145 @@ static int yolo_postprocessing(void *model_params, float *data, int width, int h
 		new_w = correct_w * p->model_in_h / correct_h;
 		new_h = p->model_in_h;
 	}
+	p->box_sx = new_w / p->model_in_w;
+	p->box_sy = new_h / p->model_in_h;
+	if (p->ver == 5)
+		p->box_sx = p->box_sy = 1;
+
+	p->num_planes = p->num_inf_out_layer * p->num_bb;
+	p->planes = calloc(p->num_planes ? p->num_planes : 1, sizeof(*p->planes));
+	if (!p->planes)
+		return -ENOMEM;
 
 	for (n = 0; n < p->num_inf_out_layer; n++) {
 		int num_grid = p->num_grids[n];
 		int anchor_offset = 2 * p->num_bb * (p->num_inf_out_layer - (n + 1));
-		for (b = 0; b < p->num_bb; b++) {
-			for (y = 0; y < num_grid; y++) {
-				for (x = 0; x < num_grid; x++) {
-					int offs = yolo_offset(n, b, y, x, p->num_grids, p->num_bb, num_class);
-					float tx = data[offs];
-					float ty = data[yolo_index(num_grid, offs, 1)];
-					float tw = data[yolo_index(num_grid, offs, 2)];
-					float th = data[yolo_index(num_grid, offs, 3)];
-					float tc = data[yolo_index(num_grid, offs, 4)];
-
-					float max_pred = 0;
-					int pred_class = -1;
-
-					float objectness = sigmoid(tc);
-					float probability;
-
-					/* Compute the bounding box */
-					/* get_yolo_box/get_region_box in paper implementation*/
-					float center_x = ((float)x + sigmoid(tx)) / (float)num_grid;
-					float center_y = ((float)y + sigmoid(ty)) / (float)num_grid;
-					float box_w;
-					float box_h;
-
-					if (p->ver == 3) {
-						box_w = (float)exp(tw) * p->anchors[anchor_offset + 2 * b + 0] / (float)p->model_in_w;
-						box_h = (float)exp(th) * p->anchors[anchor_offset + 2 * b + 1] / (float)p->model_in_h;
-					} else {
-						box_w = (float)exp(tw) * p->anchors[anchor_offset + 2 * b + 0] / (float)num_grid;
-						box_h = (float)exp(th) * p->anchors[anchor_offset + 2 * b + 1] / (float)num_grid;
-					}
-
-					/* Adjustment for VGA size */
-					/* correct_yolo/region_boxes */
-					center_x = (center_x - (p->model_in_w - new_w) / 2. / p->model_in_w) / ((float)new_w / p->model_in_w);
-					center_y = (center_y - (p->model_in_h - new_h) / 2. / p->model_in_h) / ((float)new_h / p->model_in_h);
-					box_w *= (float)(p->model_in_w / new_w);
-					box_h *= (float)(p->model_in_h / new_h);
-
-					center_x = round(center_x * width);
-					center_y = round(center_y * height);
-					box_w = round(box_w * width);
-					box_h = round(box_h * height);
-
-					/* Get the class prediction */
-					for (i = 0; i < num_class; i++) {
-						if (p->ver == 3)
-							classes[i] = sigmoid(data[yolo_index(num_grid, offs, 5 + i)]);
-						else
-							classes[i] = data[yolo_index(num_grid, offs, 5 + i)];
-					}
-
-					if (p->ver == 2)
-						softmax(classes, num_class);
-
-					for (i = 0; i < num_class; i++) {
-						if (classes[i] > max_pred) {
-							pred_class = i;
-							max_pred = classes[i];
-						}
-					}
-
-					probability = max_pred * objectness;
-
-					/* Store the result into the list if the probability is more than the threshold */
-					if (probability < p->thresh_prob)
-						continue;
-
-					if (num_detections >= allocated) {
-						void *oldptr = detections;
-						allocated += 32;
-						detections = realloc(detections, allocated * sizeof(*detections));
-						if (!detections) {
-							free(oldptr);
-							return -ENOMEM;
-						}
-					}
-					d = &detections[num_detections];
-					d->pred_class = pred_class;
-					d->probability = probability * 100.0f;
-					d->box.w = box_w;
-					d->box.h = box_h;
-					d->box.x = (int)(center_x - (d->box.w / 2));
-					d->box.y = (int)(center_y - (d->box.h / 2));
-					num_detections++;
-				}
+		/* YOLOv3/v5 anchors are in model input pixels, YOLOv2 ones in cells */
+		float aw = p->ver != 2 ? p->model_in_w : num_grid;
+		float ah = p->ver != 2 ? p->model_in_h : num_grid;
+
+		/* YOLOv5 anchors go from the finest grid to the coarsest */
+		if (p->ver == 5) {
+			anchor_offset = 0;
+			for (i = 0; i < p->num_inf_out_layer; i++) {
+				if (p->num_grids[i] > num_grid || (p->num_grids[i] == num_grid && i < n))
+					anchor_offset += 2 * p->num_bb;
 			}
 		}
-	}
-	/* Non-Maximum Supression filter */
-	filter_boxes_nms(detections, num_detections, p->thresh_nms);
 
-	obj = json_object_new_object();
-	arr = json_object_new_array();
-	if (!arr || !obj) {
-		rc = -errno;
-		goto err;
+		for (b = 0; b < p->num_bb; b++) {
+			struct yolo_plane *pl = &p->planes[n * p->num_bb + b];
+
+			pl->layer = n;
+			pl->offset = offset;
+			pl->num_grid = num_grid;
+			pl->mask_offset = mask_offset;
+
+			/* correct_yolo/region_boxes: (c - (1 - s) / 2) / s */
+			pl->cx_mul = 1.0f / (num_grid * p->box_sx);
+			pl->cx_add = -(1.0f - p->box_sx) / 2 / p->box_sx;
+			pl->cy_mul = 1.0f / (num_grid * p->box_sy);
+			pl->cy_add = -(1.0f - p->box_sy) / 2 / p->box_sy;
+			pl->anchor_w = p->anchors[anchor_offset + 2 * b + 0] / aw / p->box_sx;
+			pl->anchor_h = p->anchors[anchor_offset + 2 * b + 1] / ah / p->box_sy;
+
+			offset += channels * num_grid * num_grid;
+		}
+		mask_offset += num_grid * num_grid;
 	}
-	json_object_object_add(result, "name", json_object_new_string("drpai-object-detection-result"));
-	json_object_object_add(result, "value", arr);
-
-	rc = 0;
-	for (i = 0; i < num_detections; i++) {
-		json_object *jobj, *jbox;
-		d = &detections[i];
-		if (d->probability < p->thresh_prob)
+	p->num_values = offset;
+
+	for (i = 0; yolo_decoders[i].decode; i++) {
+		if (yolo_decoders[i].ver != p->ver)
 			continue;
-		jobj = json_object_new_object();
-		jbox = json_object_new_object();
-		if (!jobj || !jbox) {
-			json_object_put(jbox);
-			json_object_put(jobj);
-			rc = -errno;
-			goto err;
-		}
-		n = d->pred_class;
-		json_object_object_add(jobj, "label", json_object_new_string(p->labels[n]));
-		json_object_object_add(jobj, "box", jbox);
-		json_object_object_add(jbox, "x", json_object_new_int(d->box.x));
-		json_object_object_add(jbox, "y", json_object_new_int(d->box.y));
-		json_object_object_add(jbox, "w", json_object_new_int(d->box.w));
-		json_object_object_add(jbox, "h", json_object_new_int(d->box.h));
+		if (!yolo_decoders[i].num_class || yolo_decoders[i].num_class == p->num_labels)
+			break;
+	}
+	p->decode = yolo_decoders[i].decode;
 
-		json_object_object_add(jobj, "probability", json_object_new_double(d->probability));
+	return p->decode ? 0 : -EINVAL;
+}
 
-		json_object_array_add(arr, jobj);
-        }
-	free(detections);
+static void yolo_free_jobs(struct yolo_model_params *p)
+{
+	int i;
 
-	return 0;
-err:
-	free(detections);
-	json_object_put(obj);
-	json_object_put(arr);
-	return rc;
+	for (i = 0; p->jobs && i < p->num_jobs; i++) {
+		free(p->jobs[i].cells);
+		free(p->jobs[i].classes);
+		free(p->jobs[i].obj);
+		free(p->jobs[i].vals);
+		detections_free(&p->jobs[i].dets);
+	}
+	free(p->jobs);
 }
 
-static int yolo_load_labels(json_object *config, struct yolo_model_params *p)
+/* Split the planes into bands of whole rows, of about YOLO_JOB_CELLS */
+static int yolo_build_jobs(struct yolo_model_params *p)
 {
-	json_object *jobj;
-	int i;
+	int i, k, num = 0;
 
-	jobj = json_object_object_get(config, "labels");
-	if (!jobj || !json_object_is_type(jobj, json_type_array))
-		return -ENOENT;
+	for (i = 0; i < p->num_planes; i++) {
+		int g = p->planes[i].num_grid;
 
-	p->num_labels = json_object_array_length(jobj);
-	p->labels = malloc(sizeof(char*) * p->num_labels);
-	if (!p->labels) {
-		free(p);
-		return -ENOMEM;
+		num += (g * g + YOLO_JOB_CELLS - 1) / YOLO_JOB_CELLS;
 	}
 
-	/* This saves up a bit on re-allocation during processing */
-	p->classes = malloc(sizeof(*(p->classes)) * p->num_labels);
-	if (!p->classes) {
-		free(p->labels);
-		free(p);
+	p->jobs = calloc(num ? num : 1, sizeof(*p->jobs));
+	if (!p->jobs)
 		return -ENOMEM;
-	}
-
-	for (i = 0; i < p->num_labels; i++) {
-		json_object *e = json_object_array_get_idx(jobj, i);
-		p->labels[i] = strdup(json_object_get_string(e));
+	p->num_jobs = num;
+
+	for (i = 0, k = 0; i < p->num_planes; i++) {
+		const struct yolo_plane *pl = &p->planes[i];
+		int g = pl->num_grid;
+		int bands = (g * g + YOLO_JOB_CELLS - 1) / YOLO_JOB_CELLS;
+		int b;
+
+		for (b = 0; b < bands; b++, k++) {
+			struct yolo_job *j = &p->jobs[k];
+			int row0 = b * g / bands;
+			int row1 = (b + 1) * g / bands;
+
+			j->pl = pl;
+			j->start = row0 * g;
+			j->num = (row1 - row0) * g;
+			j->cells = malloc(sizeof(*j->cells) * (j->num ? j->num : 1));
+			j->classes = malloc(sizeof(*j->classes) * p->num_labels);
+			j->obj = malloc(sizeof(*j->obj) * (j->num ? j->num : 1));
+			j->vals = malloc(sizeof(*j->vals) * (5 + p->num_labels));
+			if (!j->cells || !j->classes || !j->obj || !j->vals)
+				return -ENOMEM;
+		}
 	}
 
 	return 0;
 }
 
-static void yolo_free_labels(struct yolo_model_params *p)
+static int yolo_load_labels(json_object *config, struct yolo_model_params *p)
 {
-	int i;
+	int num;
 
-	if (!p || !p->labels)
-		return;
+	p->labels = drpai_model_config_get_labels(config, &num);
+	if (!p->labels)
+		return num;
+	p->num_labels = num;
 
-	for (i = 0; i < p->num_labels; i++)
-		free(p->labels[i]);
-	free(p->labels);
-	free(p->classes);
+	return 0;
 }
 
-static int yolo_config_get_int(json_object *cfg, const char *id, int dflt)
+static void yolo_free_labels(struct yolo_model_params *p)
 {
-	json_object *jobj = json_object_object_get(cfg, id);
-	return jobj ? json_object_get_int(jobj) : dflt;
-}
+	if (!p)
+		return;
 
-static float yolo_config_get_float(json_object *cfg, const char *id, float dflt)
-{
-	json_object *jobj = json_object_object_get(cfg, id);
-	return jobj ? json_object_get_double(jobj) : dflt;
+	drpai_model_free_labels(p->labels, p->num_labels);
 }
 
 static int yolo_config_load_num_grids(json_object *cfg, struct yolo_model_params *p)
 {
 	json_object *jobj = json_object_object_get(cfg, "num_grids");
-	int i, num;
+	int i, num, num_cells = 0;
 
 	if (!jobj || !json_object_is_type(jobj, json_type_array))
 		return -EINVAL;
@@ -372,8 +645,15 @@ static int yolo_config_load_num_grids(json_object *cfg, struct yolo_model_params
 	for (i = 0; i < num; i++) {
 		json_object *e = json_object_array_get_idx(jobj, i);
 		p->num_grids[i] = json_object_get_int(e);
+		if (p->num_grids[i] <= 0)
+			return -EINVAL;
+		num_cells += p->num_grids[i] * p->num_grids[i];
 	}
 
+	p->cell_mask = malloc(num_cells ? num_cells : 1);
+	if (!p->cell_mask)
+		return -ENOMEM;
+
 	return 0;
 }
 
@@ -386,7 +666,8 @@ static int yolo_config_load_anchors(json_object *cfg, struct yolo_model_params *
 		return -EINVAL;
 
 	num = json_object_array_length(jobj);
-	p->anchors = malloc(sizeof(*(p->anchors)) * num);
+	p->num_anchors = num;
+	p->anchors = malloc(sizeof(*(p->anchors)) * (num ? num : 1));
 	if (!p->anchors)
 		return -ENOMEM;
 
@@ -401,7 +682,7 @@ static int yolo_config_load_anchors(json_object *cfg, struct yolo_model_params *
 static void *yolo_init(json_object *config, int *err)
 {
 	struct yolo_model_params *p = NULL;
-	int rc, lret = 0;
+	int lret = 0, threads;
 	const char *s;
 
 	s = json_object_get_string(json_object_object_get(config, "model_type"));
@@ -416,7 +697,9 @@ static void *yolo_init(json_object *config, int *err)
 		goto err_store;
 	}
 
-	if (!strcmp("yolov3", s)) {
+	if (!strcmp("yolov5", s)) {
+		p->ver = 5;
+	} else if (!strcmp("yolov3", s)) {
 		p->ver = 3;
 	} else if (!strcmp("yolov2", s)) {
 		p->ver = 2;
@@ -425,26 +708,40 @@ static void *yolo_init(json_object *config, int *err)
 		goto err_store;
 	}
 
-	rc = yolo_load_labels(config, p);
-	if (rc)
+	lret = yolo_load_labels(config, p);
+	if (lret)
 		goto err_store;
 
-	p->model_in_w = yolo_config_get_int(config, "model_in_w", 416);
-	p->model_in_h = yolo_config_get_int(config, "model_in_h", 416);
-	p->num_bb = yolo_config_get_int(config, "num_bb", -1);
+	p->model_in_w = drpai_config_get_int(config, "model_in_w", 416);
+	p->model_in_h = drpai_config_get_int(config, "model_in_h", 416);
+	p->num_bb = drpai_config_get_int(config, "num_bb", -1);
 	if (p->num_bb < 0) {
 		lret = -EINVAL;
 		goto err_store;
 	}
 
-	p->thresh_prob = yolo_config_get_float(config, "thresh_prob", -1.);
+	p->thresh_prob = drpai_config_get_float(config, "thresh_prob", -1.);
 	if (p->thresh_prob < 0) {
 		lret = -EINVAL;
 		goto err_store;
 	}
+	p->thresh_obj = vmath_logitf(p->thresh_prob) - YOLO_OBJ_SLACK;
+
+	/* probabilities are in percent by then */
+	p->nms = nms_create(config, p->thresh_prob * 100.0f, &lret);
+	if (!p->nms)
+		goto err_store;
 
-	p->thresh_nms = yolo_config_get_float(config, "thresh_nms", -1.);
-	if (p->thresh_nms < 0) {
+	s = json_object_get_string(json_object_object_get(config, "decode"));
+	if (s && !strcmp(s, "drp")) {
+		p->drp_decode = true;
+		p->max_boxes = drpai_config_get_int(config, "max_boxes", 100);
+		if (p->max_boxes <= 0) {
+			lret = -EINVAL;
+			goto err_store;
+		}
+		return p;
+	} else if (s && strcmp(s, "cpu")) {
 		lret = -EINVAL;
 		goto err_store;
 	}
@@ -457,12 +754,34 @@ static void *yolo_init(json_object *config, int *err)
 	if (lret < 0)
 		goto err_store;
 
+	lret = yolo_build_plan(p);
+	if (lret < 0)
+		goto err_store;
+
+	lret = yolo_build_jobs(p);
+	if (lret < 0)
+		goto err_store;
+
+	/* threads besides the calling one; by default, one per other core */
+	threads = drpai_config_get_int(config, "decode_threads", -1);
+	if (threads) {
+		p->workers = workers_get(threads, &lret);
+		if (!p->workers)
+			goto err_store;
+	}
+
 	return p;
 err_store:
-	free(p->num_grids);
-	free(p->anchors);
-	yolo_free_labels(p);
-	free(p);
+	if (p) {
+		free(p->num_grids);
+		free(p->cell_mask);
+		free(p->anchors);
+		free(p->planes);
+		yolo_free_jobs(p);
+		nms_free(p->nms);
+		yolo_free_labels(p);
+		free(p);
+	}
 	if (err)
 		*err = lret;
 	return NULL;
@@ -475,8 +794,17 @@ static void yolo_cleanup(void *model_params)
 	if (!p)
 		return;
 
+	/* the jobs of a frame may still be running */
+	workers_wait(p->workers, &p->batch);
+	workers_put(p->workers);
 	free(p->num_grids);
+	free(p->cell_mask);
 	free(p->anchors);
+	free(p->planes);
+	yolo_free_jobs(p);
+	detections_free(&p->dets);
+	free(p->records);
+	nms_free(p->nms);
 	yolo_free_labels(p);
 	free(p);
 }
@@ -485,5 +813,7 @@ const struct drpai_model_ops yolo_model_ops = {
 	.init = yolo_init,
 	.cleanup = yolo_cleanup,
 	.postprocessing = yolo_postprocessing,
+	.postprocessing_start = yolo_postprocessing_start,
+	.postprocessing_finish = yolo_postprocessing_finish,
 };
 
@@ -0,0 +1,326 @@
+
+#include "detections.h"
+#include "models.h"
+#include "nms.h"
+#include "vmath.h"
+#include "workers.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Anchor-free YOLOv8 style heads (YOLOv8/v11 exports look the same): one
+ * output of (4 + classes) x N values, channel-major, for the N grid points
+ * of all strides. The first four channels are the box (center x, center y,
+ * width, height, in model input pixels, with the distribution focal loss
+ * already applied in the graph); the others are the class scores, with no
+ * objectness.
+ * Config:
+ *   "labels": [ ... ],
+ *   "model_in_w": 640, "model_in_h": 640,
+ *   "strides": [ 8, 16, 32 ], to work out N,
+ *   "scores": "sigmoid" (the default, probabilities already) or "logits",
+ *   "thresh_prob": minimum probability (0..1),
+ *   "decode_threads": threads besides the calling one,
+ * and the NMS settings of nms_create().
+ */
+
+/* A band of grid points, as a job for the worker pool; see model_yolo.c */
+struct yolov8_job {
+	int start;
+	int num;
+	float *max;		/* best class score of each point of the band */
+	float *row;		/* narrow output types: a class row, as floats */
+	int *cells;
+	struct detections dets;
+};
+
+#define YOLOV8_JOB_POINTS	1024
+
+struct yolov8_model_params {
+	char **labels;
+	int num_labels;
+	int model_in_w;
+	int model_in_h;
+	int num_points;
+	bool logits;
+	float thresh_prob;
+	float thresh_score;	/* thresh_prob as a raw score */
+	struct nms *nms;
+	struct yolov8_job *jobs;
+	int num_jobs;
+	struct workers *workers;
+	/* the frame being decoded */
+	const struct drpai_tensor *out;
+	const struct drpai_frame *frame;
+	/* all detections, before NMS */
+	struct detections dets;
+};
+
+/* The pre-filter on raw scores is conservative by this much */
+#define YOLOV8_SCORE_SLACK	1e-3f
+
+/**
+ * The best class score of each point is worked out a class row at a time,
+ * which reads the output in order and is all vector operations; only the
+ * points whose best score passes are looked at one by one.
+ */
+static int yolov8_decode_job(void *arg, int idx)
+{
+	struct yolov8_model_params *p = arg;
+	const struct drpai_tensor *out = p->out;
+	struct yolov8_job *j = &p->jobs[idx];
+	const size_t n = p->num_points;
+	int c, k, num_cells, rc;
+
+	j->dets.num = 0;
+
+	for (c = 0; c < p->num_labels; c++) {
+		size_t row = (4 + c) * n + j->start;
+		const float *src;
+
+		if (out->dtype == DRPAI_DTYPE_FP32) {
+			src = (const float *)out->data + row;
+		} else {
+			drpai_tensor_read(out, row, 1, j->num, j->row);
+			src = j->row;
+		}
+
+		if (c)
+			vmath_max(j->max, src, j->num);
+		else
+			memcpy(j->max, src, j->num * sizeof(*j->max));
+	}
+
+	num_cells = vmath_select_ge(j->max, j->num, p->thresh_score, NULL, j->cells);
+
+	for (k = 0; k < num_cells; k++) {
+		size_t i = j->start + j->cells[k];
+		float center_x, center_y, box_w, box_h;
+		float score = -INFINITY, probability;
+		int pred_class = 0;
+
+		for (c = 0; c < p->num_labels; c++) {
+			float v = drpai_tensor_get(out, (4 + c) * n + i);
+
+			if (v > score) {
+				score = v;
+				pred_class = c;
+			}
+		}
+
+		probability = p->logits ? vmath_sigmoidf(score) : score;
+		if (probability < p->thresh_prob)
+			continue;
+
+		center_x = drpai_tensor_get(out, i) / p->model_in_w;
+		center_y = drpai_tensor_get(out, n + i) / p->model_in_h;
+		box_w = drpai_tensor_get(out, 2 * n + i) / p->model_in_w;
+		box_h = drpai_tensor_get(out, 3 * n + i) / p->model_in_h;
+
+		if (!drpai_frame_in_roi(p->frame, center_x, center_y))
+			continue;
+
+		rc = detections_add(&j->dets, p->frame, center_x, center_y, box_w, box_h,
+				    pred_class, probability);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+static int yolov8_postprocessing(void *model_params, const struct drpai_tensor *out,
+				 const struct drpai_frame *frame, json_object *result)
+{
+	struct yolov8_model_params *p = model_params;
+	int i, rc, num_detections;
+
+	if (out->num < (size_t)(4 + p->num_labels) * p->num_points)
+		return -EINVAL;
+
+	p->out = out;
+	p->frame = frame;
+	rc = workers_run(p->workers, p->num_jobs, yolov8_decode_job, p);
+	p->out = NULL;
+	p->frame = NULL;
+	if (rc)
+		return rc;
+
+	/* in job order, so that the result does not depend on the threads */
+	p->dets.num = 0;
+	for (i = 0; i < p->num_jobs; i++) {
+		rc = detections_append(&p->dets, &p->jobs[i].dets);
+		if (rc)
+			return rc;
+	}
+
+	num_detections = nms_run(p->nms, p->dets.d, p->dets.num);
+	if (num_detections < 0)
+		return num_detections;
+
+	return detections_to_json(&p->dets, num_detections, p->labels,
+				  p->thresh_prob * 100.0f, result);
+}
+
+/* The number of grid points of all strides */
+static int yolov8_config_load_strides(json_object *cfg, struct yolov8_model_params *p)
+{
+	static const int default_strides[] = { 8, 16, 32 };
+	json_object *jobj = json_object_object_get(cfg, "strides");
+	int i, num, stride;
+
+	if (jobj && !json_object_is_type(jobj, json_type_array))
+		return -EINVAL;
+
+	num = jobj ? (int)json_object_array_length(jobj) : 3;
+	p->num_points = 0;
+
+	for (i = 0; i < num; i++) {
+		stride = jobj ? json_object_get_int(json_object_array_get_idx(jobj, i)) :
+				default_strides[i];
+		if (stride <= 0)
+			return -EINVAL;
+		p->num_points += ((p->model_in_w + stride - 1) / stride) *
+				 ((p->model_in_h + stride - 1) / stride);
+	}
+
+	return p->num_points ? 0 : -EINVAL;
+}
+
+static void yolov8_free_jobs(struct yolov8_model_params *p)
+{
+	int i;
+
+	for (i = 0; p->jobs && i < p->num_jobs; i++) {
+		free(p->jobs[i].max);
+		free(p->jobs[i].row);
+		free(p->jobs[i].cells);
+		detections_free(&p->jobs[i].dets);
+	}
+	free(p->jobs);
+}
+
+static int yolov8_build_jobs(struct yolov8_model_params *p)
+{
+	int i;
+
+	p->num_jobs = (p->num_points + YOLOV8_JOB_POINTS - 1) / YOLOV8_JOB_POINTS;
+	p->jobs = calloc(p->num_jobs, sizeof(*p->jobs));
+	if (!p->jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < p->num_jobs; i++) {
+		struct yolov8_job *j = &p->jobs[i];
+
+		j->start = i * p->num_points / p->num_jobs;
+		j->num = (i + 1) * p->num_points / p->num_jobs - j->start;
+		j->max = malloc(sizeof(*j->max) * j->num);
+		j->row = malloc(sizeof(*j->row) * j->num);
+		j->cells = malloc(sizeof(*j->cells) * j->num);
+		if (!j->max || !j->row || !j->cells)
+			return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void yolov8_cleanup(void *model_params)
+{
+	struct yolov8_model_params *p = model_params;
+
+	if (!p)
+		return;
+
+	workers_put(p->workers);
+	yolov8_free_jobs(p);
+	detections_free(&p->dets);
+	nms_free(p->nms);
+	drpai_model_free_labels(p->labels, p->num_labels);
+	free(p);
+}
+
+static void *yolov8_init(json_object *config, int *err)
+{
+	struct yolov8_model_params *p;
+	int lret = 0, threads;
+	const char *s;
+
+	p = calloc(1, sizeof(*p));
+	if (!p) {
+		lret = -ENOMEM;
+		goto err_store;
+	}
+
+	p->labels = drpai_model_config_get_labels(config, &p->num_labels);
+	if (!p->labels) {
+		lret = p->num_labels;
+		p->num_labels = 0;
+		goto err_free;
+	}
+	if (!p->num_labels) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	p->model_in_w = drpai_config_get_int(config, "model_in_w", 640);
+	p->model_in_h = drpai_config_get_int(config, "model_in_h", 640);
+	if (p->model_in_w <= 0 || p->model_in_h <= 0) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	lret = yolov8_config_load_strides(config, p);
+	if (lret)
+		goto err_free;
+
+	s = json_object_get_string(json_object_object_get(config, "scores"));
+	if (s && !strcmp(s, "logits")) {
+		p->logits = true;
+	} else if (s && strcmp(s, "sigmoid")) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+
+	p->thresh_prob = drpai_config_get_float(config, "thresh_prob", -1.);
+	if (p->thresh_prob < 0) {
+		lret = -EINVAL;
+		goto err_free;
+	}
+	p->thresh_score = p->logits ? vmath_logitf(p->thresh_prob) - YOLOV8_SCORE_SLACK :
+				      p->thresh_prob - YOLOV8_SCORE_SLACK;
+
+	/* probabilities are in percent by then */
+	p->nms = nms_create(config, p->thresh_prob * 100.0f, &lret);
+	if (!p->nms)
+		goto err_free;
+
+	lret = yolov8_build_jobs(p);
+	if (lret)
+		goto err_free;
+
+	threads = drpai_config_get_int(config, "decode_threads", -1);
+	if (threads) {
+		p->workers = workers_get(threads, &lret);
+		if (!p->workers)
+			goto err_free;
+	}
+
+	return p;
+err_free:
+	yolov8_cleanup(p);
+err_store:
+	if (err)
+		*err = lret;
+	return NULL;
+}
+
+const struct drpai_model_ops yolov8_model_ops = {
+	.init = yolov8_init,
+	.cleanup = yolov8_cleanup,
+	.postprocessing = yolov8_postprocessing,
+};
@@ -1,9 +1,11 @@
 #define MODELS_PRIVATE_DATA
 #include "models.h"
+#include "plugins.h"
 
 #include <sys/stat.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 struct model_type_to_ops_map {
@@ -11,10 +13,15 @@ struct model_type_to_ops_map {
 	const struct drpai_model_ops *ops;
 };
 
-/* These are common/reference models */
+/* These are common/reference models; any others come from plugins */
 static const struct model_type_to_ops_map model_type_to_ops_map[] = {
 	{ "yolov2",		&yolo_model_ops },
 	{ "yolov3",		&yolo_model_ops },
+	{ "yolov5",		&yolo_model_ops },
+	{ "yolov8",		&yolov8_model_ops },
+	{ "ssd",		&ssd_model_ops },
+	{ "classification",	&classify_model_ops },
+	{ "segmentation",	&segment_model_ops },
 	{ /* sentinel */ }
 };
 
@@ -31,7 +38,170 @@ const struct drpai_model_ops *drpai_model_type_to_ops(const char *type)
 		return model_type_to_ops_map[i].ops;
 	}
 
-	return NULL;
+	return drpai_plugins_find(type);
+}
+
+/* The "labels" array of a model config */
+char **drpai_model_config_get_labels(json_object *config, int *num)
+{
+	json_object *jobj;
+	char **labels;
+	int i, n;
+
+	jobj = json_object_object_get(config, "labels");
+	if (!jobj || !json_object_is_type(jobj, json_type_array)) {
+		*num = -ENOENT;
+		return NULL;
+	}
+
+	n = json_object_array_length(jobj);
+	labels = calloc(n ? n : 1, sizeof(*labels));
+	if (!labels) {
+		*num = -ENOMEM;
+		return NULL;
+	}
+
+	for (i = 0; i < n; i++) {
+		const char *s = json_object_get_string(json_object_array_get_idx(jobj, i));
+
+		labels[i] = strdup(s ? s : "");
+		if (!labels[i]) {
+			drpai_model_free_labels(labels, i);
+			*num = -ENOMEM;
+			return NULL;
+		}
+	}
+
+	*num = n;
+
+	return labels;
+}
+
+void drpai_model_free_labels(char **labels, int num)
+{
+	int i;
+
+	if (!labels)
+		return;
+
+	for (i = 0; i < num; i++)
+		free(labels[i]);
+	free(labels);
+}
+
+int drpai_config_get_int(json_object *cfg, const char *id, int dflt)
+{
+	json_object *jobj = json_object_object_get(cfg, id);
+	return jobj ? json_object_get_int(jobj) : dflt;
+}
+
+float drpai_config_get_float(json_object *cfg, const char *id, float dflt)
+{
+	json_object *jobj = json_object_object_get(cfg, id);
+	return jobj ? json_object_get_double(jobj) : dflt;
+}
+
+static const char * const drpai_dtype_names[] = {
+	[DRPAI_DTYPE_FP32] = "fp32",
+	[DRPAI_DTYPE_FP16] = "fp16",
+	[DRPAI_DTYPE_INT8] = "int8",
+	[DRPAI_DTYPE_UINT8] = "uint8",
+};
+
+int drpai_tensor_parse(json_object *cfg, struct drpai_tensor *t)
+{
+	json_object *jobj;
+	const char *s;
+	size_t i;
+
+	memset(t, 0, sizeof(*t));
+	t->dtype = DRPAI_DTYPE_FP32;
+	t->scale = 1.0f;
+	if (!cfg)
+		return 0;
+
+	s = json_object_get_string(json_object_object_get(cfg, "type"));
+	if (s) {
+		for (i = 0; i < sizeof(drpai_dtype_names) / sizeof(*drpai_dtype_names); i++) {
+			if (!strcmp(s, drpai_dtype_names[i]))
+				break;
+		}
+		if (i == sizeof(drpai_dtype_names) / sizeof(*drpai_dtype_names))
+			return -EINVAL;
+		t->dtype = i;
+	}
+
+	if ((jobj = json_object_object_get(cfg, "scale")))
+		t->scale = json_object_get_double(jobj);
+	if ((jobj = json_object_object_get(cfg, "zero_point")))
+		t->zero_point = json_object_get_int(jobj);
+
+	/* the decoders rely on the order of the values being kept */
+	if (t->scale <= 0)
+		return -EINVAL;
+
+	return 0;
+}
+
+size_t drpai_dtype_size(enum drpai_dtype dtype)
+{
+	switch (dtype) {
+	case DRPAI_DTYPE_FP16:
+		return 2;
+	case DRPAI_DTYPE_INT8:
+	case DRPAI_DTYPE_UINT8:
+		return 1;
+	default:
+		return 4;
+	}
+}
+
+void drpai_tensor_read(const struct drpai_tensor *t, size_t start, size_t stride,
+		       int n, float *dst)
+{
+	const uint8_t *src = (const uint8_t *)t->data + start * drpai_dtype_size(t->dtype);
+	int i;
+
+	if (stride != 1) {
+		for (i = 0; i < n; i++)
+			dst[i] = drpai_tensor_get(t, start + i * stride);
+		return;
+	}
+
+	switch (t->dtype) {
+	case DRPAI_DTYPE_FP16:
+		vmath_f16_to_f32_array(dst, (const uint16_t *)src, n);
+		break;
+	case DRPAI_DTYPE_INT8:
+		vmath_s8_to_f32(dst, (const int8_t *)src, n, t->scale, t->zero_point);
+		break;
+	case DRPAI_DTYPE_UINT8:
+		vmath_u8_to_f32(dst, src, n, t->scale, t->zero_point);
+		break;
+	default:
+		memcpy(dst, src, n * sizeof(*dst));
+		break;
+	}
+}
+
+const float *drpai_tensor_floats(const struct drpai_tensor *t, float **buf, size_t *buf_num)
+{
+	float *f;
+
+	if (t->dtype == DRPAI_DTYPE_FP32)
+		return t->data;
+
+	if (t->num > *buf_num) {
+		f = realloc(*buf, t->num * sizeof(*f));
+		if (!f)
+			return NULL;
+		*buf = f;
+		*buf_num = t->num;
+	}
+
+	drpai_tensor_read(t, 0, 1, t->num, *buf);
+
+	return *buf;
 }
 
 /* FIXME: Currently not used */
@@ -1,15 +1,128 @@
 #ifndef __MODELS_H__
 #define __MODELS_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <json-c/json.h>
 
+#include "vmath.h"
+
+struct drpai_roi;
+
+/* Region of the model input image that the model was run on, and how
+ * that image maps back onto the camera frame: input = frame * scale + pad
+ * where the letterboxed frame is the part of the camera frame at
+ * (src_x, src_y); the whole frame, unless cropped to a ROI or tiled.
+ */
+struct drpai_frame {
+	int x;
+	int y;
+	int width;
+	int height;
+	float scale;
+	int pad_x;
+	int pad_y;
+	int src_x;
+	int src_y;
+	int frame_width;
+	int frame_height;
+	const struct drpai_roi *roi;	/* NULL if the whole frame is of interest */
+};
+
+/* Map a box (center + size) from model input to camera frame coordinates */
+static inline void drpai_frame_map_box(const struct drpai_frame *f, float *cx, float *cy,
+				       float *w, float *h)
+{
+	if (f->scale <= 0)
+		return;
+
+	*cx = (*cx - f->pad_x) / f->scale + f->src_x;
+	*cy = (*cy - f->pad_y) / f->scale + f->src_y;
+	*w /= f->scale;
+	*h /= f->scale;
+}
+
+/* True if the point, relative to the model input (0..1), is in the ROI */
+bool drpai_frame_in_roi(const struct drpai_frame *f, float x, float y);
+
+enum drpai_dtype {
+	DRPAI_DTYPE_FP32,
+	DRPAI_DTYPE_FP16,
+	DRPAI_DTYPE_INT8,
+	DRPAI_DTYPE_UINT8,
+};
+
+/**
+ * The output tensor, as the DRP AI wrote it. Quantized values are
+ * (q - zero_point) * scale. Its type comes from the "output" object
+ * of the model config:
+ *   "output": { "type": "fp32" | "fp16" | "int8" | "uint8",
+ *               "scale": <float>, "zero_point": <int> }
+ */
+struct drpai_tensor {
+	const void *data;
+	size_t num;		/* of values */
+	enum drpai_dtype dtype;
+	float scale;
+	int zero_point;
+};
+
+int drpai_tensor_parse(json_object *cfg, struct drpai_tensor *t);
+size_t drpai_dtype_size(enum drpai_dtype dtype);
+
+static inline float drpai_tensor_get(const struct drpai_tensor *t, size_t idx)
+{
+	switch (t->dtype) {
+	case DRPAI_DTYPE_FP16:
+		return vmath_f16_to_f32(((const uint16_t *)t->data)[idx]);
+	case DRPAI_DTYPE_INT8:
+		return (((const int8_t *)t->data)[idx] - t->zero_point) * t->scale;
+	case DRPAI_DTYPE_UINT8:
+		return (((const uint8_t *)t->data)[idx] - t->zero_point) * t->scale;
+	default:
+		return ((const float *)t->data)[idx];
+	}
+}
+
+/* 'n' values from 'start' on, every 'stride' values, as floats */
+void drpai_tensor_read(const struct drpai_tensor *t, size_t start, size_t stride,
+		       int n, float *dst);
+
+/**
+ * The whole tensor as floats: the data itself if FP32, or else converted
+ * into '*buf', which is grown as needed (and to be freed by the caller).
+ */
+const float *drpai_tensor_floats(const struct drpai_tensor *t, float **buf, size_t *buf_num);
+
 struct drpai_model_ops {
 	void *(*init)(json_object *config, int *err);
 	void (*cleanup)(void *priv);
-	int (*postprocessing)(void *priv, float *data, int width, int height, json_object *result);
+	int (*postprocessing)(void *priv, const struct drpai_tensor *out,
+			      const struct drpai_frame *frame, json_object *result);
+	/**
+	 * Optional; post-processing off the calling thread. start() returns
+	 * once the work is under way (or -EOPNOTSUPP to do it the plain way),
+	 * and 'done' is called from any thread when it is over; finish()
+	 * then puts the result together, with the error of the work. 'out'
+	 * and 'frame' are to stay as they are until 'done'.
+	 */
+	int (*postprocessing_start)(void *priv, const struct drpai_tensor *out,
+				    const struct drpai_frame *frame,
+				    void (*done)(void *arg, int err), void *arg);
+	int (*postprocessing_finish)(void *priv, int err, json_object *result);
 };
 
 const struct drpai_model_ops *drpai_model_type_to_ops(const char *type);
+
+/* Returns the labels, with their number in 'num' (or a negative error) */
+char **drpai_model_config_get_labels(json_object *config, int *num);
+void drpai_model_free_labels(char **labels, int num);
+
+/* A number of a model config, or 'dflt' if it has none */
+int drpai_config_get_int(json_object *cfg, const char *id, int dflt);
+float drpai_config_get_float(json_object *cfg, const char *id, float dflt);
+
 /* FIXME: Currently not used */
 char **drpai_load_labels_from_file(const char *model, const char *fname, int *ret);
 
@@ -17,6 +130,10 @@ json_object *drpai_model_types_get();
 
 #ifdef MODELS_PRIVATE_DATA
 extern const struct drpai_model_ops yolo_model_ops;
+extern const struct drpai_model_ops yolov8_model_ops;
+extern const struct drpai_model_ops ssd_model_ops;
+extern const struct drpai_model_ops classify_model_ops;
+extern const struct drpai_model_ops segment_model_ops;
 #endif
 
 #endif /* __MODELS_H__ */
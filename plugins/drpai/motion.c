@@ -0,0 +1,404 @@
+
+#include "motion.h"
+#include "models.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/**
+ * Frames are compared on a luma plane, downsampled 4x4 (by averaging,
+ * which also takes out some of the sensor noise), against the last frame
+ * that was given to the accelerator. The plane is split in cells of
+ * 16x16 (i.e. 64x64 camera pixels); the changed pixels are counted per
+ * cell, which gives both the total and the regions that moved.
+ */
+
+#define MOTION_SCALE		4
+#define MOTION_CELL		16
+/* Motion of the frames submitted, but without a result yet */
+#define MOTION_PENDING		8
+
+struct motion_pending {
+	uint64_t submit_us;
+	json_object *jmotion;
+};
+
+struct motion_gate {
+	float threshold;
+	uint8_t pixel_threshold;
+	uint64_t max_interval_us;
+	bool regions;
+	/* downsampled planes, of the current and the reference frame */
+	int width;
+	int height;
+	int ds_w;
+	int ds_h;
+	uint8_t *cur;
+	uint8_t *ref;
+	bool have_ref;
+	/* changed pixels per cell, of the last checked frame */
+	int cells_x;
+	int cells_y;
+	uint16_t *cells;
+	float level;
+	uint64_t last_us;
+	struct motion_pending pending[MOTION_PENDING];
+	int num_pending;
+};
+
+/* Average 4x4 blocks of the luma of 4 YUYV rows, into 'n' pixels */
+static void motion_downsample_row(const uint8_t *src, int stride, uint8_t *dst, int n)
+{
+	int i = 0, y;
+
+#if defined(__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		const uint8_t *p = src + i * MOTION_SCALE * 2;
+		uint16x8_t lo = vdupq_n_u16(0);
+		uint16x8_t hi = vdupq_n_u16(0);
+		uint16x4_t s0, s1;
+
+		for (y = 0; y < MOTION_SCALE; y++) {
+			/* de-interleaves; the luma ends up in val[0] */
+			uint8x16x2_t a = vld2q_u8(p + y * stride);
+			uint8x16x2_t b = vld2q_u8(p + y * stride + 32);
+
+			lo = vpadalq_u8(lo, a.val[0]);
+			hi = vpadalq_u8(hi, b.val[0]);
+		}
+
+		s0 = vpadd_u16(vget_low_u16(lo), vget_high_u16(lo));
+		s1 = vpadd_u16(vget_low_u16(hi), vget_high_u16(hi));
+		vst1_u8(dst + i, vrshrn_n_u16(vcombine_u16(s0, s1), 4));
+	}
+#elif defined(__SSE2__)
+	const __m128i luma = _mm_set1_epi16(0x00ff);
+	const __m128i ones = _mm_set1_epi16(1);
+	const __m128i round = _mm_set1_epi16(8);
+
+	for (; i + 8 <= n; i += 8) {
+		const uint8_t *p = src + i * MOTION_SCALE * 2;
+		__m128i acc[4], q0, q1, q;
+		int k;
+
+		for (k = 0; k < 4; k++)
+			acc[k] = _mm_setzero_si128();
+
+		for (y = 0; y < MOTION_SCALE; y++) {
+			for (k = 0; k < 4; k++) {
+				__m128i v = _mm_loadu_si128((const __m128i *)(p + y * stride + 16 * k));
+				acc[k] = _mm_add_epi16(acc[k], _mm_and_si128(v, luma));
+			}
+		}
+
+		/* pairs, then groups of 4; at most 4 * 4 * 255, fits 16 bits */
+		q0 = _mm_packs_epi32(_mm_madd_epi16(acc[0], ones), _mm_madd_epi16(acc[1], ones));
+		q1 = _mm_packs_epi32(_mm_madd_epi16(acc[2], ones), _mm_madd_epi16(acc[3], ones));
+		q = _mm_packs_epi32(_mm_madd_epi16(q0, ones), _mm_madd_epi16(q1, ones));
+		q = _mm_srli_epi16(_mm_add_epi16(q, round), 4);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(q, q));
+	}
+#endif
+	for (; i < n; i++) {
+		const uint8_t *p = src + i * MOTION_SCALE * 2;
+		unsigned int sum = 0;
+
+		for (y = 0; y < MOTION_SCALE; y++)
+			sum += p[y * stride] + p[y * stride + 2] + p[y * stride + 4] + p[y * stride + 6];
+		dst[i] = (sum + 8) >> 4;
+	}
+}
+
+/* Number of pixels with |a - b| > thr */
+static int motion_count_changed(const uint8_t *a, const uint8_t *b, int n, uint8_t thr)
+{
+	int i = 0, count = 0;
+
+#if defined(__ARM_NEON)
+	const uint8x16_t vthr = vdupq_n_u8(thr);
+	uint16x8_t acc = vdupq_n_u16(0);
+	uint64x2_t sum;
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t d = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+
+		acc = vpadalq_u8(acc, vshrq_n_u8(vcgtq_u8(d, vthr), 7));
+	}
+	sum = vpaddlq_u32(vpaddlq_u16(acc));
+	count = vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+#elif defined(__SSE2__)
+	const __m128i vthr = _mm_set1_epi8(thr);
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		/* all ones where not changed */
+		__m128i same = _mm_cmpeq_epi8(_mm_subs_epu8(d, vthr), zero);
+
+		count += 16 - __builtin_popcount(_mm_movemask_epi8(same));
+	}
+#endif
+	for (; i < n; i++) {
+		int d = a[i] - b[i];
+
+		if (d > thr || -d > thr)
+			count++;
+	}
+
+	return count;
+}
+
+static int motion_resize(struct motion_gate *m, int width, int height)
+{
+	size_t len;
+
+	free(m->cur);
+	free(m->ref);
+	free(m->cells);
+	m->cur = m->ref = NULL;
+	m->cells = NULL;
+	m->have_ref = false;
+
+	m->width = width;
+	m->height = height;
+	m->ds_w = width / MOTION_SCALE;
+	m->ds_h = height / MOTION_SCALE;
+	m->cells_x = (m->ds_w + MOTION_CELL - 1) / MOTION_CELL;
+	m->cells_y = (m->ds_h + MOTION_CELL - 1) / MOTION_CELL;
+
+	len = m->ds_w * m->ds_h;
+	m->cur = malloc(len);
+	m->ref = malloc(len);
+	m->cells = calloc(m->cells_x * m->cells_y, sizeof(*m->cells));
+	if (!m->cur || !m->ref || !m->cells) {
+		m->width = m->height = 0;
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void motion_measure(struct motion_gate *m)
+{
+	int x, y, total = 0;
+
+	memset(m->cells, 0, m->cells_x * m->cells_y * sizeof(*m->cells));
+
+	for (y = 0; y < m->ds_h; y++) {
+		const uint8_t *a = m->cur + y * m->ds_w;
+		const uint8_t *b = m->ref + y * m->ds_w;
+		uint16_t *cells = m->cells + (y / MOTION_CELL) * m->cells_x;
+
+		for (x = 0; x < m->ds_w; x += MOTION_CELL) {
+			int n = m->ds_w - x < MOTION_CELL ? m->ds_w - x : MOTION_CELL;
+			int c = motion_count_changed(a + x, b + x, n, m->pixel_threshold);
+
+			cells[x / MOTION_CELL] += c;
+			total += c;
+		}
+	}
+
+	m->level = (float)total / (m->ds_w * m->ds_h);
+}
+
+bool motion_gate_check(struct motion_gate *m, const uint8_t *yuyv,
+		       int width, int height, uint64_t now_us)
+{
+	int y, stride = width * 2;
+
+	if (!m)
+		return true;
+
+	if (width != m->width || height != m->height) {
+		if (motion_resize(m, width, height))
+			return true;
+	}
+
+	if (!m->ds_w || !m->ds_h)
+		return true;
+
+	for (y = 0; y < m->ds_h; y++)
+		motion_downsample_row(yuyv + y * MOTION_SCALE * stride, stride,
+				      m->cur + y * m->ds_w, m->ds_w);
+
+	if (!m->have_ref) {
+		m->level = 1;
+		memset(m->cells, 0, m->cells_x * m->cells_y * sizeof(*m->cells));
+		return true;
+	}
+
+	motion_measure(m);
+	if (m->level >= m->threshold)
+		return true;
+
+	return m->max_interval_us && now_us - m->last_us >= m->max_interval_us;
+}
+
+/* Cells with motion, merged into horizontal runs, in camera pixels */
+static json_object *motion_regions(struct motion_gate *m)
+{
+	const int cell_px = MOTION_CELL * MOTION_SCALE;
+	/* a cell counts if a tenth of it changed */
+	const int min_count = MOTION_CELL * MOTION_CELL / 10;
+	json_object *arr = json_object_new_array();
+	int cx, cy;
+
+	if (!arr)
+		return NULL;
+
+	for (cy = 0; cy < m->cells_y; cy++) {
+		const uint16_t *cells = m->cells + cy * m->cells_x;
+
+		for (cx = 0; cx < m->cells_x; cx++) {
+			json_object *jbox;
+			int start, x, y, w, h;
+
+			if (cells[cx] < min_count)
+				continue;
+
+			start = cx;
+			while (cx + 1 < m->cells_x && cells[cx + 1] >= min_count)
+				cx++;
+
+			x = start * cell_px;
+			y = cy * cell_px;
+			w = (cx + 1) * cell_px;
+			h = y + cell_px;
+			w = (w > m->width ? m->width : w) - x;
+			h = (h > m->height ? m->height : h) - y;
+
+			jbox = json_object_new_object();
+			if (!jbox)
+				continue;
+			json_object_object_add(jbox, "x", json_object_new_int(x));
+			json_object_object_add(jbox, "y", json_object_new_int(y));
+			json_object_object_add(jbox, "w", json_object_new_int(w));
+			json_object_object_add(jbox, "h", json_object_new_int(h));
+			json_object_array_add(arr, jbox);
+		}
+	}
+
+	return arr;
+}
+
+void motion_gate_commit(struct motion_gate *m, uint64_t now_us)
+{
+	struct motion_pending *p;
+	json_object *jmotion;
+	uint8_t *tmp;
+
+	if (!m || !m->cur)
+		return;
+
+	tmp = m->ref;
+	m->ref = m->cur;
+	m->cur = tmp;
+	m->have_ref = true;
+	m->last_us = now_us;
+
+	if (!m->regions)
+		return;
+
+	jmotion = json_object_new_object();
+	if (!jmotion)
+		return;
+	json_object_object_add(jmotion, "level", json_object_new_double(m->level));
+	json_object_object_add(jmotion, "regions", motion_regions(m));
+
+	/* drop the oldest, if its result never came */
+	if (m->num_pending == MOTION_PENDING) {
+		json_object_put(m->pending[0].jmotion);
+		memmove(&m->pending[0], &m->pending[1],
+			(MOTION_PENDING - 1) * sizeof(m->pending[0]));
+		m->num_pending--;
+	}
+
+	p = &m->pending[m->num_pending++];
+	p->submit_us = now_us;
+	p->jmotion = jmotion;
+}
+
+/**
+ * The frame is committed just before it is submitted, so its entry is the
+ * last one committed at or before 'submit_us'; any older ones belong to
+ * results that are not coming anymore.
+ */
+void motion_gate_attach(struct motion_gate *m, json_object *result, uint64_t submit_us)
+{
+	int i, n = 0;
+
+	if (!m || !result)
+		return;
+
+	while (n < m->num_pending && m->pending[n].submit_us <= submit_us)
+		n++;
+	if (!n)
+		return;
+
+	json_object_object_add(result, "motion", m->pending[n - 1].jmotion);
+	for (i = 0; i < n - 1; i++)
+		json_object_put(m->pending[i].jmotion);
+
+	m->num_pending -= n;
+	memmove(&m->pending[0], &m->pending[n], m->num_pending * sizeof(m->pending[0]));
+}
+
+struct motion_gate *motion_gate_create(json_object *cfg, int *err)
+{
+	struct motion_gate *m;
+	float pixel_threshold, max_interval_ms;
+	json_object *jobj;
+	int lerr = 0;
+
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+
+	m->threshold = drpai_config_get_float(cfg, "threshold", 0.01f);
+	pixel_threshold = drpai_config_get_float(cfg, "pixel_threshold", 16);
+	max_interval_ms = drpai_config_get_float(cfg, "max_interval_ms", 2000);
+	if ((jobj = json_object_object_get(cfg, "regions")))
+		m->regions = json_object_get_boolean(jobj);
+
+	if (m->threshold < 0 || m->threshold > 1 || pixel_threshold < 0 ||
+	    pixel_threshold > 255 || max_interval_ms < 0) {
+		free(m);
+		lerr = -EINVAL;
+		goto err_store;
+	}
+
+	m->pixel_threshold = pixel_threshold;
+	m->max_interval_us = max_interval_ms * 1000;
+
+	return m;
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void motion_gate_free(struct motion_gate *m)
+{
+	int i;
+
+	if (!m)
+		return;
+
+	for (i = 0; i < m->num_pending; i++)
+		json_object_put(m->pending[i].jmotion);
+	free(m->cur);
+	free(m->ref);
+	free(m->cells);
+	free(m);
+}
@@ -0,0 +1,33 @@
+#ifndef __DRPAI_MOTION_H__
+#define __DRPAI_MOTION_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <json-c/json.h>
+
+/* Motion gate for one camera; opaque */
+struct motion_gate;
+
+/**
+ * 'cfg' is the optional "motion" object of the camera inference config:
+ *   { "threshold": <fraction of the image that must change, 0..1>,
+ *     "pixel_threshold": <luma difference for a pixel to count as changed>,
+ *     "max_interval_ms": <run anyway after this long, 0 = never>,
+ *     "regions": <true, to add the regions that changed to the results> }
+ */
+struct motion_gate *motion_gate_create(json_object *cfg, int *err);
+void motion_gate_free(struct motion_gate *m);
+
+/* True if the YUYV frame changed enough since the last committed frame
+ * (or the maximum interval ran out) to be worth running inference on.
+ */
+bool motion_gate_check(struct motion_gate *m, const uint8_t *yuyv,
+		       int width, int height, uint64_t now_us);
+
+/* The last checked frame was submitted; it becomes the reference */
+void motion_gate_commit(struct motion_gate *m, uint64_t now_us);
+
+/* Add the motion of the frame submitted at 'submit_us' to its result */
+void motion_gate_attach(struct motion_gate *m, json_object *result, uint64_t submit_us);
+
+#endif /* __DRPAI_MOTION_H__ */
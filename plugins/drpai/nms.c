@@ -0,0 +1,277 @@
+
+#include "nms.h"
+#include "models.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Candidates are sorted by class, and by probability within a class, so
+ * that each class is a bucket that is filtered on its own: a candidate
+ * is only compared with the boxes kept so far in its class, and a class
+ * is done as soon as it has 'max_per_class' of them.
+ */
+
+struct nms_key {
+	int cls;
+	float prob;
+	int idx;
+};
+
+struct nms {
+	float thresh;
+	float soft_sigma;	/* 0 for plain NMS */
+	float min_probability;
+	int max_per_class;
+	int max_per_frame;
+	/* grown on demand and kept between frames */
+	int size;
+	struct nms_key *keys;
+	float *areas;
+	int *kept;
+	struct nms_detection *tmp;
+};
+
+struct nms *nms_create(json_object *config, float min_probability, int *err)
+{
+	struct nms *n;
+	int lerr = 0;
+
+	n = calloc(1, sizeof(*n));
+	if (!n) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+
+	n->thresh = drpai_config_get_float(config, "thresh_nms", -1.);
+	n->max_per_class = drpai_config_get_int(config, "max_per_class", 0);
+	n->max_per_frame = drpai_config_get_int(config, "max_per_frame", 0);
+	n->soft_sigma = drpai_config_get_float(config, "soft_nms_sigma", 0);
+	n->min_probability = min_probability;
+
+	if (n->thresh < 0 || n->max_per_class < 0 || n->max_per_frame < 0 ||
+	    n->soft_sigma < 0) {
+		lerr = -EINVAL;
+		goto err_free;
+	}
+
+	return n;
+err_free:
+	free(n);
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void nms_free(struct nms *n)
+{
+	if (!n)
+		return;
+
+	free(n->keys);
+	free(n->areas);
+	free(n->kept);
+	free(n->tmp);
+	free(n);
+}
+
+static int nms_reserve(struct nms *n, int num)
+{
+	void *keys, *areas, *kept, *tmp;
+
+	if (num <= n->size)
+		return 0;
+
+	num += 64;
+	keys = realloc(n->keys, num * sizeof(*n->keys));
+	if (keys)
+		n->keys = keys;
+	areas = realloc(n->areas, num * sizeof(*n->areas));
+	if (areas)
+		n->areas = areas;
+	kept = realloc(n->kept, num * sizeof(*n->kept));
+	if (kept)
+		n->kept = kept;
+	tmp = realloc(n->tmp, num * sizeof(*n->tmp));
+	if (tmp)
+		n->tmp = tmp;
+
+	if (!keys || !areas || !kept || !tmp)
+		return -ENOMEM;
+
+	n->size = num;
+
+	return 0;
+}
+
+/* by class, then most likely first */
+static int nms_key_cmp(const void *a, const void *b)
+{
+	const struct nms_key *ka = a, *kb = b;
+
+	if (ka->cls != kb->cls)
+		return ka->cls < kb->cls ? -1 : 1;
+	if (ka->prob != kb->prob)
+		return ka->prob > kb->prob ? -1 : 1;
+
+	return ka->idx - kb->idx;
+}
+
+static int nms_detection_cmp(const void *a, const void *b)
+{
+	const struct nms_detection *da = a, *db = b;
+
+	return (da->probability < db->probability) - (da->probability > db->probability);
+}
+
+/* IoU of two boxes; and if one lies (nearly) inside the other, which counts as overlapping too */
+static float nms_iou(const struct nms_box *a, float area_a,
+		     const struct nms_box *b, float area_b, bool *contained)
+{
+	int iw = (a->x + a->w < b->x + b->w ? a->x + a->w : b->x + b->w) -
+		 (a->x > b->x ? a->x : b->x);
+	int ih = (a->y + a->h < b->y + b->h ? a->y + a->h : b->y + b->h) -
+		 (a->y > b->y ? a->y : b->y);
+	float inter, uni;
+
+	*contained = false;
+	if (iw <= 0 || ih <= 0)
+		return 0;
+
+	inter = (float)iw * ih;
+	uni = area_a + area_b - inter;
+	*contained = inter >= area_a - 1 || inter >= area_b - 1;
+
+	return uni > 0 ? inter / uni : 1;
+}
+
+/* Greedy NMS of the class bucket keys[start..end) */
+static int nms_hard(struct nms *n, const struct nms_detection *d,
+		    int start, int end, int num_kept)
+{
+	int first = num_kept;
+	int j, k;
+
+	for (j = start; j < end; j++) {
+		int i = n->keys[j].idx;
+		bool suppressed = false;
+
+		if (n->max_per_class && num_kept - first >= n->max_per_class)
+			break;
+
+		for (k = first; k < num_kept && !suppressed; k++) {
+			int o = n->kept[k];
+			bool contained;
+			float iou = nms_iou(&d[i].box, n->areas[i], &d[o].box, n->areas[o],
+					    &contained);
+
+			suppressed = iou > n->thresh || contained;
+		}
+
+		if (!suppressed)
+			n->kept[num_kept++] = i;
+	}
+
+	return num_kept;
+}
+
+/**
+ * Gaussian soft-NMS (Bodla et al.) of the class bucket keys[start..end):
+ * take the most likely box, scale the probability of each one left by
+ * exp(-iou^2 / sigma), drop those below the minimum, and repeat.
+ */
+static int nms_soft(struct nms *n, struct nms_detection *d,
+		    int start, int end, int num_kept)
+{
+	int first = num_kept;
+	int i, j, best;
+
+	while (start < end) {
+		struct nms_key tmp;
+
+		if (n->max_per_class && num_kept - first >= n->max_per_class)
+			break;
+
+		best = start;
+		for (j = start + 1; j < end; j++) {
+			if (n->keys[j].prob > n->keys[best].prob)
+				best = j;
+		}
+		tmp = n->keys[start];
+		n->keys[start] = n->keys[best];
+		n->keys[best] = tmp;
+
+		i = n->keys[start++].idx;
+		n->kept[num_kept++] = i;
+
+		for (j = start; j < end; ) {
+			struct nms_key *k = &n->keys[j];
+			int o = k->idx;
+			bool contained;
+			float iou = nms_iou(&d[i].box, n->areas[i], &d[o].box, n->areas[o],
+					    &contained);
+
+			if (iou > 0) {
+				k->prob *= expf(-iou * iou / n->soft_sigma);
+				d[o].probability = k->prob;
+			}
+
+			if (k->prob < n->min_probability) {
+				*k = n->keys[--end];
+				continue;
+			}
+			j++;
+		}
+	}
+
+	return num_kept;
+}
+
+int nms_run(struct nms *n, struct nms_detection *d, int num)
+{
+	int i, start, end, num_kept = 0;
+	int rc;
+
+	if (num <= 0)
+		return 0;
+
+	rc = nms_reserve(n, num);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < num; i++) {
+		n->keys[i].cls = d[i].pred_class;
+		n->keys[i].prob = d[i].probability;
+		n->keys[i].idx = i;
+		n->areas[i] = (float)d[i].box.w * d[i].box.h;
+	}
+
+	qsort(n->keys, num, sizeof(*n->keys), nms_key_cmp);
+
+	for (start = 0; start < num; start = end) {
+		for (end = start + 1; end < num && n->keys[end].cls == n->keys[start].cls; end++)
+			;
+
+		if (n->soft_sigma > 0)
+			num_kept = nms_soft(n, d, start, end, num_kept);
+		else
+			num_kept = nms_hard(n, d, start, end, num_kept);
+	}
+
+	for (i = 0; i < num_kept; i++)
+		n->tmp[i] = d[n->kept[i]];
+
+	if (num_kept > 1)
+		qsort(n->tmp, num_kept, sizeof(*n->tmp), nms_detection_cmp);
+
+	if (n->max_per_frame && num_kept > n->max_per_frame)
+		num_kept = n->max_per_frame;
+
+	memcpy(d, n->tmp, num_kept * sizeof(*d));
+
+	return num_kept;
+}
@@ -0,0 +1,41 @@
+#ifndef __DRPAI_NMS_H__
+#define __DRPAI_NMS_H__
+
+#include <json-c/json.h>
+
+/* Box in camera frame pixels; (x, y) is the top left corner */
+struct nms_box {
+	int x;
+	int y;
+	int w;
+	int h;
+};
+
+struct nms_detection {
+	struct nms_box box;
+	int pred_class;
+	float probability;
+};
+
+/* Non-maximum suppression, with its buffers; opaque */
+struct nms;
+
+/**
+ * Reads the NMS settings of a model config:
+ *   "thresh_nms": <IoU above which the less likely box goes>,
+ *   "max_per_class": <at most this many detections per class, 0 = all>,
+ *   "max_per_frame": <at most this many detections in total, 0 = all>,
+ *   "soft_nms_sigma": <Gaussian soft-NMS instead, if > 0>
+ * With soft-NMS, overlapping boxes get their probability lowered instead,
+ * and only go once it drops below 'min_probability'.
+ */
+struct nms *nms_create(json_object *config, float min_probability, int *err);
+void nms_free(struct nms *n);
+
+/**
+ * Filters the detections in place; returns how many are left, sorted by
+ * probability (or a negative error code).
+ */
+int nms_run(struct nms *n, struct nms_detection *d, int num);
+
+#endif /* __DRPAI_NMS_H__ */
@@ -0,0 +1,308 @@
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+#include "pkg.h"
+
+#define ALIGN_UP(x, a)	(((x) + (a) - 1) & ~((uint64_t)(a) - 1))
+
+static void pkg_section_from_le(struct drpai_pkg_section *s)
+{
+	s->type = le32toh(s->type);
+	s->index = le32toh(s->index);
+	s->offset = le64toh(s->offset);
+	s->size = le64toh(s->size);
+	s->address = le32toh(s->address);
+	s->region_size = le32toh(s->region_size);
+}
+
+static void pkg_section_to_le(struct drpai_pkg_section *s)
+{
+	s->type = htole32(s->type);
+	s->index = htole32(s->index);
+	s->offset = htole64(s->offset);
+	s->size = htole64(s->size);
+	s->address = htole32(s->address);
+	s->region_size = htole32(s->region_size);
+}
+
+void drpai_pkg_close(struct drpai_pkg *pkg)
+{
+	if (pkg->map)
+		munmap(pkg->map, pkg->len);
+	pkg->map = NULL;
+	pkg->len = 0;
+	pkg->num_sections = 0;
+}
+
+int drpai_pkg_open(struct drpai_pkg *pkg, const char *model)
+{
+	struct drpai_pkg_header h;
+	struct drpai_pkg_section *s;
+	char path[512];
+	struct stat st;
+	size_t table;
+	int fd, i, rc;
+
+	pkg->map = NULL;
+	pkg->len = 0;
+	pkg->num_sections = 0;
+
+	snprintf(path, sizeof(path), "%s/%s" DRPAI_PKG_SUFFIX, DRPAI_MODELS_ROOT_DIR, model);
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st)) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+	if ((size_t)st.st_size < sizeof(h)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	pkg->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (pkg->map == MAP_FAILED) {
+		pkg->map = NULL;
+		return -errno;
+	}
+	pkg->len = st.st_size;
+
+	/* the sections are read once, front to back */
+	madvise(pkg->map, pkg->len, MADV_SEQUENTIAL);
+
+	memcpy(&h, pkg->map, sizeof(h));
+	h.version = le32toh(h.version);
+	h.num_sections = le32toh(h.num_sections);
+	h.size = le64toh(h.size);
+
+	table = sizeof(h) + (size_t)h.num_sections * sizeof(*s);
+	if (memcmp(h.magic, DRPAI_PKG_MAGIC, sizeof(h.magic)) ||
+	    h.version != DRPAI_PKG_VERSION ||
+	    h.num_sections > DRPAI_PKG_MAX_SECTIONS ||
+	    h.size != pkg->len || table > pkg->len) {
+		rc = -EINVAL;
+		goto err;
+	}
+
+	for (i = 0; i < (int)h.num_sections; i++) {
+		s = &pkg->sections[i];
+		memcpy(s, (const uint8_t *)pkg->map + sizeof(h) + i * sizeof(*s), sizeof(*s));
+		pkg_section_from_le(s);
+
+		if (s->type < DRPAI_PKG_CONFIG || s->type > DRPAI_PKG_PARAM_INFO ||
+		    s->offset > pkg->len || s->size > pkg->len - s->offset) {
+			rc = -EINVAL;
+			goto err;
+		}
+	}
+	pkg->num_sections = h.num_sections;
+
+	return 0;
+err:
+	lwsl_err("%s: %s: not a valid package\n", __func__, path);
+	drpai_pkg_close(pkg);
+	return rc;
+}
+
+json_object *drpai_pkg_config(const struct drpai_pkg *pkg, int *err)
+{
+	const struct drpai_pkg_section *s;
+	json_object *c;
+	char *str;
+	int i;
+
+	for (i = 0; i < pkg->num_sections; i++) {
+		s = &pkg->sections[i];
+		if (s->type != DRPAI_PKG_CONFIG)
+			continue;
+
+		/* not NUL terminated in the file */
+		str = strndup(drpai_pkg_data(pkg, s), s->size);
+		if (!str) {
+			*err = -ENOMEM;
+			return NULL;
+		}
+		c = json_tokener_parse(str);
+		free(str);
+
+		*err = c ? 0 : -EINVAL;
+		return c;
+	}
+
+	*err = -ENOENT;
+	return NULL;
+}
+
+int drpai_pkg_verify(const struct drpai_pkg *pkg, uint8_t digest[SHA256_SIZE])
+{
+	const struct drpai_pkg_section *s;
+	uint8_t hash[SHA256_SIZE];
+	struct sha256 sha;
+	int i;
+
+	for (i = 0; i < pkg->num_sections; i++) {
+		s = &pkg->sections[i];
+		if (!s->size)
+			continue;
+
+		sha256_init(&sha);
+		sha256_update(&sha, drpai_pkg_data(pkg, s), s->size);
+		sha256_final(&sha, hash);
+		if (memcmp(hash, s->sha256, sizeof(hash)))
+			return -EBADMSG;
+	}
+
+	sha256_init(&sha);
+	sha256_update(&sha, pkg->map, sizeof(struct drpai_pkg_header) +
+		      pkg->num_sections * sizeof(struct drpai_pkg_section));
+	sha256_final(&sha, digest);
+
+	return 0;
+}
+
+static int pkg_pwrite(int fd, const void *buf, size_t len, uint64_t offset)
+{
+	const uint8_t *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = pwrite(fd, p, len, offset);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+/* Copy a section into the package, and hash it on the way */
+static int pkg_write_section(int fd, const struct drpai_pkg_input *in,
+			     struct drpai_pkg_section *s)
+{
+	uint8_t buf[65536];
+	struct sha256 sha;
+	uint64_t done;
+	ssize_t n;
+	int src, rc = 0;
+
+	sha256_init(&sha);
+
+	if (!in->path) {
+		sha256_update(&sha, in->data, s->size);
+		sha256_final(&sha, s->sha256);
+		return pkg_pwrite(fd, in->data, s->size, s->offset);
+	}
+
+	src = open(in->path, O_RDONLY | O_CLOEXEC);
+	if (src < 0)
+		return -errno;
+
+	for (done = 0; done < s->size; done += n) {
+		n = read(src, buf, sizeof(buf));
+		if (n <= 0) {
+			rc = n ? -errno : -EIO;
+			break;
+		}
+		sha256_update(&sha, buf, n);
+		rc = pkg_pwrite(fd, buf, n, s->offset + done);
+		if (rc)
+			break;
+	}
+
+	close(src);
+	sha256_final(&sha, s->sha256);
+
+	return rc;
+}
+
+int drpai_pkg_write(const char *model, const struct drpai_pkg_input *in, int num)
+{
+	struct drpai_pkg_section table[DRPAI_PKG_MAX_SECTIONS];
+	struct drpai_pkg_header h;
+	char tmp[512], path[512];
+	uint64_t offset;
+	struct stat st;
+	int fd, i, rc = 0;
+
+	if (num > DRPAI_PKG_MAX_SECTIONS)
+		return -E2BIG;
+
+	/* a dot file is not a model, for the catalog */
+	snprintf(tmp, sizeof(tmp), "%s/.%s" DRPAI_PKG_SUFFIX, DRPAI_MODELS_ROOT_DIR, model);
+	snprintf(path, sizeof(path), "%s/%s" DRPAI_PKG_SUFFIX, DRPAI_MODELS_ROOT_DIR, model);
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	offset = sizeof(h) + num * sizeof(table[0]);
+	for (i = 0; i < num; i++) {
+		table[i] = in[i].section;
+		table[i].size = in[i].size;
+		if (in[i].path) {
+			if (stat(in[i].path, &st)) {
+				rc = -errno;
+				goto err;
+			}
+			table[i].size = st.st_size;
+		}
+
+		offset = ALIGN_UP(offset, DRPAI_PKG_ALIGN);
+		table[i].offset = table[i].size ? offset : 0;
+		offset += table[i].size;
+
+		if (table[i].size) {
+			rc = pkg_write_section(fd, &in[i], &table[i]);
+			if (rc)
+				goto err;
+		}
+		pkg_section_to_le(&table[i]);
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, DRPAI_PKG_MAGIC, sizeof(h.magic));
+	h.version = htole32(DRPAI_PKG_VERSION);
+	h.num_sections = htole32(num);
+	h.size = htole64(offset);
+
+	rc = pkg_pwrite(fd, &h, sizeof(h), 0);
+	if (!rc)
+		rc = pkg_pwrite(fd, table, num * sizeof(table[0]), sizeof(h));
+	if (!rc && (ftruncate(fd, offset) || fsync(fd)))
+		rc = -errno;
+	if (rc)
+		goto err;
+
+	close(fd);
+
+	if (rename(tmp, path)) {
+		rc = -errno;
+		unlink(tmp);
+		return rc;
+	}
+
+	return 0;
+err:
+	close(fd);
+	unlink(tmp);
+	return rc;
+}
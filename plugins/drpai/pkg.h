@@ -0,0 +1,93 @@
+#ifndef __DRPAI_PKG_H__
+#define __DRPAI_PKG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <json-c/json.h>
+
+#include "sha256.h"
+
+/**
+ * A model as a single file, DRPAI_MODELS_ROOT_DIR/<model>.drpai, which
+ * takes precedence over a model directory of the same name:
+ *
+ *   header | section table | config | data ... (each page aligned)
+ *
+ * All fields are little endian. The sections are the JSON model config,
+ * the memory regions of the address map, and the DRP parameter info (of
+ * models with pre-processing); the regions that are loaded into the DRP
+ * AI memory carry their data, and the others (input, output) just their
+ * address and size. Each section with data has its SHA-256.
+ */
+#define DRPAI_PKG_MAGIC		"DRPAIPKG"
+#define DRPAI_PKG_VERSION	1
+#define DRPAI_PKG_SUFFIX	".drpai"
+#define DRPAI_PKG_ALIGN		4096
+#define DRPAI_PKG_MAX_SECTIONS	64
+
+enum drpai_pkg_type {
+	DRPAI_PKG_CONFIG = 1,
+	DRPAI_PKG_REGION,
+	DRPAI_PKG_PARAM_INFO,		/* drp_param_info.txt */
+};
+
+struct drpai_pkg_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t num_sections;
+	uint64_t size;			/* of the whole file */
+	uint8_t reserved[8];
+};
+
+struct drpai_pkg_section {
+	uint32_t type;			/* enum drpai_pkg_type */
+	uint32_t index;			/* DRPAI_INDEX_* of a region */
+	uint64_t offset;		/* of the data in the file */
+	uint64_t size;			/* of the data; 0 if there is none */
+	uint32_t address;		/* of a region, as in the address map */
+	uint32_t region_size;
+	uint8_t sha256[SHA256_SIZE];
+};
+
+/* A package mapped into memory; the sections are in host byte order */
+struct drpai_pkg {
+	void *map;
+	size_t len;
+	int num_sections;
+	struct drpai_pkg_section sections[DRPAI_PKG_MAX_SECTIONS];
+};
+
+/* -ENOENT if the model is not a package */
+int drpai_pkg_open(struct drpai_pkg *pkg, const char *model);
+/* Fine on a package that did not open */
+void drpai_pkg_close(struct drpai_pkg *pkg);
+
+static inline const void *drpai_pkg_data(const struct drpai_pkg *pkg,
+					 const struct drpai_pkg_section *s)
+{
+	return (const uint8_t *)pkg->map + s->offset;
+}
+
+/* The embedded model config; NULL with '*err' set if there is none */
+json_object *drpai_pkg_config(const struct drpai_pkg *pkg, int *err);
+
+/**
+ * Check the data of all sections against their hash; the hash of the
+ * whole package (of its section table, which has the section hashes)
+ * goes in 'digest'. This reads all of the file, so it is not done on
+ * every load, but when the model catalog looks at a new package.
+ */
+int drpai_pkg_verify(const struct drpai_pkg *pkg, uint8_t digest[SHA256_SIZE]);
+
+/* What to put in a package: the data is either in memory or in a file */
+struct drpai_pkg_input {
+	struct drpai_pkg_section section;	/* type, index, address, region_size */
+	const void *data;
+	const char *path;
+	uint64_t size;
+};
+
+/* Write a package, atomically, as 'model' */
+int drpai_pkg_write(const char *model, const struct drpai_pkg_input *in, int num);
+
+#endif /* __DRPAI_PKG_H__ */
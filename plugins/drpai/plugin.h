@@ -0,0 +1,59 @@
+#ifndef __DRPAI_PLUGIN_H__
+#define __DRPAI_PLUGIN_H__
+
+#include <stdint.h>
+
+#include "models.h"
+
+/**
+ * Post-processing plugins: shared objects in DRPAI_PLUGINS_DIR that
+ * provide the drpai_model_ops of more "model_type"s. A plugin defines
+ *
+ *   const struct drpai_plugin drpai_plugin = {
+ *           .abi_version = DRPAI_PLUGIN_ABI_VERSION,
+ *           .name = "my-heads",
+ *           .models = (const struct drpai_plugin_model []) {
+ *                   { "my-head", &my_head_ops },
+ *                   { }
+ *           },
+ *   };
+ *
+ * and is built against the headers etb installs (cc -shared -fPIC); it
+ * may call the functions of models.h, vmath.h, nms.h and detections.h,
+ * which etb exports. The built-in model types come first, so a plugin
+ * cannot replace them.
+ *
+ * DRPAI_PLUGIN_ABI_VERSION changes with any change to these structures,
+ * to struct drpai_model_ops, drpai_tensor or drpai_frame, or to the
+ * exported functions; plugins built for another version are not loaded.
+ */
+#define DRPAI_PLUGIN_ABI_VERSION	1
+
+#define DRPAI_PLUGIN_SYMBOL		"drpai_plugin"
+
+struct drpai_plugin_model {
+	const char *type;
+	const struct drpai_model_ops *ops;
+};
+
+/* An output to time a decoder on, made up by the plugin */
+struct drpai_plugin_bench {
+	struct drpai_tensor out;
+	struct drpai_frame frame;
+	void *priv;			/* the plugin's, for bench_end() */
+};
+
+struct drpai_plugin {
+	uint32_t abi_version;
+	const char *name;
+	const struct drpai_plugin_model *models;	/* up to one with no type */
+	/**
+	 * The benchmark hook, optional: fill in 'b' with an output of a model
+	 * of 'type' with 'config'; the decoder is then timed on it, and
+	 * bench_end() called.
+	 */
+	int (*bench_begin)(const char *type, json_object *config, struct drpai_plugin_bench *b);
+	void (*bench_end)(struct drpai_plugin_bench *b);
+};
+
+#endif /* __DRPAI_PLUGIN_H__ */
@@ -0,0 +1,314 @@
+
+#include "plugins.h"
+#include "../../monotonic.h"
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+#ifndef DRPAI_PLUGINS_DIR
+#error "Must define DRPAI_PLUGINS_DIR, for the location of the post-processing plugins"
+#endif
+
+/* At most, per benchmark; it runs on the event loop, so it is cut short
+ * once it took DRPAI_PLUGINS_BENCH_MAX_US
+ */
+#define DRPAI_PLUGINS_BENCH_MAX		1000
+#define DRPAI_PLUGINS_BENCH_MAX_US	50000
+
+/* Files that did not load are kept too (with no handle), so as not to retry them */
+struct loaded_plugin {
+	char *file;
+	void *handle;
+	const struct drpai_plugin *plugin;
+	struct loaded_plugin *next;
+};
+
+static struct loaded_plugin *plugins;
+
+static bool drpai_plugins_is_loaded(const char *file)
+{
+	struct loaded_plugin *lp;
+
+	for (lp = plugins; lp; lp = lp->next) {
+		if (!strcmp(lp->file, file))
+			return true;
+	}
+
+	return false;
+}
+
+static int drpai_plugin_check(const struct drpai_plugin *p)
+{
+	const struct drpai_plugin_model *m;
+
+	if (p->abi_version != DRPAI_PLUGIN_ABI_VERSION)
+		return -EPROTO;
+	if (!p->name || !p->models)
+		return -EINVAL;
+
+	for (m = p->models; m->type; m++) {
+		if (!m->ops || !m->ops->postprocessing)
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void drpai_plugin_open(struct loaded_plugin *lp)
+{
+	char path[512];
+	const struct drpai_plugin *p;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", DRPAI_PLUGINS_DIR, lp->file);
+
+	lp->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if (!lp->handle) {
+		lwsl_err("%s: %s\n", __func__, dlerror());
+		return;
+	}
+
+	p = dlsym(lp->handle, DRPAI_PLUGIN_SYMBOL);
+	if (!p) {
+		lwsl_err("%s: %s: no " DRPAI_PLUGIN_SYMBOL "\n", __func__, path);
+		goto err_close;
+	}
+
+	rc = drpai_plugin_check(p);
+	if (rc == -EPROTO) {
+		lwsl_err("%s: %s: ABI version %u, not %u\n", __func__, path,
+			 p->abi_version, DRPAI_PLUGIN_ABI_VERSION);
+		goto err_close;
+	} else if (rc) {
+		lwsl_err("%s: %s: invalid plugin\n", __func__, path);
+		goto err_close;
+	}
+
+	lp->plugin = p;
+	lwsl_notice("%s: loaded %s from %s\n", __func__, p->name, path);
+
+	return;
+err_close:
+	dlclose(lp->handle);
+	lp->handle = NULL;
+}
+
+/* Loads the plugins that were not looked at yet */
+static void drpai_plugins_load(void)
+{
+	struct loaded_plugin *lp;
+	struct dirent *ep;
+	size_t len;
+	DIR *dp;
+
+	dp = opendir(DRPAI_PLUGINS_DIR);
+	if (!dp)
+		return;
+
+	while ((ep = readdir(dp))) {
+		len = strlen(ep->d_name);
+		if (len < 4 || strcmp(ep->d_name + len - 3, ".so"))
+			continue;
+		if (drpai_plugins_is_loaded(ep->d_name))
+			continue;
+
+		lp = calloc(1, sizeof(*lp));
+		if (!lp)
+			break;
+		lp->file = strdup(ep->d_name);
+		if (!lp->file) {
+			free(lp);
+			break;
+		}
+
+		drpai_plugin_open(lp);
+		lp->next = plugins;
+		plugins = lp;
+	}
+
+	closedir(dp);
+}
+
+static const struct drpai_plugin_model *drpai_plugins_find_model(const char *type,
+								  const struct drpai_plugin **plugin)
+{
+	const struct drpai_plugin_model *m;
+	struct loaded_plugin *lp;
+
+	for (lp = plugins; lp; lp = lp->next) {
+		if (!lp->plugin)
+			continue;
+		for (m = lp->plugin->models; m->type; m++) {
+			if (strcmp(m->type, type))
+				continue;
+			if (plugin)
+				*plugin = lp->plugin;
+			return m;
+		}
+	}
+
+	return NULL;
+}
+
+const struct drpai_model_ops *drpai_plugins_find(const char *type)
+{
+	const struct drpai_plugin_model *m;
+
+	if (!type)
+		return NULL;
+
+	m = drpai_plugins_find_model(type, NULL);
+	if (!m) {
+		drpai_plugins_load();
+		m = drpai_plugins_find_model(type, NULL);
+	}
+
+	return m ? m->ops : NULL;
+}
+
+void drpai_plugins_unload(void)
+{
+	struct loaded_plugin *lp;
+
+	while ((lp = plugins)) {
+		plugins = lp->next;
+		if (lp->handle)
+			dlclose(lp->handle);
+		free(lp->file);
+		free(lp);
+	}
+}
+
+int drpai_plugins_get(json_object *req)
+{
+	const struct drpai_plugin_model *m;
+	struct loaded_plugin *lp;
+	json_object *arr;
+
+	drpai_plugins_load();
+
+	arr = json_object_new_array();
+	if (!arr) {
+		json_object_object_add(req, "error",
+				       json_object_new_string("error allocating JSON object"));
+		return -ENOMEM;
+	}
+	json_object_object_add(req, "value", arr);
+
+	for (lp = plugins; lp; lp = lp->next) {
+		json_object *e = json_object_new_object();
+		json_object *types = json_object_new_array();
+
+		if (!e || !types) {
+			json_object_put(e);
+			json_object_put(types);
+			continue;
+		}
+
+		json_object_object_add(e, "file", json_object_new_string(lp->file));
+		json_object_object_add(e, "loaded", json_object_new_boolean(!!lp->plugin));
+		if (lp->plugin) {
+			json_object_object_add(e, "name", json_object_new_string(lp->plugin->name));
+			json_object_object_add(e, "benchmark",
+					       json_object_new_boolean(!!lp->plugin->bench_begin));
+			for (m = lp->plugin->models; m->type; m++)
+				json_object_array_add(types, json_object_new_string(m->type));
+		}
+		json_object_object_add(e, "types", types);
+		json_object_array_add(arr, e);
+	}
+
+	return 0;
+}
+
+int drpai_plugins_bench(json_object *config, int iterations, json_object *val)
+{
+	const struct drpai_plugin_model *m;
+	const struct drpai_plugin *plugin = NULL;
+	struct drpai_plugin_bench b;
+	uint64_t start, t, us, min_us = UINT64_MAX, max_us = 0, total_us = 0;
+	void *priv = NULL;
+	const char *type;
+	int i, rc = 0;
+
+	type = json_object_get_string(json_object_object_get(config, "model_type"));
+	if (!type)
+		return -EINVAL;
+
+	drpai_plugins_find(type);
+	m = drpai_plugins_find_model(type, &plugin);
+	if (!m)
+		return -ENOENT;
+	if (!plugin->bench_begin)
+		return -EOPNOTSUPP;
+
+	if (iterations < 1)
+		iterations = 1;
+	if (iterations > DRPAI_PLUGINS_BENCH_MAX)
+		iterations = DRPAI_PLUGINS_BENCH_MAX;
+
+	if (m->ops->init) {
+		priv = m->ops->init(config, &rc);
+		if (!priv)
+			return rc ? rc : -EINVAL;
+	}
+
+	memset(&b, 0, sizeof(b));
+	rc = plugin->bench_begin(type, config, &b);
+	if (rc)
+		goto out_cleanup;
+
+	start = monotonic_now_us();
+	for (i = 0, t = start; i < iterations; i++) {
+		json_object *res;
+
+		/* at least one, even if it takes longer */
+		if (i && t - start >= DRPAI_PLUGINS_BENCH_MAX_US)
+			break;
+
+		res = json_object_new_object();
+		if (!res) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		t = monotonic_now_us();
+		rc = m->ops->postprocessing(priv, &b.out, &b.frame, res);
+		us = monotonic_now_us() - t;
+		t += us;
+		json_object_put(res);
+		if (rc)
+			break;
+
+		total_us += us;
+		if (us < min_us)
+			min_us = us;
+		if (us > max_us)
+			max_us = us;
+	}
+
+	if (plugin->bench_end)
+		plugin->bench_end(&b);
+
+	iterations = i;
+	if (!rc) {
+		json_object_object_add(val, "plugin", json_object_new_string(plugin->name));
+		json_object_object_add(val, "type", json_object_new_string(type));
+		json_object_object_add(val, "iterations", json_object_new_int(iterations));
+		json_object_object_add(val, "mean_us", json_object_new_int64(total_us / iterations));
+		json_object_object_add(val, "min_us", json_object_new_int64(min_us));
+		json_object_object_add(val, "max_us", json_object_new_int64(max_us));
+	}
+out_cleanup:
+	if (m->ops->cleanup)
+		m->ops->cleanup(priv);
+
+	return rc;
+}
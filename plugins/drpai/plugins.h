@@ -0,0 +1,27 @@
+#ifndef __DRPAI_PLUGINS_H__
+#define __DRPAI_PLUGINS_H__
+
+#include <json-c/json.h>
+
+#include "plugin.h"
+
+/**
+ * The plugins of DRPAI_PLUGINS_DIR (see plugin.h) are loaded when a model
+ * type is not a built-in one; the directory is looked at again for types
+ * no plugin has, so that new plugins do not need a restart. They stay
+ * loaded until drpai_plugins_unload(), once no model uses them.
+ */
+const struct drpai_model_ops *drpai_plugins_find(const char *type);
+void drpai_plugins_unload(void);
+
+/* The loaded plugins and their model types, as the "value" of 'req' */
+int drpai_plugins_get(json_object *req);
+
+/**
+ * Time the decoder of a plugin model type on the output its benchmark
+ * hook makes up, 'iterations' times, or fewer if that takes too long;
+ * the times, and the iterations that ran, are added to 'val'.
+ */
+int drpai_plugins_bench(json_object *config, int iterations, json_object *val);
+
+#endif /* __DRPAI_PLUGINS_H__ */
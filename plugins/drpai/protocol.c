@@ -1,16 +1,22 @@
 
 #include <libwebsockets.h>
+#include <errno.h>
 #include <stdbool.h>
 #include <string.h>
 #include <json-c/json.h>
 
 #include "protocol.h"
+#include "catalog.h"
 #include "drpai.h"
+#include "plugins.h"
+#include "sched.h"
+#include "../../metrics.h"
 
 #define RING_DEPTH 4096
 
+static uint32_t protocol_sessions;
+
 bool drpai_active = false;
-struct drpai *drpai = NULL;
 
 enum command {
 	CMD_INVALID = -1,
@@ -19,6 +25,10 @@ enum command {
 	CMD_MODEL_START,
 	CMD_MODEL_STOP,
 	CMD_MODEL_DELETE,
+	CMD_STATS_GET,
+	CMD_PLUGINS_GET,
+	CMD_PLUGIN_BENCH,
+	CMD_MODEL_PACK,
 	CMD_MAX,
 };
 
@@ -28,6 +38,10 @@ static const char *command_names[] = {
 	[CMD_MODEL_START]  = "drpai-model-start",
 	[CMD_MODEL_STOP]   = "drpai-model-stop",
 	[CMD_MODEL_DELETE] = "drpai-model-delete",
+	[CMD_STATS_GET]    = "drpai-stats-get",
+	[CMD_PLUGINS_GET]  = "drpai-plugins-get",
+	[CMD_PLUGIN_BENCH] = "drpai-plugin-bench",
+	[CMD_MODEL_PACK]   = "drpai-model-pack",
 };
 
 struct msg {
@@ -66,6 +80,31 @@ static enum command protocol_get_command_enum(const char *cmd)
 	return CMD_INVALID;
 }
 
+/* Takes over the reference to 'reply' */
+static int protocol_send(struct lws *wsi, struct per_session_data__drpai *pss,
+			 json_object *reply)
+{
+	struct msg amsg;
+
+	amsg.response = reply;
+	amsg.send_buf = NULL;
+	if (!lws_ring_insert(pss->ring, &amsg, 1)) {
+		__destroy_message(&amsg);
+		lwsl_warn("dropping!\n");
+		return -1;
+	}
+
+	lws_callback_on_writable(wsi);
+
+	return 0;
+}
+
+/* From the worker pool: a pack is done, for the writeable callbacks */
+static void protocol_wake(void *arg)
+{
+	lws_cancel_service(arg);
+}
+
 static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__drpai *pss,
 				    void *in, size_t len)
 {
@@ -90,31 +129,49 @@ static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__dr
 	switch (cmd) {
 		case CMD_MODELS_GET:
 			send_req_back_as_reply = true;
-			drpai_models_get(req);
+			drpai_catalog_get(req);
+			break;
+		case CMD_MODEL_UPLOAD:
+			send_req_back_as_reply = true;
+			drpai_upload_command(&pss->upload, req);
+			break;
+		case CMD_MODEL_DELETE:
+			send_req_back_as_reply = true;
+			drpai_model_delete(req);
 			break;
 		case CMD_MODEL_START:
-			if (drpai_load_model(pss->drpai, req) == 0)
+			if (drpai_load_model(req) == 0)
 				drpai_active = true;
 			break;
 		case CMD_MODEL_STOP:
 			drpai_active = false;
 			break;
+		case CMD_STATS_GET:
+			send_req_back_as_reply = true;
+			drpai_sched_stats_get(req);
+			break;
+		case CMD_PLUGINS_GET:
+			send_req_back_as_reply = true;
+			drpai_plugins_get(req);
+			break;
+		case CMD_PLUGIN_BENCH:
+			send_req_back_as_reply = true;
+			drpai_plugin_bench(req);
+			break;
+		case CMD_MODEL_PACK:
+			/* if it started, the reply comes once it is done */
+			send_req_back_as_reply =
+				drpai_model_pack(req, &pss->pack, protocol_wake,
+						 lws_get_context(wsi)) != 1;
+			break;
 		default:
 			break;
 	}
 
-	if (send_req_back_as_reply) {
-		struct msg amsg;
-		amsg.response = req;
-		amsg.send_buf = NULL;
-		if (!lws_ring_insert(pss->ring, &amsg, 1)) {
-			__destroy_message(&amsg);
-			lwsl_warn("dropping!\n");
-			return -1;
-		}
-
-		json_object_get(req);
-		lws_callback_on_writable(wsi);
+	if (send_req_back_as_reply &&
+	    protocol_send(wsi, pss, json_object_get(req))) {
+		json_object_put(req);
+		return -1;
 	}
 
 	json_object_put(req);
@@ -127,6 +184,36 @@ static int protocol_handle_incoming(struct lws *wsi, struct per_session_data__dr
 	return 0;
 }
 
+/*
+ * Model file data, streamed to disk as it comes. Once a chunk went to
+ * disk, rx is held until the next writeable callback, so that a large
+ * upload takes turns with the other connections rather than holding up
+ * the event loop.
+ */
+static void protocol_handle_upload(struct lws *wsi, struct per_session_data__drpai *pss,
+				   void *in, size_t len)
+{
+	json_object *reply;
+	int rc;
+
+	if (!pss->upload) {
+		lwsl_warn("drpai: got binary data with no upload; dropping\n");
+		return;
+	}
+
+	rc = drpai_upload_write(pss->upload, in, len, &reply);
+	if (rc == -EINVAL && !reply)
+		lwsl_warn("drpai: got binary data with no file upload; dropping\n");
+	if (reply)
+		protocol_send(wsi, pss, reply);
+
+	if (rc == 1 && !pss->upload_throttled) {
+		lws_rx_flow_control(wsi, 0);
+		pss->upload_throttled = 1;
+		lws_callback_on_writable(wsi);
+	}
+}
+
 static int handle_outgoing_message(struct lws *wsi, struct per_session_data__drpai *pss)
 {
 	struct msg *pmsg;
@@ -190,9 +277,16 @@ int callback_drpai(struct lws *wsi, enum lws_callback_reasons reason,
 		vhd->context = lws_get_context(wsi);
 		vhd->vhost = lws_get_vhost(wsi);
 
+		/* a missing models directory is reported on every listing */
+		drpai_catalog_init();
+
 		lwsl_info("drpai: protocol initialized\n");
 		break;
 
+	case LWS_CALLBACK_PROTOCOL_DESTROY:
+		drpai_catalog_free();
+		break;
+
 	case LWS_CALLBACK_ESTABLISHED:
 		lwsl_info("drpai: client connected\n");
 		pss->ring = lws_ring_create(sizeof(struct msg), RING_DEPTH,
@@ -200,22 +294,41 @@ int callback_drpai(struct lws *wsi, enum lws_callback_reasons reason,
 		if (!pss->ring)
 			return 1;
 
-		pss->drpai = drpai_init(&rc);
-		if (!pss->drpai) {
+		rc = drpai_get();
+		if (rc) {
 			lwsl_warn("%s: could not initialize DRP AI: %d\n",
 				  __func__, rc);
 			return 1;
 		}
-		// FIXME: hack
-		drpai = pss->drpai;
+		pss->drpai_ref = 1;
 
 		pss->tail = 0;
+		pss->session_id = ++protocol_sessions;
+		break;
+
+	case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+		/* a model pack is done; its session sends the reply */
+		if (vhd)
+			lws_callback_on_writable_all_protocol(vhd->context, lws_get_protocol(wsi));
 		break;
 
 	case LWS_CALLBACK_SERVER_WRITEABLE:
 
 		lwsl_debug("LWS_CALLBACK_SERVER_WRITEABLE\n");
 
+		if (pss->pack) {
+			json_object *reply = drpai_model_pack_reply(&pss->pack);
+
+			if (reply)
+				protocol_send(wsi, pss, reply);
+		}
+
+		if (pss->upload_throttled) {
+			pss->upload_throttled = 0;
+			if (!pss->flow_controlled)
+				lws_rx_flow_control(wsi, 1);
+		}
+
 		if (pss->write_consume_pending) {
 			/* perform the deferred fifo consume */
 			lws_ring_consume_single_tail(pss->ring, &pss->tail, 1);
@@ -258,7 +371,7 @@ int callback_drpai(struct lws *wsi, enum lws_callback_reasons reason,
 		}
 
 		if (lws_frame_is_binary(wsi)) {
-			lwsl_warn("drpai: got binary data; dropping\n");
+			protocol_handle_upload(wsi, pss, in, len);
 			break;
 		}
 
@@ -280,13 +393,23 @@ int callback_drpai(struct lws *wsi, enum lws_callback_reasons reason,
 
 	case LWS_CALLBACK_CLOSED:
 		lwsl_info("drpai: client disconnected\n");
-		drpai_free(pss->drpai);
-		pss->drpai = NULL;
-		// FIXME: hack
-		drpai = NULL;
+		if (pss->drpai_ref)
+			drpai_put();
+		pss->drpai_ref = 0;
+		drpai_upload_free(pss->upload);
+		pss->upload = NULL;
+		drpai_model_pack_free(pss->pack);
+		pss->pack = NULL;
 		lws_ring_destroy(pss->ring);
 		break;
 
+	case METRICS_CALLBACK_SESSION:
+		if (pss->ring)
+			metrics_printf(in, "etb_session_queue_depth{protocol=\"drpai\",session=\"%u\"} %zu\n",
+				       pss->session_id,
+				       lws_ring_get_count_waiting_elements(pss->ring, &pss->tail));
+		break;
+
 	default:
 		break;
 	}
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <libwebsockets.h>
 #include "drpai.h"
+#include "upload.h"
 
 /* FIXME: abstract this better */
 
@@ -12,11 +13,15 @@ int callback_drpai(struct lws *wsi, enum lws_callback_reasons reason,
 
 struct per_session_data__drpai {
 	struct lws_ring *ring;
+	uint32_t session_id;	/* for the metrics */
+	struct drpai_upload *upload;
+	struct drpai_pack *pack;	/* in the works, if any */
 	uint32_t msglen;
 	uint32_t tail;
-	struct drpai *drpai;
+	uint8_t drpai_ref:1;
 	uint8_t flow_controlled:1;
 	uint8_t write_consume_pending:1;
+	uint8_t upload_throttled:1;
 };
 
 #define LWS_PLUGIN_PROTOCOL_DRPAI \
@@ -0,0 +1,227 @@
+
+#include "roi.h"
+#include "models.h"
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+/* Rectangles are kept as polygons too; 'pts' holds x, y pairs */
+struct roi_shape {
+	int num;
+	float *pts;
+};
+
+struct drpai_roi {
+	int refcount;
+	int num;
+	struct roi_shape *shapes;
+	/* bounding box of all shapes */
+	float x0, y0, x1, y1;
+};
+
+static int roi_shape_rect(json_object *jshape, struct roi_shape *s)
+{
+	float x, y, w, h;
+
+	x = json_object_get_double(json_object_object_get(jshape, "x"));
+	y = json_object_get_double(json_object_object_get(jshape, "y"));
+	w = json_object_get_double(json_object_object_get(jshape, "w"));
+	h = json_object_get_double(json_object_object_get(jshape, "h"));
+	if (w <= 0 || h <= 0)
+		return -EINVAL;
+
+	s->pts = malloc(sizeof(*s->pts) * 8);
+	if (!s->pts)
+		return -ENOMEM;
+
+	s->num = 4;
+	s->pts[0] = x;     s->pts[1] = y;
+	s->pts[2] = x + w; s->pts[3] = y;
+	s->pts[4] = x + w; s->pts[5] = y + h;
+	s->pts[6] = x;     s->pts[7] = y + h;
+
+	return 0;
+}
+
+static int roi_shape_polygon(json_object *jpts, struct roi_shape *s)
+{
+	int i, num;
+
+	if (!json_object_is_type(jpts, json_type_array))
+		return -EINVAL;
+
+	num = json_object_array_length(jpts);
+	if (num < 3)
+		return -EINVAL;
+
+	s->pts = malloc(sizeof(*s->pts) * 2 * num);
+	if (!s->pts)
+		return -ENOMEM;
+	s->num = num;
+
+	for (i = 0; i < num; i++) {
+		json_object *jpt = json_object_array_get_idx(jpts, i);
+
+		if (!json_object_is_type(jpt, json_type_array) ||
+		    json_object_array_length(jpt) != 2)
+			return -EINVAL;
+
+		s->pts[2 * i] = json_object_get_double(json_object_array_get_idx(jpt, 0));
+		s->pts[2 * i + 1] = json_object_get_double(json_object_array_get_idx(jpt, 1));
+	}
+
+	return 0;
+}
+
+struct drpai_roi *drpai_roi_create(json_object *cfg, int *err)
+{
+	struct drpai_roi *roi = NULL;
+	int i, j, lerr = -EINVAL;
+
+	if (!json_object_is_type(cfg, json_type_array) || !json_object_array_length(cfg))
+		goto err_store;
+
+	roi = calloc(1, sizeof(*roi));
+	if (!roi) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+	roi->refcount = 1;
+
+	roi->num = json_object_array_length(cfg);
+	roi->shapes = calloc(roi->num, sizeof(*roi->shapes));
+	if (!roi->shapes) {
+		lerr = -ENOMEM;
+		goto err_free;
+	}
+
+	roi->x0 = roi->y0 = FLT_MAX;
+	roi->x1 = roi->y1 = -FLT_MAX;
+
+	for (i = 0; i < roi->num; i++) {
+		json_object *jshape = json_object_array_get_idx(cfg, i);
+		json_object *jpts = json_object_object_get(jshape, "points");
+		struct roi_shape *s = &roi->shapes[i];
+
+		lerr = jpts ? roi_shape_polygon(jpts, s) : roi_shape_rect(jshape, s);
+		if (lerr)
+			goto err_free;
+
+		for (j = 0; j < s->num; j++) {
+			roi->x0 = fminf(roi->x0, s->pts[2 * j]);
+			roi->y0 = fminf(roi->y0, s->pts[2 * j + 1]);
+			roi->x1 = fmaxf(roi->x1, s->pts[2 * j]);
+			roi->y1 = fmaxf(roi->y1, s->pts[2 * j + 1]);
+		}
+	}
+
+	return roi;
+err_free:
+	drpai_roi_put(roi);
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+struct drpai_roi *drpai_roi_get(struct drpai_roi *roi)
+{
+	if (roi)
+		roi->refcount++;
+
+	return roi;
+}
+
+void drpai_roi_put(struct drpai_roi *roi)
+{
+	int i;
+
+	if (!roi || --roi->refcount > 0)
+		return;
+
+	for (i = 0; roi->shapes && i < roi->num; i++)
+		free(roi->shapes[i].pts);
+	free(roi->shapes);
+	free(roi);
+}
+
+/* Even-odd rule: count the edges crossed by a ray to the right */
+static bool roi_shape_contains(const struct roi_shape *s, float x, float y)
+{
+	bool inside = false;
+	int i, j;
+
+	for (i = 0, j = s->num - 1; i < s->num; j = i++) {
+		float xi = s->pts[2 * i], yi = s->pts[2 * i + 1];
+		float xj = s->pts[2 * j], yj = s->pts[2 * j + 1];
+
+		if ((yi > y) != (yj > y) &&
+		    x < (xj - xi) * (y - yi) / (yj - yi) + xi)
+			inside = !inside;
+	}
+
+	return inside;
+}
+
+bool drpai_roi_contains(const struct drpai_roi *roi, float x, float y)
+{
+	int i;
+
+	if (!roi)
+		return true;
+
+	if (x < roi->x0 || x > roi->x1 || y < roi->y0 || y > roi->y1)
+		return false;
+
+	for (i = 0; i < roi->num; i++) {
+		if (roi_shape_contains(&roi->shapes[i], x, y))
+			return true;
+	}
+
+	return false;
+}
+
+bool drpai_roi_bounds(const struct drpai_roi *roi, int width, int height,
+		      int *x, int *y, int *w, int *h)
+{
+	int x0 = 0, y0 = 0, x1 = width, y1 = height;
+
+	if (roi) {
+		x0 = fmaxf(floorf(roi->x0), 0);
+		y0 = fmaxf(floorf(roi->y0), 0);
+		x1 = fminf(ceilf(roi->x1), width);
+		y1 = fminf(ceilf(roi->y1), height);
+	}
+
+	/* YUYV macro-pixels */
+	x0 &= ~1;
+	x1 = (x1 + 1) & ~1;
+	if (x1 > width)
+		x1 = width & ~1;
+
+	if (x1 - x0 < 2 || y1 - y0 < 1)
+		return false;
+
+	*x = x0;
+	*y = y0;
+	*w = x1 - x0;
+	*h = y1 - y0;
+
+	return true;
+}
+
+bool drpai_frame_in_roi(const struct drpai_frame *f, float x, float y)
+{
+	float w = 0, h = 0;
+
+	if (!f->roi)
+		return true;
+
+	x = x * f->width + f->x;
+	y = y * f->height + f->y;
+	drpai_frame_map_box(f, &x, &y, &w, &h);
+
+	return drpai_roi_contains(f->roi, x, y);
+}
@@ -0,0 +1,28 @@
+#ifndef __DRPAI_ROI_H__
+#define __DRPAI_ROI_H__
+
+#include <stdbool.h>
+#include <json-c/json.h>
+
+/* Region of interest of a camera; opaque and reference counted */
+struct drpai_roi;
+
+/**
+ * 'cfg' is the optional "roi" array of the camera inference config, in
+ * camera frame pixels; the region is the union of its shapes:
+ *   [ { "x": 0, "y": 200, "w": 1920, "h": 400 },
+ *     { "points": [ [ x, y ], [ x, y ], [ x, y ], ... ] } ]
+ */
+struct drpai_roi *drpai_roi_create(json_object *cfg, int *err);
+struct drpai_roi *drpai_roi_get(struct drpai_roi *roi);
+void drpai_roi_put(struct drpai_roi *roi);
+
+bool drpai_roi_contains(const struct drpai_roi *roi, float x, float y);
+
+/* Bounding box of the region, clipped to a 'width' x 'height' frame;
+ * returns false if nothing is left of it.
+ */
+bool drpai_roi_bounds(const struct drpai_roi *roi, int width, int height,
+		      int *x, int *y, int *w, int *h);
+
+#endif /* __DRPAI_ROI_H__ */
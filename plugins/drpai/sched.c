@@ -0,0 +1,607 @@
+
+#include "sched.h"
+#include "device.h"
+#include "drpai.h"
+#include "roi.h"
+#include "../../metrics.h"
+#include "../../monotonic.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+/**
+ * Time-slices the DRP AI instances between all cameras that request
+ * inference.
+ *
+ * Everything runs on the lws event loop, so cameras call in with frames
+ * at their own pace. When an instance is free, it goes to the eligible
+ * camera with the lowest virtual time; each run advances a camera's
+ * virtual time by 1/priority, so a camera with priority 2 gets twice the
+ * share of one with priority 1 (weighted fair queueing).
+ * A camera with a target fps is only eligible once its next frame is due.
+ * Cameras that asked recently, but lost, are remembered as waiting, so
+ * that the next free slot is not simply taken by whoever calls first.
+ *
+ * With several instances, a frame goes to the free instance that has
+ * been busy the least, and one camera may have frames on more than one
+ * instance at a time. Results are numbered per camera and handed out in
+ * submission order.
+ *
+ * Decoders that can do so run on the worker pool, and the instance stays
+ * busy until the decode is done; the pool then wakes up the event loop
+ * with lws_cancel_service(), and the next poll collects the result.
+ */
+
+/* A waiting camera that has not called in for this long is ignored */
+#define SCHED_STALE_US		250000
+#define SCHED_FPS_WINDOW_US	1000000
+#define SCHED_DRAIN_US		1000000
+
+struct drpai_sched_client {
+	struct drpai_sched_client *next;
+	int cam_id;
+	int priority;
+	float target_fps;
+	int interval;			/* at most every this many frames */
+	struct drpai_tiles tiles;	/* cols = 0 to use the model's */
+	struct drpai_roi *roi;		/* NULL for the whole frame */
+	int frames;			/* frames since the last submit */
+	double vtime;
+	uint64_t next_due_us;
+	uint64_t waiting_since_us;	/* 0 if not waiting */
+	uint64_t last_seen_us;
+	/* completed results, by sequence number modulo DRPAI_MAX_DEVICES */
+	uint32_t submit_seq;
+	uint32_t deliver_seq;
+	json_object *results[DRPAI_MAX_DEVICES];
+	struct drpai_sched_times times[DRPAI_MAX_DEVICES];
+	bool ready[DRPAI_MAX_DEVICES];
+	/* statistics */
+	unsigned long runs;
+	uint64_t window_start_us;
+	unsigned int window_runs;
+	float fps;
+};
+
+struct sched_instance {
+	struct drpai *d;
+	bool busy;
+	struct drpai_sched_client *owner;	/* NULL if the camera went away */
+	uint32_t seq;
+	uint64_t start_us;
+	json_object *res;	/* result in progress, while a cascade runs */
+	struct drpai_sched_times times;	/* of the frame it has */
+	uint64_t run_start_us;	/* of the current run, or decode */
+	bool decoding;		/* on the worker pool, rather than running */
+	/* statistics */
+	unsigned long runs;
+	uint64_t busy_us;
+};
+
+static struct {
+	struct lws_context *context;
+	struct drpai_sched_client *clients;
+	struct sched_instance inst[DRPAI_MAX_DEVICES];
+	int num_inst;
+	/* aggregate statistics */
+	uint64_t since_us;
+	unsigned long runs;
+	uint64_t window_start_us;
+	unsigned int window_runs;
+	float fps;
+} sched;
+
+static json_object *sched_error_result(const char *err_msg)
+{
+	json_object *res = json_object_new_object();
+
+	if (res)
+		json_object_object_add(res, "error", json_object_new_string(err_msg));
+
+	return res;
+}
+
+static bool sched_update_fps(uint64_t now, uint64_t *window_start_us,
+			     unsigned int *window_runs, float *fps)
+{
+	uint64_t elapsed = now - *window_start_us;
+
+	(*window_runs)++;
+	if (elapsed < SCHED_FPS_WINDOW_US)
+		return false;
+
+	*fps = *window_runs * 1000000.0f / elapsed;
+	*window_runs = 0;
+	*window_start_us = now;
+
+	return true;
+}
+
+static void sched_complete(struct sched_instance *si, uint64_t now)
+{
+	struct drpai_sched_client *c;
+	uint64_t done_us, read_us;
+	const char *err_msg;
+	json_object *res;
+	int slot;
+
+	done_us = monotonic_now_us();
+	if (si->decoding)
+		si->times.postproc_us += done_us - si->run_start_us;
+	else
+		si->times.run_us += done_us - si->run_start_us;
+	si->decoding = false;
+
+	/* also done for orphans, so that a cascade runs to its end */
+	res = si->res ? si->res : json_object_new_object();
+	si->res = NULL;
+	if (res) {
+		err_msg = drpai_model_get_result(si->d, res);
+		read_us = drpai_model_read_us(si->d);
+		si->run_start_us = monotonic_now_us();
+		si->times.read_us += read_us;
+		si->times.postproc_us += si->run_start_us - done_us - read_us;
+		if (err_msg) {
+			json_object_put(res);
+			res = sched_error_result(err_msg);
+		} else if (drpai_model_pending(si->d)) {
+			/* more runs on the same frame, or its decode; stays busy */
+			si->decoding = drpai_model_decoding(si->d);
+			si->res = res;
+			return;
+		}
+	}
+
+	c = si->owner;
+	si->busy = false;
+	si->owner = NULL;
+	__atomic_fetch_add(&si->runs, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&si->busy_us, now - si->start_us, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&sched.runs, 1, __ATOMIC_RELAXED);
+	if (sched_update_fps(now, &sched.window_start_us, &sched.window_runs, &sched.fps))
+		lwsl_info("drpai: %.1f inferences/s on %d instance(s)\n",
+			  sched.fps, sched.num_inst);
+
+	if (!c) {
+		json_object_put(res);
+		return;
+	}
+
+	sched_update_fps(now, &c->window_start_us, &c->window_runs, &c->fps);
+	if (res) {
+		json_object_object_add(res, "camera", json_object_new_int(c->cam_id));
+		json_object_object_add(res, "fps", json_object_new_double(c->fps));
+	}
+
+	slot = si->seq % DRPAI_MAX_DEVICES;
+	c->results[slot] = res;
+	c->times[slot] = si->times;
+	c->ready[slot] = true;
+}
+
+/* Collect the results of all frames that are done */
+static void sched_poll(uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < sched.num_inst; i++) {
+		struct sched_instance *si = &sched.inst[i];
+
+		if (si->busy && !drpai_model_decoding(si->d) && !drpai_is_running(si->d))
+			sched_complete(si, now);
+	}
+}
+
+/* The free instance that has been busy the least */
+static struct sched_instance *sched_pick_instance(void)
+{
+	struct sched_instance *best = NULL;
+	int i;
+
+	for (i = 0; i < sched.num_inst; i++) {
+		struct sched_instance *si = &sched.inst[i];
+
+		if (si->busy)
+			continue;
+		if (!best || si->busy_us < best->busy_us)
+			best = si;
+	}
+
+	return best;
+}
+
+static bool sched_client_is_due(const struct drpai_sched_client *c, uint64_t now)
+{
+	if (c->frames < c->interval)
+		return false;
+
+	return c->target_fps <= 0 || now >= c->next_due_us;
+}
+
+/* Results are kept in order, so only this many can be outstanding */
+static bool sched_client_can_submit(const struct drpai_sched_client *c)
+{
+	return c->submit_seq - c->deliver_seq < (uint32_t)sched.num_inst;
+}
+
+static bool sched_client_has_precedence(const struct drpai_sched_client *other,
+					const struct drpai_sched_client *c,
+					uint64_t now)
+{
+	if (!other->waiting_since_us)
+		return false;
+
+	if (now - other->last_seen_us > SCHED_STALE_US)
+		return false;
+
+	if (!sched_client_is_due(other, now) || !sched_client_can_submit(other))
+		return false;
+
+	/* on a tie, the one waiting the longest */
+	if (other->vtime == c->vtime)
+		return other->waiting_since_us < c->waiting_since_us;
+
+	return other->vtime < c->vtime;
+}
+
+/* With 'free_inst' instances free, is 'c' among the ones to get one? */
+static bool sched_client_should_run(struct drpai_sched_client *c, int free_inst,
+				    uint64_t now)
+{
+	struct drpai_sched_client *o;
+	int ahead = 0;
+
+	for (o = sched.clients; o; o = o->next) {
+		if (o != c && sched_client_has_precedence(o, c, now))
+			ahead++;
+	}
+
+	return ahead < free_inst;
+}
+
+static int sched_free_instances(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < sched.num_inst; i++) {
+		if (!sched.inst[i].busy)
+			n++;
+	}
+
+	return n;
+}
+
+int drpai_sched_submit(struct drpai_sched_client *c, const void *addr,
+		       int width, int height, uint64_t capture_us,
+		       const char **err_msg)
+{
+	uint64_t now = monotonic_now_us(), load_us, loaded_us;
+	struct sched_instance *si;
+
+	if (!c)
+		return 0;
+
+	c->last_seen_us = now;
+	if (c->frames < c->interval)
+		c->frames++;
+
+	sched_poll(now);
+
+	if (!drpai_active || !sched_client_is_due(c, now) ||
+	    !sched_client_can_submit(c)) {
+		c->waiting_since_us = 0;
+		return 0;
+	}
+
+	if (!c->waiting_since_us)
+		c->waiting_since_us = now;
+
+	si = sched_pick_instance();
+	if (!si || !sched_client_should_run(c, sched_free_instances(), now))
+		return 0;
+
+	load_us = monotonic_now_us();
+	*err_msg = drpai_model_load_input(si->d, addr, width, height,
+					  c->tiles.cols ? &c->tiles : NULL, c->roi);
+	if (*err_msg)
+		return -EIO;
+	loaded_us = monotonic_now_us();
+
+	*err_msg = drpai_model_start(si->d);
+	if (*err_msg)
+		return -EIO;
+
+	si->busy = true;
+	si->owner = c;
+	si->seq = c->submit_seq++;
+	si->start_us = now;
+	si->run_start_us = monotonic_now_us();
+	memset(&si->times, 0, sizeof(si->times));
+	si->times.capture_us = capture_us;
+	si->times.submit_us = now;
+	si->times.load_us = loaded_us - load_us;
+	si->times.start_us = si->run_start_us - loaded_us;
+	c->frames = 0;
+
+	c->waiting_since_us = 0;
+	/* a tiled frame takes a run per tile */
+	c->vtime += (c->tiles.cols ? c->tiles.cols * c->tiles.rows : 1.0) / c->priority;
+	__atomic_fetch_add(&c->runs, 1, __ATOMIC_RELAXED);
+	if (c->target_fps > 0) {
+		uint64_t period = 1000000.0f / c->target_fps;
+		/* do not accumulate credit when falling behind */
+		c->next_due_us = (now - c->next_due_us < period) ?
+				 c->next_due_us + period : now + period;
+	}
+
+	return 1;
+}
+
+json_object *drpai_sched_get_result(struct drpai_sched_client *c,
+				    struct drpai_sched_times *times)
+{
+	json_object *res;
+	int slot;
+
+	if (!c)
+		return NULL;
+
+	sched_poll(monotonic_now_us());
+
+	slot = c->deliver_seq % DRPAI_MAX_DEVICES;
+	if (!c->ready[slot])
+		return NULL;
+
+	res = c->results[slot];
+	if (times)
+		*times = c->times[slot];
+	c->results[slot] = NULL;
+	c->ready[slot] = false;
+	c->deliver_seq++;
+
+	return res;
+}
+
+/* From the worker pool: a decode is done, for the next sched_poll() */
+static void sched_wake(void *arg)
+{
+	/* only clients start decodes, and they set the context */
+	if (sched.context)
+		lws_cancel_service(sched.context);
+}
+
+void drpai_sched_instances_init(void)
+{
+	int i;
+
+	memset(sched.inst, 0, sizeof(sched.inst));
+	sched.num_inst = drpai_instances_count();
+	for (i = 0; i < sched.num_inst; i++) {
+		sched.inst[i].d = drpai_instance(i);
+		drpai_model_set_notify(sched.inst[i].d, sched_wake, NULL);
+	}
+
+	sched.since_us = sched.window_start_us = monotonic_now_us();
+	sched.runs = 0;
+	sched.window_runs = 0;
+	sched.fps = 0;
+}
+
+struct drpai_sched_client *drpai_sched_client_create(struct lws_context *context, int cam_id,
+						     json_object *cfg, int *err)
+{
+	struct drpai_sched_client *c, *o;
+	json_object *jobj;
+	int lerr = 0;
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+
+	c->cam_id = cam_id;
+	c->priority = 1;
+	c->interval = 1;
+
+	if ((jobj = json_object_object_get(cfg, "fps")))
+		c->target_fps = json_object_get_double(jobj);
+	if ((jobj = json_object_object_get(cfg, "priority")))
+		c->priority = json_object_get_int(jobj);
+	if ((jobj = json_object_object_get(cfg, "interval")))
+		c->interval = json_object_get_int(jobj);
+
+	lerr = drpai_tiles_parse(json_object_object_get(cfg, "tiles"), &c->tiles);
+	if (lerr)
+		goto err_free;
+
+	if ((jobj = json_object_object_get(cfg, "roi"))) {
+		c->roi = drpai_roi_create(jobj, &lerr);
+		if (!c->roi)
+			goto err_free;
+	}
+
+	if (c->target_fps < 0 || c->priority < 1 || c->interval < 1 ||
+	    c->priority > DRPAI_SCHED_MAX_PRIORITY) {
+		lerr = -EINVAL;
+		goto err_free;
+	}
+
+	lerr = drpai_get();
+	if (lerr)
+		goto err_put_roi;
+
+	sched.context = context;
+
+	/* start level with the others, so that a new camera cannot starve them */
+	for (o = sched.clients; o; o = o->next) {
+		if (o == sched.clients || o->vtime < c->vtime)
+			c->vtime = o->vtime;
+	}
+
+	c->window_start_us = monotonic_now_us();
+	c->frames = c->interval;
+	c->next = sched.clients;
+	sched.clients = c;
+
+	return c;
+err_put_roi:
+	drpai_roi_put(c->roi);
+err_free:
+	free(c);
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void drpai_sched_client_destroy(struct drpai_sched_client *c)
+{
+	struct drpai_sched_client **pc;
+	int i;
+
+	if (!c)
+		return;
+
+	for (pc = &sched.clients; *pc; pc = &(*pc)->next) {
+		if (*pc == c) {
+			*pc = c->next;
+			break;
+		}
+	}
+
+	/* its frames still on an instance run to their end, and sched_complete()
+	 * drops their results; the instances stay busy until then */
+	for (i = 0; i < sched.num_inst; i++) {
+		if (sched.inst[i].owner == c)
+			sched.inst[i].owner = NULL;
+	}
+
+	for (i = 0; i < DRPAI_MAX_DEVICES; i++)
+		json_object_put(c->results[i]);
+	drpai_roi_put(c->roi);
+	free(c);
+
+	drpai_put();
+}
+
+/*
+ * Lets the frames on the instances run to their end, cascade runs, tiles
+ * and decodes included, so that a model load never pulls the model from
+ * under one. Their results go to their cameras as usual.
+ */
+int drpai_sched_drain(void)
+{
+	uint64_t start = monotonic_now_us(), now;
+
+	for (;;) {
+		now = monotonic_now_us();
+		sched_poll(now);
+		if (sched_free_instances() == sched.num_inst)
+			return 0;
+		if (now - start > SCHED_DRAIN_US)
+			return -EBUSY;
+		usleep(1000);
+	}
+}
+
+void drpai_sched_instances_release(void)
+{
+	int i;
+
+	for (i = 0; i < sched.num_inst; i++) {
+		json_object_put(sched.inst[i].res);
+		sched.inst[i].res = NULL;
+	}
+	sched.num_inst = 0;
+}
+
+int drpai_sched_stats_get(json_object *req)
+{
+	struct drpai_sched_client *c;
+	json_object *val, *arr;
+	uint64_t now = monotonic_now_us();
+	int i;
+
+	val = json_object_new_object();
+	if (!val) {
+		json_object_object_add(req, "error",
+				       json_object_new_string("error allocating JSON object"));
+		return -ENOMEM;
+	}
+	json_object_object_add(req, "value", val);
+
+	json_object_object_add(val, "fps", json_object_new_double(sched.fps));
+	json_object_object_add(val, "runs", json_object_new_int64(sched.runs));
+
+	arr = json_object_new_array();
+	json_object_object_add(val, "instances", arr);
+	for (i = 0; arr && i < sched.num_inst; i++) {
+		struct sched_instance *si = &sched.inst[i];
+		json_object *e = json_object_new_object();
+		double load = 0;
+
+		if (!e)
+			continue;
+
+		if (now > sched.since_us)
+			load = (double)si->busy_us / (now - sched.since_us);
+
+		json_object_object_add(e, "runs", json_object_new_int64(si->runs));
+		json_object_object_add(e, "load", json_object_new_double(load));
+		json_object_array_add(arr, e);
+	}
+
+	arr = json_object_new_array();
+	json_object_object_add(val, "cameras", arr);
+	for (c = sched.clients; arr && c; c = c->next) {
+		json_object *e = json_object_new_object();
+		if (!e)
+			continue;
+
+		json_object_object_add(e, "camera", json_object_new_int(c->cam_id));
+		json_object_object_add(e, "priority", json_object_new_int(c->priority));
+		json_object_object_add(e, "target_fps", json_object_new_double(c->target_fps));
+		json_object_object_add(e, "fps", json_object_new_double(c->fps));
+		json_object_object_add(e, "runs", json_object_new_int64(c->runs));
+		json_object_array_add(arr, e);
+	}
+
+	return 0;
+}
+
+void drpai_sched_metrics(struct metrics *m)
+{
+	struct drpai_sched_client *c;
+	int i;
+
+	metrics_family(m, "etb_drpai_inferences_total", "counter",
+		       "Frames run on a DRP AI instance");
+	for (i = 0; i < sched.num_inst; i++)
+		metrics_printf(m, "etb_drpai_inferences_total{instance=\"%d\"} %lu\n",
+			       i, __atomic_load_n(&sched.inst[i].runs, __ATOMIC_RELAXED));
+
+	metrics_family(m, "etb_drpai_busy_seconds_total", "counter",
+		       "Time a DRP AI instance had a frame, until its result was complete");
+	for (i = 0; i < sched.num_inst; i++)
+		metrics_printf(m, "etb_drpai_busy_seconds_total{instance=\"%d\"} %.6f\n",
+			       i, __atomic_load_n(&sched.inst[i].busy_us, __ATOMIC_RELAXED) / 1e6);
+
+	metrics_family(m, "etb_drpai_camera_inferences_total", "counter",
+		       "Frames of a camera given to the DRP AI");
+	for (c = sched.clients; c; c = c->next)
+		metrics_printf(m, "etb_drpai_camera_inferences_total{camera=\"%d\"} %lu\n",
+			       c->cam_id, __atomic_load_n(&c->runs, __ATOMIC_RELAXED));
+
+	metrics_family(m, "etb_drpai_camera_fps", "gauge",
+		       "Inference results per second, per camera");
+	for (c = sched.clients; c; c = c->next)
+		metrics_printf(m, "etb_drpai_camera_fps{camera=\"%d\"} %.2f\n",
+			       c->cam_id, c->fps);
+}
@@ -0,0 +1,69 @@
+#ifndef __DRPAI_SCHED_H__
+#define __DRPAI_SCHED_H__
+
+#include <stdint.h>
+#include <json-c/json.h>
+
+struct lws_context;
+struct metrics;
+
+/* One per camera that wants inference; opaque */
+struct drpai_sched_client;
+
+/**
+ * 'context' is the event loop that is woken up when a result is ready.
+ * 'cfg' is the optional "inference" object of the camera play request:
+ *   { "fps": <target rate, 0 = as fast as possible>,
+ *     "priority": <weight, 1..DRPAI_SCHED_MAX_PRIORITY>,
+ *     "interval": <at most every this many frames, default 1>,
+ *     "tiles": <tiling of the frames, see struct drpai_tiles>,
+ *     "roi": <region of interest, see drpai_roi_create()> }
+ */
+struct drpai_sched_client *drpai_sched_client_create(struct lws_context *context, int cam_id,
+						     json_object *cfg, int *err);
+void drpai_sched_client_destroy(struct drpai_sched_client *c);
+
+/* Returns 1 if the frame was given to the accelerator, 0 if not, or
+ * a negative error code (with 'err_msg' set). 'capture_us' is when the
+ * frame was taken, passed back with its result.
+ */
+int drpai_sched_submit(struct drpai_sched_client *c, const void *addr,
+		       int width, int height, uint64_t capture_us,
+		       const char **err_msg);
+
+/* Where the time of a frame went, on the DRP AI side */
+struct drpai_sched_times {
+	uint64_t capture_us;	/* as given to drpai_sched_submit() */
+	uint64_t submit_us;	/* when it was submitted */
+	uint64_t load_us;	/* the rest are durations */
+	uint64_t start_us;
+	uint64_t run_us;	/* until seen done, for all runs on the frame */
+	uint64_t read_us;
+	uint64_t postproc_us;
+};
+
+/* Returns the next completed result for this camera (to be put), if any,
+ * and where the time of its frame went.
+ */
+json_object *drpai_sched_get_result(struct drpai_sched_client *c,
+				    struct drpai_sched_times *times);
+
+/**
+ * The instance table lives as long as the DRP AI instances do: drpai_get()
+ * sets it up when it opens them, and drpai_put() releases it before they
+ * are closed, so that a frame in flight is never mistaken for a free slot.
+ */
+void drpai_sched_instances_init(void);
+void drpai_sched_instances_release(void);
+
+/* Waits for the frames in flight, before a model load: -EBUSY if they
+ * do not complete in time.
+ */
+int drpai_sched_drain(void);
+
+int drpai_sched_stats_get(json_object *req);
+void drpai_sched_metrics(struct metrics *m);
+
+#define DRPAI_SCHED_MAX_PRIORITY	16
+
+#endif /* __DRPAI_SCHED_H__ */
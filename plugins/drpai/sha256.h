@@ -0,0 +1,24 @@
+#ifndef __DRPAI_SHA256_H__
+#define __DRPAI_SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_SIZE		32
+#define SHA256_HEX_SIZE		(2 * SHA256_SIZE + 1)
+
+struct sha256 {
+	uint32_t h[8];
+	uint64_t len;		/* in bytes */
+	uint8_t buf[64];
+	size_t buf_len;
+};
+
+void sha256_init(struct sha256 *s);
+void sha256_update(struct sha256 *s, const void *data, size_t len);
+void sha256_final(struct sha256 *s, uint8_t digest[SHA256_SIZE]);
+
+/* Lower case, NUL terminated */
+void sha256_to_hex(const uint8_t digest[SHA256_SIZE], char hex[SHA256_HEX_SIZE]);
+
+#endif /* __DRPAI_SHA256_H__ */
@@ -0,0 +1,482 @@
+
+#include "tracker.h"
+#include "models.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwebsockets.h>
+
+/**
+ * SORT-style tracker: each track has a constant velocity Kalman filter on
+ * the box center and size, detections are matched to the predicted
+ * tracks by IoU (greedily, best overlap first, same label only), and
+ * unmatched detections start new tracks.
+ * SORT's filter has diagonal noise matrices, so it falls apart into
+ * independent (value, velocity) filters per coordinate; that is what is
+ * done here, with time in seconds, since inference results do not come
+ * at a fixed frame rate.
+ * Between detections, the boxes are extrapolated to the time of each
+ * camera frame, so every frame gets boxes with stable track ids.
+ */
+
+#define TRACKER_LABEL_LEN	64
+
+/* Noise, in pixels (and pixels/s^2 for the acceleration) */
+#define TRACKER_MEAS_STD	4.0f
+#define TRACKER_ACCEL_STD	400.0f
+#define TRACKER_VEL_STD		200.0f
+
+enum {
+	TRACK_CX,
+	TRACK_CY,
+	TRACK_W,
+	TRACK_H,
+	TRACK_NUM_COORDS,
+};
+
+struct kalman {
+	float x;
+	float v;
+	/* covariance */
+	float p00;
+	float p01;
+	float p11;
+};
+
+struct track {
+	int id;
+	char label[TRACKER_LABEL_LEN];
+	float probability;
+	json_object *cls;	/* second model result of a cascade, if any */
+	struct kalman kf[TRACK_NUM_COORDS];
+	uint64_t state_us;	/* time of the filter state */
+	uint64_t seen_us;	/* time of the last detection */
+	int hits;
+};
+
+struct match {
+	int track;
+	int det;
+	float iou;
+};
+
+struct drpai_tracker {
+	float iou_thresh;
+	int min_hits;
+	uint64_t max_age_us;
+	int next_id;
+	struct track *tracks;
+	int num_tracks;
+	int max_tracks;
+	/* kept between updates */
+	struct match *matches;
+	int max_matches;
+};
+
+static void kalman_init(struct kalman *k, float x)
+{
+	k->x = x;
+	k->v = 0;
+	k->p00 = TRACKER_MEAS_STD * TRACKER_MEAS_STD;
+	k->p01 = 0;
+	k->p11 = TRACKER_VEL_STD * TRACKER_VEL_STD;
+}
+
+/* x = F x, P = F P F' + Q; F = [1 dt; 0 1], white noise acceleration */
+static void kalman_predict(struct kalman *k, float dt)
+{
+	const float q = TRACKER_ACCEL_STD * TRACKER_ACCEL_STD;
+	float dt2 = dt * dt;
+
+	k->x += k->v * dt;
+	k->p00 += dt * (2 * k->p01 + dt * k->p11) + q * dt2 * dt2 / 4;
+	k->p01 += dt * k->p11 + q * dt2 * dt / 2;
+	k->p11 += q * dt2;
+}
+
+/* Measurement of x only; H = [1 0] */
+static void kalman_update(struct kalman *k, float z)
+{
+	const float r = TRACKER_MEAS_STD * TRACKER_MEAS_STD;
+	float s = k->p00 + r;
+	float k0 = k->p00 / s;
+	float k1 = k->p01 / s;
+	float y = z - k->x;
+
+	k->x += k0 * y;
+	k->v += k1 * y;
+	k->p11 -= k1 * k->p01;
+	k->p01 -= k0 * k->p01;
+	k->p00 -= k0 * k->p00;
+}
+
+static float track_coord_at(const struct track *tr, int i, uint64_t t_us)
+{
+	float dt = t_us > tr->state_us ? (t_us - tr->state_us) / 1e6f : 0;
+
+	return tr->kf[i].x + tr->kf[i].v * dt;
+}
+
+struct tbox {
+	float x0;
+	float y0;
+	float x1;
+	float y1;
+};
+
+static void track_box_at(const struct track *tr, uint64_t t_us, struct tbox *b)
+{
+	float cx = track_coord_at(tr, TRACK_CX, t_us);
+	float cy = track_coord_at(tr, TRACK_CY, t_us);
+	float w = track_coord_at(tr, TRACK_W, t_us);
+	float h = track_coord_at(tr, TRACK_H, t_us);
+
+	if (w < 1)
+		w = 1;
+	if (h < 1)
+		h = 1;
+
+	b->x0 = cx - w / 2;
+	b->y0 = cy - h / 2;
+	b->x1 = cx + w / 2;
+	b->y1 = cy + h / 2;
+}
+
+static float tbox_iou(const struct tbox *a, const struct tbox *b)
+{
+	float w = (a->x1 < b->x1 ? a->x1 : b->x1) - (a->x0 > b->x0 ? a->x0 : b->x0);
+	float h = (a->y1 < b->y1 ? a->y1 : b->y1) - (a->y0 > b->y0 ? a->y0 : b->y0);
+	float inter, uni;
+
+	if (w <= 0 || h <= 0)
+		return 0;
+
+	inter = w * h;
+	uni = (a->x1 - a->x0) * (a->y1 - a->y0) + (b->x1 - b->x0) * (b->y1 - b->y0) - inter;
+
+	return uni > 0 ? inter / uni : 0;
+}
+
+static int det_get_int(json_object *jbox, const char *id)
+{
+	return json_object_get_int(json_object_object_get(jbox, id));
+}
+
+static bool det_get_box(json_object *det, struct tbox *b)
+{
+	json_object *jbox = json_object_object_get(det, "box");
+
+	if (!jbox)
+		return false;
+
+	b->x0 = det_get_int(jbox, "x");
+	b->y0 = det_get_int(jbox, "y");
+	b->x1 = b->x0 + det_get_int(jbox, "w");
+	b->y1 = b->y0 + det_get_int(jbox, "h");
+
+	return b->x1 > b->x0 && b->y1 > b->y0;
+}
+
+static const char *det_get_label(json_object *det)
+{
+	const char *s = json_object_get_string(json_object_object_get(det, "label"));
+
+	return s ? s : "";
+}
+
+static void track_set_detection(struct track *tr, json_object *det)
+{
+	json_object *cls = json_object_object_get(det, "class");
+
+	snprintf(tr->label, sizeof(tr->label), "%s", det_get_label(det));
+	tr->probability = json_object_get_double(json_object_object_get(det, "probability"));
+
+	/* keep the last known class, a cascade may skip some frames */
+	if (cls) {
+		json_object_put(tr->cls);
+		tr->cls = json_object_get(cls);
+	}
+}
+
+static struct track *tracker_new_track(struct drpai_tracker *t, json_object *det,
+				       const struct tbox *b, uint64_t t_us)
+{
+	struct track *tr;
+
+	if (t->num_tracks >= t->max_tracks) {
+		int num = t->max_tracks + 16;
+		tr = realloc(t->tracks, num * sizeof(*tr));
+		if (!tr)
+			return NULL;
+		t->tracks = tr;
+		t->max_tracks = num;
+	}
+
+	tr = &t->tracks[t->num_tracks++];
+	memset(tr, 0, sizeof(*tr));
+	tr->id = t->next_id++;
+	kalman_init(&tr->kf[TRACK_CX], (b->x0 + b->x1) / 2);
+	kalman_init(&tr->kf[TRACK_CY], (b->y0 + b->y1) / 2);
+	kalman_init(&tr->kf[TRACK_W], b->x1 - b->x0);
+	kalman_init(&tr->kf[TRACK_H], b->y1 - b->y0);
+	tr->state_us = tr->seen_us = t_us;
+	tr->hits = 1;
+	track_set_detection(tr, det);
+
+	return tr;
+}
+
+static int match_cmp(const void *a, const void *b)
+{
+	const struct match *ma = a, *mb = b;
+
+	if (ma->iou == mb->iou)
+		return 0;
+	return ma->iou < mb->iou ? 1 : -1;
+}
+
+/* Candidate track/detection pairs, best overlap first */
+static int tracker_find_matches(struct drpai_tracker *t, json_object *dets, int num_dets,
+				uint64_t t_us)
+{
+	int i, j, num = 0;
+
+	for (i = 0; i < t->num_tracks; i++) {
+		struct tbox tb;
+
+		track_box_at(&t->tracks[i], t_us, &tb);
+
+		for (j = 0; j < num_dets; j++) {
+			json_object *det = json_object_array_get_idx(dets, j);
+			struct tbox db;
+			float iou;
+
+			if (!det_get_box(det, &db))
+				continue;
+			if (strcmp(t->tracks[i].label, det_get_label(det)))
+				continue;
+
+			iou = tbox_iou(&tb, &db);
+			if (iou < t->iou_thresh)
+				continue;
+
+			if (num >= t->max_matches) {
+				int n = t->max_matches + 32;
+				struct match *m = realloc(t->matches, n * sizeof(*m));
+				if (!m)
+					return -ENOMEM;
+				t->matches = m;
+				t->max_matches = n;
+			}
+			t->matches[num].track = i;
+			t->matches[num].det = j;
+			t->matches[num].iou = iou;
+			num++;
+		}
+	}
+
+	if (num > 1)
+		qsort(t->matches, num, sizeof(*t->matches), match_cmp);
+
+	return num;
+}
+
+int drpai_tracker_update(struct drpai_tracker *t, json_object *result, uint64_t frame_us)
+{
+	bool *track_used = NULL, *det_used = NULL;
+	json_object *dets;
+	int i, j, num_dets, num_matches, rc = 0;
+
+	if (!t)
+		return -EINVAL;
+
+	dets = json_object_object_get(result, "value");
+	if (!json_object_is_type(dets, json_type_array))
+		return -EINVAL;
+	num_dets = json_object_array_length(dets);
+
+	/* bring all tracks to the time of the frame */
+	for (i = 0; i < t->num_tracks; i++) {
+		struct track *tr = &t->tracks[i];
+
+		if (frame_us <= tr->state_us)
+			continue;
+		for (j = 0; j < TRACK_NUM_COORDS; j++)
+			kalman_predict(&tr->kf[j], (frame_us - tr->state_us) / 1e6f);
+		tr->state_us = frame_us;
+	}
+
+	num_matches = tracker_find_matches(t, dets, num_dets, frame_us);
+	if (num_matches < 0)
+		return num_matches;
+
+	track_used = calloc(t->num_tracks + 1, sizeof(*track_used));
+	det_used = calloc(num_dets + 1, sizeof(*det_used));
+	if (!track_used || !det_used) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < num_matches; i++) {
+		const struct match *m = &t->matches[i];
+		json_object *det;
+		struct track *tr;
+		struct tbox db;
+
+		if (track_used[m->track] || det_used[m->det])
+			continue;
+		track_used[m->track] = det_used[m->det] = true;
+
+		tr = &t->tracks[m->track];
+		det = json_object_array_get_idx(dets, m->det);
+		det_get_box(det, &db);
+
+		kalman_update(&tr->kf[TRACK_CX], (db.x0 + db.x1) / 2);
+		kalman_update(&tr->kf[TRACK_CY], (db.y0 + db.y1) / 2);
+		kalman_update(&tr->kf[TRACK_W], db.x1 - db.x0);
+		kalman_update(&tr->kf[TRACK_H], db.y1 - db.y0);
+		tr->seen_us = frame_us;
+		tr->hits++;
+		track_set_detection(tr, det);
+
+		json_object_object_add(det, "track", json_object_new_int(tr->id));
+	}
+
+	/* everything else starts a new track */
+	for (j = 0; j < num_dets; j++) {
+		json_object *det = json_object_array_get_idx(dets, j);
+		struct track *tr;
+		struct tbox db;
+
+		if (det_used[j] || !det_get_box(det, &db))
+			continue;
+
+		tr = tracker_new_track(t, det, &db, frame_us);
+		if (!tr) {
+			rc = -ENOMEM;
+			goto out;
+		}
+		json_object_object_add(det, "track", json_object_new_int(tr->id));
+	}
+
+	/* drop the tracks that have not been seen for a while */
+	for (i = 0, j = 0; i < t->num_tracks; i++) {
+		struct track *tr = &t->tracks[i];
+
+		if (frame_us - tr->seen_us > t->max_age_us) {
+			json_object_put(tr->cls);
+			continue;
+		}
+		if (i != j)
+			t->tracks[j] = *tr;
+		j++;
+	}
+	t->num_tracks = j;
+out:
+	free(track_used);
+	free(det_used);
+	return rc;
+}
+
+json_object *drpai_tracker_predict(struct drpai_tracker *t, uint64_t now_us)
+{
+	json_object *res, *arr;
+	int i;
+
+	if (!t)
+		return NULL;
+
+	res = json_object_new_object();
+	arr = json_object_new_array();
+	if (!res || !arr) {
+		json_object_put(res);
+		json_object_put(arr);
+		return NULL;
+	}
+
+	json_object_object_add(res, "name", json_object_new_string("drpai-object-detection-result"));
+	json_object_object_add(res, "value", arr);
+
+	for (i = 0; i < t->num_tracks; i++) {
+		const struct track *tr = &t->tracks[i];
+		json_object *jobj, *jbox;
+		struct tbox b;
+
+		if (tr->hits < t->min_hits || now_us - tr->seen_us > t->max_age_us)
+			continue;
+
+		jobj = json_object_new_object();
+		jbox = json_object_new_object();
+		if (!jobj || !jbox) {
+			json_object_put(jobj);
+			json_object_put(jbox);
+			break;
+		}
+
+		track_box_at(tr, now_us, &b);
+		json_object_object_add(jobj, "label", json_object_new_string(tr->label));
+		json_object_object_add(jobj, "box", jbox);
+		json_object_object_add(jbox, "x", json_object_new_int(b.x0 + 0.5f));
+		json_object_object_add(jbox, "y", json_object_new_int(b.y0 + 0.5f));
+		json_object_object_add(jbox, "w", json_object_new_int(b.x1 - b.x0 + 0.5f));
+		json_object_object_add(jbox, "h", json_object_new_int(b.y1 - b.y0 + 0.5f));
+		json_object_object_add(jobj, "probability", json_object_new_double(tr->probability));
+		json_object_object_add(jobj, "track", json_object_new_int(tr->id));
+		if (tr->cls)
+			json_object_object_add(jobj, "class", json_object_get(tr->cls));
+
+		json_object_array_add(arr, jobj);
+	}
+
+	return res;
+}
+
+struct drpai_tracker *drpai_tracker_create(json_object *cfg, int *err)
+{
+	struct drpai_tracker *t;
+	float max_age_ms;
+	int lerr = 0;
+
+	t = calloc(1, sizeof(*t));
+	if (!t) {
+		lerr = -ENOMEM;
+		goto err_store;
+	}
+
+	t->iou_thresh = drpai_config_get_float(cfg, "iou", 0.3f);
+	t->min_hits = drpai_config_get_float(cfg, "min_hits", 2);
+	max_age_ms = drpai_config_get_float(cfg, "max_age_ms", 500);
+	t->next_id = 1;
+
+	if (t->iou_thresh <= 0 || t->iou_thresh > 1 || t->min_hits < 1 ||
+	    max_age_ms <= 0) {
+		free(t);
+		lerr = -EINVAL;
+		goto err_store;
+	}
+	t->max_age_us = max_age_ms * 1000;
+
+	return t;
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void drpai_tracker_destroy(struct drpai_tracker *t)
+{
+	int i;
+
+	if (!t)
+		return;
+
+	for (i = 0; i < t->num_tracks; i++)
+		json_object_put(t->tracks[i].cls);
+	free(t->tracks);
+	free(t->matches);
+	free(t);
+}
@@ -0,0 +1,27 @@
+#ifndef __DRPAI_TRACKER_H__
+#define __DRPAI_TRACKER_H__
+
+#include <stdint.h>
+#include <json-c/json.h>
+
+/* Multi-object tracker for one camera; opaque */
+struct drpai_tracker;
+
+/**
+ * 'cfg' is the optional "tracker" object of the camera inference config:
+ *   { "iou": <min. overlap to match a detection to a track, 0..1>,
+ *     "min_hits": <detections before a track is reported>,
+ *     "max_age_ms": <how long a track lives without detections> }
+ */
+struct drpai_tracker *drpai_tracker_create(json_object *cfg, int *err);
+void drpai_tracker_destroy(struct drpai_tracker *t);
+
+/* Feed an object detection result, for a frame taken at 'frame_us';
+ * the detections get the "track" they were matched to.
+ */
+int drpai_tracker_update(struct drpai_tracker *t, json_object *result, uint64_t frame_us);
+
+/* Returns the tracked objects, at time 'now_us', as an object detection result */
+json_object *drpai_tracker_predict(struct drpai_tracker *t, uint64_t now_us);
+
+#endif /* __DRPAI_TRACKER_H__ */
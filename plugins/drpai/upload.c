@@ -0,0 +1,722 @@
+
+#define _GNU_SOURCE		/* sync_file_range(), renameat2() */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+#include "pkg.h"
+#include "sha256.h"
+#include "upload.h"
+
+/* On the same file system as the models, for the final rename() */
+#define UPLOAD_DIR		DRPAI_MODELS_ROOT_DIR "/.upload"
+#define UPLOAD_PART		".part"
+
+/* What a session holds in memory, whatever the size of the file */
+#define UPLOAD_BUF_SIZE		65536
+/* Writeback is started every so often, so that the final sync is short */
+#define UPLOAD_SYNC_SIZE	(4 << 20)
+
+struct drpai_upload {
+	char model[NAME_MAX + 1];
+	char file[256];
+	int fd;			/* of the .part file; -1 with no file going */
+	int state_fd;		/* of its upload_state */
+	uint64_t size;
+	uint64_t received;
+	uint64_t written;
+	uint64_t synced;
+	struct sha256 sha;	/* of what was written */
+	char sha256[SHA256_HEX_SIZE];
+	size_t buf_len;
+	uint8_t buf[UPLOAD_BUF_SIZE];
+};
+
+/**
+ * The hash so far of a file, kept in UPLOAD_DIR/.sha256-<model>/<file>
+ * (out of the staged model) as the file is written, so that neither a
+ * resume nor the check of a file uploaded before reads it all again.
+ */
+struct upload_state {
+	uint64_t offset;	/* what 'sha' covers */
+	int64_t mtime_ns;	/* of the file once done, 0 before */
+	struct sha256 sha;
+};
+
+/* Plain names only, so that nothing ends up outside of the staging directory */
+static bool upload_name_ok(const char *name, size_t max, bool allow_stage)
+{
+	const char *p;
+	bool stage = false;
+
+	if (!name || !*name || *name == '.' || strlen(name) >= max)
+		return false;
+
+	for (p = name; *p; p++) {
+		if (*p == '/') {
+			if (!allow_stage || stage || p[1] == '.' || !p[1])
+				return false;
+			stage = true;
+			continue;
+		}
+		if (!isalnum((unsigned char)*p) && !strchr("._-", *p))
+			return false;
+	}
+
+	return true;
+}
+
+static int upload_mkdir(const char *path)
+{
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+/* 'dir', and the stage directory of 'file' in it, if any */
+static int upload_mkdirs(const char *dir, const char *file)
+{
+	char path[PATH_MAX];
+	const char *slash;
+	int rc;
+
+	rc = upload_mkdir(dir);
+	slash = strchr(file, '/');
+	if (!rc && slash) {
+		snprintf(path, sizeof(path), "%s/%.*s", dir, (int)(slash - file), file);
+		rc = upload_mkdir(path);
+	}
+
+	return rc;
+}
+
+static int64_t upload_mtime_ns(const struct stat *st)
+{
+	return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+static int upload_state_read(int fd, struct upload_state *s)
+{
+	ssize_t n;
+
+	n = pread(fd, s, sizeof(*s), 0);
+	if (n < 0)
+		return -errno;
+
+	/* anything torn or from elsewhere does not add up */
+	if (n != sizeof(*s) || s->sha.len != s->offset ||
+	    s->sha.buf_len != s->offset % sizeof(s->sha.buf))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void upload_state_write(struct drpai_upload *up, int64_t mtime_ns)
+{
+	struct upload_state s = {
+		.offset = up->written,
+		.mtime_ns = mtime_ns,
+		.sha = up->sha,
+	};
+
+	/* at worst, the next resume starts the file over */
+	if (pwrite(up->state_fd, &s, sizeof(s), 0) != sizeof(s))
+		lwsl_warn("%s: %s/%s: could not save the hash\n", __func__,
+			  up->model, up->file);
+}
+
+static int upload_remove_fn(const char *path, const struct stat *st, int flag,
+			    struct FTW *ftw)
+{
+	return remove(path) ? -errno : 0;
+}
+
+static int upload_remove_tree(const char *path)
+{
+	int rc;
+
+	rc = nftw(path, upload_remove_fn, 16, FTW_DEPTH | FTW_PHYS);
+	if (rc > 0 || (rc < 0 && errno != ENOENT))
+		return rc > 0 ? -rc : -errno;
+
+	return 0;
+}
+
+/* The saved hashes of the files of a model, once they are of no more use */
+static int upload_remove_state(const char *model)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), UPLOAD_DIR "/.sha256-%s", model);
+	return upload_remove_tree(path);
+}
+
+static int upload_flush(struct drpai_upload *up)
+{
+	size_t off = 0;
+	ssize_t n;
+
+	if (!up->buf_len)
+		return 0;
+
+	while (off < up->buf_len) {
+		n = write(up->fd, up->buf + off, up->buf_len - off);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		off += n;
+	}
+	sha256_update(&up->sha, up->buf, up->buf_len);
+	up->written += up->buf_len;
+	up->buf_len = 0;
+	upload_state_write(up, 0);
+
+	if (up->written - up->synced >= UPLOAD_SYNC_SIZE) {
+		sync_file_range(up->fd, up->synced, up->written - up->synced,
+				SYNC_FILE_RANGE_WRITE);
+		up->synced = up->written;
+	}
+
+	return 0;
+}
+
+/* Stops the current file; what was received so far stays for a resume */
+static void upload_close(struct drpai_upload *up)
+{
+	if (up->fd < 0)
+		return;
+
+	if (upload_flush(up))
+		lwsl_warn("%s: %s/%s: could not write\n", __func__, up->model, up->file);
+	close(up->fd);
+	close(up->state_fd);
+	up->fd = -1;
+	up->state_fd = -1;
+}
+
+void drpai_upload_free(struct drpai_upload *up)
+{
+	if (!up)
+		return;
+
+	upload_close(up);
+	free(up);
+}
+
+static json_object *upload_reply(json_object *val, const char *err)
+{
+	json_object *reply;
+
+	reply = json_object_new_object();
+	if (!reply) {
+		json_object_put(val);
+		return NULL;
+	}
+
+	json_object_object_add(reply, "name", json_object_new_string("drpai-model-upload"));
+	if (err) {
+		json_object_put(val);
+		json_object_object_add(reply, "error", json_object_new_string(err));
+	} else {
+		json_object_object_add(reply, "value", val);
+	}
+
+	return reply;
+}
+
+static json_object *upload_file_value(const struct drpai_upload *up, const char *file,
+				      uint64_t offset, bool done)
+{
+	json_object *val;
+
+	val = json_object_new_object();
+	if (!val)
+		return NULL;
+
+	json_object_object_add(val, "model", json_object_new_string(up->model));
+	json_object_object_add(val, "file", json_object_new_string(file));
+	json_object_object_add(val, "offset", json_object_new_int64(offset));
+	if (done) {
+		json_object_object_add(val, "size", json_object_new_int64(offset));
+		json_object_object_add(val, "done", json_object_new_boolean(1));
+	}
+
+	return val;
+}
+
+/* Of a copy, so that 'sha' can still be saved */
+static const char *upload_hex(const struct sha256 *sha, char hex[SHA256_HEX_SIZE])
+{
+	uint8_t digest[SHA256_SIZE];
+	struct sha256 s = *sha;
+
+	sha256_final(&s, digest);
+	sha256_to_hex(digest, hex);
+
+	return hex;
+}
+
+/* The whole file is in: check it, and give it its name */
+static const char *upload_finish(struct drpai_upload *up)
+{
+	char path[PATH_MAX], part[PATH_MAX], state[PATH_MAX];
+	char hex[SHA256_HEX_SIZE];
+	const char *err = NULL;
+	struct stat st;
+
+	snprintf(path, sizeof(path), UPLOAD_DIR "/%s/%s", up->model, up->file);
+	snprintf(part, sizeof(part), UPLOAD_DIR "/%s/%s" UPLOAD_PART, up->model, up->file);
+	snprintf(state, sizeof(state), UPLOAD_DIR "/.sha256-%s/%s", up->model, up->file);
+
+	if (upload_flush(up) || fdatasync(up->fd))
+		err = "could not write the file";
+	else if (strcmp(upload_hex(&up->sha, hex), up->sha256))
+		err = "checksum mismatch";
+	else if (rename(part, path))
+		err = "could not rename the file";
+	else if (!fstat(up->fd, &st))
+		upload_state_write(up, upload_mtime_ns(&st));
+
+	close(up->fd);
+	close(up->state_fd);
+	up->fd = -1;
+	up->state_fd = -1;
+
+	/* a mismatch means that the data on disk is no good */
+	if (err) {
+		unlink(part);
+		unlink(state);
+	}
+
+	return err;
+}
+
+static const char *upload_begin(struct drpai_upload *up, json_object *jval,
+				json_object **val)
+{
+	char path[PATH_MAX], part[PATH_MAX], state[PATH_MAX];
+	const char *model, *file, *hash;
+	struct upload_state s;
+	uint64_t offset;
+	struct stat st;
+	int64_t size;
+	int fd, state_fd, rc;
+
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+	file = json_object_get_string(json_object_object_get(jval, "file"));
+	hash = json_object_get_string(json_object_object_get(jval, "sha256"));
+	size = json_object_get_int64(json_object_object_get(jval, "size"));
+
+	if (!upload_name_ok(model, sizeof(up->model), false) ||
+	    !upload_name_ok(file, sizeof(up->file), true))
+		return "invalid model or file name";
+	if (size < 0 || !hash || strlen(hash) != SHA256_HEX_SIZE - 1 ||
+	    strspn(hash, "0123456789abcdef") != SHA256_HEX_SIZE - 1)
+		return "invalid size or sha256";
+	if (strlen(file) > strlen(UPLOAD_PART) &&
+	    !strcmp(file + strlen(file) - strlen(UPLOAD_PART), UPLOAD_PART))
+		return "invalid model or file name";
+
+	upload_close(up);
+	snprintf(up->model, sizeof(up->model), "%s", model);
+	snprintf(up->file, sizeof(up->file), "%s", file);
+
+	snprintf(path, sizeof(path), UPLOAD_DIR "/%s/%s", model, file);
+	snprintf(part, sizeof(part), UPLOAD_DIR "/%s/%s" UPLOAD_PART, model, file);
+	snprintf(state, sizeof(state), UPLOAD_DIR "/.sha256-%s/%s", model, file);
+
+	/* done already, in an earlier session: as hashed then, if untouched */
+	if (!stat(path, &st)) {
+		char hex[SHA256_HEX_SIZE];
+		bool same = false;
+
+		fd = open(state, O_RDONLY | O_CLOEXEC);
+		if (fd >= 0) {
+			same = !upload_state_read(fd, &s) &&
+			       (uint64_t)st.st_size == (uint64_t)size &&
+			       s.offset == (uint64_t)size &&
+			       s.mtime_ns == upload_mtime_ns(&st) &&
+			       !strcmp(upload_hex(&s.sha, hex), hash);
+			close(fd);
+		}
+		if (same) {
+			*val = upload_file_value(up, file, size, true);
+			return NULL;
+		}
+		unlink(path);
+	}
+
+	rc = upload_mkdir(UPLOAD_DIR);
+	if (!rc) {
+		snprintf(path, sizeof(path), UPLOAD_DIR "/%s", model);
+		rc = upload_mkdirs(path, file);
+	}
+	if (!rc) {
+		snprintf(path, sizeof(path), UPLOAD_DIR "/.sha256-%s", model);
+		rc = upload_mkdirs(path, file);
+	}
+	if (rc)
+		return "could not create the staging directory";
+
+	fd = open(part, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return "could not create the file";
+
+	if (flock(fd, LOCK_EX | LOCK_NB)) {
+		close(fd);
+		return "the file is being uploaded by another session";
+	}
+
+	state_fd = open(state, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (state_fd < 0) {
+		close(fd);
+		return "could not create the file";
+	}
+
+	/*
+	 * The hash covers what was received before, as it was saved; what
+	 * came in after that (at most a buffer) is received again.
+	 */
+	offset = 0;
+	sha256_init(&up->sha);
+	if (!fstat(fd, &st) && !upload_state_read(state_fd, &s) && !s.mtime_ns &&
+	    s.offset <= (uint64_t)st.st_size && s.offset <= (uint64_t)size) {
+		offset = s.offset;
+		up->sha = s.sha;
+	}
+	if (ftruncate(fd, offset) || lseek(fd, offset, SEEK_SET) < 0) {
+		close(state_fd);
+		close(fd);
+		return "could not truncate the file";
+	}
+
+	up->fd = fd;
+	up->state_fd = state_fd;
+	up->size = size;
+	up->received = offset;
+	up->written = offset;
+	up->synced = offset;
+	up->buf_len = 0;
+	snprintf(up->sha256, sizeof(up->sha256), "%s", hash);
+
+	lwsl_notice("%s: %s/%s: %llu bytes, from %llu\n", __func__, model, file,
+		    (unsigned long long)size, (unsigned long long)offset);
+
+	if (offset == up->size) {
+		const char *err = upload_finish(up);
+
+		if (err)
+			return err;
+		*val = upload_file_value(up, file, offset, true);
+		return NULL;
+	}
+
+	*val = upload_file_value(up, file, offset, false);
+
+	return NULL;
+}
+
+static int upload_write_config(const char *model, json_object *c, char *path, size_t size)
+{
+	const char *s;
+	size_t len;
+	FILE *fp;
+	int rc = 0;
+
+	s = json_object_to_json_string_length(c, JSON_C_TO_STRING_PRETTY, &len);
+	if (!s)
+		return -EINVAL;
+
+	/* no model name starts with a dot */
+	snprintf(path, size, UPLOAD_DIR "/.config-%s.json", model);
+	fp = fopen(path, "w");
+	if (!fp)
+		return -errno;
+
+	if (fwrite(s, 1, len, fp) != len || fflush(fp) || fdatasync(fileno(fp)))
+		rc = errno ? -errno : -EIO;
+	if (fclose(fp) && !rc)
+		rc = -errno;
+	if (rc)
+		unlink(path);
+
+	return rc;
+}
+
+/* Anything still .part means the model is not all there */
+static bool upload_has_parts(const char *dir, int depth)
+{
+	char path[PATH_MAX];
+	struct dirent *ep;
+	bool ret = false;
+	size_t len;
+	DIR *dp;
+
+	dp = opendir(dir);
+	if (!dp)
+		return false;
+
+	while (!ret && (ep = readdir(dp))) {
+		if (!strcmp(ep->d_name, ".") || !strcmp(ep->d_name, ".."))
+			continue;
+
+		len = strlen(ep->d_name);
+		if (len >= strlen(UPLOAD_PART) &&
+		    !strcmp(ep->d_name + len - strlen(UPLOAD_PART), UPLOAD_PART)) {
+			ret = true;
+		} else if (ep->d_type == DT_DIR && depth) {
+			snprintf(path, sizeof(path), "%s/%s", dir, ep->d_name);
+			ret = upload_has_parts(path, depth - 1);
+		}
+	}
+
+	closedir(dp);
+
+	return ret;
+}
+
+static const char *upload_commit(struct drpai_upload *up, const char *model,
+				 json_object *config)
+{
+	char staged[PATH_MAX], dst[PATH_MAX], cfg[PATH_MAX];
+	int rc;
+
+	snprintf(staged, sizeof(staged), UPLOAD_DIR "/%s", model);
+	snprintf(dst, sizeof(dst), DRPAI_MODELS_ROOT_DIR "/%s", model);
+
+	if (access(staged, F_OK))
+		return "nothing was uploaded for the model";
+	if (upload_has_parts(staged, 1))
+		return "the upload of the model is not complete";
+
+	if (up && !strcmp(up->model, model))
+		upload_close(up);
+
+	/* a package is the whole model, in one file */
+	snprintf(cfg, sizeof(cfg), UPLOAD_DIR "/%s/%s" DRPAI_PKG_SUFFIX, model, model);
+	if (!access(cfg, F_OK)) {
+		snprintf(dst, sizeof(dst), DRPAI_MODELS_ROOT_DIR "/%s" DRPAI_PKG_SUFFIX, model);
+		if (rename(cfg, dst))
+			return "could not move the package into place";
+		upload_remove_tree(staged);
+		upload_remove_state(model);
+		lwsl_notice("%s: %s (package)\n", __func__, model);
+		return NULL;
+	}
+
+	if (config) {
+		rc = upload_write_config(model, config, cfg, sizeof(cfg));
+		if (rc)
+			return "could not write the model config";
+	}
+
+	/* swap with the previous model, which then goes away with the staging */
+	if (rename(staged, dst)) {
+		if (errno != EEXIST && errno != ENOTEMPTY)
+			return "could not move the model into place";
+		if (renameat2(AT_FDCWD, staged, AT_FDCWD, dst, RENAME_EXCHANGE))
+			return "could not replace the model";
+		upload_remove_tree(staged);
+	}
+
+	if (config) {
+		snprintf(dst, sizeof(dst), DRPAI_MODELS_ROOT_DIR "/%s.json", model);
+		if (rename(cfg, dst))
+			return "could not move the model config into place";
+	}
+
+	/* or it would still be what gets loaded */
+	snprintf(dst, sizeof(dst), DRPAI_MODELS_ROOT_DIR "/%s" DRPAI_PKG_SUFFIX, model);
+	unlink(dst);
+	upload_remove_state(model);
+
+	lwsl_notice("%s: %s\n", __func__, model);
+
+	return NULL;
+}
+
+int drpai_upload_command(struct drpai_upload **up, json_object *req)
+{
+	json_object *jval, *val = NULL;
+	const char *model, *err = NULL;
+
+	jval = json_object_object_get(req, "value");
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+
+	if (!*up) {
+		*up = calloc(1, sizeof(**up));
+		if (!*up) {
+			err = "out of memory";
+			goto err;
+		}
+		(*up)->fd = -1;
+		(*up)->state_fd = -1;
+	}
+
+	if (json_object_get_boolean(json_object_object_get(jval, "commit")) ||
+	    json_object_get_boolean(json_object_object_get(jval, "abort"))) {
+		char path[PATH_MAX];
+
+		if (!upload_name_ok(model, NAME_MAX + 1, false)) {
+			err = "invalid model name";
+			goto err;
+		}
+
+		if (json_object_get_boolean(json_object_object_get(jval, "commit"))) {
+			err = upload_commit(*up, model,
+					    json_object_object_get(jval, "config"));
+		} else {
+			if (!strcmp((*up)->model, model))
+				upload_close(*up);
+			snprintf(path, sizeof(path), UPLOAD_DIR "/%s", model);
+			if (upload_remove_tree(path) || upload_remove_state(model))
+				err = "could not remove the staged files";
+		}
+		if (err)
+			goto err;
+
+		val = json_object_new_object();
+		json_object_object_add(val, "model", json_object_new_string(model));
+	} else {
+		err = upload_begin(*up, jval, &val);
+		if (err)
+			goto err;
+	}
+
+	json_object_object_add(req, "value", val);
+
+	return 0;
+err:
+	json_object_object_add(req, "error", json_object_new_string(err));
+	lwsl_err("%s: %s\n", __func__, err);
+	return -1;
+}
+
+int drpai_upload_write(struct drpai_upload *up, const void *data, size_t len,
+		       json_object **reply)
+{
+	const uint8_t *p = data;
+	const char *err;
+	bool flushed = false;
+	size_t n;
+	int rc;
+
+	*reply = NULL;
+
+	/* whatever was wrong has been replied already */
+	if (up->fd < 0)
+		return -EINVAL;
+
+	if (len > up->size - up->received) {
+		upload_close(up);
+		*reply = upload_reply(NULL, "more data than the size of the file");
+		return -EINVAL;
+	}
+
+	up->received += len;
+
+	while (len) {
+		n = sizeof(up->buf) - up->buf_len;
+		if (n > len)
+			n = len;
+		memcpy(up->buf + up->buf_len, p, n);
+		up->buf_len += n;
+		p += n;
+		len -= n;
+
+		if (up->buf_len < sizeof(up->buf))
+			break;
+
+		rc = upload_flush(up);
+		if (rc) {
+			upload_close(up);
+			*reply = upload_reply(NULL, "could not write the file");
+			return rc;
+		}
+		flushed = true;
+	}
+
+	if (up->received < up->size)
+		return flushed;
+
+	err = upload_finish(up);
+	if (err) {
+		*reply = upload_reply(NULL, err);
+		return -EIO;
+	}
+
+	lwsl_notice("%s: %s/%s: done\n", __func__, up->model, up->file);
+	*reply = upload_reply(upload_file_value(up, up->file, up->size, true), NULL);
+
+	return 1;
+}
+
+int drpai_model_delete(json_object *req)
+{
+	char path[PATH_MAX], trash[PATH_MAX];
+	const char *model, *err = NULL;
+	json_object *jval, *val;
+	bool found;
+
+	jval = json_object_object_get(req, "value");
+	model = json_object_get_string(json_object_object_get(jval, "model"));
+	if (!upload_name_ok(model, NAME_MAX + 1, false)) {
+		err = "invalid model name";
+		goto err;
+	}
+
+	/* out of sight first, so that the catalog never sees half a model */
+	snprintf(path, sizeof(path), DRPAI_MODELS_ROOT_DIR "/%s", model);
+	snprintf(trash, sizeof(trash), UPLOAD_DIR "/.delete-%s", model);
+	if (upload_mkdir(UPLOAD_DIR) || upload_remove_tree(trash)) {
+		err = "could not create the staging directory";
+		goto err;
+	}
+	found = !rename(path, trash);
+	if (!found && errno != ENOENT) {
+		err = "could not remove the model";
+		goto err;
+	}
+
+	snprintf(path, sizeof(path), DRPAI_MODELS_ROOT_DIR "/%s" DRPAI_PKG_SUFFIX, model);
+	if (!unlink(path))
+		found = true;
+	if (!found) {
+		err = "no such model";
+		goto err;
+	}
+
+	snprintf(path, sizeof(path), DRPAI_MODELS_ROOT_DIR "/%s.json", model);
+	unlink(path);
+	if (upload_remove_tree(trash))
+		lwsl_warn("%s: could not clean up %s\n", __func__, trash);
+
+	lwsl_notice("%s: %s\n", __func__, model);
+
+	/* 'model' goes away with the old "value" */
+	val = json_object_new_object();
+	json_object_object_add(val, "model", json_object_new_string(model));
+	json_object_object_add(req, "value", val);
+
+	return 0;
+err:
+	json_object_object_add(req, "error", json_object_new_string(err));
+	lwsl_err("%s: %s\n", __func__, err);
+	return -1;
+}
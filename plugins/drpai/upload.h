@@ -0,0 +1,49 @@
+#ifndef __DRPAI_UPLOAD_H__
+#define __DRPAI_UPLOAD_H__
+
+#include <stddef.h>
+#include <json-c/json.h>
+
+/**
+ * Model upload, one file at a time, into a staging directory next to the
+ * models; opaque, and one per websocket session.
+ *
+ * "drpai-model-upload", with "value":
+ *   { "model", "file", "size", "sha256" }
+ *	starts (or resumes) a file; "file" is a name in the model
+ *	directory, or in one of its stage directories ("stage/name"). The
+ *	reply has the "offset" to send the file from, as binary frames.
+ *	Once "size" bytes came in, and they match "sha256", another reply
+ *	has "done".
+ *   { "model", "commit": true, "config": { ... } }
+ *	moves the model into place, replacing any previous one, with
+ *	"config" (optional) as its <model>.json. If the upload was a
+ *	package, "<model>.drpai" (see pkg.h), only that is moved.
+ *   { "model", "abort": true }
+ *	throws away what was staged.
+ *
+ * Staged files stay across sessions: a file that is started again picks
+ * up from where the previous session left it.
+ */
+struct drpai_upload;
+
+void drpai_upload_free(struct drpai_upload *up);
+
+/* The "drpai-model-upload" command; allocates '*up' as needed */
+int drpai_upload_command(struct drpai_upload **up, json_object *req);
+
+/**
+ * Binary data of the file being uploaded. Returns < 0 on error, or 1 if
+ * the data went to disk (and the caller may want to let other work in
+ * before the next chunk), 0 otherwise; -EINVAL with no file going.
+ * '*reply' is set to a
+ * "drpai-model-upload" message to send, if any: when the file is done,
+ * or on error.
+ */
+int drpai_upload_write(struct drpai_upload *up, const void *data, size_t len,
+		       json_object **reply);
+
+/* "drpai-model-delete", with "value": { "model" } */
+int drpai_model_delete(json_object *req);
+
+#endif /* __DRPAI_UPLOAD_H__ */
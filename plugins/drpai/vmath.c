@@ -0,0 +1,513 @@
+
+#include "vmath.h"
+
+#include <float.h>
+#include <math.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__F16C__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* NEON has half precision conversions with the VFPv4 half precision extension */
+#if defined(__ARM_NEON) && (defined(__aarch64__) || (__ARM_FP & 2))
+#define VMATH_NEON_FP16
+#endif
+
+float vmath_logitf(float p)
+{
+	if (p <= 0)
+		return -FLT_MAX;
+	if (p >= 1)
+		return FLT_MAX;
+
+	return logf(p / (1.0f - p));
+}
+
+#if defined(__ARM_NEON)
+static inline float32x4_t vmath_exp_f32x4(float32x4_t x)
+{
+	const float32x4_t one = vdupq_n_f32(1.0f);
+	float32x4_t fx, tmp, r, y;
+	uint32x4_t gt;
+	int32x4_t n;
+
+	x = vminq_f32(x, vdupq_n_f32(VMATH_EXP_HI));
+	x = vmaxq_f32(x, vdupq_n_f32(VMATH_EXP_LO));
+
+	/* n = floor(x * log2(e) + 0.5) */
+	fx = vaddq_f32(vmulq_f32(x, vdupq_n_f32(VMATH_LOG2E)), vdupq_n_f32(0.5f));
+	tmp = vcvtq_f32_s32(vcvtq_s32_f32(fx));
+	gt = vcgtq_f32(tmp, fx);
+	fx = vsubq_f32(tmp, vreinterpretq_f32_u32(vandq_u32(gt, vreinterpretq_u32_f32(one))));
+	n = vcvtq_s32_f32(fx);
+
+	r = vsubq_f32(x, vmulq_f32(fx, vdupq_n_f32(VMATH_LN2_HI)));
+	r = vsubq_f32(r, vmulq_f32(fx, vdupq_n_f32(VMATH_LN2_LO)));
+
+	y = vdupq_n_f32(VMATH_EXP_P0);
+	y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(VMATH_EXP_P1));
+	y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(VMATH_EXP_P2));
+	y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(VMATH_EXP_P3));
+	y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(VMATH_EXP_P4));
+	y = vaddq_f32(vmulq_f32(y, r), vdupq_n_f32(VMATH_EXP_P5));
+	y = vaddq_f32(vaddq_f32(vmulq_f32(vmulq_f32(y, r), r), r), one);
+
+	n = vshlq_n_s32(vaddq_s32(n, vdupq_n_s32(127)), 23);
+
+	return vmulq_f32(y, vreinterpretq_f32_s32(n));
+}
+
+static inline float32x4_t vmath_recip_f32x4(float32x4_t x)
+{
+#if defined(__aarch64__)
+	return vdivq_f32(vdupq_n_f32(1.0f), x);
+#else
+	float32x4_t r = vrecpeq_f32(x);
+
+	r = vmulq_f32(vrecpsq_f32(x, r), r);
+	return vmulq_f32(vrecpsq_f32(x, r), r);
+#endif
+}
+#elif defined(__SSE2__)
+static inline __m128 vmath_exp_ps(__m128 x)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	__m128 fx, tmp, r, y;
+	__m128i n;
+
+	x = _mm_min_ps(x, _mm_set1_ps(VMATH_EXP_HI));
+	x = _mm_max_ps(x, _mm_set1_ps(VMATH_EXP_LO));
+
+	/* n = floor(x * log2(e) + 0.5) */
+	fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(VMATH_LOG2E)), _mm_set1_ps(0.5f));
+	tmp = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+	fx = _mm_sub_ps(tmp, _mm_and_ps(_mm_cmpgt_ps(tmp, fx), one));
+	n = _mm_cvttps_epi32(fx);
+
+	r = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(VMATH_LN2_HI)));
+	r = _mm_sub_ps(r, _mm_mul_ps(fx, _mm_set1_ps(VMATH_LN2_LO)));
+
+	y = _mm_set1_ps(VMATH_EXP_P0);
+	y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(VMATH_EXP_P1));
+	y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(VMATH_EXP_P2));
+	y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(VMATH_EXP_P3));
+	y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(VMATH_EXP_P4));
+	y = _mm_add_ps(_mm_mul_ps(y, r), _mm_set1_ps(VMATH_EXP_P5));
+	y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(y, r), r), r), one);
+
+	n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+
+	return _mm_mul_ps(y, _mm_castsi128_ps(n));
+}
+#endif
+
+void vmath_exp(float *dst, const float *src, int n)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmath_exp_f32x4(vld1q_f32(src + i)));
+#elif defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, vmath_exp_ps(_mm_loadu_ps(src + i)));
+#endif
+	for (; i < n; i++)
+		dst[i] = vmath_expf(src[i]);
+}
+
+void vmath_sigmoid(float *dst, const float *src, int n)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	const float32x4_t one = vdupq_n_f32(1.0f);
+
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t e = vmath_exp_f32x4(vnegq_f32(vld1q_f32(src + i)));
+		vst1q_f32(dst + i, vmath_recip_f32x4(vaddq_f32(one, e)));
+	}
+#elif defined(__SSE2__)
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 e = vmath_exp_ps(_mm_sub_ps(zero, _mm_loadu_ps(src + i)));
+		_mm_storeu_ps(dst + i, _mm_div_ps(one, _mm_add_ps(one, e)));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = vmath_sigmoidf(src[i]);
+}
+
+void vmath_max(float *dst, const float *src, int n)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vmaxq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+#elif defined(__SSE2__)
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(dst + i, _mm_max_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+#endif
+	for (; i < n; i++) {
+		if (src[i] > dst[i])
+			dst[i] = src[i];
+	}
+}
+
+void vmath_argmax_update(float *max, int32_t *idx, const float *src, int n, int32_t plane)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	int32x4_t vp = vdupq_n_s32(plane);
+
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t vs = vld1q_f32(src + i);
+		float32x4_t vm = vld1q_f32(max + i);
+		uint32x4_t gt = vcgtq_f32(vs, vm);
+
+		vst1q_f32(max + i, vbslq_f32(gt, vs, vm));
+		vst1q_s32(idx + i, vbslq_s32(gt, vp, vld1q_s32(idx + i)));
+	}
+#elif defined(__SSE2__)
+	__m128i vp = _mm_set1_epi32(plane);
+
+	for (; i + 4 <= n; i += 4) {
+		__m128 vs = _mm_loadu_ps(src + i);
+		__m128 vm = _mm_loadu_ps(max + i);
+		__m128 gt = _mm_cmpgt_ps(vs, vm);
+		__m128i gti = _mm_castps_si128(gt);
+		__m128i vi = _mm_loadu_si128((const __m128i *)(idx + i));
+
+		_mm_storeu_ps(max + i, _mm_or_ps(_mm_and_ps(gt, vs), _mm_andnot_ps(gt, vm)));
+		_mm_storeu_si128((__m128i *)(idx + i),
+				 _mm_or_si128(_mm_and_si128(gti, vp), _mm_andnot_si128(gti, vi)));
+	}
+#endif
+	for (; i < n; i++) {
+		if (src[i] > max[i]) {
+			max[i] = src[i];
+			idx[i] = plane;
+		}
+	}
+}
+
+int vmath_argmax(const float *src, int n, float *max)
+{
+	float m = -FLT_MAX;
+	int i = 0, best = -1;
+
+#if defined(__ARM_NEON)
+	if (n >= 4) {
+		float32x4_t vm = vld1q_f32(src);
+		float32x2_t t;
+
+		for (i = 4; i + 4 <= n; i += 4)
+			vm = vmaxq_f32(vm, vld1q_f32(src + i));
+		t = vpmax_f32(vget_low_f32(vm), vget_high_f32(vm));
+		t = vpmax_f32(t, t);
+		m = vget_lane_f32(t, 0);
+	}
+#elif defined(__SSE2__)
+	if (n >= 4) {
+		__m128 vm = _mm_loadu_ps(src);
+
+		for (i = 4; i + 4 <= n; i += 4)
+			vm = _mm_max_ps(vm, _mm_loadu_ps(src + i));
+		vm = _mm_max_ps(vm, _mm_shuffle_ps(vm, vm, _MM_SHUFFLE(1, 0, 3, 2)));
+		vm = _mm_max_ps(vm, _mm_shuffle_ps(vm, vm, _MM_SHUFFLE(2, 3, 0, 1)));
+		m = _mm_cvtss_f32(vm);
+	}
+#endif
+	for (; i < n; i++) {
+		if (src[i] > m)
+			m = src[i];
+	}
+
+	/* first one with the largest value, like a plain scan */
+	for (i = 0; i < n; i++) {
+		if (src[i] == m) {
+			best = i;
+			break;
+		}
+	}
+
+	if (max)
+		*max = m;
+
+	return best;
+}
+
+float vmath_softmax(float *val, int n, int *argmax)
+{
+	float max, sum = 0;
+	int i, best;
+
+	best = vmath_argmax(val, n, &max);
+	if (argmax)
+		*argmax = best;
+	if (best < 0)
+		return 0;
+
+	for (i = 0; i < n; i++)
+		val[i] -= max;
+	vmath_exp(val, val, n);
+
+	for (i = 0; i < n; i++)
+		sum += val[i];
+	for (i = 0; i < n; i++)
+		val[i] /= sum;
+
+	return val[best];
+}
+
+int vmath_select_ge(const float *src, int n, float thresh,
+		    const uint8_t *mask, int *idx)
+{
+	int i = 0, j, num = 0;
+
+#if defined(__ARM_NEON)
+	const float32x4_t vt = vdupq_n_f32(thresh);
+
+	/* mostly nothing passes; only look closer at groups where something does */
+	for (; i + 4 <= n; i += 4) {
+		uint32x4_t ge = vcgeq_f32(vld1q_f32(src + i), vt);
+		uint32x2_t t = vorr_u32(vget_low_u32(ge), vget_high_u32(ge));
+
+		if (!(vget_lane_u32(t, 0) | vget_lane_u32(t, 1)))
+			continue;
+
+		for (j = i; j < i + 4; j++) {
+			if (src[j] >= thresh && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128 vt = _mm_set1_ps(thresh);
+
+	for (; i + 4 <= n; i += 4) {
+		int bits = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(src + i), vt));
+
+		for (j = i; bits; j++, bits >>= 1) {
+			if ((bits & 1) && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (src[i] >= thresh && (!mask || mask[i]))
+			idx[num++] = i;
+	}
+
+	return num;
+}
+
+void vmath_f16_to_f32_array(float *dst, const uint16_t *src, int n)
+{
+	int i = 0;
+
+#if defined(VMATH_NEON_FP16)
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(dst + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+#elif defined(__F16C__)
+	for (; i + 8 <= n; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(src + i))));
+#elif defined(__SSE2__)
+	/* vmath_f16_to_f32(), four at a time */
+	const __m128i shifted_exp = _mm_set1_epi32(0x7c00 << 13);
+	const __m128i bias = _mm_set1_epi32((127 - 15) << 23);
+	const __m128i one_exp = _mm_set1_epi32(1 << 23);
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i *)(src + i)),
+					       _mm_setzero_si128());
+		__m128i o = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+		__m128i exp = _mm_and_si128(o, shifted_exp);
+		__m128i infnan = _mm_cmpeq_epi32(exp, shifted_exp);
+		__m128i denorm = _mm_cmpeq_epi32(exp, _mm_setzero_si128());
+		__m128 d;
+
+		o = _mm_add_epi32(o, bias);
+		o = _mm_add_epi32(o, _mm_and_si128(infnan, bias));
+		d = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(o, one_exp)), magic);
+		o = _mm_or_si128(_mm_and_si128(denorm, _mm_castps_si128(d)),
+				 _mm_andnot_si128(denorm, o));
+		o = _mm_or_si128(o, _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16));
+		_mm_storeu_ps(dst + i, _mm_castsi128_ps(o));
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = vmath_f16_to_f32(src[i]);
+}
+
+#if defined(__ARM_NEON)
+static inline void vmath_s16_to_f32x8(float *dst, int16x8_t q, float32x4_t scale)
+{
+	vst1q_f32(dst, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(q))), scale));
+	vst1q_f32(dst + 4, vmulq_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(q))), scale));
+}
+#elif defined(__SSE2__)
+static inline void vmath_s16_to_f32x8(float *dst, __m128i q, __m128 scale)
+{
+	__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(q, q), 16);
+	__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(q, q), 16);
+
+	_mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+	_mm_storeu_ps(dst + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+}
+#endif
+
+void vmath_s8_to_f32(float *dst, const int8_t *src, int n, float scale, int zero_point)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	const int16x8_t zp = vdupq_n_s16(zero_point);
+	const float32x4_t vs = vdupq_n_f32(scale);
+
+	for (; i + 8 <= n; i += 8)
+		vmath_s16_to_f32x8(dst + i, vsubq_s16(vmovl_s8(vld1_s8(src + i)), zp), vs);
+#elif defined(__SSE2__)
+	const __m128i zp = _mm_set1_epi16(zero_point);
+	const __m128 vs = _mm_set1_ps(scale);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i q = _mm_loadl_epi64((const __m128i *)(src + i));
+
+		q = _mm_srai_epi16(_mm_unpacklo_epi8(q, q), 8);
+		vmath_s16_to_f32x8(dst + i, _mm_sub_epi16(q, zp), vs);
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = (src[i] - zero_point) * scale;
+}
+
+void vmath_u8_to_f32(float *dst, const uint8_t *src, int n, float scale, int zero_point)
+{
+	int i = 0;
+
+#if defined(__ARM_NEON)
+	const int16x8_t zp = vdupq_n_s16(zero_point);
+	const float32x4_t vs = vdupq_n_f32(scale);
+
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t q = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(src + i)));
+
+		vmath_s16_to_f32x8(dst + i, vsubq_s16(q, zp), vs);
+	}
+#elif defined(__SSE2__)
+	const __m128i zp = _mm_set1_epi16(zero_point);
+	const __m128 vs = _mm_set1_ps(scale);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i q = _mm_loadl_epi64((const __m128i *)(src + i));
+
+		q = _mm_unpacklo_epi8(q, _mm_setzero_si128());
+		vmath_s16_to_f32x8(dst + i, _mm_sub_epi16(q, zp), vs);
+	}
+#endif
+	for (; i < n; i++)
+		dst[i] = (src[i] - zero_point) * scale;
+}
+
+int vmath_select_ge_s8(const int8_t *src, int n, int thresh,
+		       const uint8_t *mask, int *idx)
+{
+	int i = 0, j, num = 0;
+
+	if (thresh > INT8_MAX)
+		return 0;
+	if (thresh < INT8_MIN)
+		thresh = INT8_MIN;
+
+#if defined(__ARM_NEON)
+	const int8x16_t vt = vdupq_n_s8(thresh);
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t ge = vcgeq_s8(vld1q_s8(src + i), vt);
+		uint8x8_t t = vorr_u8(vget_low_u8(ge), vget_high_u8(ge));
+
+		if (!vget_lane_u64(vreinterpret_u64_u8(t), 0))
+			continue;
+
+		for (j = i; j < i + 16; j++) {
+			if (src[j] >= thresh && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i vt = _mm_set1_epi8(thresh);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		/* v >= t is !(t > v) */
+		int bits = _mm_movemask_epi8(_mm_cmpgt_epi8(vt, v)) ^ 0xffff;
+
+		for (j = i; bits; j++, bits >>= 1) {
+			if ((bits & 1) && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (src[i] >= thresh && (!mask || mask[i]))
+			idx[num++] = i;
+	}
+
+	return num;
+}
+
+int vmath_select_ge_u8(const uint8_t *src, int n, int thresh,
+		       const uint8_t *mask, int *idx)
+{
+	int i = 0, j, num = 0;
+
+	if (thresh > UINT8_MAX)
+		return 0;
+	if (thresh < 0)
+		thresh = 0;
+
+#if defined(__ARM_NEON)
+	const uint8x16_t vt = vdupq_n_u8(thresh);
+
+	for (; i + 16 <= n; i += 16) {
+		uint8x16_t ge = vcgeq_u8(vld1q_u8(src + i), vt);
+		uint8x8_t t = vorr_u8(vget_low_u8(ge), vget_high_u8(ge));
+
+		if (!vget_lane_u64(vreinterpret_u64_u8(t), 0))
+			continue;
+
+		for (j = i; j < i + 16; j++) {
+			if (src[j] >= thresh && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#elif defined(__SSE2__)
+	const __m128i vt = _mm_set1_epi8((char)thresh);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		/* v >= t is max(v, t) == v */
+		int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, vt), v));
+
+		for (j = i; bits; j++, bits >>= 1) {
+			if ((bits & 1) && (!mask || mask[j]))
+				idx[num++] = j;
+		}
+	}
+#endif
+	for (; i < n; i++) {
+		if (src[i] >= thresh && (!mask || mask[i]))
+			idx[num++] = i;
+	}
+
+	return num;
+}
@@ -0,0 +1,127 @@
+#ifndef __DRPAI_VMATH_H__
+#define __DRPAI_VMATH_H__
+
+#include <stdint.h>
+
+/**
+ * Float approximations for decoding model outputs.
+ * exp() is the Cephes single precision one: a range reduction to
+ * |r| <= ln(2)/2 and a degree 6 polynomial; the relative error is
+ * below 2e-7 over the whole float range, well below what the int8/FP16
+ * outputs of the models resolve. The array versions use NEON or SSE2
+ * where available, and agree with the scalar ones to within rounding.
+ */
+
+#define VMATH_EXP_HI	88.3762626647949f
+#define VMATH_EXP_LO	-87.3365447504019f
+#define VMATH_LOG2E	1.44269504088896341f
+#define VMATH_LN2_HI	0.693359375f
+#define VMATH_LN2_LO	-2.12194440e-4f
+
+#define VMATH_EXP_P0	1.9875691500E-4f
+#define VMATH_EXP_P1	1.3981999507E-3f
+#define VMATH_EXP_P2	8.3334519073E-3f
+#define VMATH_EXP_P3	4.1665795894E-2f
+#define VMATH_EXP_P4	1.6666665459E-1f
+#define VMATH_EXP_P5	5.0000001201E-1f
+
+static inline float vmath_expf(float x)
+{
+	union { float f; int32_t i; } pow2n;
+	float fx, r, y;
+	int32_t n;
+
+	if (x > VMATH_EXP_HI)
+		x = VMATH_EXP_HI;
+	if (x < VMATH_EXP_LO)
+		x = VMATH_EXP_LO;
+
+	/* x = n * ln(2) + r */
+	fx = x * VMATH_LOG2E + 0.5f;
+	n = (int32_t)fx;
+	if ((float)n > fx)
+		n--;
+	r = x - n * VMATH_LN2_HI - n * VMATH_LN2_LO;
+
+	y = VMATH_EXP_P0;
+	y = y * r + VMATH_EXP_P1;
+	y = y * r + VMATH_EXP_P2;
+	y = y * r + VMATH_EXP_P3;
+	y = y * r + VMATH_EXP_P4;
+	y = y * r + VMATH_EXP_P5;
+	y = y * r * r + r + 1.0f;
+
+	pow2n.i = (n + 127) << 23;
+
+	return y * pow2n.f;
+}
+
+static inline float vmath_sigmoidf(float x)
+{
+	return 1.0f / (1.0f + vmath_expf(-x));
+}
+
+/* IEEE half precision to float, including subnormals, inf and NaN */
+static inline float vmath_f16_to_f32(uint16_t h)
+{
+	union { float f; uint32_t u; } o, magic = { .u = 113 << 23 };
+	uint32_t exp;
+
+	o.u = (h & 0x7fff) << 13;
+	exp = o.u & (0x7c00 << 13);
+	o.u += (127 - 15) << 23;
+	if (exp == 0x7c00 << 13) {
+		o.u += (128 - 16) << 23;
+	} else if (!exp) {
+		o.u += 1 << 23;
+		o.f -= magic.f;
+	}
+	o.u |= (uint32_t)(h & 0x8000) << 16;
+
+	return o.f;
+}
+
+/* Inverse of the sigmoid: sigmoid(x) >= p  <=>  x >= vmath_logitf(p) */
+float vmath_logitf(float p);
+
+void vmath_exp(float *dst, const float *src, int n);
+void vmath_sigmoid(float *dst, const float *src, int n);
+
+/* In place; returns the largest probability, at 'argmax' */
+float vmath_softmax(float *val, int n, int *argmax);
+
+/* dst[i] = max(dst[i], src[i]) */
+void vmath_max(float *dst, const float *src, int n);
+
+/* Index of the largest value, which is stored in 'max' */
+int vmath_argmax(const float *src, int n, float *max);
+
+/**
+ * One step of an element-wise argmax over planes: where src[i] > max[i],
+ * max[i] = src[i] and idx[i] = plane. Fed the planes in order, that is
+ * the first plane with the largest value, like a plain scan.
+ */
+void vmath_argmax_update(float *max, int32_t *idx, const float *src, int n, int32_t plane);
+
+/**
+ * Narrow output tensors to float; the quantized ones are
+ * (q - zero_point) * scale.
+ */
+void vmath_f16_to_f32_array(float *dst, const uint16_t *src, int n);
+void vmath_s8_to_f32(float *dst, const int8_t *src, int n, float scale, int zero_point);
+void vmath_u8_to_f32(float *dst, const uint8_t *src, int n, float scale, int zero_point);
+
+/**
+ * Indices of the values >= 'thresh' (and with a non-zero 'mask', if
+ * given) are stored in 'idx'; returns how many.
+ */
+int vmath_select_ge(const float *src, int n, float thresh,
+		    const uint8_t *mask, int *idx);
+
+/* The same on quantized values, which saves converting them first */
+int vmath_select_ge_s8(const int8_t *src, int n, int thresh,
+		       const uint8_t *mask, int *idx);
+int vmath_select_ge_u8(const uint8_t *src, int n, int thresh,
+		       const uint8_t *mask, int *idx);
+
+#endif /* __DRPAI_VMATH_H__ */
@@ -0,0 +1,319 @@
+
+#include "workers.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <libwebsockets.h>
+
+#include "../../metrics.h"
+
+/**
+ * A batch is a number of jobs, handed out one at a time under the lock:
+ * the jobs are of the order of 100us, so that is cheap enough, and it
+ * keeps the threads busy even when the jobs are not of the same size.
+ * Batches are queued until all their jobs were handed out; with none
+ * queued, the threads sleep on 'start'.
+ */
+struct workers {
+	int refcount;
+	int num_threads;
+	pthread_t threads[WORKERS_MAX];
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	bool stop;
+	struct workers_batch *queue;
+};
+
+static struct workers *pool;
+
+/* what ran on a pool; added to by the callers of workers_run() */
+static unsigned long workers_batches;
+static unsigned long workers_jobs;
+
+static void workers_dequeue(struct workers *w, struct workers_batch *b)
+{
+	struct workers_batch **pb;
+
+	for (pb = &w->queue; *pb; pb = &(*pb)->next) {
+		if (*pb == b) {
+			*pb = b->next;
+			break;
+		}
+	}
+	b->next = NULL;
+}
+
+/* The last job of 'b' ran; called with the lock held */
+static void workers_finish(struct workers *w, struct workers_batch *b)
+{
+	workers_done_fn done = b->done;
+
+	/* 'b' stays busy, so it cannot go away under the callback */
+	if (done) {
+		pthread_mutex_unlock(&w->lock);
+		done(b->done_arg, b->err);
+		pthread_mutex_lock(&w->lock);
+	}
+
+	b->busy = false;
+	pthread_cond_broadcast(&w->done);
+}
+
+/*
+ * Run jobs until none are left to hand out, of 'only' or else of the
+ * queued batches; called with the lock held.
+ */
+static void workers_take_jobs(struct workers *w, struct workers_batch *only)
+{
+	struct workers_batch *b;
+
+	while ((b = only ? only : w->queue) && b->next_job < b->num_jobs) {
+		int job = b->next_job++;
+		int rc;
+
+		if (b->next_job == b->num_jobs)
+			workers_dequeue(w, b);
+
+		pthread_mutex_unlock(&w->lock);
+		rc = b->fn(b->arg, job);
+		pthread_mutex_lock(&w->lock);
+
+		if (rc && job < b->err_job) {
+			b->err_job = job;
+			b->err = rc;
+		}
+		if (++b->jobs_done == b->num_jobs)
+			workers_finish(w, b);
+	}
+}
+
+static void *workers_thread(void *arg)
+{
+	struct workers *w = arg;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->stop && !w->queue)
+			pthread_cond_wait(&w->start, &w->lock);
+		if (w->stop)
+			break;
+
+		workers_take_jobs(w, NULL);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+/* Signals are for the event loop */
+static int workers_spawn(struct workers *w, int num_threads)
+{
+	sigset_t all, old;
+	int rc = 0;
+
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	while (w->num_threads < num_threads) {
+		rc = -pthread_create(&w->threads[w->num_threads], NULL, workers_thread, w);
+		if (rc)
+			break;
+		w->num_threads++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return rc;
+}
+
+static void workers_stop(struct workers *w)
+{
+	int i;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_broadcast(&w->start);
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 0; i < w->num_threads; i++)
+		pthread_join(w->threads[i], NULL);
+
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->start);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+}
+
+struct workers *workers_get(int num_threads, int *err)
+{
+	struct workers *w = pool;
+	int lerr = 0;
+
+	if (num_threads < 0)
+		num_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (num_threads > WORKERS_MAX)
+		num_threads = WORKERS_MAX;
+
+	if (!w) {
+		w = calloc(1, sizeof(*w));
+		if (!w) {
+			lerr = -ENOMEM;
+			goto err_store;
+		}
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->start, NULL);
+		pthread_cond_init(&w->done, NULL);
+	}
+
+	/* new threads just join in on what is queued */
+	lerr = workers_spawn(w, num_threads);
+	if (lerr && !w->num_threads) {
+		if (w != pool)
+			workers_stop(w);
+		goto err_store;
+	}
+	if (lerr)
+		lwsl_warn("%s: only %d of %d threads\n", __func__, w->num_threads, num_threads);
+
+	if (w != pool)
+		lwsl_info("%s: %d post-processing threads\n", __func__, w->num_threads);
+
+	pool = w;
+	w->refcount++;
+
+	return w;
+err_store:
+	if (err)
+		*err = lerr;
+	return NULL;
+}
+
+void workers_put(struct workers *w)
+{
+	if (!w || --w->refcount > 0)
+		return;
+
+	if (w == pool)
+		pool = NULL;
+	workers_stop(w);
+}
+
+static int workers_run_here(int num_jobs, workers_fn fn, void *arg)
+{
+	int i, rc;
+
+	for (i = 0; i < num_jobs; i++) {
+		rc = fn(arg, i);
+		if (rc)
+			return rc;
+	}
+
+	return 0;
+}
+
+/* Called with the lock held */
+static void workers_queue(struct workers *w, struct workers_batch *b, int num_jobs,
+			  workers_fn fn, void *arg)
+{
+	struct workers_batch **pb;
+
+	__atomic_fetch_add(&workers_batches, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&workers_jobs, num_jobs, __ATOMIC_RELAXED);
+
+	b->fn = fn;
+	b->arg = arg;
+	b->num_jobs = num_jobs;
+	b->next_job = 0;
+	b->jobs_done = 0;
+	b->err_job = num_jobs;
+	b->err = 0;
+	b->busy = true;
+	b->next = NULL;
+
+	for (pb = &w->queue; *pb; pb = &(*pb)->next)
+		;
+	*pb = b;
+	pthread_cond_broadcast(&w->start);
+}
+
+int workers_run(struct workers *w, int num_jobs, workers_fn fn, void *arg)
+{
+	struct workers_batch b = {};
+	int rc;
+
+	if (!w || !w->num_threads || num_jobs < 2)
+		return workers_run_here(num_jobs, fn, arg);
+
+	pthread_mutex_lock(&w->lock);
+	workers_queue(w, &b, num_jobs, fn, arg);
+
+	/* only its own jobs, not to be held up by those of another batch */
+	workers_take_jobs(w, &b);
+	while (b.busy)
+		pthread_cond_wait(&w->done, &w->lock);
+
+	rc = b.err;
+	pthread_mutex_unlock(&w->lock);
+
+	return rc;
+}
+
+int workers_post(struct workers *w, struct workers_batch *b, int num_jobs,
+		 workers_fn fn, void *arg, workers_done_fn done, void *done_arg)
+{
+	workers_wait(w, b);
+
+	b->done = done;
+	b->done_arg = done_arg;
+
+	if (!w || !w->num_threads || num_jobs < 1) {
+		b->err = workers_run_here(num_jobs, fn, arg);
+		done(done_arg, b->err);
+		return 0;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	workers_queue(w, b, num_jobs, fn, arg);
+	pthread_mutex_unlock(&w->lock);
+
+	return 0;
+}
+
+int workers_wait(struct workers *w, struct workers_batch *b)
+{
+	int rc;
+
+	if (!w)
+		return b->err;
+
+	pthread_mutex_lock(&w->lock);
+	while (b->busy)
+		pthread_cond_wait(&w->done, &w->lock);
+	rc = b->err;
+	pthread_mutex_unlock(&w->lock);
+
+	return rc;
+}
+
+void workers_metrics(struct metrics *m)
+{
+	metrics_family(m, "etb_workers_threads", "gauge",
+		       "Threads of the post-processing pool");
+	metrics_printf(m, "etb_workers_threads %d\n", pool ? pool->num_threads : 0);
+
+	metrics_family(m, "etb_workers_batches_total", "counter",
+		       "Batches of post-processing jobs run on the pool");
+	metrics_printf(m, "etb_workers_batches_total %lu\n",
+		       __atomic_load_n(&workers_batches, __ATOMIC_RELAXED));
+
+	metrics_family(m, "etb_workers_jobs_total", "counter",
+		       "Post-processing jobs run on the pool");
+	metrics_printf(m, "etb_workers_jobs_total %lu\n",
+		       __atomic_load_n(&workers_jobs, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,66 @@
+#ifndef __DRPAI_WORKERS_H__
+#define __DRPAI_WORKERS_H__
+
+#include <stdbool.h>
+
+/* Pool of threads for post-processing; opaque, and shared by all models */
+struct workers;
+struct metrics;
+
+#define WORKERS_MAX	8
+
+/* Runs job number 'job' of a batch; returns 0 or a negative error code */
+typedef int (*workers_fn)(void *arg, int job);
+
+/* Called once all jobs of a posted batch ran, with the error of the batch */
+typedef void (*workers_done_fn)(void *arg, int err);
+
+/* A batch of jobs; owned by the caller, the fields are the pool's */
+struct workers_batch {
+	struct workers_batch *next;	/* in the queue, while jobs are left */
+	workers_fn fn;
+	void *arg;
+	workers_done_fn done;
+	void *done_arg;
+	int num_jobs;
+	int next_job;
+	int jobs_done;
+	int err_job;
+	int err;
+	bool busy;		/* until done, and 'done' returned */
+};
+
+/**
+ * Reference to the pool, with at least 'num_threads' threads (beyond
+ * the calling one), up to WORKERS_MAX; < 0 for one per other CPU core.
+ */
+struct workers *workers_get(int num_threads, int *err);
+void workers_put(struct workers *w);
+
+/**
+ * Runs jobs 0 .. 'num_jobs' - 1 on the pool, with the calling thread
+ * taking jobs too, and returns once all are done: with the error of the
+ * lowest numbered job that failed, if any, so that the outcome does not
+ * depend on which thread ran what. Without a pool ('w' is NULL), the jobs
+ * just run in order.
+ */
+int workers_run(struct workers *w, int num_jobs, workers_fn fn, void *arg);
+
+/**
+ * Queues the jobs of 'b' on the pool and returns; batches run in the
+ * order they were posted. 'done' is called on the thread that finished
+ * the last job, with the error as for workers_run(). Without threads,
+ * the jobs run right away, and 'done' is called before this returns.
+ * A batch still busy is waited for first; it is not to be freed before
+ * workers_wait() returned.
+ */
+int workers_post(struct workers *w, struct workers_batch *b, int num_jobs,
+		 workers_fn fn, void *arg, workers_done_fn done, void *done_arg);
+
+/* Waits for 'b' to be done, if it was posted; returns its error */
+int workers_wait(struct workers *w, struct workers_batch *b);
+
+/* Threads of the pool, and the batches and jobs that ran on it */
+void workers_metrics(struct metrics *m);
+
+#endif /* __DRPAI_WORKERS_H__ */
@@ -0,0 +1,290 @@
+
+#include "../plugins/drpai/models.h"
+#include "../metrics.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-c/json.h>
+
+/**
+ * Golden-output tests of the decoders: for each case <name> in the data
+ * directory, the output tensor <name>.bin, as the DRP AI wrote it, goes
+ * through the post-processing of the model config <name>.json, and the
+ * result has to match <name>.golden.json (box coordinates within a pixel,
+ * probabilities within 1e-3 relative). With -u, the golden files are
+ * written from the results instead, to be checked and committed.
+ *
+ *   test_decoders [-u] <data directory>
+ */
+
+static const char *cases[] = {
+	"yolov5_fp32", "yolov5_fp16", "yolov5_int8",
+	"yolov8_fp32", "yolov8_fp16", "yolov8_int8",
+	"ssd_fp32", "ssd_fp16", "ssd_int8",
+	NULL
+};
+
+/* The decoders count their work in the worker pool metrics */
+void metrics_printf(struct metrics *m, const char *fmt, ...)
+{
+}
+
+void metrics_family(struct metrics *m, const char *name, const char *type,
+		    const char *help)
+{
+}
+
+static void *read_file(const char *path, size_t *size)
+{
+	FILE *f;
+	void *buf = NULL;
+	long len;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	if (fseek(f, 0, SEEK_END) || (len = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET))
+		goto out;
+
+	buf = malloc(len);
+	if (buf && fread(buf, 1, len, f) != (size_t)len) {
+		free(buf);
+		buf = NULL;
+	}
+	*size = len;
+out:
+	fclose(f);
+	return buf;
+}
+
+static bool json_match(json_object *got, json_object *exp, const char *path)
+{
+	json_type type = json_object_get_type(exp);
+	char sub[256];
+	double g, e;
+	size_t i;
+
+	if (json_object_get_type(got) != type &&
+	    !(json_object_is_type(got, json_type_int) && type == json_type_double) &&
+	    !(json_object_is_type(got, json_type_double) && type == json_type_int)) {
+		fprintf(stderr, "%s: type %d, expected %d\n", path, json_object_get_type(got), type);
+		return false;
+	}
+
+	switch (type) {
+	case json_type_object:
+		json_object_object_foreach(exp, key, val) {
+			snprintf(sub, sizeof(sub), "%s.%s", path, key);
+			if (!json_match(json_object_object_get(got, key), val, sub))
+				return false;
+		}
+		json_object_object_foreach(got, gkey, gval) {
+			(void)gval;
+			if (!json_object_object_get_ex(exp, gkey, NULL)) {
+				fprintf(stderr, "%s.%s: not expected\n", path, gkey);
+				return false;
+			}
+		}
+		return true;
+	case json_type_array:
+		if (json_object_array_length(got) != json_object_array_length(exp)) {
+			fprintf(stderr, "%s: %zu elements, expected %zu\n", path,
+				json_object_array_length(got), json_object_array_length(exp));
+			return false;
+		}
+		for (i = 0; i < json_object_array_length(exp); i++) {
+			snprintf(sub, sizeof(sub), "%s[%zu]", path, i);
+			if (!json_match(json_object_array_get_idx(got, i),
+					json_object_array_get_idx(exp, i), sub))
+				return false;
+		}
+		return true;
+	case json_type_int:
+	case json_type_double:
+		g = json_object_get_double(got);
+		e = json_object_get_double(exp);
+		if (fabs(g - e) <= (type == json_type_int ? 1 : 1e-3 * fmax(1, fabs(e))))
+			return true;
+		fprintf(stderr, "%s: %g, expected %g\n", path, g, e);
+		return false;
+	case json_type_string:
+		if (!strcmp(json_object_get_string(got), json_object_get_string(exp)))
+			return true;
+		fprintf(stderr, "%s: \"%s\", expected \"%s\"\n", path,
+			json_object_get_string(got), json_object_get_string(exp));
+		return false;
+	default:
+		return json_object_get_boolean(got) == json_object_get_boolean(exp);
+	}
+}
+
+struct decode_wait {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool done;
+	int err;
+};
+
+static void decode_done(void *arg, int err)
+{
+	struct decode_wait *w = arg;
+
+	pthread_mutex_lock(&w->lock);
+	w->done = true;
+	w->err = err;
+	pthread_cond_signal(&w->cond);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* As the scheduler does it when the model can: started, then finished */
+static int run_async(const struct drpai_model_ops *ops, void *priv,
+		     const struct drpai_tensor *out, const struct drpai_frame *frame,
+		     json_object *result)
+{
+	struct decode_wait w = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	int rc;
+
+	rc = ops->postprocessing_start(priv, out, frame, decode_done, &w);
+	if (rc)
+		return rc;
+
+	pthread_mutex_lock(&w.lock);
+	while (!w.done)
+		pthread_cond_wait(&w.cond, &w.lock);
+	pthread_mutex_unlock(&w.lock);
+
+	return ops->postprocessing_finish(priv, w.err, result);
+}
+
+static int run_case(const char *dir, const char *name, bool update)
+{
+	const struct drpai_model_ops *ops;
+	struct drpai_tensor out = {};
+	struct drpai_frame frame = {};
+	json_object *config, *golden = NULL, *result = NULL;
+	char path[512];
+	void *data = NULL, *priv = NULL;
+	size_t size = 0;
+	int rc, err = 0;
+
+	snprintf(path, sizeof(path), "%s/%s.json", dir, name);
+	config = json_object_from_file(path);
+	if (!config) {
+		fprintf(stderr, "%s: cannot load the config\n", name);
+		return -EINVAL;
+	}
+
+	ops = drpai_model_type_to_ops(json_object_get_string(
+		json_object_object_get(config, "model_type")));
+	rc = drpai_tensor_parse(json_object_object_get(config, "output"), &out);
+	if (!ops || rc) {
+		fprintf(stderr, "%s: bad model type or output\n", name);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s.bin", dir, name);
+	data = read_file(path, &size);
+	if (!data) {
+		fprintf(stderr, "%s: cannot read the tensor\n", name);
+		rc = -EIO;
+		goto out;
+	}
+	out.data = data;
+	out.num = size / drpai_dtype_size(out.dtype);
+
+	/* the whole model input, as is */
+	frame.width = json_object_get_int(json_object_object_get(config, "model_in_w"));
+	frame.height = json_object_get_int(json_object_object_get(config, "model_in_h"));
+	frame.frame_width = frame.width;
+	frame.frame_height = frame.height;
+
+	priv = ops->init(config, &err);
+	if (!priv) {
+		fprintf(stderr, "%s: init error %d\n", name, err);
+		rc = err ? err : -EINVAL;
+		goto out;
+	}
+
+	result = json_object_new_object();
+	rc = ops->postprocessing(priv, &out, &frame, result);
+	if (rc) {
+		fprintf(stderr, "%s: post-processing error %d\n", name, rc);
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/%s.golden.json", dir, name);
+	if (update) {
+		rc = json_object_to_file_ext(path, result, JSON_C_TO_STRING_PRETTY);
+		goto out;
+	}
+
+	golden = json_object_from_file(path);
+	if (!golden) {
+		fprintf(stderr, "%s: cannot load the golden output\n", name);
+		rc = -EINVAL;
+		goto out;
+	}
+	if (!json_match(result, golden, name)) {
+		rc = -EINVAL;
+		goto out;
+	}
+
+	if (ops->postprocessing_start) {
+		json_object_put(result);
+		result = json_object_new_object();
+		rc = run_async(ops, priv, &out, &frame, result);
+		if (rc == -EOPNOTSUPP) {
+			rc = 0;
+		} else if (rc) {
+			fprintf(stderr, "%s: async post-processing error %d\n", name, rc);
+		} else if (!json_match(result, golden, name)) {
+			rc = -EINVAL;
+		}
+	}
+out:
+	if (priv)
+		ops->cleanup(priv);
+	json_object_put(result);
+	json_object_put(golden);
+	json_object_put(config);
+	free(data);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	bool update = false;
+	int i, failed = 0;
+
+	if (argc > 1 && !strcmp(argv[1], "-u")) {
+		update = true;
+		argc--;
+		argv++;
+	}
+	if (argc != 2) {
+		fprintf(stderr, "usage: test_decoders [-u] <data directory>\n");
+		return 2;
+	}
+
+	for (i = 0; cases[i]; i++) {
+		if (run_case(argv[1], cases[i], update)) {
+			printf("FAIL %s\n", cases[i]);
+			failed++;
+		} else {
+			printf("ok   %s\n", cases[i]);
+		}
+	}
+
+	return failed ? 1 : 0;
+}
@@ -5,6 +5,7 @@
 #include <libwebsockets.h>
 
 #include "ws_server.h"
+#include "metrics.h"
 #include "plugins/camera/protocol.h"
 #include "plugins/drpai/protocol.h"
 
@@ -23,6 +24,7 @@ static struct lws_protocols protocols[] = {
 	LWS_PROTOCOL_HTTP_DEFAULT,
 	LWS_PLUGIN_PROTOCOL_CAMERA,
 	LWS_PLUGIN_PROTOCOL_DRPAI,
+	LWS_PLUGIN_PROTOCOL_METRICS,
 	LWS_PROTOCOL_LIST_TERM
 };
 
@@ -34,6 +36,14 @@ static const struct lws_http_mount mount = {
 	.mountpoint_len			= 1,			/* char count */
 };
 
+static const struct lws_http_mount mount_metrics = {
+	.mount_next			= &mount,
+	.mountpoint			= "/metrics",
+	.origin				= "metrics",		/* protocol name */
+	.origin_protocol		= LWSMPRO_CALLBACK,	/* dynamic content */
+	.mountpoint_len			= 8,
+};
+
 int ws_server_init(struct ws_server **ws, int argc, const char *argv[])
 {
 	struct lws_context_creation_info info;
@@ -49,7 +59,7 @@ int ws_server_init(struct ws_server **ws, int argc, const char *argv[])
 
 	/* FIXME: hard-coded for now */
 	info.port = 8000;
-	info.mounts = &mount;
+	info.mounts = &mount_metrics;
 	info.protocols = protocols;
 	info.options = LWS_SERVER_OPTION_HTTP_HEADERS_SECURITY_BEST_PRACTICES_ENFORCE;
 	info.gid = -1;